@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+#
+# Compare the size of a population's BSON in each PopulationLayout and
+# how long it takes to decode, for a sample cross.
+#
+# This doesn't run the C code. It builds the same documents that
+# groups_population.c saves, with the same keys in the same order, and
+# encodes them with pymongo's bson module, so the sizes are those of
+# the BSON that would be sent to the server. The decode times are for
+# pymongo's C decoder and are only a rough guide to how much work
+# reading each layout back is; the C loader's times will differ.
+#
+# The PGS_* key names come from the parental genotype service's headers,
+# which aren't in this tree, so "chromosome", "mapping_position" and
+# "name" stand in for them. They are the same in every layout so they
+# don't change the comparison.
+#
+# A population over 16MB is split into chunks when it is saved. The
+# sizes here are for the whole population as one document; each chunk
+# only adds its own header.
+#
+# usage: population_sizes.py [--accessions n] [--markers n] [--missing fraction] [--seed n]
+#
+
+import argparse
+import random
+import time
+
+import bson
+from bson.binary import Binary
+from bson.objectid import ObjectId
+
+
+# from groups_population.h
+GP_LAYOUT_S = "layout"
+GP_ACCESSIONS_S = "accessions"
+GP_CALLS_S = "calls"
+GP_ALPHABET_S = "alphabet"
+GP_MISSING_CALL_S = "-"
+GP_PACKED_CALL_BITS = 2
+GP_CALLS_PER_BYTE = 8 // GP_PACKED_CALL_BITS
+
+CALLS = [ "A", "B", "H" ]
+
+
+def make_cross (num_accessions, num_markers, missing, seed):
+	rng = random.Random (seed)
+	accessions = [ "ParW%03d" % i for i in range (num_accessions) ]
+	markers = []
+
+	for i in range (num_markers):
+		calls = [ GP_MISSING_CALL_S if rng.random () < missing else rng.choice (CALLS) for _ in accessions ]
+		chromosome = "%d%s" % (1 + (i % 7), "ABD" [(i // 7) % 3])
+		markers.append (("AX-%08d" % (94380000 + i), chromosome, "%.2f" % (rng.random () * 200), calls))
+
+	return accessions, markers
+
+
+def build_documents (accessions, markers):
+	doc = { "_id": ObjectId (), "name": "Paragon x Watkins" }
+
+	for name, chromosome, position, calls in markers:
+		marker = { "chromosome": chromosome, "mapping_position": position }
+
+		for accession, call in zip (accessions, calls):
+			marker [accession] = call
+
+		doc [name] = marker
+
+	return doc
+
+
+def build_columns (accessions, markers):
+	doc = { "_id": ObjectId (), "name": "Paragon x Watkins", GP_LAYOUT_S: "columns", GP_ACCESSIONS_S: accessions }
+
+	for name, chromosome, position, calls in markers:
+		doc [name] = { "chromosome": chromosome, "mapping_position": position, GP_CALLS_S: calls }
+
+	return doc
+
+
+def build_packed (accessions, markers):
+	# the missing call is always code 0
+	alphabet = [ GP_MISSING_CALL_S ] + CALLS
+	codes = { call: i for i, call in enumerate (alphabet) }
+	doc = { "_id": ObjectId (), "name": "Paragon x Watkins", GP_LAYOUT_S: "packed", GP_ACCESSIONS_S: accessions, GP_ALPHABET_S: alphabet }
+
+	for name, chromosome, position, calls in markers:
+		packed = bytearray ((len (calls) + GP_CALLS_PER_BYTE - 1) // GP_CALLS_PER_BYTE)
+
+		for i, call in enumerate (calls):
+			packed [i // GP_CALLS_PER_BYTE] |= codes [call] << ((i % GP_CALLS_PER_BYTE) * GP_PACKED_CALL_BITS)
+
+		doc [name] = { "chromosome": chromosome, "mapping_position": position, GP_CALLS_S: Binary (bytes (packed)) }
+
+	return doc
+
+
+def time_decode (data, runs):
+	times = []
+
+	for _ in range (runs):
+		start = time.perf_counter ()
+		bson.decode (data)
+		times.append (time.perf_counter () - start)
+
+	times.sort ()
+	return times [len (times) // 2]
+
+
+def main ():
+	parser = argparse.ArgumentParser ()
+	parser.add_argument ("--accessions", type = int, default = 94)
+	parser.add_argument ("--markers", type = int, default = 35000)
+	parser.add_argument ("--missing", type = float, default = 0.02)
+	parser.add_argument ("--runs", type = int, default = 5)
+	parser.add_argument ("--seed", type = int, default = 1)
+	args = parser.parse_args ()
+
+	accessions, markers = make_cross (args.accessions, args.markers, args.missing, args.seed)
+
+	print ("%d accessions, %d markers, %.0f%% missing calls" % (args.accessions, args.markers, args.missing * 100))
+	print ("%-10s %14s %10s %14s" % ("layout", "bytes", "ratio", "decode p50 ms"))
+
+	documents_size = None
+
+	for layout, build in (("documents", build_documents), ("columns", build_columns), ("packed", build_packed)):
+		data = bson.encode (build (accessions, markers))
+
+		if documents_size is None:
+			documents_size = len (data)
+
+		print ("%-10s %14d %10.3f %14.1f" % (layout, len (data), len (data) / documents_size, time_decode (data, args.runs) * 1000))
+
+
+if __name__ == "__main__":
+	main ()
@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Run users_bench against a mongod in a temporary directory, which is
+# removed afterwards along with the mongod.
+#
+# usage: run_users_bench.sh <users_bench> [users_bench options]
+#
+# Set MONGOD to choose the mongod binary and BENCH_MONGO_PORT to
+# choose its port.
+#
+
+BENCH=$1
+
+if [ -z "$BENCH" ]; then
+	echo "usage: $0 <users_bench> [users_bench options]" >&2
+	exit 1
+fi
+
+shift
+
+MONGOD=${MONGOD:-mongod}
+PORT=${BENCH_MONGO_PORT:-27117}
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/users_bench.XXXXXX") || exit 1
+
+cleanup () {
+	if [ -f "$DIR/mongod.pid" ]; then
+		kill "$(cat "$DIR/mongod.pid")" 2>/dev/null
+
+		# wait for it to release the data files before removing them
+		while kill -0 "$(cat "$DIR/mongod.pid")" 2>/dev/null; do
+			sleep 1
+		done
+	fi
+
+	rm -rf "$DIR"
+}
+
+trap cleanup EXIT
+trap "exit 1" INT TERM
+
+# --fork only returns once mongod is ready for connections
+if ! "$MONGOD" --dbpath "$DIR" --port "$PORT" --bind_ip 127.0.0.1 --fork --logpath "$DIR/mongod.log" --pidfilepath "$DIR/mongod.pid" > /dev/null; then
+	echo "Failed to start $MONGOD, see below" >&2
+	cat "$DIR/mongod.log" >&2
+	exit 1
+fi
+
+"$BENCH" --uri "mongodb://127.0.0.1:$PORT" "$@"
@@ -0,0 +1,1066 @@
+/*
+ * users_bench.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ *
+ * A standalone benchmark of the users service's hot paths. It is run
+ * by run_users_bench.sh against a mongod in a temporary directory so
+ * it needs neither a Grassroots server nor a shared database.
+ *
+ * For each operation it prints the latency percentiles and the mean
+ * number of heap allocations, counted by wrapping malloc (), calloc ()
+ * and realloc () for the whole process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+/*
+ * The functions being measured are static, so the service's source
+ * is built as part of the benchmark rather than linked against.
+ */
+#include "users_submission_service.c"
+
+#include "groups_population.h"
+#include "mongo_client_manager.h"
+
+
+/*
+ * Static declarations
+ */
+
+typedef struct UsersBenchConfig
+{
+	const char *ubc_uri_s;
+	const char *ubc_database_s;
+	uint32 ubc_num_users;
+	uint32 ubc_num_runs;
+	uint32 ubc_num_accessions;
+	uint32 ubc_num_markers;
+	uint32 ubc_seed;
+} UsersBenchConfig;
+
+
+typedef struct UsersBenchResult
+{
+	const char *ubr_name_s;
+	uint64 *ubr_times_p;
+	uint32 ubr_num_runs;
+	uint64 ubr_num_allocations;
+} UsersBenchResult;
+
+
+static const char * const S_SURNAMES_SS [] = { "Smith", "Jones", "Taylor", "Brown", "Williams", "Wilson", "Johnson", "Davies", "Patel", "Robinson", "Wright", "Thompson", "Evans", "Walker", "White", "Roberts" };
+
+static const char * const S_FORENAMES_SS [] = { "Oliver", "Amelia", "George", "Isla", "Harry", "Ava", "Noah", "Mia", "Jack", "Ivy", "Leo", "Lily", "Arthur", "Freya", "Muhammad", "Florence" };
+
+static const char * const S_CALLS_SS [] = { "A", "B", "H", GP_MISSING_CALL_S };
+
+/** The fields that the users directory reads for each User. */
+static const char * const S_NAME_FIELDS_SS [] = { US_SURNAME_S, US_FORENAME_S, US_EMAIL_S, NULL };
+
+
+static uint64 s_num_allocations = 0;
+
+
+extern void *__libc_malloc (size_t size);
+
+extern void *__libc_calloc (size_t num, size_t size);
+
+extern void *__libc_realloc (void *mem_p, size_t size);
+
+
+static bool ParseUsersBenchArgs (int argc, char *argv [], UsersBenchConfig *config_p);
+
+static bool DropUsersBenchDatabase (const UsersBenchConfig *config_p);
+
+static Service *AllocateUsersBenchService (GrassrootsServer *grassroots_p, const UsersBenchConfig *config_p);
+
+static bool RunSaveUserBench (Service *service_p, const UsersBenchConfig *config_p, UsersBenchResult *result_p, User **active_user_pp);
+
+static bool RunParametersBench (Service *service_p, const UsersBenchConfig *config_p, UsersBenchResult *result_p);
+
+static bool RunActiveUserParametersBench (Service *service_p, const UsersBenchConfig *config_p, const User *active_user_p, const bool template_flag, UsersBenchResult *result_p);
+
+static bool RunDirectoryLoadBench (UsersServiceData *data_p, const UsersBenchConfig *config_p, UsersBenchResult *result_p);
+
+static bool RunUsersJSONBench (UsersServiceData *data_p, const UsersBenchConfig *config_p, UsersBenchResult *result_p);
+
+static bool RunUsersCursorBench (UsersServiceData *data_p, const UsersBenchConfig *config_p, const char *name_s, const char * const *fields_ss, UsersBenchResult *result_p);
+
+static bool RunPopulationBench (UsersServiceData *data_p, const UsersBenchConfig *config_p, const PopulationLayout layout, UsersBenchResult *result_p);
+
+static bool BuildAndSavePopulation (UsersServiceData *data_p, MongoTool *tool_p, const UsersBenchConfig *config_p, const PopulationLayout layout, uint32 *seed_p);
+
+static bool InitUsersBenchResult (UsersBenchResult *result_p, const char *name_s, const uint32 num_runs);
+
+static void RecordUsersBenchRun (UsersBenchResult *result_p, const uint32 run, const struct timespec *start_p, const uint64 allocations_before);
+
+static void PrintUsersBenchResult (UsersBenchResult *result_p);
+
+static void ClearUsersBenchResult (UsersBenchResult *result_p);
+
+static uint64 GetUsersBenchAllocations (void);
+
+static uint32 GetUsersBenchRandom (uint32 *seed_p);
+
+static int CompareUsersBenchTimes (const void *v0_p, const void *v1_p);
+
+
+/*
+ * Every allocation in the process goes through these, including
+ * those made by jansson, libbson and the Grassroots libraries.
+ */
+void *malloc (size_t size)
+{
+	__atomic_add_fetch (&s_num_allocations, 1, __ATOMIC_RELAXED);
+	return __libc_malloc (size);
+}
+
+
+void *calloc (size_t num, size_t size)
+{
+	__atomic_add_fetch (&s_num_allocations, 1, __ATOMIC_RELAXED);
+	return __libc_calloc (num, size);
+}
+
+
+void *realloc (void *mem_p, size_t size)
+{
+	__atomic_add_fetch (&s_num_allocations, 1, __ATOMIC_RELAXED);
+	return __libc_realloc (mem_p, size);
+}
+
+
+int main (int argc, char *argv [])
+{
+	int ret = EXIT_FAILURE;
+	UsersBenchConfig config;
+
+	if (ParseUsersBenchArgs (argc, argv, &config))
+		{
+			mongoc_init ();
+
+			if (DropUsersBenchDatabase (&config))
+				{
+					GrassrootsServer grassroots;
+
+					memset (&grassroots, 0, sizeof (GrassrootsServer));
+
+					if ((grassroots.gs_mongo_manager_p = AllocateMongoClientManager (config.ubc_uri_s)) != NULL)
+						{
+							Service *service_p = AllocateUsersBenchService (&grassroots, &config);
+
+							if (service_p)
+								{
+									UsersServiceData *data_p = (UsersServiceData *) (service_p -> se_data_p);
+									UsersBenchResult result;
+									User *active_user_p = NULL;
+									bool success_flag = true;
+
+									printf ("%-22s %8s %10s %10s %10s %10s %12s\n", "operation", "runs", "p50 us", "p90 us", "p99 us", "max us", "allocs/op");
+
+									/*
+									 * Saving the Users fills the collection for the operations that follow
+									 */
+									if (success_flag && (success_flag = RunSaveUserBench (service_p, &config, &result, &active_user_p)))
+										{
+											PrintUsersBenchResult (&result);
+										}
+
+									if (success_flag && (success_flag = RunParametersBench (service_p, &config, &result)))
+										{
+											PrintUsersBenchResult (&result);
+										}
+
+									/*
+									 * Compare building the parameters from scratch with making
+									 * them from the template, both for an active User
+									 */
+									if (success_flag && (success_flag = RunActiveUserParametersBench (service_p, &config, active_user_p, false, &result)))
+										{
+											PrintUsersBenchResult (&result);
+										}
+
+									if (success_flag && (data_p -> usd_parameters_template_p))
+										{
+											if ((success_flag = RunActiveUserParametersBench (service_p, &config, active_user_p, true, &result)))
+												{
+													PrintUsersBenchResult (&result);
+												}
+										}
+
+									if (success_flag && (success_flag = RunDirectoryLoadBench (data_p, &config, &result)))
+										{
+											PrintUsersBenchResult (&result);
+										}
+
+									/*
+									 * Compare reading every User's name through jansson and a User,
+									 * as the directory used to, with reading it from the BSON cursor
+									 */
+									if (success_flag && (success_flag = RunUsersJSONBench (data_p, &config, &result)))
+										{
+											PrintUsersBenchResult (&result);
+										}
+
+									if (success_flag && (success_flag = RunUsersCursorBench (data_p, &config, "users_cursor", S_NAME_FIELDS_SS, &result)))
+										{
+											PrintUsersBenchResult (&result);
+										}
+
+									/*
+									 * Compare fetching whole documents with fetching just
+									 * the fields that the uncached users list needs
+									 */
+									if (success_flag && (success_flag = RunUsersCursorBench (data_p, &config, "users_list_whole", NULL, &result)))
+										{
+											PrintUsersBenchResult (&result);
+										}
+
+									if (success_flag && (success_flag = RunUsersCursorBench (data_p, &config, "users_list_fields", S_LIST_FIELDS_SS, &result)))
+										{
+											PrintUsersBenchResult (&result);
+										}
+
+									if (success_flag && (success_flag = RunPopulationBench (data_p, &config, PL_DOCUMENTS, &result)))
+										{
+											PrintUsersBenchResult (&result);
+										}
+
+									if (success_flag && (success_flag = RunPopulationBench (data_p, &config, PL_COLUMNS, &result)))
+										{
+											PrintUsersBenchResult (&result);
+										}
+
+									if (success_flag && (success_flag = RunPopulationBench (data_p, &config, PL_PACKED, &result)))
+										{
+											PrintUsersBenchResult (&result);
+										}
+
+									if (success_flag)
+										{
+											ret = EXIT_SUCCESS;
+										}
+
+									if (active_user_p)
+										{
+											FreeUser (active_user_p);
+										}
+
+									/*
+									 * This frees data_p too
+									 */
+									FreeService (service_p);
+								}		/* if (service_p) */
+
+							FreeMongoClientManager (grassroots.gs_mongo_manager_p);
+						}
+					else
+						{
+							fprintf (stderr, "Failed to connect to \"%s\"\n", config.ubc_uri_s);
+						}
+
+				}		/* if (DropUsersBenchDatabase (&config)) */
+
+			mongoc_cleanup ();
+		}		/* if (ParseUsersBenchArgs (argc, argv, &config)) */
+
+	return ret;
+}
+
+
+static bool ParseUsersBenchArgs (int argc, char *argv [], UsersBenchConfig *config_p)
+{
+	static const struct option options [] =
+		{
+			{ "uri", required_argument, NULL, 'u' },
+			{ "database", required_argument, NULL, 'd' },
+			{ "users", required_argument, NULL, 'n' },
+			{ "runs", required_argument, NULL, 'r' },
+			{ "accessions", required_argument, NULL, 'a' },
+			{ "markers", required_argument, NULL, 'm' },
+			{ "seed", required_argument, NULL, 's' },
+			{ NULL, 0, NULL, 0 }
+		};
+	int c;
+
+	config_p -> ubc_uri_s = "mongodb://127.0.0.1:27017";
+	config_p -> ubc_database_s = "users_bench";
+	config_p -> ubc_num_users = 10000;
+	config_p -> ubc_num_runs = 200;
+	config_p -> ubc_num_accessions = 200;
+	config_p -> ubc_num_markers = 5000;
+	config_p -> ubc_seed = 1;
+
+	while ((c = getopt_long (argc, argv, "u:d:n:r:a:m:s:", options, NULL)) != -1)
+		{
+			switch (c)
+				{
+					case 'u':
+						config_p -> ubc_uri_s = optarg;
+						break;
+
+					case 'd':
+						config_p -> ubc_database_s = optarg;
+						break;
+
+					case 'n':
+						config_p -> ubc_num_users = (uint32) strtoul (optarg, NULL, 10);
+						break;
+
+					case 'r':
+						config_p -> ubc_num_runs = (uint32) strtoul (optarg, NULL, 10);
+						break;
+
+					case 'a':
+						config_p -> ubc_num_accessions = (uint32) strtoul (optarg, NULL, 10);
+						break;
+
+					case 'm':
+						config_p -> ubc_num_markers = (uint32) strtoul (optarg, NULL, 10);
+						break;
+
+					case 's':
+						config_p -> ubc_seed = (uint32) strtoul (optarg, NULL, 10);
+						break;
+
+					default:
+						fprintf (stderr, "usage: %s [--uri <mongodb uri>] [--database <name>] [--users <n>] [--runs <n>] [--accessions <n>] [--markers <n>] [--seed <n>]\n", argv [0]);
+						return false;
+				}
+		}
+
+	if ((config_p -> ubc_num_users == 0) || (config_p -> ubc_num_runs == 0) || (config_p -> ubc_num_accessions == 0) || (config_p -> ubc_num_markers == 0))
+		{
+			fprintf (stderr, "The number of users, runs, accessions and markers must all be greater than 0\n");
+			return false;
+		}
+
+	/* xorshift never leaves 0 */
+	if (config_p -> ubc_seed == 0)
+		{
+			config_p -> ubc_seed = 1;
+		}
+
+	return true;
+}
+
+
+/*
+ * Start from an empty database so that every run is comparable.
+ */
+static bool DropUsersBenchDatabase (const UsersBenchConfig *config_p)
+{
+	bool success_flag = false;
+	mongoc_client_t *client_p = mongoc_client_new (config_p -> ubc_uri_s);
+
+	if (client_p)
+		{
+			mongoc_database_t *database_p = mongoc_client_get_database (client_p, config_p -> ubc_database_s);
+			bson_error_t error;
+
+			if (mongoc_database_drop (database_p, &error))
+				{
+					success_flag = true;
+				}
+			else
+				{
+					fprintf (stderr, "Failed to drop \"%s\": %s\n", config_p -> ubc_database_s, error.message);
+				}
+
+			mongoc_database_destroy (database_p);
+			mongoc_client_destroy (client_p);
+		}
+	else
+		{
+			fprintf (stderr, "Invalid uri \"%s\"\n", config_p -> ubc_uri_s);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Set the service up as GetUsersSubmissionService () does, but with its
+ * configuration given here rather than read from the server's.
+ */
+static Service *AllocateUsersBenchService (GrassrootsServer *grassroots_p, const UsersBenchConfig *config_p)
+{
+	Service *service_p = (Service *) AllocMemory (sizeof (Service));
+
+	if (service_p)
+		{
+			UsersServiceData *data_p = AllocateUsersServiceData ();
+
+			memset (service_p, 0, sizeof (Service));
+
+			if (data_p)
+				{
+					if (InitialiseService (service_p,
+																 GetUsersSubmissionServiceName,
+																 GetUsersSubmissionServiceDescription,
+																 GetUsersSubmissionServiceAlias,
+																 GetUsersSubmissionServiceInformationUri,
+																 RunUsersSubmissionService,
+																 IsResourceForUsersSubmissionService,
+																 GetUsersSubmissionServiceParameters,
+																 GetUsersSubmissionServiceParameterTypesForNamedParameters,
+																 ReleaseUsersSubmissionServiceParameters,
+																 CloseUsersSubmissionService,
+																 NULL,
+																 false,
+																 SY_SYNCHRONOUS,
+																 (ServiceData *) data_p,
+																 GetUsersSubmissionServiceMetadata,
+																 NULL,
+																 grassroots_p))
+						{
+							/*
+							 * No workers or watcher so that nothing else is allocating
+							 * while the operations are being counted
+							 */
+							json_t *config_json_p = json_pack ("{s:s,s:s,s:s,s:b,s:i,s:i}",
+																								 "database", config_p -> ubc_database_s,
+																								 "users_collection", "users",
+																								 "groups_collection", "groups",
+																								 "users_directory_cache", 1,
+																								 "users_directory_ttl", 0,
+																								 "shared_data_idle_timeout", 0);
+
+							if (config_json_p)
+								{
+									data_p -> usd_base_data.sd_config_p = config_json_p;
+
+									if (ConfigureUsersService (data_p, grassroots_p))
+										{
+											return service_p;
+										}
+
+									fprintf (stderr, "Failed to configure the service\n");
+								}
+						}
+					else
+						{
+							fprintf (stderr, "Failed to initialise the service\n");
+						}
+
+					FreeUsersServiceData (data_p);
+				}		/* if (data_p) */
+
+			FreeMemory (service_p);
+		}		/* if (service_p) */
+
+	return NULL;
+}
+
+
+/*
+ * The first User is kept in active_user_pp for the parameters to be filled in from.
+ */
+static bool RunSaveUserBench (Service *service_p, const UsersBenchConfig *config_p, UsersBenchResult *result_p, User **active_user_pp)
+{
+	bool success_flag = false;
+
+	if (InitUsersBenchResult (result_p, "save_user", config_p -> ubc_num_users))
+		{
+			UsersServiceData *data_p = (UsersServiceData *) (service_p -> se_data_p);
+			ServiceJobSet *jobs_p = AllocateSimpleServiceJobSet (service_p, NULL, "Users");
+
+			if (jobs_p)
+				{
+					ServiceJob *job_p = GetServiceJobFromServiceJobSet (jobs_p, 0);
+					uint32 seed = config_p -> ubc_seed;
+					uint32 i;
+
+					success_flag = true;
+
+					for (i = 0; (i < config_p -> ubc_num_users) && success_flag; ++ i)
+						{
+							const uint32 num_surnames = sizeof (S_SURNAMES_SS) / sizeof (S_SURNAMES_SS [0]);
+							const uint32 num_forenames = sizeof (S_FORENAMES_SS) / sizeof (S_FORENAMES_SS [0]);
+							char email_s [64];
+							char surname_s [64];
+							User *user_p;
+
+							/*
+							 * The numbers keep the names and email addresses unique
+							 */
+							snprintf (email_s, sizeof (email_s), "user" UINT32_FMT "@example.org", i);
+							snprintf (surname_s, sizeof (surname_s), "%s" UINT32_FMT, S_SURNAMES_SS [GetUsersBenchRandom (&seed) % num_surnames], i);
+
+							if ((user_p = AllocateUser (NULL, email_s, S_FORENAMES_SS [GetUsersBenchRandom (&seed) % num_forenames], surname_s, "Example Institute", NULL)) != NULL)
+								{
+									const uint64 allocations = GetUsersBenchAllocations ();
+									struct timespec start;
+
+									clock_gettime (CLOCK_MONOTONIC, &start);
+
+									if (SaveUser (user_p, job_p, data_p, false) == OS_SUCCEEDED)
+										{
+											RecordUsersBenchRun (result_p, i, &start, allocations);
+										}
+									else
+										{
+											fprintf (stderr, "Failed to save \"%s\"\n", email_s);
+											success_flag = false;
+										}
+
+									if (success_flag && (i == 0))
+										{
+											*active_user_pp = user_p;
+										}
+									else
+										{
+											FreeUser (user_p);
+										}
+								}
+							else
+								{
+									success_flag = false;
+								}
+						}
+
+					FreeServiceJobSet (jobs_p);
+				}
+
+			if (!success_flag)
+				{
+					ClearUsersBenchResult (result_p);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * The first run loads the directory, the rest show the cost of each
+ * request once it is up to date.
+ */
+static bool RunParametersBench (Service *service_p, const UsersBenchConfig *config_p, UsersBenchResult *result_p)
+{
+	bool success_flag = false;
+
+	if (InitUsersBenchResult (result_p, "parameters", config_p -> ubc_num_runs))
+		{
+			uint32 i;
+
+			success_flag = true;
+
+			for (i = 0; (i < config_p -> ubc_num_runs) && success_flag; ++ i)
+				{
+					const uint64 allocations = GetUsersBenchAllocations ();
+					struct timespec start;
+					ParameterSet *params_p;
+
+					clock_gettime (CLOCK_MONOTONIC, &start);
+
+					if ((params_p = GetUsersSubmissionServiceParameters (service_p, NULL, NULL)) != NULL)
+						{
+							FreeParameterSet (params_p);
+							RecordUsersBenchRun (result_p, i, &start, allocations);
+						}
+					else
+						{
+							fprintf (stderr, "Failed to get parameters\n");
+							success_flag = false;
+						}
+				}
+
+			if (!success_flag)
+				{
+					ClearUsersBenchResult (result_p);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * The parameters for an active User, either built from scratch every
+ * time or made from the template, which is built by the first run.
+ */
+static bool RunActiveUserParametersBench (Service *service_p, const UsersBenchConfig *config_p, const User *active_user_p, const bool template_flag, UsersBenchResult *result_p)
+{
+	bool success_flag = false;
+
+	if (InitUsersBenchResult (result_p, template_flag ? "parameters_template" : "parameters_build", config_p -> ubc_num_runs))
+		{
+			UsersServiceData *data_p = (UsersServiceData *) (service_p -> se_data_p);
+			uint32 i;
+
+			success_flag = true;
+
+			for (i = 0; (i < config_p -> ubc_num_runs) && success_flag; ++ i)
+				{
+					const uint64 allocations = GetUsersBenchAllocations ();
+					struct timespec start;
+					ParameterSet *params_p;
+
+					clock_gettime (CLOCK_MONOTONIC, &start);
+
+					if (template_flag)
+						{
+							params_p = GetUsersSubmissionServiceParametersFromTemplate (service_p, data_p, active_user_p);
+						}
+					else
+						{
+							params_p = BuildUsersSubmissionServiceParameters (service_p, data_p, NULL, active_user_p);
+						}
+
+					if (params_p)
+						{
+							FreeParameterSet (params_p);
+							RecordUsersBenchRun (result_p, i, &start, allocations);
+						}
+					else
+						{
+							fprintf (stderr, "Failed to get parameters for \"%s\"\n", active_user_p -> us_email_s);
+							success_flag = false;
+						}
+				}
+
+			if (!success_flag)
+				{
+					ClearUsersBenchResult (result_p);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Each run loads every User into a new directory.
+ */
+static bool RunDirectoryLoadBench (UsersServiceData *data_p, const UsersBenchConfig *config_p, UsersBenchResult *result_p)
+{
+	bool success_flag = false;
+
+	if (InitUsersBenchResult (result_p, "directory_load", config_p -> ubc_num_runs))
+		{
+			uint32 i;
+
+			success_flag = true;
+
+			for (i = 0; (i < config_p -> ubc_num_runs) && success_flag; ++ i)
+				{
+					UsersDirectory *directory_p = AllocateUsersDirectory (0, UD_DEFAULT_SYNC_OVERLAP_MS, UD_DEFAULT_FULL_RELOAD_INTERVAL);
+
+					if (directory_p)
+						{
+							const uint64 allocations = GetUsersBenchAllocations ();
+							struct timespec start;
+							const UsersDirectorySnapshot *snapshot_p;
+
+							clock_gettime (CLOCK_MONOTONIC, &start);
+
+							if ((snapshot_p = AcquireUsersDirectorySnapshot (directory_p, data_p -> usd_mongo_pool_p, data_p -> usd_users_collection_s)) != NULL)
+								{
+									ReleaseUsersDirectorySnapshot (directory_p, snapshot_p);
+									RecordUsersBenchRun (result_p, i, &start, allocations);
+								}
+							else
+								{
+									fprintf (stderr, "Failed to load the users directory\n");
+									success_flag = false;
+								}
+
+							FreeUsersDirectory (directory_p);
+						}
+					else
+						{
+							success_flag = false;
+						}
+				}
+
+			if (!success_flag)
+				{
+					ClearUsersBenchResult (result_p);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Each run reads every User's name the way that the users directory
+ * did before it used a UsersCursor: all of the documents are converted
+ * to JSON and then each one to a User.
+ */
+static bool RunUsersJSONBench (UsersServiceData *data_p, const UsersBenchConfig *config_p, UsersBenchResult *result_p)
+{
+	bool success_flag = false;
+
+	if (InitUsersBenchResult (result_p, "users_json", config_p -> ubc_num_runs))
+		{
+			MongoTool *tool_p = CheckOutMongoTool (data_p -> usd_mongo_pool_p);
+
+			if (tool_p)
+				{
+					bson_t *opts_p = BCON_NEW ("sort", "{", US_SURNAME_S, BCON_INT32 (1), US_FORENAME_S, BCON_INT32 (1), "}");
+
+					if (opts_p && SetMongoToolCollection (tool_p, data_p -> usd_users_collection_s))
+						{
+							uint32 i;
+
+							success_flag = true;
+
+							for (i = 0; (i < config_p -> ubc_num_runs) && success_flag; ++ i)
+								{
+									const uint64 allocations = GetUsersBenchAllocations ();
+									struct timespec start;
+									json_t *results_p;
+
+									clock_gettime (CLOCK_MONOTONIC, &start);
+
+									if ((results_p = GetAllMongoResultsAsJSON (tool_p, NULL, opts_p)) != NULL)
+										{
+											const size_t num_results = json_array_size (results_p);
+											size_t j;
+
+											for (j = 0; (j < num_results) && success_flag; ++ j)
+												{
+													User *user_p = GetUserFromJSON (json_array_get (results_p, j));
+
+													success_flag = false;
+
+													if (user_p)
+														{
+															char *name_s = GetFullUsername (user_p);
+
+															if (name_s)
+																{
+																	FreeFullUsername (name_s);
+																	success_flag = true;
+																}
+
+															FreeUser (user_p);
+														}
+												}
+
+											json_decref (results_p);
+
+											if (success_flag)
+												{
+													RecordUsersBenchRun (result_p, i, &start, allocations);
+												}
+										}
+									else
+										{
+											success_flag = false;
+										}
+
+									if (!success_flag)
+										{
+											fprintf (stderr, "Failed to read users as JSON\n");
+										}
+								}
+						}
+
+					if (opts_p)
+						{
+							bson_destroy (opts_p);
+						}
+
+					CheckInMongoTool (data_p -> usd_mongo_pool_p, tool_p);
+				}
+
+			if (!success_flag)
+				{
+					ClearUsersBenchResult (result_p);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Each run reads every User's name from a UsersCursor that
+ * fetches the given fields.
+ */
+static bool RunUsersCursorBench (UsersServiceData *data_p, const UsersBenchConfig *config_p, const char *name_s, const char * const *fields_ss, UsersBenchResult *result_p)
+{
+	bool success_flag = false;
+
+	if (InitUsersBenchResult (result_p, name_s, config_p -> ubc_num_runs))
+		{
+			MongoTool *tool_p = CheckOutMongoTool (data_p -> usd_mongo_pool_p);
+
+			if (tool_p)
+				{
+					uint32 i;
+
+					success_flag = true;
+
+					for (i = 0; (i < config_p -> ubc_num_runs) && success_flag; ++ i)
+						{
+							const uint64 allocations = GetUsersBenchAllocations ();
+							struct timespec start;
+							UsersCursor cursor;
+
+							clock_gettime (CLOCK_MONOTONIC, &start);
+
+							if (OpenUsersCursor (&cursor, tool_p, data_p -> usd_users_collection_s, NULL, fields_ss))
+								{
+									const UsersCursorRow *row_p;
+
+									while (success_flag && ((row_p = GetNextUsersCursorRow (&cursor)) != NULL))
+										{
+											if (! (row_p -> ucr_display_name_s))
+												{
+													char *row_name_s = GetUsersCursorRowName (row_p);
+
+													if (row_name_s)
+														{
+															FreeUsersCursorRowName (row_name_s);
+														}
+													else
+														{
+															success_flag = false;
+														}
+												}
+										}
+
+									if (HasUsersCursorFailed (&cursor))
+										{
+											success_flag = false;
+										}
+
+									CloseUsersCursor (&cursor);
+
+									if (success_flag)
+										{
+											RecordUsersBenchRun (result_p, i, &start, allocations);
+										}
+								}
+							else
+								{
+									success_flag = false;
+								}
+
+							if (!success_flag)
+								{
+									fprintf (stderr, "Failed to read users for %s\n", name_s);
+								}
+						}
+
+					CheckInMongoTool (data_p -> usd_mongo_pool_p, tool_p);
+				}
+
+			if (!success_flag)
+				{
+					ClearUsersBenchResult (result_p);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Each run ingests a new population of random calls in the same way
+ * as the groups submission service does for each row of its table.
+ */
+static bool RunPopulationBench (UsersServiceData *data_p, const UsersBenchConfig *config_p, const PopulationLayout layout, UsersBenchResult *result_p)
+{
+	bool success_flag = false;
+	const char *name_s = (layout == PL_PACKED) ? "population_packed" : ((layout == PL_COLUMNS) ? "population_columns" : "population_documents");
+
+	if (InitUsersBenchResult (result_p, name_s, config_p -> ubc_num_runs))
+		{
+			MongoTool *tool_p = CheckOutMongoTool (data_p -> usd_mongo_pool_p);
+
+			if (tool_p)
+				{
+					uint32 seed = config_p -> ubc_seed;
+					uint32 i;
+
+					success_flag = true;
+
+					for (i = 0; (i < config_p -> ubc_num_runs) && success_flag; ++ i)
+						{
+							const uint64 allocations = GetUsersBenchAllocations ();
+							struct timespec start;
+
+							clock_gettime (CLOCK_MONOTONIC, &start);
+
+							if (BuildAndSavePopulation (data_p, tool_p, config_p, layout, &seed))
+								{
+									RecordUsersBenchRun (result_p, i, &start, allocations);
+								}
+							else
+								{
+									fprintf (stderr, "Failed to save %s\n", name_s);
+									success_flag = false;
+								}
+						}
+
+					CheckInMongoTool (data_p -> usd_mongo_pool_p, tool_p);
+				}
+
+			if (!success_flag)
+				{
+					ClearUsersBenchResult (result_p);
+				}
+		}
+
+	return success_flag;
+}
+
+
+static bool BuildAndSavePopulation (UsersServiceData *data_p, MongoTool *tool_p, const UsersBenchConfig *config_p, const PopulationLayout layout, uint32 *seed_p)
+{
+	bool success_flag = false;
+	bson_oid_t id;
+	PopulationBuilder *builder_p;
+
+	bson_oid_init (&id, NULL);
+
+	if ((builder_p = AllocatePopulationBuilder (&id, config_p -> ubc_num_markers, layout)) != NULL)
+		{
+			char name_s [32];
+			uint32 i;
+
+			success_flag = SetPopulationString (builder_p, "name", "bench cross");
+
+			for (i = 0; (i < config_p -> ubc_num_markers) && success_flag; ++ i)
+				{
+					snprintf (name_s, sizeof (name_s), "m" UINT32_FMT, i);
+
+					if (!AddPopulationMarker (builder_p, name_s, NULL))
+						{
+							success_flag = false;
+						}
+				}
+
+			for (i = 0; (i < config_p -> ubc_num_accessions) && success_flag; ++ i)
+				{
+					snprintf (name_s, sizeof (name_s), "acc" UINT32_FMT, i);
+
+					if (AddPopulationAccession (builder_p, name_s))
+						{
+							const uint32 num_calls = sizeof (S_CALLS_SS) / sizeof (S_CALLS_SS [0]);
+							uint32 j;
+
+							for (j = 0; (j < config_p -> ubc_num_markers) && success_flag; ++ j)
+								{
+									PopulationMarker *marker_p;
+
+									snprintf (name_s, sizeof (name_s), "m" UINT32_FMT, j);
+
+									if (! (((marker_p = GetPopulationMarkerAt (builder_p, j, name_s)) != NULL) && SetPopulationMarkerCall (builder_p, marker_p, S_CALLS_SS [GetUsersBenchRandom (seed_p) % num_calls])))
+										{
+											success_flag = false;
+										}
+								}
+						}
+					else
+						{
+							success_flag = false;
+						}
+				}
+
+			if (success_flag)
+				{
+					success_flag = SavePopulation (tool_p, data_p -> usd_groups_collection_s, builder_p);
+				}
+
+			FreePopulationBuilder (builder_p);
+		}
+
+	return success_flag;
+}
+
+
+static bool InitUsersBenchResult (UsersBenchResult *result_p, const char *name_s, const uint32 num_runs)
+{
+	result_p -> ubr_name_s = name_s;
+	result_p -> ubr_num_runs = num_runs;
+	result_p -> ubr_num_allocations = 0;
+
+	/*
+	 * This is allocated before any runs so isn't counted against them
+	 */
+	if ((result_p -> ubr_times_p = (uint64 *) calloc (num_runs, sizeof (uint64))) != NULL)
+		{
+			return true;
+		}
+
+	fprintf (stderr, "Failed to allocate " UINT32_FMT " times for %s\n", num_runs, name_s);
+
+	return false;
+}
+
+
+static void RecordUsersBenchRun (UsersBenchResult *result_p, const uint32 run, const struct timespec *start_p, const uint64 allocations_before)
+{
+	struct timespec end;
+
+	clock_gettime (CLOCK_MONOTONIC, &end);
+
+	result_p -> ubr_num_allocations += GetUsersBenchAllocations () - allocations_before;
+	(result_p -> ubr_times_p) [run] = ((uint64) (end.tv_sec - start_p -> tv_sec)) * 1000000000ULL + (uint64) (end.tv_nsec - start_p -> tv_nsec);
+}
+
+
+static void PrintUsersBenchResult (UsersBenchResult *result_p)
+{
+	const uint32 num_runs = result_p -> ubr_num_runs;
+	uint64 *times_p = result_p -> ubr_times_p;
+
+	qsort (times_p, num_runs, sizeof (uint64), CompareUsersBenchTimes);
+
+	printf ("%-22s %8u %10.1f %10.1f %10.1f %10.1f %12.1f\n", result_p -> ubr_name_s, num_runs,
+					times_p [(num_runs * 50) / 100] / 1000.0, times_p [(num_runs * 90) / 100] / 1000.0, times_p [(num_runs * 99) / 100] / 1000.0, times_p [num_runs - 1] / 1000.0,
+					((double) (result_p -> ubr_num_allocations)) / num_runs);
+
+	ClearUsersBenchResult (result_p);
+}
+
+
+static void ClearUsersBenchResult (UsersBenchResult *result_p)
+{
+	free (result_p -> ubr_times_p);
+	result_p -> ubr_times_p = NULL;
+}
+
+
+static uint64 GetUsersBenchAllocations (void)
+{
+	return __atomic_load_n (&s_num_allocations, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * A fixed xorshift sequence so that every run gets the same data.
+ */
+static uint32 GetUsersBenchRandom (uint32 *seed_p)
+{
+	uint32 x = *seed_p;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	*seed_p = x;
+
+	return x;
+}
+
+
+static int CompareUsersBenchTimes (const void *v0_p, const void *v1_p)
+{
+	const uint64 t0 = * ((const uint64 *) v0_p);
+	const uint64 t1 = * ((const uint64 *) v1_p);
+
+	return (t0 < t1) ? -1 : ((t0 > t1) ? 1 : 0);
+}
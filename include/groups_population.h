@@ -0,0 +1,583 @@
+/*
+ * groups_population.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SERVICES_USERS_SERVICE_INCLUDE_GROUPS_POPULATION_H_
+#define SERVICES_USERS_SERVICE_INCLUDE_GROUPS_POPULATION_H_
+
+#include "jansson.h"
+
+#include "mongodb_tool.h"
+
+#include "users_service_library.h"
+#include "users_arena.h"
+
+
+/**
+ * The largest document that the server will store. This is much smaller
+ * than libbson's own BSON_MAX_SIZE so it is what populations are
+ * split against.
+ */
+#define GP_MAX_DOCUMENT_SIZE (16 * 1024 * 1024)
+
+
+/**
+ * The key for the id of the population that a chunk belongs to.
+ * Only populations that have been split have this.
+ */
+#define GP_POPULATION_ID_S "population_id"
+
+/** The key for the index of a chunk within its population, starting at 0. */
+#define GP_CHUNK_S "chunk"
+
+/** The key for the number of chunks that a population was split into. */
+#define GP_NUM_CHUNKS_S "num_chunks"
+
+/** The key for the index of the first marker in a chunk. */
+#define GP_FIRST_MARKER_S "first_marker"
+
+/** The key for the index after the last marker in a chunk. */
+#define GP_END_MARKER_S "end_marker"
+
+
+/**
+ * The key for how a population's calls are stored. Populations without
+ * this use PL_DOCUMENTS.
+ */
+#define GP_LAYOUT_S "layout"
+
+/** The GP_LAYOUT_S value for PL_COLUMNS. */
+#define GP_LAYOUT_COLUMNS_S "columns"
+
+/** The GP_LAYOUT_S value for PL_PACKED. */
+#define GP_LAYOUT_PACKED_S "packed"
+
+/**
+ * The key for the array of a PL_COLUMNS or PL_PACKED population's
+ * accessions, in the same order as each marker's calls.
+ */
+#define GP_ACCESSIONS_S "accessions"
+
+/**
+ * The key for a marker's calls. For PL_COLUMNS this is an array of
+ * the calls and for PL_PACKED it is the binary packed codes.
+ */
+#define GP_CALLS_S "calls"
+
+/**
+ * The key for the array of a PL_PACKED population's calls, where
+ * each call's code is its position in the array.
+ */
+#define GP_ALPHABET_S "alphabet"
+
+/** The number of bits used for each PL_PACKED call. */
+#define GP_PACKED_CALL_BITS (2)
+
+/** The number of PL_PACKED calls stored in each byte. */
+#define GP_CALLS_PER_BYTE (8 / GP_PACKED_CALL_BITS)
+
+/** The largest number of different calls that PL_PACKED can store. */
+#define GP_ALPHABET_SIZE (1 << GP_PACKED_CALL_BITS)
+
+/**
+ * The PL_PACKED call that is always code 0 and is used for any
+ * accession without a call for a marker.
+ */
+#define GP_MISSING_CALL_S "-"
+
+/**
+ * Get the number of bytes needed to store a number of PL_PACKED calls.
+ */
+#define GP_PACKED_CALLS_SIZE(num_calls) (((num_calls) + GP_CALLS_PER_BYTE - 1) / GP_CALLS_PER_BYTE)
+
+
+/**
+ * How a population's genotype calls are stored.
+ *
+ * bench/population_sizes.py encodes the same documents with pymongo to
+ * compare the layouts. For a 94 accession by 35000 marker cross with 2%
+ * missing calls, PL_DOCUMENTS is 51.6MB, PL_COLUMNS 35.3MB (0.68) and
+ * PL_PACKED 3.6MB (0.07).
+ */
+typedef enum PopulationLayout
+{
+	/**
+	 * Each marker is a document with a value for each accession
+	 * keyed by the accession's name.
+	 */
+	PL_DOCUMENTS,
+
+	/**
+	 * The population has one ordered array of its accessions and
+	 * each marker has an array of its calls in the same order. This
+	 * doesn't repeat every accession name in every marker so is much
+	 * smaller for large populations. An accession without a call for
+	 * a marker has a null, unless the population started out as
+	 * PL_PACKED, in which case every missing call is GP_MISSING_CALL_S
+	 * as it would have been if the population had stayed packed.
+	 */
+	PL_COLUMNS,
+
+	/**
+	 * Like PL_COLUMNS but each marker's calls are packed into
+	 * GP_PACKED_CALL_BITS codes in a binary value, with the calls
+	 * that the codes stand for stored in the population's
+	 * GP_ALPHABET_S array. This can only be used for populations
+	 * with no more than GP_ALPHABET_SIZE different calls, including
+	 * GP_MISSING_CALL_S. A population that turns out to have more
+	 * is stored as PL_COLUMNS instead.
+	 */
+	PL_PACKED
+
+} PopulationLayout;
+
+
+/**
+ * A marker in a PopulationBuilder.
+ */
+typedef struct PopulationMarker
+{
+	/** The marker's name as it appears in the table. */
+	const char *pm_name_s;
+
+	/**
+	 * The key that the marker is stored under. This is the same as
+	 * pm_name_s unless the name needed escaping.
+	 */
+	const char *pm_key_s;
+
+	/**
+	 * The marker's values, e.g. its chromosome, mapping position and
+	 * genotype calls. This is <code>NULL</code> once the marker has
+	 * been saved.
+	 */
+	bson_t *pm_doc_p;
+
+	/**
+	 * For PL_COLUMNS, the marker's calls in accession order. This is
+	 * <code>NULL</code> for PL_DOCUMENTS and once the marker has been saved.
+	 */
+	bson_t *pm_calls_p;
+
+	/**
+	 * For PL_PACKED, the marker's packed call codes. This is
+	 * <code>NULL</code> for the other layouts and once the marker
+	 * has been saved.
+	 */
+	uint8 *pm_packed_calls_p;
+
+	/** The number of bytes allocated for pm_packed_calls_p. */
+	size_t pm_packed_calls_size;
+
+	/**
+	 * The number of calls that have been added. For PL_DOCUMENTS,
+	 * where the missing calls aren't stored, this is one more than
+	 * the position of the last accession with a call.
+	 */
+	uint32 pm_num_calls;
+
+} PopulationMarker;
+
+
+/**
+ * Builds a population's BSON straight from its table, one row at a time,
+ * with each marker's values appended to its own buffer. The document
+ * isn't put together until it is saved so its size, and whether it needs
+ * splitting, is known before anything is copied.
+ */
+typedef struct PopulationBuilder
+{
+	/**
+	 * @private
+	 *
+	 * The id of the population.
+	 */
+	bson_oid_t pb_id;
+
+	/**
+	 * @private
+	 *
+	 * How the population's calls are stored.
+	 */
+	PopulationLayout pb_layout;
+
+	/**
+	 * @private
+	 *
+	 * The population's values that aren't markers.
+	 */
+	bson_t *pb_header_p;
+
+	/**
+	 * @private
+	 *
+	 * The markers in the order that they were added.
+	 */
+	PopulationMarker *pb_markers_p;
+
+	/**
+	 * @private
+	 *
+	 * The markers sorted by name for GetPopulationMarker ().
+	 */
+	PopulationMarker **pb_sorted_markers_pp;
+
+	/**
+	 * @private
+	 *
+	 * Does pb_sorted_markers_pp need sorting before it is searched?
+	 */
+	bool pb_unsorted_flag;
+
+	/**
+	 * @private
+	 *
+	 * The number of markers that have been added.
+	 */
+	uint32 pb_num_markers;
+
+	/**
+	 * @private
+	 *
+	 * The number of markers that there is space for.
+	 */
+	uint32 pb_max_markers;
+
+	/**
+	 * @private
+	 *
+	 * The memory for the marker names and keys.
+	 */
+	UsersArena *pb_arena_p;
+
+	/**
+	 * @private
+	 *
+	 * The accession whose calls are being added.
+	 */
+	const char *pb_accession_s;
+
+	/**
+	 * @private
+	 *
+	 * For PL_COLUMNS and PL_PACKED, the accessions in the order that
+	 * they were added.
+	 */
+	bson_t *pb_accessions_p;
+
+	/**
+	 * @private
+	 *
+	 * For PL_PACKED, the calls that each code stands for.
+	 */
+	const char *pb_alphabet_ss [GP_ALPHABET_SIZE];
+
+	/**
+	 * @private
+	 *
+	 * The number of entries in pb_alphabet_ss.
+	 */
+	uint32 pb_alphabet_size;
+
+	/**
+	 * @private
+	 *
+	 * Was the population PL_PACKED until it had too many different
+	 * calls? If so, missing calls are GP_MISSING_CALL_S rather than
+	 * null so that they all read back the same whether they were
+	 * added before or after it changed to PL_COLUMNS.
+	 */
+	bool pb_unpacked_flag;
+
+	/**
+	 * @private
+	 *
+	 * The names of the accessions that have been added, so that an
+	 * accession that appears in more than one row can be rejected.
+	 */
+	json_t *pb_accession_names_p;
+
+	/**
+	 * @private
+	 *
+	 * The number of accessions that have been added.
+	 */
+	uint32 pb_num_accessions;
+
+} PopulationBuilder;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a PopulationBuilder.
+ *
+ * @param id_p The id of the population.
+ * @param max_markers The maximum number of markers in the population.
+ * @param layout How to store the population's calls.
+ * @return The new PopulationBuilder or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL PopulationBuilder *AllocatePopulationBuilder (const bson_oid_t *id_p, const uint32 max_markers, const PopulationLayout layout);
+
+
+/**
+ * Free a PopulationBuilder.
+ *
+ * @param builder_p The PopulationBuilder to free.
+ */
+USERS_SERVICE_LOCAL void FreePopulationBuilder (PopulationBuilder *builder_p);
+
+
+/**
+ * Set one of a population's values that isn't a marker.
+ *
+ * @param builder_p The PopulationBuilder to add the value to.
+ * @param key_s The key for the value.
+ * @param value_s The value.
+ * @return <code>true</code> if the value was set successfully,
+ * <code>false</code> otherwise.
+ */
+USERS_SERVICE_LOCAL bool SetPopulationString (PopulationBuilder *builder_p, const char *key_s, const char *value_s);
+
+
+/**
+ * Add a marker to a population.
+ *
+ * @param builder_p The PopulationBuilder to add the marker to.
+ * @param name_s The marker's name as it appears in the table.
+ * @param key_s The key to store the marker under. If this is <code>NULL</code>,
+ * name_s is used.
+ * @return The new PopulationMarker or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL PopulationMarker *AddPopulationMarker (PopulationBuilder *builder_p, const char *name_s, const char *key_s);
+
+
+/**
+ * Find one of a population's markers.
+ *
+ * @param builder_p The PopulationBuilder to search.
+ * @param name_s The marker's name as it appears in the table.
+ * @return The PopulationMarker or <code>NULL</code> if there isn't one
+ * with the given name.
+ */
+USERS_SERVICE_LOCAL PopulationMarker *GetPopulationMarker (PopulationBuilder *builder_p, const char *name_s);
+
+
+/**
+ * Find one of a population's markers by the column that it is in.
+ * The rows of a table normally have their columns in the same order
+ * as the header row that the markers were added from, so this checks
+ * the marker at that position first and only searches for it by name
+ * if that marker has a different name.
+ *
+ * @param builder_p The PopulationBuilder to search.
+ * @param index The position of the marker's column, not counting any
+ * columns that aren't markers.
+ * @param name_s The marker's name as it appears in the table.
+ * @return The PopulationMarker or <code>NULL</code> if there isn't one
+ * with the given name.
+ */
+USERS_SERVICE_LOCAL PopulationMarker *GetPopulationMarkerAt (PopulationBuilder *builder_p, const uint32 index, const char *name_s);
+
+
+/**
+ * Does a marker name contain a full stop and so need escaping before
+ * it can be used as a key? This lets names without one skip
+ * SearchAndReplaceInString(), which always copies the string.
+ *
+ * @param name_s The marker name.
+ * @return <code>true</code> if the name contains a full stop,
+ * <code>false</code> otherwise.
+ */
+USERS_SERVICE_LOCAL bool DoesPopulationKeyNeedEscaping (const char *name_s);
+
+
+/**
+ * Append a value to a marker.
+ *
+ * @param marker_p The PopulationMarker to add the value to.
+ * @param key_s The key for the value.
+ * @param value_s The value.
+ * @return <code>true</code> if the value was added successfully,
+ * <code>false</code> otherwise.
+ */
+USERS_SERVICE_LOCAL bool SetPopulationMarkerString (PopulationMarker *marker_p, const char *key_s, const char *value_s);
+
+
+/**
+ * Start adding the calls for an accession. Any calls added with
+ * SetPopulationMarkerCall () are for this accession until this
+ * is called again. Each accession can only be added once.
+ *
+ * @param builder_p The PopulationBuilder to add the accession to.
+ * @param accession_s The accession's name.
+ * @return <code>true</code> if the accession was added successfully,
+ * <code>false</code> otherwise.
+ */
+USERS_SERVICE_LOCAL bool AddPopulationAccession (PopulationBuilder *builder_p, const char *accession_s);
+
+
+/**
+ * Add a marker's call for the current accession.
+ *
+ * @param builder_p The PopulationBuilder that the marker belongs to.
+ * @param marker_p The PopulationMarker to add the call to.
+ * @param value_s The call.
+ * @return <code>true</code> if the call was added successfully,
+ * <code>false</code> otherwise.
+ */
+USERS_SERVICE_LOCAL bool SetPopulationMarkerCall (PopulationBuilder *builder_p, PopulationMarker *marker_p, const char *value_s);
+
+
+/**
+ * Save a population. If it is too big to store as a single document,
+ * its markers are split across as many documents as are needed, each
+ * holding a contiguous range of the markers along with a copy of the
+ * population's other values. The first of these has the population's
+ * id and the rest refer to it with GP_POPULATION_ID_S.
+ *
+ * Each marker's buffer is freed as soon as it has been copied into
+ * the document being saved, so the PopulationBuilder can't be
+ * saved again afterwards.
+ *
+ * @param tool_p The MongoTool to use.
+ * @param collection_s The collection to save the population to.
+ * @param builder_p The PopulationBuilder holding the population.
+ * @return <code>true</code> if the whole population was saved successfully,
+ * <code>false</code> otherwise in which case nothing is saved.
+ */
+USERS_SERVICE_LOCAL bool SavePopulation (MongoTool *tool_p, const char *collection_s, PopulationBuilder *builder_p);
+
+
+/**
+ * Find the documents holding a range of a population's markers. The chunks
+ * are returned in order. A population that wasn't split is returned as its
+ * single document whatever the range.
+ *
+ * @param tool_p The MongoTool to use.
+ * @param collection_s The collection that the population is stored in.
+ * @param id_p The id of the population.
+ * @param first_marker The index of the first marker to get.
+ * @param end_marker The index after the last marker to get. If this is 0,
+ * all of the markers from first_marker onwards are got.
+ * @return The cursor for the chunks which should be freed with
+ * mongoc_cursor_destroy() or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL mongoc_cursor_t *FindPopulationChunks (MongoTool *tool_p, const char *collection_s, const bson_oid_t *id_p, const uint32 first_marker, const uint32 end_marker);
+
+
+/**
+ * Get a whole population as a single document, putting it back
+ * together if it was split.
+ *
+ * @param tool_p The MongoTool to use.
+ * @param collection_s The collection that the population is stored in.
+ * @param id_p The id of the population.
+ * @return The population which should be freed with bson_destroy() or
+ * <code>NULL</code> if it couldn't be found or any of its chunks are missing.
+ */
+USERS_SERVICE_LOCAL bson_t *GetPopulation (MongoTool *tool_p, const char *collection_s, const bson_oid_t *id_p);
+
+
+/**
+ * Get how a population's calls are stored.
+ *
+ * @param population_p The population or one of its chunks.
+ * @return The PopulationLayout.
+ */
+USERS_SERVICE_LOCAL PopulationLayout GetPopulationLayout (const bson_t *population_p);
+
+
+/**
+ * Get the position of an accession in a PL_COLUMNS or PL_PACKED population.
+ *
+ * @param population_p The population or one of its chunks.
+ * @param accession_s The accession's name.
+ * @return The accession's position or -1 if the population doesn't
+ * have it or is PL_DOCUMENTS.
+ */
+USERS_SERVICE_LOCAL int32 GetPopulationAccessionIndex (const bson_t *population_p, const char *accession_s);
+
+
+/**
+ * Get a marker's call for an accession, whichever PopulationLayout
+ * the population uses. For PL_COLUMNS and PL_PACKED, this has to find the
+ * accession's position first, so use GetPopulationCallAt () when
+ * getting lots of calls for the same accession.
+ *
+ * @param population_p The population or the chunk that holds the marker.
+ * @param marker_key_s The key that the marker is stored under.
+ * @param accession_s The accession's name.
+ * @return The call, which belongs to population_p, or <code>NULL</code>
+ * if there isn't one.
+ */
+USERS_SERVICE_LOCAL const char *GetPopulationCall (const bson_t *population_p, const char *marker_key_s, const char *accession_s);
+
+
+/**
+ * Get a marker's call for the accession at a given position in a
+ * PL_COLUMNS or PL_PACKED population.
+ *
+ * @param population_p The population or the chunk that holds the marker.
+ * @param marker_key_s The key that the marker is stored under.
+ * @param accession_index The accession's position from GetPopulationAccessionIndex ().
+ * @return The call, which belongs to population_p, or <code>NULL</code>
+ * if there isn't one.
+ */
+USERS_SERVICE_LOCAL const char *GetPopulationCallAt (const bson_t *population_p, const char *marker_key_s, const uint32 accession_index);
+
+
+/**
+ * Get the calls that a PL_PACKED population's codes stand for.
+ *
+ * @param population_p The population or one of its chunks.
+ * @param alphabet_ss The array to fill in with the call for each code.
+ * These belong to population_p.
+ * @return The number of calls in the alphabet or 0 if the population
+ * isn't PL_PACKED.
+ */
+USERS_SERVICE_LOCAL uint32 GetPopulationAlphabet (const bson_t *population_p, const char *alphabet_ss [GP_ALPHABET_SIZE]);
+
+
+/**
+ * Get a PL_PACKED marker's packed call codes.
+ *
+ * @param population_p The population or the chunk that holds the marker.
+ * @param marker_key_s The key that the marker is stored under.
+ * @param size_p Where to store the number of bytes of packed codes.
+ * @return The packed codes, which belong to population_p, or <code>NULL</code>
+ * if the marker couldn't be found or isn't packed.
+ */
+USERS_SERVICE_LOCAL const uint8 *GetPopulationPackedCalls (const bson_t *population_p, const char *marker_key_s, uint32 *size_p);
+
+
+/**
+ * Unpack a PL_PACKED marker's call codes so that there is a byte
+ * for each code. Each code is the position of its call in the
+ * population's alphabet from GetPopulationAlphabet ().
+ *
+ * @param packed_p The packed codes from GetPopulationPackedCalls ().
+ * @param packed_size The number of bytes of packed codes.
+ * @param codes_p The array to unpack the codes into. This must have
+ * room for num_calls entries.
+ * @param num_calls The number of codes to unpack, which is normally
+ * the number of accessions in the population.
+ * @return <code>true</code> if the codes were unpacked successfully,
+ * <code>false</code> if there weren't enough packed codes.
+ */
+USERS_SERVICE_LOCAL bool DecodePopulationCalls (const uint8 *packed_p, const uint32 packed_size, uint8 *codes_p, const uint32 num_calls);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_USERS_SERVICE_INCLUDE_GROUPS_POPULATION_H_ */
@@ -0,0 +1,128 @@
+/*
+ * users_arena.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SERVICES_USERS_SERVICE_INCLUDE_USERS_ARENA_H_
+#define SERVICES_USERS_SERVICE_INCLUDE_USERS_ARENA_H_
+
+#include <stddef.h>
+
+#include "typedefs.h"
+
+#include "users_service_library.h"
+
+
+/** The default number of bytes in each block of a UsersArena. */
+#define UA_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+
+/**
+ * A block of memory that a UsersArena hands out pieces of.
+ */
+typedef struct UsersArenaBlock
+{
+	/** The previously filled block. */
+	struct UsersArenaBlock *uab_next_p;
+
+	/** The number of bytes in uab_data. */
+	size_t uab_size;
+
+	/** The number of bytes in uab_data that have been handed out. */
+	size_t uab_used;
+
+	/** The memory to hand out. */
+	char uab_data [];
+
+} UsersArenaBlock;
+
+
+/**
+ * An allocator for lots of small pieces of memory that all
+ * have the same lifetime. The pieces can't be freed individually,
+ * instead they are all released together by FreeUsersArena().
+ *
+ * A UsersArena is not thread-safe, it is filled by a single thread
+ * and after that it can be read from by any number of threads.
+ */
+typedef struct UsersArena
+{
+	/**
+	 * @private
+	 *
+	 * The block currently being filled.
+	 */
+	UsersArenaBlock *ua_current_p;
+
+	/**
+	 * @private
+	 *
+	 * The default size of each new block.
+	 */
+	size_t ua_block_size;
+
+	/**
+	 * @private
+	 *
+	 * The total number of bytes that have been handed out.
+	 */
+	size_t ua_num_bytes;
+
+} UsersArena;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a UsersArena.
+ *
+ * @param block_size The number of bytes to allocate at a time. If this
+ * is 0, UA_DEFAULT_BLOCK_SIZE is used.
+ * @return The new UsersArena or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL UsersArena *AllocateUsersArena (const size_t block_size);
+
+
+/**
+ * Free a UsersArena and all of the memory that it has handed out.
+ *
+ * @param arena_p The UsersArena to free.
+ */
+USERS_SERVICE_LOCAL void FreeUsersArena (UsersArena *arena_p);
+
+
+/**
+ * Get some memory from a UsersArena, suitably aligned for any
+ * pointer or integer type.
+ *
+ * @param arena_p The UsersArena to use.
+ * @param size The number of bytes needed.
+ * @return The memory or <code>NULL</code> upon error. This must not be
+ * freed, it is released when the UsersArena is freed.
+ */
+USERS_SERVICE_LOCAL void *AllocUsersArenaMemory (UsersArena *arena_p, const size_t size);
+
+
+/**
+ * Copy a string into a UsersArena.
+ *
+ * @param arena_p The UsersArena to use.
+ * @param value_s The string to copy.
+ * @return The copied string or <code>NULL</code> upon error. This must not
+ * be freed, it is released when the UsersArena is freed.
+ */
+USERS_SERVICE_LOCAL char *CopyToUsersArena (UsersArena *arena_p, const char *value_s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_USERS_SERVICE_INCLUDE_USERS_ARENA_H_ */
@@ -0,0 +1,161 @@
+/*
+ * users_cache.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SERVICES_USERS_SERVICE_INCLUDE_USERS_CACHE_H_
+#define SERVICES_USERS_SERVICE_INCLUDE_USERS_CACHE_H_
+
+#include <pthread.h>
+#include <time.h>
+
+#include "grassroots_server.h"
+#include "mongodb_tool.h"
+#include "user.h"
+
+#include "users_service_library.h"
+
+
+/** The default number of Users to keep in a UsersCache. */
+#define UC_DEFAULT_CAPACITY (64)
+
+
+/**
+ * A User stored in a UsersCache.
+ */
+typedef struct UsersCacheEntry
+{
+	/** The User's id as a string. */
+	char uce_id_s [MONGO_OID_STRING_BUFFER_SIZE];
+
+	/** The User or <code>NULL</code> if this entry is unused. */
+	User *uce_user_p;
+
+	/** When the User was loaded. */
+	time_t uce_load_time;
+
+	/** When the User was last used, taken from UsersCache::uc_clock. */
+	uint64 uce_last_used;
+
+} UsersCacheEntry;
+
+
+/**
+ * A fixed size, least recently used cache of Users keyed
+ * by their ids.
+ *
+ * The Users are only ever handed out as copies so the cache can
+ * be shared between concurrent requests.
+ */
+typedef struct UsersCache
+{
+	/**
+	 * @private
+	 *
+	 * The entries.
+	 */
+	UsersCacheEntry *uc_entries_p;
+
+	/**
+	 * @private
+	 *
+	 * The number of entries.
+	 */
+	uint32 uc_capacity;
+
+	/**
+	 * @private
+	 *
+	 * The number of seconds that a User can be cached for.
+	 * If this is 0, Users stay cached until they are removed or evicted.
+	 */
+	uint32 uc_ttl;
+
+	/**
+	 * @private
+	 *
+	 * Incremented each time that an entry is used.
+	 */
+	uint64 uc_clock;
+
+	/**
+	 * @private
+	 *
+	 * Incremented each time that Users are removed so that a User
+	 * loaded at the same time isn't added after it has changed.
+	 */
+	uint64 uc_generation;
+
+	/**
+	 * @private
+	 *
+	 * The lock for accessing the entries.
+	 */
+	pthread_mutex_t uc_lock;
+
+} UsersCache;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a UsersCache.
+ *
+ * @param capacity The maximum number of Users to keep.
+ * @param ttl The number of seconds that a User can be cached for.
+ * If this is 0, Users stay cached until they are removed or evicted.
+ * @return The new UsersCache or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL UsersCache *AllocateUsersCache (const uint32 capacity, const uint32 ttl);
+
+
+/**
+ * Free a UsersCache and all of the Users that it has.
+ *
+ * @param cache_p The UsersCache to free.
+ */
+USERS_SERVICE_LOCAL void FreeUsersCache (UsersCache *cache_p);
+
+
+/**
+ * Get a User by its id, loading it from the database if it is not
+ * already cached.
+ *
+ * @param cache_p The UsersCache to use.
+ * @param id_s The User's id as a string.
+ * @param grassroots_p The GrassrootsServer to load the User with.
+ * @return A copy of the User which should be freed with FreeUser()
+ * or <code>NULL</code> if the User could not be found.
+ */
+USERS_SERVICE_LOCAL User *GetUserFromUsersCache (UsersCache *cache_p, const char *id_s, GrassrootsServer *grassroots_p);
+
+
+/**
+ * Remove a User from a UsersCache, e.g. after it has been changed.
+ *
+ * @param cache_p The UsersCache to use.
+ * @param id_p The id of the User to remove.
+ */
+USERS_SERVICE_LOCAL void RemoveUserFromUsersCache (UsersCache *cache_p, const bson_oid_t *id_p);
+
+
+/**
+ * Remove all of the Users from a UsersCache.
+ *
+ * @param cache_p The UsersCache to clear.
+ */
+USERS_SERVICE_LOCAL void ClearUsersCache (UsersCache *cache_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_USERS_SERVICE_INCLUDE_USERS_CACHE_H_ */
@@ -0,0 +1,215 @@
+/*
+ * users_cursor.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SERVICES_USERS_SERVICE_INCLUDE_USERS_CURSOR_H_
+#define SERVICES_USERS_SERVICE_INCLUDE_USERS_CURSOR_H_
+
+#include <time.h>
+
+#include "mongodb_tool.h"
+
+#include "users_service_library.h"
+
+
+/**
+ * The fields of a User document that a UsersCursor has
+ * read for the current row.
+ */
+typedef struct UsersCursorRow
+{
+	/** The User's id as a string. */
+	char ucr_id_s [MONGO_OID_STRING_BUFFER_SIZE];
+
+	/**
+	 * The User's surname. This is only valid until the next call
+	 * to GetNextUsersCursorRow() and can be <code>NULL</code>.
+	 */
+	const char *ucr_surname_s;
+
+	/**
+	 * The User's forename. This is only valid until the next call
+	 * to GetNextUsersCursorRow() and can be <code>NULL</code>.
+	 */
+	const char *ucr_forename_s;
+
+	/**
+	 * The User's email address. This is only valid until the next call
+	 * to GetNextUsersCursorRow() and can be <code>NULL</code>.
+	 */
+	const char *ucr_email_s;
+
+	/**
+	 * When the User was last saved, in milliseconds since the epoch,
+	 * or 0 if the document doesn't have a MONGO_TIMESTAMP_S.
+	 */
+	int64 ucr_timestamp;
+
+	/**
+	 * The User's stored sort key. This is only valid until the next
+	 * call to GetNextUsersCursorRow() and can be <code>NULL</code> for
+	 * Users saved before sort keys were added.
+	 */
+	const char *ucr_sort_key_s;
+
+	/**
+	 * The User's stored display name. This is only valid until the next
+	 * call to GetNextUsersCursorRow() and can be <code>NULL</code> for
+	 * Users saved before display names were added.
+	 */
+	const char *ucr_display_name_s;
+
+	/**
+	 * The raw document for this row. This is only valid until the
+	 * next call to GetNextUsersCursorRow().
+	 */
+	const bson_t *ucr_doc_p;
+
+} UsersCursorRow;
+
+
+/**
+ * A cursor that streams Users from the database one document
+ * at a time, sorted by their sort key.
+ */
+typedef struct UsersCursor
+{
+	/**
+	 * @private
+	 *
+	 * The underlying mongo cursor.
+	 */
+	mongoc_cursor_t *uc_cursor_p;
+
+	/**
+	 * @private
+	 *
+	 * The current row.
+	 */
+	UsersCursorRow uc_row;
+
+	/**
+	 * @private
+	 *
+	 * Did the cursor stop because of an error rather than
+	 * because there were no more Users?
+	 */
+	bool uc_failed_flag;
+
+	/**
+	 * @private
+	 *
+	 * The number of rows read so far.
+	 */
+	size_t uc_num_rows;
+
+	/**
+	 * @private
+	 *
+	 * The total size of the documents read so far.
+	 */
+	size_t uc_num_bytes;
+
+	/**
+	 * @private
+	 *
+	 * When the cursor was opened, from CLOCK_MONOTONIC.
+	 */
+	struct timespec uc_start;
+
+} UsersCursor;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Start iterating over the Users in a collection.
+ *
+ * @param cursor_p The UsersCursor to open.
+ * @param tool_p The MongoTool to use.
+ * @param collection_s The collection that the Users are stored in.
+ * @param query_p The query to match Users against. This can be
+ * <code>NULL</code> to iterate over all of the Users.
+ * @param fields_ss A <code>NULL</code>-terminated array of the keys to fetch
+ * for each User. The id, sort key and display name are always fetched. If this
+ * is <code>NULL</code>, the whole document is fetched.
+ * @return <code>true</code> if the cursor was opened successfully,
+ * <code>false</code> otherwise. If this is <code>true</code>, CloseUsersCursor()
+ * must be called when the cursor is no longer needed.
+ */
+USERS_SERVICE_LOCAL bool OpenUsersCursor (UsersCursor *cursor_p, MongoTool *tool_p, const char *collection_s, const bson_t *query_p, const char * const *fields_ss);
+
+
+/**
+ * Get the options to find Users sorted by their sort key.
+ *
+ * @param fields_ss A <code>NULL</code>-terminated array of the keys to fetch
+ * for each User. The id, sort key and display name are always fetched. If this
+ * is <code>NULL</code>, the whole document is fetched.
+ * @return The options which should be freed with bson_destroy() or
+ * <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL bson_t *GetUsersQueryOptions (const char * const *fields_ss);
+
+
+/**
+ * Get the next User from a UsersCursor.
+ *
+ * @param cursor_p The UsersCursor to use.
+ * @return The next row or <code>NULL</code> if there are no more
+ * Users or there was an error. HasUsersCursorFailed() can be used to
+ * tell these apart.
+ */
+USERS_SERVICE_LOCAL const UsersCursorRow *GetNextUsersCursorRow (UsersCursor *cursor_p);
+
+
+/**
+ * Check whether a UsersCursor stopped because of an error.
+ *
+ * @param cursor_p The UsersCursor to check.
+ * @return <code>true</code> if there was an error, <code>false</code>
+ * otherwise.
+ */
+USERS_SERVICE_LOCAL bool HasUsersCursorFailed (const UsersCursor *cursor_p);
+
+
+/**
+ * Close a UsersCursor and free its resources.
+ *
+ * @param cursor_p The UsersCursor to close.
+ */
+USERS_SERVICE_LOCAL void CloseUsersCursor (UsersCursor *cursor_p);
+
+
+/**
+ * Build the name to display for a UsersCursorRow. This is only
+ * needed if the row doesn't have a stored ucr_display_name_s.
+ *
+ * @param row_p The row to get the name for.
+ * @return The name which should be freed with FreeUsersCursorRowName() or
+ * <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL char *GetUsersCursorRowName (const UsersCursorRow *row_p);
+
+
+/**
+ * Free a name from GetUsersCursorRowName().
+ *
+ * @param name_s The name to free.
+ */
+USERS_SERVICE_LOCAL void FreeUsersCursorRowName (char *name_s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_USERS_SERVICE_INCLUDE_USERS_CURSOR_H_ */
@@ -0,0 +1,418 @@
+/*
+ * users_directory.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SERVICES_USERS_SERVICE_INCLUDE_USERS_DIRECTORY_H_
+#define SERVICES_USERS_SERVICE_INCLUDE_USERS_DIRECTORY_H_
+
+#include <pthread.h>
+#include <time.h>
+
+#include "mongodb_tool.h"
+
+#include "users_service_library.h"
+#include "users_mongo_pool.h"
+#include "users_arena.h"
+
+
+/**
+ * An entry in the UsersDirectory storing just what is needed
+ * to list a User.
+ */
+typedef struct UsersDirectoryEntry
+{
+	/** The User's id as a string. */
+	char ude_id_s [MONGO_OID_STRING_BUFFER_SIZE];
+
+	/** The name to display for the User. This is stored in the snapshot's arena. */
+	const char *ude_name_s;
+
+	/**
+	 * The User's sort key, used to keep the entries in order when
+	 * merging in changes. This is stored in the snapshot's arena
+	 * and can be <code>NULL</code>.
+	 */
+	const char *ude_sort_key_s;
+
+} UsersDirectoryEntry;
+
+
+/**
+ * A normalised search key pointing to a UsersDirectoryEntry,
+ * used to find Users by the start of their surname, forename
+ * or email address.
+ */
+typedef struct UsersDirectoryKey
+{
+	/** The folded key. This is stored in the snapshot's arena. */
+	const char *udk_key_s;
+
+	/** The index of the UsersDirectoryEntry that this key is for. */
+	size_t udk_entry_index;
+
+} UsersDirectoryKey;
+
+
+/**
+ * An immutable set of UsersDirectoryEntries, sorted by
+ * their sort keys. Any number of requests can
+ * read from a snapshot at the same time.
+ */
+typedef struct UsersDirectorySnapshot
+{
+	/** The entries */
+	UsersDirectoryEntry *uds_entries_p;
+
+	/** The number of entries */
+	size_t uds_num_entries;
+
+	/** The search keys for the entries, sorted by key. */
+	UsersDirectoryKey *uds_keys_p;
+
+	/** The number of search keys */
+	size_t uds_num_keys;
+
+	/**
+	 * The revision of the owning UsersDirectory that this snapshot
+	 * is. Each snapshot that a UsersDirectory loads gets a new one so
+	 * anything built from a snapshot can check whether it is current.
+	 */
+	uint32 uds_revision;
+
+	/**
+	 * @private
+	 *
+	 * The number of entries that have been allocated.
+	 */
+	size_t uds_capacity;
+
+	/**
+	 * @private
+	 *
+	 * The arena that the names and keys are stored in so that they
+	 * are all freed together with the snapshot.
+	 */
+	UsersArena *uds_arena_p;
+
+	/**
+	 * @private
+	 *
+	 * The latest MONGO_TIMESTAMP_S, in milliseconds, of the Users in
+	 * this snapshot. Only Users changed since then need to be fetched
+	 * to bring the snapshot up to date.
+	 */
+	int64 uds_watermark;
+
+	/**
+	 * @private
+	 *
+	 * The number of references held to this snapshot, guarded by
+	 * the owning UsersDirectory's lock.
+	 */
+	uint32 uds_num_refs;
+
+} UsersDirectorySnapshot;
+
+
+/**
+ * The id of a User that has been deleted and needs to be
+ * removed from a UsersDirectory when it is next synced.
+ */
+typedef struct UsersDirectoryTombstone
+{
+	/** The User's id as a string. */
+	char udt_id_s [MONGO_OID_STRING_BUFFER_SIZE];
+
+} UsersDirectoryTombstone;
+
+
+/**
+ * A process-wide cache of the Users in the database so that
+ * the list of Users does not need to be loaded for every
+ * request.
+ */
+typedef struct UsersDirectory
+{
+	/**
+	 * @private
+	 *
+	 * The current snapshot, this can be <code>NULL</code> if it
+	 * has not been loaded yet.
+	 */
+	UsersDirectorySnapshot *ud_snapshot_p;
+
+	/**
+	 * @private
+	 *
+	 * When the current snapshot was loaded.
+	 */
+	time_t ud_load_time;
+
+	/**
+	 * @private
+	 *
+	 * When every User was last loaded rather than just
+	 * the ones that had changed.
+	 */
+	time_t ud_full_load_time;
+
+	/**
+	 * @private
+	 *
+	 * The number of seconds between loading every User, to catch any
+	 * deletions that were missed when syncing. If this is 0, every User
+	 * is only loaded when a sync can't be trusted.
+	 */
+	uint32 ud_full_reload_interval;
+
+	/**
+	 * @private
+	 *
+	 * The number of seconds that a snapshot is valid for. If this
+	 * is 0, a snapshot is only reloaded after it has been invalidated.
+	 */
+	uint32 ud_ttl;
+
+	/**
+	 * @private
+	 *
+	 * How far back, in milliseconds, before a snapshot's watermark
+	 * to look for changes when syncing it. Writes can be acknowledged
+	 * in a different order from their timestamps so this catches any
+	 * that finished just after the last sync.
+	 */
+	uint32 ud_sync_overlap_ms;
+
+	/**
+	 * @private
+	 *
+	 * The number of times that the directory has been invalidated.
+	 */
+	uint32 ud_num_invalidations;
+
+	/**
+	 * @private
+	 *
+	 * Has the directory been invalidated since the current snapshot
+	 * was loaded?
+	 */
+	bool ud_stale_flag;
+
+	/**
+	 * @private
+	 *
+	 * Is a request currently reloading the snapshot? If so, any
+	 * other requests use the current snapshot or, if there isn't
+	 * one yet, wait for it rather than running the same query.
+	 */
+	bool ud_loading_flag;
+
+	/**
+	 * @private
+	 *
+	 * The number of reloads that have finished, whether they
+	 * succeeded or not.
+	 */
+	uint32 ud_num_loads;
+
+	/**
+	 * @private
+	 *
+	 * The revision given to the last snapshot that was loaded.
+	 */
+	uint32 ud_revision;
+
+	/**
+	 * @private
+	 *
+	 * The Users that have been deleted since the last sync.
+	 */
+	UsersDirectoryTombstone *ud_tombstones_p;
+
+	/**
+	 * @private
+	 *
+	 * The number of tombstones.
+	 */
+	size_t ud_num_tombstones;
+
+	/**
+	 * @private
+	 *
+	 * The number of tombstones that have been allocated.
+	 */
+	size_t ud_tombstones_capacity;
+
+	/**
+	 * @private
+	 *
+	 * Must the next reload fetch every User rather than just
+	 * the ones that have changed?
+	 */
+	bool ud_full_reload_flag;
+
+	/**
+	 * @private
+	 *
+	 * Is a change stream adding a tombstone for every deleted User?
+	 * If so, a sync doesn't need to count the Users in the collection
+	 * to find out whether it has missed any deletions.
+	 */
+	bool ud_tracking_deletions_flag;
+
+	/**
+	 * @private
+	 *
+	 * Must the next sync count the Users in the collection even though
+	 * deletions are being tracked? This is set when tracking starts as
+	 * any deletions before then won't have tombstones.
+	 */
+	bool ud_count_next_sync_flag;
+
+	/**
+	 * @private
+	 *
+	 * The lock guarding access to all of the above.
+	 */
+	pthread_mutex_t ud_lock;
+
+	/**
+	 * @private
+	 *
+	 * Signalled when a reload finishes.
+	 */
+	pthread_cond_t ud_loaded;
+
+} UsersDirectory;
+
+
+/** The default number of seconds that a UsersDirectorySnapshot is valid for. */
+#define UD_DEFAULT_TTL (300)
+
+/** The default number of milliseconds before a snapshot's watermark to look for changes from. */
+#define UD_DEFAULT_SYNC_OVERLAP_MS (5000)
+
+/** The default number of seconds between loading every User. */
+#define UD_DEFAULT_FULL_RELOAD_INTERVAL (3600)
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a UsersDirectory.
+ *
+ * @param ttl The number of seconds that each loaded snapshot is valid for.
+ * If this is 0 then a snapshot is only reloaded after InvalidateUsersDirectory()
+ * has been called.
+ * @param sync_overlap_ms How far back, in milliseconds, before the newest
+ * timestamp in a snapshot to look for changes when syncing it. This should
+ * be longer than the time between a User's timestamp being set and its
+ * write being acknowledged.
+ * @param full_reload_interval The number of seconds between loading every
+ * User rather than syncing, as a backstop for any missed deletions. If this
+ * is 0, every User is only loaded when a sync can't be trusted.
+ * @return The newly-allocated UsersDirectory or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL UsersDirectory *AllocateUsersDirectory (const uint32 ttl, const uint32 sync_overlap_ms, const uint32 full_reload_interval);
+
+
+/**
+ * Free a UsersDirectory and its current snapshot.
+ *
+ * @param directory_p The UsersDirectory to free.
+ */
+USERS_SERVICE_LOCAL void FreeUsersDirectory (UsersDirectory *directory_p);
+
+
+/**
+ * Mark a UsersDirectory as needing to be reloaded, e.g.
+ * after a User has been saved.
+ *
+ * @param directory_p The UsersDirectory to invalidate.
+ */
+USERS_SERVICE_LOCAL void InvalidateUsersDirectory (UsersDirectory *directory_p);
+
+
+/**
+ * Say whether every deletion from the collection is being passed to
+ * RemoveUserFromUsersDirectory(), e.g. by a change stream. While it is,
+ * syncing a snapshot doesn't need to count the Users in the collection.
+ *
+ * @param directory_p The UsersDirectory.
+ * @param tracking_flag <code>true</code> if deletions are being tracked,
+ * <code>false</code> otherwise.
+ */
+USERS_SERVICE_LOCAL void SetUsersDirectoryDeletionTracking (UsersDirectory *directory_p, const bool tracking_flag);
+
+
+/**
+ * Mark a User as deleted so that it is removed from a UsersDirectory
+ * when it is next synced. Deletions can't be found from the timestamps
+ * of the remaining Users so they must be reported this way.
+ *
+ * @param directory_p The UsersDirectory to update.
+ * @param id_p The id of the deleted User.
+ * @return <code>true</code> if the tombstone was added, <code>false</code>
+ * upon error in which case the directory will be fully reloaded instead.
+ */
+USERS_SERVICE_LOCAL bool RemoveUserFromUsersDirectory (UsersDirectory *directory_p, const bson_oid_t *id_p);
+
+
+/**
+ * Get the current snapshot of a UsersDirectory, updating it
+ * from the database first if it is missing, stale or has expired.
+ * If there is already a snapshot, only the Users whose MONGO_TIMESTAMP_S
+ * has changed since it was loaded are fetched and merged into it.
+ * If another request is already reloading it, the current snapshot
+ * is returned straight away. Only if there is no snapshot yet does
+ * this wait for that reload and use its result rather than querying
+ * the database again.
+ * Each successful call must be matched by a call to
+ * ReleaseUsersDirectorySnapshot().
+ *
+ * @param directory_p The UsersDirectory to get the snapshot from.
+ * @param pool_p The UsersMongoPool to get a MongoTool from if the
+ * snapshot needs reloading.
+ * @param collection_s The collection that the Users are stored in.
+ * @return The snapshot or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL const UsersDirectorySnapshot *AcquireUsersDirectorySnapshot (UsersDirectory *directory_p, UsersMongoPool *pool_p, const char *collection_s);
+
+
+/**
+ * Release a snapshot returned by AcquireUsersDirectorySnapshot().
+ *
+ * @param directory_p The UsersDirectory that the snapshot came from.
+ * @param snapshot_p The snapshot to release.
+ */
+USERS_SERVICE_LOCAL void ReleaseUsersDirectorySnapshot (UsersDirectory *directory_p, const UsersDirectorySnapshot *snapshot_p);
+
+
+/**
+ * Find the Users in a snapshot whose surname, forename or email
+ * address starts with a given prefix, ignoring case and accents.
+ *
+ * @param snapshot_p The snapshot to search.
+ * @param prefix_s The prefix to search for.
+ * @param matches_pp An array of at least max_num_matches elements that
+ * the matching entries will be stored in. They are stored in the same
+ * order as they appear in the snapshot.
+ * @param max_num_matches The maximum number of matches to find.
+ * @return The number of matching entries.
+ */
+USERS_SERVICE_LOCAL size_t SearchUsersDirectorySnapshot (const UsersDirectorySnapshot *snapshot_p, const char *prefix_s, const UsersDirectoryEntry **matches_pp, const size_t max_num_matches);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_USERS_SERVICE_INCLUDE_USERS_DIRECTORY_H_ */
@@ -0,0 +1,51 @@
+/*
+ * users_import.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SERVICES_USERS_SERVICE_INCLUDE_USERS_IMPORT_H_
+#define SERVICES_USERS_SERVICE_INCLUDE_USERS_IMPORT_H_
+
+#include "users_service_data.h"
+#include "service_job.h"
+
+
+/** The default number of Users to write to the database in each batch. */
+#define UI_DEFAULT_BATCH_SIZE (500)
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Import a table of Users, updating any existing Users with the
+ * same email addresses. Email addresses are stored in lower case
+ * so that they match regardless of case.
+ *
+ * Every row is checked before anything is written, then the valid rows
+ * are written in unordered batches. The outcome of each row is added
+ * to the ServiceJob's results.
+ *
+ * @param data_p The UsersServiceData for the service.
+ * @param rows_p The array of rows, each of which is an object keyed
+ * by the column headings.
+ * @param job_p The ServiceJob to add the results and any errors to.
+ * @param param_name_s The name of the Parameter that the table came from,
+ * used when reporting errors.
+ * @return OS_SUCCEEDED if every row was imported, OS_PARTIALLY_SUCCEEDED
+ * if only some of them were or OS_FAILED if none of them were.
+ */
+USERS_SERVICE_LOCAL OperationStatus ImportUsers (UsersServiceData *data_p, const json_t *rows_p, ServiceJob *job_p, const char *param_name_s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_USERS_SERVICE_INCLUDE_USERS_IMPORT_H_ */
@@ -0,0 +1,147 @@
+/*
+ * users_mongo_pool.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SERVICES_USERS_SERVICE_INCLUDE_USERS_MONGO_POOL_H_
+#define SERVICES_USERS_SERVICE_INCLUDE_USERS_MONGO_POOL_H_
+
+#include <pthread.h>
+
+#include "mongodb_tool.h"
+
+#include "users_service_library.h"
+
+
+/** The default number of MongoTools in a UsersMongoPool. */
+#define UMP_DEFAULT_SIZE (8)
+
+
+/**
+ * A fixed size pool of MongoTools so that concurrent requests
+ * can each have their own MongoTool rather than changing the
+ * collection of a shared one.
+ */
+typedef struct UsersMongoPool
+{
+	/**
+	 * @private
+	 *
+	 * All of the MongoTools in the pool.
+	 */
+	MongoTool **ump_tools_pp;
+
+	/**
+	 * @private
+	 *
+	 * The MongoTools that are not checked out.
+	 */
+	MongoTool **ump_free_tools_pp;
+
+	/**
+	 * @private
+	 *
+	 * The number of MongoTools in the pool.
+	 */
+	uint32 ump_size;
+
+	/**
+	 * @private
+	 *
+	 * The number of MongoTools that are not checked out.
+	 */
+	uint32 ump_num_free;
+
+	/**
+	 * @private
+	 *
+	 * The number of times that a MongoTool has been checked out.
+	 */
+	uint64 ump_num_checkouts;
+
+	/**
+	 * @private
+	 *
+	 * The number of checkouts that had to wait for a MongoTool
+	 * to be returned.
+	 */
+	uint64 ump_num_waits;
+
+	/**
+	 * @private
+	 *
+	 * The largest number of MongoTools that have been checked
+	 * out at the same time.
+	 */
+	uint32 ump_max_in_use;
+
+	/**
+	 * @private
+	 *
+	 * The lock for accessing the pool.
+	 */
+	pthread_mutex_t ump_lock;
+
+	/**
+	 * @private
+	 *
+	 * Signalled when a MongoTool is returned to the pool.
+	 */
+	pthread_cond_t ump_returned;
+
+} UsersMongoPool;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a UsersMongoPool.
+ *
+ * @param size The number of MongoTools in the pool.
+ * @param manager_p The MongoClientManager to get the connections from.
+ * @param database_s The database for each MongoTool to use.
+ * @return The new UsersMongoPool or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL UsersMongoPool *AllocateUsersMongoPool (const uint32 size, MongoClientManager *manager_p, const char *database_s);
+
+
+/**
+ * Free a UsersMongoPool and all of its MongoTools. None of the
+ * MongoTools can be checked out when this is called.
+ *
+ * @param pool_p The UsersMongoPool to free.
+ */
+USERS_SERVICE_LOCAL void FreeUsersMongoPool (UsersMongoPool *pool_p);
+
+
+/**
+ * Check out a MongoTool from a UsersMongoPool, waiting for one to be
+ * returned if they are all in use.
+ *
+ * @param pool_p The UsersMongoPool to use.
+ * @return The MongoTool which must be returned with CheckInMongoTool().
+ */
+USERS_SERVICE_LOCAL MongoTool *CheckOutMongoTool (UsersMongoPool *pool_p);
+
+
+/**
+ * Return a MongoTool to the UsersMongoPool that it was checked out from.
+ *
+ * @param pool_p The UsersMongoPool to use.
+ * @param tool_p The MongoTool to return.
+ */
+USERS_SERVICE_LOCAL void CheckInMongoTool (UsersMongoPool *pool_p, MongoTool *tool_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_USERS_SERVICE_INCLUDE_USERS_MONGO_POOL_H_ */
@@ -0,0 +1,119 @@
+/*
+ * users_parameters_template.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SERVICES_USERS_SERVICE_INCLUDE_USERS_PARAMETERS_TEMPLATE_H_
+#define SERVICES_USERS_SERVICE_INCLUDE_USERS_PARAMETERS_TEMPLATE_H_
+
+#include <pthread.h>
+
+#include "jansson.h"
+
+#include "typedefs.h"
+
+#include "users_service_library.h"
+
+
+/**
+ * The serialised ParameterSet for the Users submission service with no
+ * active User, built once for each revision of the UsersDirectory that
+ * its list of Users came from. Each request makes its ParameterSet from
+ * this and then only fills in the active User's values.
+ *
+ * Any number of requests can use the template at the same time.
+ */
+typedef struct UsersParametersTemplate
+{
+	/**
+	 * @private
+	 *
+	 * The ParameterSet as JSON, this is <code>NULL</code> until it
+	 * has been built for the first time.
+	 */
+	json_t *upt_template_p;
+
+	/**
+	 * @private
+	 *
+	 * The revision of the UsersDirectory that upt_template_p was
+	 * built from.
+	 */
+	uint32 upt_revision;
+
+	/**
+	 * @private
+	 *
+	 * The lock guarding access to all of the above, including the
+	 * reference count of upt_template_p.
+	 */
+	pthread_mutex_t upt_lock;
+
+} UsersParametersTemplate;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate an empty UsersParametersTemplate.
+ *
+ * @return The new UsersParametersTemplate or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL UsersParametersTemplate *AllocateUsersParametersTemplate (void);
+
+
+/**
+ * Free a UsersParametersTemplate.
+ *
+ * @param template_p The UsersParametersTemplate to free.
+ */
+USERS_SERVICE_LOCAL void FreeUsersParametersTemplate (UsersParametersTemplate *template_p);
+
+
+/**
+ * Get the template if it was built from the given revision of
+ * the UsersDirectory.
+ *
+ * @param template_p The UsersParametersTemplate to use.
+ * @param revision The current revision of the UsersDirectory.
+ * @return A reference to the template, which must be given back with
+ * ReleaseUsersParametersTemplate(), or <code>NULL</code> if the template
+ * needs building for this revision.
+ */
+USERS_SERVICE_LOCAL json_t *AcquireUsersParametersTemplate (UsersParametersTemplate *template_p, const uint32 revision);
+
+
+/**
+ * Give back a reference returned by AcquireUsersParametersTemplate().
+ *
+ * @param template_p The UsersParametersTemplate that the reference came from.
+ * @param template_json_p The reference to give back.
+ */
+USERS_SERVICE_LOCAL void ReleaseUsersParametersTemplate (UsersParametersTemplate *template_p, json_t *template_json_p);
+
+
+/**
+ * Store a newly built template. If requests built templates for
+ * different revisions at the same time, the newest one is kept.
+ *
+ * @param template_p The UsersParametersTemplate to update.
+ * @param revision The revision of the UsersDirectory that the
+ * template was built from.
+ * @param template_json_p The template. The UsersParametersTemplate
+ * takes its own reference to this.
+ */
+USERS_SERVICE_LOCAL void SetUsersParametersTemplate (UsersParametersTemplate *template_p, const uint32 revision, json_t *template_json_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_USERS_SERVICE_INCLUDE_USERS_PARAMETERS_TEMPLATE_H_ */
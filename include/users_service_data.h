@@ -8,9 +8,19 @@
 #ifndef SERVICES_USERS_SERVICE_INCLUDE_USERS_SERVICE_DATA_H_
 #define SERVICES_USERS_SERVICE_INCLUDE_USERS_SERVICE_DATA_H_
 
+#include <time.h>
+
 #include "mongodb_tool.h"
 
 #include "users_service.h"
+#include "users_directory.h"
+#include "users_cache.h"
+#include "users_mongo_pool.h"
+#include "users_worker_pool.h"
+#include "users_timings.h"
+#include "users_watcher.h"
+#include "users_write_behind.h"
+#include "users_parameters_template.h"
 
 /**
  * The configuration data used by the Users Service.
@@ -26,9 +36,11 @@ typedef struct /*USERS_SERVICE_LOCAL*/ UsersServiceData
 	/**
 	 * @private
 	 *
-	 * The MongoTool to connect to the database where our data is stored.
+	 * The MongoTools to connect to the database where our data is stored.
+	 * Each request checks one out so that concurrent requests don't
+	 * change each other's collections.
 	 */
-	MongoTool *usd_mongo_p;
+	UsersMongoPool *usd_mongo_pool_p;
 
 
 	/**
@@ -53,8 +65,171 @@ typedef struct /*USERS_SERVICE_LOCAL*/ UsersServiceData
 	 */
 	const char *usd_groups_collection_s;
 
+	/**
+	 * @private
+	 *
+	 * The cache of Users used to populate the list of
+	 * existing Users.
+	 */
+	UsersDirectory *usd_directory_p;
+
+	/**
+	 * @private
+	 *
+	 * If this is greater than 0, then rather than listing every
+	 * User, only this many Users matching a search string are
+	 * listed.
+	 */
+	uint32 usd_search_limit;
+
+	/**
+	 * @private
+	 *
+	 * The cache of recently used Users, used to get the
+	 * User being edited without going to the database
+	 * each time that the form is refreshed.
+	 */
+	UsersCache *usd_users_cache_p;
+
+	/**
+	 * @private
+	 *
+	 * The number of Users to write to the database in each
+	 * batch when importing a table of Users.
+	 */
+	uint32 usd_import_batch_size;
+
+	/**
+	 * @private
+	 *
+	 * If this is set, the service's ParameterSet is made from this
+	 * rather than being built from scratch for every request.
+	 */
+	UsersParametersTemplate *usd_parameters_template_p;
+
+	/**
+	 * @private
+	 *
+	 * If this is set, jobs are run in the background by these
+	 * workers and the service runs asynchronously.
+	 */
+	UsersWorkerPool *usd_workers_p;
+
+	/**
+	 * @private
+	 *
+	 * If this is set, the progress of background jobs is stored
+	 * in the GrassrootsServer's JobsManager for clients to poll.
+	 * It is cleared before the workers are stopped so that nothing
+	 * is published while the shared data is being freed.
+	 */
+	bool usd_publish_jobs_flag;
+
+	/**
+	 * @private
+	 *
+	 * If this is set, the time taken by each phase of the
+	 * service is recorded.
+	 */
+	UsersTimings *usd_timings_p;
+
+	/**
+	 * @private
+	 *
+	 * If this is set, it keeps the directory and cache up to
+	 * date with changes made outside of this service.
+	 */
+	UsersChangeWatcher *usd_watcher_p;
+
+	/**
+	 * @private
+	 *
+	 * If this is set, new Users are queued and written to the
+	 * database in batches rather than one at a time.
+	 */
+	UsersWriteBehind *usd_write_behind_p;
+
+	/**
+	 * @private
+	 *
+	 * If this is set, submitted populations are stored with one
+	 * array of accessions and an array of calls for each marker
+	 * rather than a document per marker keyed by accession.
+	 */
+	bool usd_columnar_populations_flag;
+
+	/**
+	 * @private
+	 *
+	 * If this is set, submitted populations are stored with each
+	 * marker's calls packed into 2-bit codes. This takes precedence
+	 * over usd_columnar_populations_flag.
+	 */
+	bool usd_packed_populations_flag;
+
+	/**
+	 * @private
+	 *
+	 * The UsersServiceData that owns the resources shared by every
+	 * instance of the service in this process, such as the
+	 * UsersDirectory. This is <code>NULL</code> for that
+	 * UsersServiceData itself.
+	 */
+	struct UsersServiceData *usd_shared_p;
+
+	/**
+	 * @private
+	 *
+	 * The next of the shared UsersServiceData, one for each
+	 * database and users collection that the service has been
+	 * configured with.
+	 */
+	struct UsersServiceData *usd_next_shared_p;
+
+	/**
+	 * @private
+	 *
+	 * For the shared UsersServiceData, the number of Services and
+	 * background jobs that are using it. It is only freed once this
+	 * has dropped to 0.
+	 */
+	uint32 usd_ref_count;
+
+	/**
+	 * @private
+	 *
+	 * For the shared UsersServiceData, when usd_ref_count last
+	 * dropped to 0.
+	 */
+	time_t usd_idle_time;
+
+	/**
+	 * @private
+	 *
+	 * For the shared UsersServiceData, how long, in seconds, it is
+	 * kept once nothing is using it so that the next request can
+	 * reuse the directory, cache and connections rather than
+	 * loading them again.
+	 */
+	uint32 usd_idle_timeout;
+
+	/**
+	 * @private
+	 *
+	 * The GrassrootsServer that the service is running on. Unlike the
+	 * Service, this is still around when a background job finishes.
+	 */
+	GrassrootsServer *usd_grassroots_p;
+
 } UsersServiceData;
 
+/**
+ * The default number of seconds that the resources shared between
+ * instances of the service are kept once nothing is using them.
+ */
+#define USD_DEFAULT_IDLE_TIMEOUT (300)
+
+
 /** The prefix to use for Field Trial Service aliases. */
 #define US_GROUP_ALIAS_PREFIX_S "users_and_groups"
 
@@ -73,6 +248,20 @@ typedef struct /*USERS_SERVICE_LOCAL*/ UsersServiceData
 #endif 		/* #ifndef DOXYGEN_SHOULD_SKIP_THIS */
 
 
+/**
+ * The key for the case- and diacritic-folded name that Users
+ * are sorted by.
+ */
+USERS_PREFIX const char *US_SORT_KEY_S USERS_VAL ("sort_key");
+
+
+/**
+ * The key for the name to display for a User, as given by
+ * GetFullUsername ().
+ */
+USERS_PREFIX const char *US_DISPLAY_NAME_S USERS_VAL ("display_name");
+
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -86,6 +275,59 @@ USERS_SERVICE_LOCAL void FreeUsersServiceData (UsersServiceData *data_p);
 
 USERS_SERVICE_LOCAL bool ConfigureUsersService (UsersServiceData *data_p, GrassrootsServer *grassroots_p);
 
+
+/**
+ * Take a reference to the resources shared between instances of the
+ * service so that they are kept while a background job uses them.
+ *
+ * @param data_p The UsersServiceData for the service or the shared
+ * UsersServiceData itself.
+ * @see ReleaseSharedUsersServiceData
+ */
+USERS_SERVICE_LOCAL void AcquireSharedUsersServiceData (UsersServiceData *data_p);
+
+
+/**
+ * Give up a reference taken with AcquireSharedUsersServiceData().
+ * Shared resources that have been unused for longer than their
+ * idle timeout are only freed when this is called from a thread
+ * run by the Grassroots server, never from a worker or the
+ * write-behind thread, so that they are stopped while the
+ * GrassrootsServer and its JobsManager are still available.
+ *
+ * @param data_p The UsersServiceData for the service or the shared
+ * UsersServiceData itself.
+ * @param server_thread_flag <code>true</code> if this is being called
+ * from a thread run by the Grassroots server, <code>false</code> if
+ * it is from one of the service's own threads.
+ */
+USERS_SERVICE_LOCAL void ReleaseSharedUsersServiceData (UsersServiceData *data_p, const bool server_thread_flag);
+
+
+/**
+ * Set the status of a ServiceJob and store it so that clients
+ * polling an asynchronous job can see its progress.
+ *
+ * @param data_p The UsersServiceData for the service that the job belongs to.
+ * @param job_p The ServiceJob to update.
+ * @param status The new status.
+ */
+USERS_SERVICE_LOCAL void UpdateUsersServiceJob (UsersServiceData *data_p, ServiceJob *job_p, const OperationStatus status);
+
+
+/**
+ * Copy a ServiceJob for a background worker to update. The framework
+ * sends the original back to the client and frees it as soon as the
+ * service returns, so the worker must not touch it. The copy has the
+ * same id so its progress can be published with UpdateUsersServiceJob().
+ *
+ * @param data_p The UsersServiceData for the service that the job belongs to.
+ * @param job_p The ServiceJob to copy.
+ * @return The copied ServiceJob which should be freed with FreeServiceJob()
+ * or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL ServiceJob *CopyUsersServiceJob (UsersServiceData *data_p, ServiceJob *job_p);
+
 #ifdef __cplusplus
 }
 #endif
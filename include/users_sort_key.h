@@ -0,0 +1,89 @@
+/*
+ * users_sort_key.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SERVICES_USERS_SERVICE_INCLUDE_USERS_SORT_KEY_H_
+#define SERVICES_USERS_SERVICE_INCLUDE_USERS_SORT_KEY_H_
+
+#include "jansson.h"
+#include "mongodb_tool.h"
+#include "user.h"
+
+#include "users_service_library.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Fold a UTF-8 string in place so that it can be compared without
+ * worrying about case or accents. ASCII letters are lower-cased and
+ * Latin letters with diacritics are replaced by their base letters,
+ * e.g. "Ørsted" becomes "orsted". Only ASCII and the Latin-1
+ * Supplement and Latin Extended-A blocks (U+0000 to U+017F) are folded;
+ * any other characters are left as they are. The folded string is
+ * never longer than the original.
+ *
+ * @param value_s The string to fold.
+ */
+USERS_SERVICE_LOCAL void FoldUsersString (char *value_s);
+
+
+/**
+ * Get the key that a User is sorted by, made from their folded
+ * surname and then forename.
+ *
+ * @param surname_s The User's surname. This can be <code>NULL</code>.
+ * @param forename_s The User's forename. This can be <code>NULL</code>.
+ * @return The sort key which should be freed with FreeUsersSortKey()
+ * or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL char *GetUsersSortKey (const char *surname_s, const char *forename_s);
+
+
+/**
+ * Free a sort key returned by GetUsersSortKey().
+ *
+ * @param key_s The sort key to free.
+ */
+USERS_SERVICE_LOCAL void FreeUsersSortKey (char *key_s);
+
+
+/**
+ * Add a User's sort key and display name to its JSON so that they
+ * are stored alongside the User.
+ *
+ * @param user_json_p The JSON to add the values to.
+ * @param user_p The User to get the values for.
+ * @return <code>true</code> if the values were added successfully,
+ * <code>false</code> otherwise.
+ */
+USERS_SERVICE_LOCAL bool AddUsersSortFields (json_t *user_json_p, const User *user_p);
+
+
+/**
+ * Add the sort key and display name to any Users that were saved
+ * before they were stored. The Users' timestamps aren't changed
+ * since nothing that they hold has changed.
+ *
+ * @param tool_p The MongoTool to use.
+ * @param collection_s The collection that the Users are stored in.
+ * @param batch_size The number of Users to update at a time.
+ * @return <code>true</code> if all of the Users were updated successfully,
+ * <code>false</code> otherwise.
+ */
+USERS_SERVICE_LOCAL bool BackfillUsersSortFields (MongoTool *tool_p, const char *collection_s, const uint32 batch_size);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_USERS_SERVICE_INCLUDE_USERS_SORT_KEY_H_ */
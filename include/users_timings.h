@@ -0,0 +1,217 @@
+/*
+ * users_timings.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SERVICES_USERS_SERVICE_INCLUDE_USERS_TIMINGS_H_
+#define SERVICES_USERS_SERVICE_INCLUDE_USERS_TIMINGS_H_
+
+#include <pthread.h>
+#include <time.h>
+
+#include "typedefs.h"
+
+#include "users_service_library.h"
+
+
+/**
+ * The number of buckets in each histogram. Bucket 0 is for
+ * times under 1 microsecond and bucket n, for n > 0, is for
+ * times from 2^(n - 1) up to 2^n microseconds.
+ */
+#define UT_NUM_BUCKETS (32)
+
+
+/**
+ * The phases of the users service that are timed.
+ */
+typedef enum UsersTimingPhase
+{
+	/** Building the whole ParameterSet. */
+	UTP_PARAMETERS,
+
+	/** Getting the User being edited. */
+	UTP_ACTIVE_USER,
+
+	/** Building the list of Users. */
+	UTP_USERS_LIST,
+
+	/** Getting the users directory, including any reload. */
+	UTP_DIRECTORY,
+
+	/** Streaming the list of Users from the database. */
+	UTP_DATABASE_LIST,
+
+	/** Running a job in the request that submitted it. */
+	UTP_RUN,
+
+	/** Running a queued job on a worker thread. */
+	UTP_WORKER,
+
+	/** Saving a User. */
+	UTP_SAVE_USER,
+
+	/** Loading the stored version of a User before updating it. */
+	UTP_LOAD_STORED_USER,
+
+	/** Importing a table of Users. */
+	UTP_IMPORT,
+
+	/** The number of phases. */
+	UTP_NUM_PHASES
+} UsersTimingPhase;
+
+
+/**
+ * A histogram of the times taken by a phase.
+ */
+typedef struct UsersTimingHistogram
+{
+	/** The number of times in each bucket. */
+	uint64 uth_buckets [UT_NUM_BUCKETS];
+
+	/** The number of times recorded. */
+	uint64 uth_count;
+
+	/** The sum of all of the times in microseconds. */
+	uint64 uth_total_us;
+
+	/** The longest time in microseconds. */
+	uint64 uth_max_us;
+
+} UsersTimingHistogram;
+
+
+/**
+ * The histograms for each of the timed phases of a service.
+ */
+typedef struct UsersTimings
+{
+	/**
+	 * @private
+	 *
+	 * The histogram for each phase.
+	 */
+	UsersTimingHistogram ut_histograms [UTP_NUM_PHASES];
+
+	/**
+	 * @private
+	 *
+	 * The number of seconds between writing the histograms
+	 * to the log. If this is 0, they are only written when
+	 * DumpUsersTimings() is called, when ut_dump_trigger_s is
+	 * created and when the UsersTimings is freed.
+	 */
+	uint32 ut_dump_interval;
+
+	/**
+	 * @private
+	 *
+	 * When the histograms were last written to the log.
+	 */
+	time_t ut_last_dump_time;
+
+	/**
+	 * @private
+	 *
+	 * If this is set, the histograms are written to the log
+	 * as soon as a file with this path is found, which is
+	 * then deleted.
+	 */
+	char *ut_dump_trigger_s;
+
+	/**
+	 * @private
+	 *
+	 * When ut_dump_trigger_s was last looked for.
+	 */
+	time_t ut_last_trigger_check_time;
+
+	/**
+	 * @private
+	 *
+	 * The lock to stop the histograms being written
+	 * more than once at the same time.
+	 */
+	pthread_mutex_t ut_dump_lock;
+
+} UsersTimings;
+
+
+/**
+ * The start of a timed phase.
+ */
+typedef struct UsersTimingSpan
+{
+	/** When the phase started. */
+	struct timespec uts_start;
+
+} UsersTimingSpan;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a UsersTimings.
+ *
+ * @param dump_interval The number of seconds between writing the histograms
+ * to the log. If this is 0, they are only written when DumpUsersTimings() is
+ * called and when the UsersTimings is freed.
+ * @param dump_trigger_s If this is not <code>NULL</code>, the path of a file
+ * that makes the histograms be written to the log as soon as it is created.
+ * The file is checked for at most once a second and deleted once the
+ * histograms have been written.
+ * @return The new UsersTimings or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL UsersTimings *AllocateUsersTimings (const uint32 dump_interval, const char *dump_trigger_s);
+
+
+/**
+ * Write the histograms to the log and free a UsersTimings.
+ *
+ * @param timings_p The UsersTimings to free.
+ */
+USERS_SERVICE_LOCAL void FreeUsersTimings (UsersTimings *timings_p);
+
+
+/**
+ * Start timing a phase.
+ *
+ * @param timings_p The UsersTimings to use. If this is <code>NULL</code>,
+ * timing is disabled and nothing is done.
+ * @param span_p The UsersTimingSpan to start.
+ */
+USERS_SERVICE_LOCAL void StartUsersTimingSpan (const UsersTimings *timings_p, UsersTimingSpan *span_p);
+
+
+/**
+ * Stop timing a phase and add the time taken to its histogram.
+ *
+ * @param timings_p The UsersTimings to use. If this is <code>NULL</code>,
+ * timing is disabled and nothing is done.
+ * @param span_p The UsersTimingSpan started by StartUsersTimingSpan().
+ * @param phase The phase that was timed.
+ */
+USERS_SERVICE_LOCAL void EndUsersTimingSpan (UsersTimings *timings_p, const UsersTimingSpan *span_p, const UsersTimingPhase phase);
+
+
+/**
+ * Write the histograms to the log.
+ *
+ * @param timings_p The UsersTimings to write.
+ */
+USERS_SERVICE_LOCAL void DumpUsersTimings (UsersTimings *timings_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_USERS_SERVICE_INCLUDE_USERS_TIMINGS_H_ */
@@ -0,0 +1,153 @@
+/*
+ * users_watcher.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SERVICES_USERS_SERVICE_INCLUDE_USERS_WATCHER_H_
+#define SERVICES_USERS_SERVICE_INCLUDE_USERS_WATCHER_H_
+
+#include <pthread.h>
+
+#include "mongodb_tool.h"
+
+#include "users_service_library.h"
+#include "users_cache.h"
+#include "users_directory.h"
+#include "users_mongo_pool.h"
+
+
+/**
+ * The default number of seconds between syncing the UsersDirectory
+ * when change streams aren't available.
+ */
+#define UCW_DEFAULT_POLL_INTERVAL (30)
+
+
+/**
+ * A thread that keeps a UsersDirectory and UsersCache up to date
+ * with changes made to the users collection by anything, not just
+ * this service.
+ *
+ * If the database supports change streams, each change is applied as
+ * it happens. Otherwise, e.g. on a standalone mongod or while a replica
+ * set has no primary, the UsersDirectory is synced at a fixed interval
+ * and starting a change stream is retried with an increasing delay.
+ */
+typedef struct UsersChangeWatcher
+{
+	/**
+	 * @private
+	 *
+	 * The watching thread.
+	 */
+	pthread_t ucw_thread;
+
+	/**
+	 * @private
+	 *
+	 * The MongoTool used for the change stream. This is separate from
+	 * the UsersMongoPool so that the watcher never holds on to one of
+	 * the tools that requests need.
+	 */
+	MongoTool *ucw_tool_p;
+
+	/**
+	 * @private
+	 *
+	 * The UsersDirectory to update. This can be <code>NULL</code>.
+	 */
+	UsersDirectory *ucw_directory_p;
+
+	/**
+	 * @private
+	 *
+	 * The UsersCache to update. This can be <code>NULL</code>.
+	 */
+	UsersCache *ucw_cache_p;
+
+	/**
+	 * @private
+	 *
+	 * The UsersMongoPool used to sync the UsersDirectory.
+	 */
+	UsersMongoPool *ucw_pool_p;
+
+	/**
+	 * @private
+	 *
+	 * The collection that the Users are stored in.
+	 */
+	const char *ucw_collection_s;
+
+	/**
+	 * @private
+	 *
+	 * The number of seconds between syncs when change streams
+	 * aren't available, or between attempts to restart a change
+	 * stream that has failed.
+	 */
+	uint32 ucw_poll_interval;
+
+	/**
+	 * @private
+	 *
+	 * Has the thread been told to stop?
+	 */
+	bool ucw_stopping_flag;
+
+	/**
+	 * @private
+	 *
+	 * The lock guarding ucw_stopping_flag.
+	 */
+	pthread_mutex_t ucw_lock;
+
+	/**
+	 * @private
+	 *
+	 * Signalled when the thread should stop.
+	 */
+	pthread_cond_t ucw_stop;
+
+} UsersChangeWatcher;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Start watching a users collection for changes.
+ *
+ * @param directory_p The UsersDirectory to keep up to date. This can be <code>NULL</code>.
+ * @param cache_p The UsersCache to keep up to date. This can be <code>NULL</code>.
+ * @param pool_p The UsersMongoPool to use when syncing the UsersDirectory.
+ * @param manager_p The MongoClientManager to get the change stream's connection from.
+ * @param database_s The database that the Users are stored in.
+ * @param collection_s The collection that the Users are stored in.
+ * @param poll_interval The number of seconds between syncs if change streams
+ * aren't available.
+ * @return The new UsersChangeWatcher or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL UsersChangeWatcher *StartUsersChangeWatcher (UsersDirectory *directory_p, UsersCache *cache_p, UsersMongoPool *pool_p, MongoClientManager *manager_p,
+	const char *database_s, const char *collection_s, const uint32 poll_interval);
+
+
+/**
+ * Stop a UsersChangeWatcher and free it.
+ *
+ * @param watcher_p The UsersChangeWatcher to stop.
+ */
+USERS_SERVICE_LOCAL void StopUsersChangeWatcher (UsersChangeWatcher *watcher_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_USERS_SERVICE_INCLUDE_USERS_WATCHER_H_ */
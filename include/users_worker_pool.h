@@ -0,0 +1,158 @@
+/*
+ * users_worker_pool.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SERVICES_USERS_SERVICE_INCLUDE_USERS_WORKER_POOL_H_
+#define SERVICES_USERS_SERVICE_INCLUDE_USERS_WORKER_POOL_H_
+
+#include <pthread.h>
+
+#include "typedefs.h"
+
+#include "users_service_library.h"
+
+
+/** The default maximum number of tasks waiting for a worker. */
+#define UWP_DEFAULT_QUEUE_SIZE (64)
+
+
+/**
+ * A piece of work to run on a UsersWorkerPool.
+ */
+typedef struct UsersTask
+{
+	/** The function to run with ut_data_p. */
+	void (*ut_run_fn) (void *data_p);
+
+	/** The function to free ut_data_p after the task has run. */
+	void (*ut_free_fn) (void *data_p);
+
+	/** The data for the task. */
+	void *ut_data_p;
+
+	/** The next task in the queue. */
+	struct UsersTask *ut_next_p;
+
+} UsersTask;
+
+
+/**
+ * A fixed number of threads running tasks from a bounded queue.
+ */
+typedef struct UsersWorkerPool
+{
+	/**
+	 * @private
+	 *
+	 * The worker threads.
+	 */
+	pthread_t *uwp_threads_p;
+
+	/**
+	 * @private
+	 *
+	 * The number of worker threads.
+	 */
+	uint32 uwp_num_threads;
+
+	/**
+	 * @private
+	 *
+	 * The next task to run.
+	 */
+	UsersTask *uwp_head_p;
+
+	/**
+	 * @private
+	 *
+	 * The last task to run.
+	 */
+	UsersTask *uwp_tail_p;
+
+	/**
+	 * @private
+	 *
+	 * The number of tasks waiting for a worker.
+	 */
+	uint32 uwp_num_queued;
+
+	/**
+	 * @private
+	 *
+	 * The maximum number of tasks that can wait for a worker.
+	 */
+	uint32 uwp_max_queued;
+
+	/**
+	 * @private
+	 *
+	 * Have the workers been told to stop?
+	 */
+	bool uwp_stopping_flag;
+
+	/**
+	 * @private
+	 *
+	 * The lock for accessing the queue.
+	 */
+	pthread_mutex_t uwp_lock;
+
+	/**
+	 * @private
+	 *
+	 * Signalled when a task is added or the workers should stop.
+	 */
+	pthread_cond_t uwp_task_added;
+
+} UsersWorkerPool;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a UsersWorkerPool and start its threads.
+ *
+ * @param num_threads The number of worker threads.
+ * @param max_queued The maximum number of tasks that can wait for a worker.
+ * @return The new UsersWorkerPool or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL UsersWorkerPool *AllocateUsersWorkerPool (const uint32 num_threads, const uint32 max_queued);
+
+
+/**
+ * Stop a UsersWorkerPool and free it. Any tasks that are already
+ * queued are run before the workers stop.
+ *
+ * @param pool_p The UsersWorkerPool to free.
+ */
+USERS_SERVICE_LOCAL void FreeUsersWorkerPool (UsersWorkerPool *pool_p);
+
+
+/**
+ * Add a task to a UsersWorkerPool.
+ *
+ * @param pool_p The UsersWorkerPool to add the task to.
+ * @param run_fn The function to run.
+ * @param free_fn The function to free data_p after run_fn has been called.
+ * This can be <code>NULL</code>.
+ * @param data_p The data to pass to run_fn and free_fn.
+ * @return <code>true</code> if the task was queued, <code>false</code> if the
+ * queue was full or there was an error. If this is <code>false</code>, data_p
+ * still belongs to the caller.
+ */
+USERS_SERVICE_LOCAL bool SubmitUsersTask (UsersWorkerPool *pool_p, void (*run_fn) (void *data_p), void (*free_fn) (void *data_p), void *data_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_USERS_SERVICE_INCLUDE_USERS_WORKER_POOL_H_ */
@@ -0,0 +1,244 @@
+/*
+ * users_write_behind.h
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#ifndef SERVICES_USERS_SERVICE_INCLUDE_USERS_WRITE_BEHIND_H_
+#define SERVICES_USERS_SERVICE_INCLUDE_USERS_WRITE_BEHIND_H_
+
+#include <pthread.h>
+#include <time.h>
+
+#include "jansson.h"
+#include "mongodb_tool.h"
+#include "service_job.h"
+
+#include "users_service_library.h"
+#include "users_cache.h"
+#include "users_directory.h"
+#include "users_mongo_pool.h"
+
+
+/** The default maximum number of Users written in one bulk write. */
+#define UWB_DEFAULT_BATCH_SIZE (64)
+
+/**
+ * The default maximum number of milliseconds that a User waits
+ * in the queue before being written.
+ */
+#define UWB_DEFAULT_FLUSH_INTERVAL_MS (50)
+
+
+/**
+ * A User waiting to be written to the database.
+ */
+typedef struct UsersPendingWrite
+{
+	/** The id of the User. */
+	bson_oid_t upw_id;
+
+	/** The update to upsert for the User. */
+	bson_t *upw_update_p;
+
+	/** The ServiceJob to update once the User has been written. */
+	ServiceJob *upw_job_p;
+
+	/** The status of the write. */
+	OperationStatus upw_status;
+
+	/** When the User was queued. */
+	struct timespec upw_queued;
+
+	/** The next User in the queue. */
+	struct UsersPendingWrite *upw_next_p;
+
+} UsersPendingWrite;
+
+
+/**
+ * A queue of Users that are written to the database in bulk by
+ * a background thread. The queue is written whenever it holds a
+ * full batch or its oldest User has waited for the flush interval,
+ * whichever comes first.
+ */
+typedef struct UsersWriteBehind
+{
+	/**
+	 * @private
+	 *
+	 * The thread writing the queued Users.
+	 */
+	pthread_t uwb_thread;
+
+	/**
+	 * @private
+	 *
+	 * The UsersMongoPool to get a MongoTool from for each batch.
+	 */
+	UsersMongoPool *uwb_pool_p;
+
+	/**
+	 * @private
+	 *
+	 * The collection that the Users are written to.
+	 */
+	const char *uwb_collection_s;
+
+	/**
+	 * @private
+	 *
+	 * The UsersDirectory to invalidate after writing Users.
+	 * This can be <code>NULL</code>.
+	 */
+	UsersDirectory *uwb_directory_p;
+
+	/**
+	 * @private
+	 *
+	 * The UsersCache to remove written Users from.
+	 * This can be <code>NULL</code>.
+	 */
+	UsersCache *uwb_cache_p;
+
+	/**
+	 * @private
+	 *
+	 * The function called with each ServiceJob and its final status
+	 * once its User has been written.
+	 */
+	void (*uwb_done_fn) (void *data_p, ServiceJob *job_p, const OperationStatus status);
+
+	/**
+	 * @private
+	 *
+	 * The data passed to uwb_done_fn.
+	 */
+	void *uwb_done_data_p;
+
+	/**
+	 * @private
+	 *
+	 * The maximum number of Users in a single bulk write.
+	 */
+	uint32 uwb_batch_size;
+
+	/**
+	 * @private
+	 *
+	 * The maximum number of milliseconds that a User waits
+	 * before being written.
+	 */
+	uint32 uwb_flush_interval_ms;
+
+	/**
+	 * @private
+	 *
+	 * The next User to write.
+	 */
+	UsersPendingWrite *uwb_head_p;
+
+	/**
+	 * @private
+	 *
+	 * The last User to write.
+	 */
+	UsersPendingWrite *uwb_tail_p;
+
+	/**
+	 * @private
+	 *
+	 * The number of Users waiting to be written.
+	 */
+	uint32 uwb_num_pending;
+
+	/**
+	 * @private
+	 *
+	 * The maximum number of Users that can wait to be written.
+	 */
+	uint32 uwb_max_pending;
+
+	/**
+	 * @private
+	 *
+	 * Has the thread been told to stop?
+	 */
+	bool uwb_stopping_flag;
+
+	/**
+	 * @private
+	 *
+	 * The lock for accessing the queue.
+	 */
+	pthread_mutex_t uwb_lock;
+
+	/**
+	 * @private
+	 *
+	 * Signalled when a User is queued or the thread should stop.
+	 */
+	pthread_cond_t uwb_write_added;
+
+} UsersWriteBehind;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Start a UsersWriteBehind queue.
+ *
+ * @param pool_p The UsersMongoPool to use for the writes.
+ * @param collection_s The collection to write the Users to.
+ * @param directory_p The UsersDirectory to invalidate after writing Users.
+ * This can be <code>NULL</code>.
+ * @param cache_p The UsersCache to remove written Users from.
+ * This can be <code>NULL</code>.
+ * @param batch_size The maximum number of Users in a single bulk write.
+ * @param flush_interval_ms The maximum number of milliseconds that a User
+ * waits before being written.
+ * @param done_fn The function to call with each ServiceJob and its final
+ * status once its User has been written. This is called on the writing thread.
+ * @param done_data_p The data to pass to done_fn.
+ * @return The new UsersWriteBehind or <code>NULL</code> upon error.
+ */
+USERS_SERVICE_LOCAL UsersWriteBehind *StartUsersWriteBehind (UsersMongoPool *pool_p, const char *collection_s, UsersDirectory *directory_p, UsersCache *cache_p,
+	const uint32 batch_size, const uint32 flush_interval_ms, void (*done_fn) (void *data_p, ServiceJob *job_p, const OperationStatus status), void *done_data_p);
+
+
+/**
+ * Stop a UsersWriteBehind and free it. Any Users that are still
+ * queued are written before the thread stops.
+ *
+ * @param write_behind_p The UsersWriteBehind to stop.
+ */
+USERS_SERVICE_LOCAL void StopUsersWriteBehind (UsersWriteBehind *write_behind_p);
+
+
+/**
+ * Queue a User to be written. The User's document is $set and its
+ * timestamp updated, inserting it if it doesn't already exist.
+ *
+ * @param write_behind_p The UsersWriteBehind to add the User to.
+ * @param id_p The id of the User.
+ * @param user_json_p The User's document.
+ * @param job_p The ServiceJob whose status is set once the User has been
+ * written. Nothing else should change this ServiceJob's status afterwards.
+ * @return <code>true</code> if the User was queued, <code>false</code> if the
+ * queue was full or there was an error, in which case the caller should
+ * write the User itself.
+ */
+USERS_SERVICE_LOCAL bool QueueUsersWrite (UsersWriteBehind *write_behind_p, const bson_oid_t *id_p, const json_t *user_json_p, ServiceJob *job_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SERVICES_USERS_SERVICE_INCLUDE_USERS_WRITE_BEHIND_H_ */
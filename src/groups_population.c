@@ -0,0 +1,1492 @@
+/*
+ * groups_population.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "groups_population.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "mongodb_util.h"
+
+
+/*
+ * Static declarations
+ */
+
+/**
+ * The space kept free in each chunk for its _id, GP_POPULATION_ID_S,
+ * GP_CHUNK_S, GP_NUM_CHUNKS_S, GP_FIRST_MARKER_S and GP_END_MARKER_S
+ * values. These need about 100 bytes so this leaves plenty to spare.
+ */
+static const size_t S_CHUNK_METADATA_SIZE = 1024;
+
+/** The name of the index used to find a population's chunks. */
+static const char * const S_CHUNKS_INDEX_S = "population_chunks";
+
+
+/*
+ * The PL_PACKED codes in each possible byte, lowest bits first,
+ * so that a byte is unpacked with a single lookup and copy.
+ */
+#define S_UNPACK(b) { (b) & 3, ((b) >> 2) & 3, ((b) >> 4) & 3, ((b) >> 6) & 3 }
+#define S_UNPACK_4(b) S_UNPACK (b), S_UNPACK ((b) + 1), S_UNPACK ((b) + 2), S_UNPACK ((b) + 3)
+#define S_UNPACK_16(b) S_UNPACK_4 (b), S_UNPACK_4 ((b) + 4), S_UNPACK_4 ((b) + 8), S_UNPACK_4 ((b) + 12)
+#define S_UNPACK_64(b) S_UNPACK_16 (b), S_UNPACK_16 ((b) + 16), S_UNPACK_16 ((b) + 32), S_UNPACK_16 ((b) + 48)
+
+static const uint8 S_UNPACKED_CODES [256][GP_CALLS_PER_BYTE] =
+{
+	S_UNPACK_64 (0), S_UNPACK_64 (64), S_UNPACK_64 (128), S_UNPACK_64 (192)
+};
+
+#undef S_UNPACK_64
+#undef S_UNPACK_16
+#undef S_UNPACK_4
+#undef S_UNPACK
+
+
+static int CompareMarkerNames (const void *v0_p, const void *v1_p);
+
+static int CompareMarkerName (const void *key_p, const void *marker_pp);
+
+static size_t GetMarkerSize (const PopulationMarker *marker_p);
+
+static bool SaveWholePopulation (MongoTool *tool_p, const char *collection_s, PopulationBuilder *builder_p, const size_t size);
+
+static bool SaveSplitPopulation (MongoTool *tool_p, const char *collection_s, PopulationBuilder *builder_p);
+
+static uint32 GetPopulationChunkEnds (const PopulationBuilder *builder_p, uint32 *chunk_ends_p);
+
+static bool InsertPopulationChunks (MongoTool *tool_p, PopulationBuilder *builder_p, const uint32 *chunk_ends_p, const uint32 num_chunks);
+
+static size_t GetPopulationChunkSize (const PopulationBuilder *builder_p, const uint32 first_marker, const uint32 end_marker);
+
+static bool AppendPopulationMarkerRange (bson_t *doc_p, PopulationBuilder *builder_p, const uint32 first_marker, const uint32 end_marker);
+
+static bool AddPopulationColumns (PopulationBuilder *builder_p);
+
+static bool AppendPopulationCall (bson_t *calls_p, const uint32 index, const char *value_s);
+
+static bool SetColumnPopulationCall (const PopulationBuilder *builder_p, PopulationMarker *marker_p, const uint32 index, const char *value_s);
+
+static const char *GetMissingPopulationCall (const PopulationBuilder *builder_p);
+
+static bool SetPackedPopulationCall (PopulationBuilder *builder_p, PopulationMarker *marker_p, const uint32 index, const char *value_s);
+
+static bool UnpackPopulationCalls (PopulationBuilder *builder_p, const char *value_s);
+
+static bool GetPackedCallCode (PopulationBuilder *builder_p, const char *value_s, uint8 *code_p);
+
+static bool ReservePackedCalls (PopulationMarker *marker_p, const uint32 num_calls);
+
+static bool FindPopulationMarker (const bson_t *population_p, const char *marker_key_s, bson_iter_t *marker_iter_p);
+
+static void RemovePopulationChunks (MongoTool *tool_p, const bson_oid_t *id_p);
+
+static bool EnsurePopulationChunksIndex (MongoTool *tool_p, const char *collection_s);
+
+static bool AppendPopulationMarkers (bson_t *population_p, const bson_t *chunk_p);
+
+
+/*
+ * API definitions
+ */
+
+PopulationBuilder *AllocatePopulationBuilder (const bson_oid_t *id_p, const uint32 max_markers, const PopulationLayout layout)
+{
+	PopulationBuilder *builder_p = (PopulationBuilder *) AllocMemory (sizeof (PopulationBuilder));
+
+	if (builder_p)
+		{
+			builder_p -> pb_header_p = bson_new ();
+
+			if (builder_p -> pb_header_p)
+				{
+					builder_p -> pb_markers_p = (PopulationMarker *) AllocMemoryArray (max_markers > 0 ? max_markers : 1, sizeof (PopulationMarker));
+
+					if (builder_p -> pb_markers_p)
+						{
+							builder_p -> pb_sorted_markers_pp = (PopulationMarker **) AllocMemoryArray (max_markers > 0 ? max_markers : 1, sizeof (PopulationMarker *));
+
+							if (builder_p -> pb_sorted_markers_pp)
+								{
+									builder_p -> pb_arena_p = AllocateUsersArena (0);
+
+									if (builder_p -> pb_arena_p)
+										{
+											builder_p -> pb_accessions_p = NULL;
+
+											if ((layout == PL_DOCUMENTS) || ((builder_p -> pb_accessions_p = bson_new ()) != NULL))
+												{
+													if ((builder_p -> pb_accession_names_p = json_object ()) != NULL)
+														{
+															bson_oid_copy (id_p, & (builder_p -> pb_id));
+															builder_p -> pb_layout = layout;
+															builder_p -> pb_unsorted_flag = false;
+															builder_p -> pb_num_markers = 0;
+															builder_p -> pb_max_markers = max_markers;
+															builder_p -> pb_accession_s = NULL;
+															builder_p -> pb_num_accessions = 0;
+
+															/* The missing call is always code 0 so unset codes are missing */
+															builder_p -> pb_alphabet_ss [0] = GP_MISSING_CALL_S;
+															builder_p -> pb_alphabet_size = 1;
+															builder_p -> pb_unpacked_flag = false;
+
+															return builder_p;
+														}
+
+													if (builder_p -> pb_accessions_p)
+														{
+															bson_destroy (builder_p -> pb_accessions_p);
+														}
+												}
+
+											FreeUsersArena (builder_p -> pb_arena_p);
+										}
+
+									FreeMemory (builder_p -> pb_sorted_markers_pp);
+								}
+
+							FreeMemory (builder_p -> pb_markers_p);
+						}
+
+					bson_destroy (builder_p -> pb_header_p);
+				}
+
+			FreeMemory (builder_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate PopulationBuilder for " UINT32_FMT " markers", max_markers);
+
+	return NULL;
+}
+
+
+void FreePopulationBuilder (PopulationBuilder *builder_p)
+{
+	uint32 i;
+
+	for (i = 0; i < builder_p -> pb_num_markers; ++ i)
+		{
+			PopulationMarker *marker_p = (builder_p -> pb_markers_p) + i;
+
+			if (marker_p -> pm_doc_p)
+				{
+					bson_destroy (marker_p -> pm_doc_p);
+				}
+
+			if (marker_p -> pm_calls_p)
+				{
+					bson_destroy (marker_p -> pm_calls_p);
+				}
+
+			if (marker_p -> pm_packed_calls_p)
+				{
+					FreeMemory (marker_p -> pm_packed_calls_p);
+				}
+		}
+
+	if (builder_p -> pb_accessions_p)
+		{
+			bson_destroy (builder_p -> pb_accessions_p);
+		}
+
+	json_decref (builder_p -> pb_accession_names_p);
+	FreeUsersArena (builder_p -> pb_arena_p);
+	FreeMemory (builder_p -> pb_sorted_markers_pp);
+	FreeMemory (builder_p -> pb_markers_p);
+	bson_destroy (builder_p -> pb_header_p);
+	FreeMemory (builder_p);
+}
+
+
+bool SetPopulationString (PopulationBuilder *builder_p, const char *key_s, const char *value_s)
+{
+	return BSON_APPEND_UTF8 (builder_p -> pb_header_p, key_s, value_s);
+}
+
+
+PopulationMarker *AddPopulationMarker (PopulationBuilder *builder_p, const char *name_s, const char *key_s)
+{
+	if (builder_p -> pb_num_markers < builder_p -> pb_max_markers)
+		{
+			PopulationMarker *marker_p = (builder_p -> pb_markers_p) + (builder_p -> pb_num_markers);
+
+			marker_p -> pm_name_s = CopyToUsersArena (builder_p -> pb_arena_p, name_s);
+
+			if (marker_p -> pm_name_s)
+				{
+					if (key_s && (strcmp (key_s, name_s) != 0))
+						{
+							marker_p -> pm_key_s = CopyToUsersArena (builder_p -> pb_arena_p, key_s);
+						}
+					else
+						{
+							marker_p -> pm_key_s = marker_p -> pm_name_s;
+						}
+
+					if (marker_p -> pm_key_s)
+						{
+							marker_p -> pm_calls_p = NULL;
+							marker_p -> pm_packed_calls_p = NULL;
+							marker_p -> pm_packed_calls_size = 0;
+							marker_p -> pm_num_calls = 0;
+
+							if ((marker_p -> pm_doc_p = bson_new ()) != NULL)
+								{
+									if ((builder_p -> pb_layout != PL_COLUMNS) || ((marker_p -> pm_calls_p = bson_new ()) != NULL))
+										{
+											builder_p -> pb_sorted_markers_pp [builder_p -> pb_num_markers] = marker_p;
+											++ (builder_p -> pb_num_markers);
+											builder_p -> pb_unsorted_flag = true;
+
+											return marker_p;
+										}
+
+									bson_destroy (marker_p -> pm_doc_p);
+									marker_p -> pm_doc_p = NULL;
+								}
+						}
+				}
+
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add marker \"%s\"", name_s);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "No space for marker \"%s\", there are already " UINT32_FMT, name_s, builder_p -> pb_max_markers);
+		}
+
+	return NULL;
+}
+
+
+PopulationMarker *GetPopulationMarker (PopulationBuilder *builder_p, const char *name_s)
+{
+	PopulationMarker **marker_pp = NULL;
+
+	/*
+	 * The markers are all added from the first row so this
+	 * only needs sorting once
+	 */
+	if (builder_p -> pb_unsorted_flag)
+		{
+			qsort (builder_p -> pb_sorted_markers_pp, builder_p -> pb_num_markers, sizeof (PopulationMarker *), CompareMarkerNames);
+			builder_p -> pb_unsorted_flag = false;
+		}
+
+	marker_pp = (PopulationMarker **) bsearch (name_s, builder_p -> pb_sorted_markers_pp, builder_p -> pb_num_markers, sizeof (PopulationMarker *), CompareMarkerName);
+
+	return marker_pp ? *marker_pp : NULL;
+}
+
+
+PopulationMarker *GetPopulationMarkerAt (PopulationBuilder *builder_p, const uint32 index, const char *name_s)
+{
+	if (index < builder_p -> pb_num_markers)
+		{
+			PopulationMarker *marker_p = (builder_p -> pb_markers_p) + index;
+
+			if (strcmp (marker_p -> pm_name_s, name_s) == 0)
+				{
+					return marker_p;
+				}
+		}
+
+	return GetPopulationMarker (builder_p, name_s);
+}
+
+
+bool DoesPopulationKeyNeedEscaping (const char *name_s)
+{
+	return (strchr (name_s, '.') != NULL);
+}
+
+
+bool SetPopulationMarkerString (PopulationMarker *marker_p, const char *key_s, const char *value_s)
+{
+	return BSON_APPEND_UTF8 (marker_p -> pm_doc_p, key_s, value_s);
+}
+
+
+bool AddPopulationAccession (PopulationBuilder *builder_p, const char *accession_s)
+{
+	bool success_flag = false;
+
+	/*
+	 * A repeated accession would give a PL_DOCUMENTS marker two values
+	 * with the same key, and the other layouts two different positions
+	 * for the same accession, so reject it rather than pick one
+	 */
+	if (json_object_get (builder_p -> pb_accession_names_p, accession_s))
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Accession \"%s\" is in more than one row", accession_s);
+			builder_p -> pb_accession_s = NULL;
+			return false;
+		}
+
+	if (json_object_set_new (builder_p -> pb_accession_names_p, accession_s, json_true ()) != 0)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to store accession \"%s\"", accession_s);
+		}
+	else if ((builder_p -> pb_accession_s = CopyToUsersArena (builder_p -> pb_arena_p, accession_s)) != NULL)
+		{
+			if (builder_p -> pb_layout != PL_DOCUMENTS)
+				{
+					success_flag = AppendPopulationCall (builder_p -> pb_accessions_p, builder_p -> pb_num_accessions, accession_s);
+				}
+			else
+				{
+					success_flag = true;
+				}
+
+			if (success_flag)
+				{
+					++ (builder_p -> pb_num_accessions);
+				}
+		}
+
+	if (!success_flag)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add accession \"%s\"", accession_s);
+		}
+
+	return success_flag;
+}
+
+
+bool SetPopulationMarkerCall (PopulationBuilder *builder_p, PopulationMarker *marker_p, const char *value_s)
+{
+	bool success_flag = false;
+
+	if (builder_p -> pb_accession_s)
+		{
+			const uint32 index = builder_p -> pb_num_accessions - 1;
+
+			if (marker_p -> pm_num_calls > index)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "\"%s\" already has a call for \"%s\"", marker_p -> pm_name_s, builder_p -> pb_accession_s);
+				}
+			else if (builder_p -> pb_layout == PL_PACKED)
+				{
+					success_flag = SetPackedPopulationCall (builder_p, marker_p, index, value_s);
+				}
+			else if (builder_p -> pb_layout == PL_COLUMNS)
+				{
+					success_flag = SetColumnPopulationCall (builder_p, marker_p, index, value_s);
+				}
+			else
+				{
+					/*
+					 * The accession is the key so a second call for it
+					 * would be a duplicate key rather than replacing the first
+					 */
+					success_flag = BSON_APPEND_UTF8 (marker_p -> pm_doc_p, builder_p -> pb_accession_s, value_s);
+
+					if (success_flag)
+						{
+							marker_p -> pm_num_calls = index + 1;
+						}
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "No accession set for call \"%s\" for \"%s\"", value_s, marker_p -> pm_name_s);
+		}
+
+	return success_flag;
+}
+
+
+bool SavePopulation (MongoTool *tool_p, const char *collection_s, PopulationBuilder *builder_p)
+{
+	bool success_flag = false;
+	/* The document's length and terminator, the _id and then the header's contents */
+	size_t size = 0;
+	uint32 i;
+
+	if (builder_p -> pb_layout != PL_DOCUMENTS)
+		{
+			if (!AddPopulationColumns (builder_p))
+				{
+					return false;
+				}
+		}
+
+	size = 5 + (1 + strlen (MONGO_ID_S) + 1 + 12) + (builder_p -> pb_header_p -> len - 5);
+
+	for (i = 0; i < builder_p -> pb_num_markers; ++ i)
+		{
+			size += GetMarkerSize ((builder_p -> pb_markers_p) + i);
+		}
+
+	/*
+	 * Is the doc ok to save in one go?
+	 */
+	if (size < GP_MAX_DOCUMENT_SIZE)
+		{
+			success_flag = SaveWholePopulation (tool_p, collection_s, builder_p, size);
+		}
+	else
+		{
+			if (SetMongoToolCollection (tool_p, collection_s))
+				{
+					PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Population of " UINT32_FMT " markers and " SIZET_FMT " bytes needs splitting", builder_p -> pb_num_markers, size);
+
+					success_flag = SaveSplitPopulation (tool_p, collection_s, builder_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set collection to \"%s\"", collection_s);
+				}
+		}
+
+	return success_flag;
+}
+
+
+mongoc_cursor_t *FindPopulationChunks (MongoTool *tool_p, const char *collection_s, const bson_oid_t *id_p, const uint32 first_marker, const uint32 end_marker)
+{
+	mongoc_cursor_t *cursor_p = NULL;
+
+	if (SetMongoToolCollection (tool_p, collection_s))
+		{
+			const int32 end = (end_marker > 0) ? (int32) end_marker : INT32_MAX;
+
+			/*
+			 * An unsplit population is a single document without a GP_POPULATION_ID_S,
+			 * whereas every chunk of a split one, including the first, has one
+			 */
+			bson_t *query_p = BCON_NEW ("$or", "[",
+				"{", MONGO_ID_S, BCON_OID (id_p), GP_POPULATION_ID_S, "{", "$exists", BCON_BOOL (false), "}", "}",
+				"{", GP_POPULATION_ID_S, BCON_OID (id_p), GP_FIRST_MARKER_S, "{", "$lt", BCON_INT32 (end), "}", GP_END_MARKER_S, "{", "$gt", BCON_INT32 ((int32) first_marker), "}", "}",
+			"]");
+
+			if (query_p)
+				{
+					bson_t *opts_p = BCON_NEW ("sort", "{", GP_CHUNK_S, BCON_INT32 (1), "}");
+
+					if (opts_p)
+						{
+							if ((cursor_p = mongoc_collection_find_with_opts (tool_p -> mt_collection_p, query_p, opts_p, NULL)) == NULL)
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open population cursor for \"%s\"", collection_s);
+								}
+
+							bson_destroy (opts_p);
+						}
+
+					bson_destroy (query_p);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set collection to \"%s\"", collection_s);
+		}
+
+	return cursor_p;
+}
+
+
+bson_t *GetPopulation (MongoTool *tool_p, const char *collection_s, const bson_oid_t *id_p)
+{
+	bson_t *population_p = NULL;
+	mongoc_cursor_t *cursor_p = FindPopulationChunks (tool_p, collection_s, id_p, 0, 0);
+
+	if (cursor_p)
+		{
+			const bson_t *doc_p = NULL;
+			bson_error_t error;
+			int32 num_chunks = 0;
+			int32 num_found = 0;
+			bool success_flag = true;
+
+			while (success_flag && (mongoc_cursor_next (cursor_p, &doc_p)))
+				{
+					if (!population_p)
+						{
+							/*
+							 * The first chunk has all of the population's other
+							 * fields as well as its first markers
+							 */
+							if ((population_p = bson_new ()) != NULL)
+								{
+									bson_iter_t iter;
+
+									bson_copy_to_excluding_noinit (doc_p, population_p, GP_POPULATION_ID_S, GP_CHUNK_S, GP_NUM_CHUNKS_S, GP_FIRST_MARKER_S, GP_END_MARKER_S, NULL);
+
+									if (bson_iter_init_find (&iter, doc_p, GP_NUM_CHUNKS_S) && BSON_ITER_HOLDS_INT32 (&iter))
+										{
+											num_chunks = bson_iter_int32 (&iter);
+										}
+									else
+										{
+											num_chunks = 1;
+										}
+								}
+							else
+								{
+									success_flag = false;
+								}
+						}
+					else
+						{
+							success_flag = AppendPopulationMarkers (population_p, doc_p);
+						}
+
+					++ num_found;
+				}
+
+			if (mongoc_cursor_error (cursor_p, &error))
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get population from \"%s\": %s", collection_s, error.message);
+					success_flag = false;
+				}
+
+			if (success_flag && (num_found != num_chunks))
+				{
+					char id_s [MONGO_OID_STRING_BUFFER_SIZE];
+
+					bson_oid_to_string (id_p, id_s);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Found %d of %d chunks for population \"%s\"", num_found, num_chunks, id_s);
+					success_flag = false;
+				}
+
+			if ((!success_flag) && population_p)
+				{
+					bson_destroy (population_p);
+					population_p = NULL;
+				}
+
+			mongoc_cursor_destroy (cursor_p);
+		}		/* if (cursor_p) */
+
+	return population_p;
+}
+
+
+PopulationLayout GetPopulationLayout (const bson_t *population_p)
+{
+	bson_iter_t iter;
+
+	if (bson_iter_init_find (&iter, population_p, GP_LAYOUT_S) && BSON_ITER_HOLDS_UTF8 (&iter))
+		{
+			const char *layout_s = bson_iter_utf8 (&iter, NULL);
+
+			if (strcmp (layout_s, GP_LAYOUT_COLUMNS_S) == 0)
+				{
+					return PL_COLUMNS;
+				}
+			else if (strcmp (layout_s, GP_LAYOUT_PACKED_S) == 0)
+				{
+					return PL_PACKED;
+				}
+		}
+
+	return PL_DOCUMENTS;
+}
+
+
+int32 GetPopulationAccessionIndex (const bson_t *population_p, const char *accession_s)
+{
+	bson_iter_t iter;
+
+	if (bson_iter_init_find (&iter, population_p, GP_ACCESSIONS_S) && BSON_ITER_HOLDS_ARRAY (&iter))
+		{
+			bson_iter_t accessions_iter;
+
+			if (bson_iter_recurse (&iter, &accessions_iter))
+				{
+					int32 index = 0;
+
+					while (bson_iter_next (&accessions_iter))
+						{
+							if (BSON_ITER_HOLDS_UTF8 (&accessions_iter))
+								{
+									if (strcmp (bson_iter_utf8 (&accessions_iter, NULL), accession_s) == 0)
+										{
+											return index;
+										}
+								}
+
+							++ index;
+						}
+				}
+		}
+
+	return -1;
+}
+
+
+const char *GetPopulationCall (const bson_t *population_p, const char *marker_key_s, const char *accession_s)
+{
+	const char *value_s = NULL;
+
+	if (GetPopulationLayout (population_p) != PL_DOCUMENTS)
+		{
+			const int32 index = GetPopulationAccessionIndex (population_p, accession_s);
+
+			if (index >= 0)
+				{
+					value_s = GetPopulationCallAt (population_p, marker_key_s, (uint32) index);
+				}
+		}
+	else
+		{
+			bson_iter_t marker_iter;
+
+			if (FindPopulationMarker (population_p, marker_key_s, &marker_iter))
+				{
+					/*
+					 * Accession names can contain full stops so this can't
+					 * use bson_iter_find_descendant ()
+					 */
+					if (bson_iter_find (&marker_iter, accession_s) && BSON_ITER_HOLDS_UTF8 (&marker_iter))
+						{
+							value_s = bson_iter_utf8 (&marker_iter, NULL);
+						}
+				}
+		}
+
+	return value_s;
+}
+
+
+const char *GetPopulationCallAt (const bson_t *population_p, const char *marker_key_s, const uint32 accession_index)
+{
+	const char *value_s = NULL;
+	bson_iter_t marker_iter;
+
+	if (FindPopulationMarker (population_p, marker_key_s, &marker_iter))
+		{
+			if (!bson_iter_find (&marker_iter, GP_CALLS_S))
+				{
+					return NULL;
+				}
+
+			if (BSON_ITER_HOLDS_BINARY (&marker_iter))
+				{
+					const uint8 *packed_p = NULL;
+					uint32 packed_size = 0;
+
+					bson_iter_binary (&marker_iter, NULL, &packed_size, &packed_p);
+
+					if (accession_index / GP_CALLS_PER_BYTE < packed_size)
+						{
+							const char *alphabet_ss [GP_ALPHABET_SIZE];
+							const uint32 alphabet_size = GetPopulationAlphabet (population_p, alphabet_ss);
+							const uint8 code = S_UNPACKED_CODES [packed_p [accession_index / GP_CALLS_PER_BYTE]] [accession_index % GP_CALLS_PER_BYTE];
+
+							if (code < alphabet_size)
+								{
+									value_s = alphabet_ss [code];
+								}
+						}
+				}
+			else if (BSON_ITER_HOLDS_ARRAY (&marker_iter))
+				{
+					bson_iter_t calls_iter;
+
+					if (bson_iter_recurse (&marker_iter, &calls_iter))
+						{
+							char buffer_s [16];
+							const char *index_s = NULL;
+
+							bson_uint32_to_string (accession_index, &index_s, buffer_s, sizeof (buffer_s));
+
+							if (bson_iter_find (&calls_iter, index_s) && BSON_ITER_HOLDS_UTF8 (&calls_iter))
+								{
+									value_s = bson_iter_utf8 (&calls_iter, NULL);
+								}
+						}
+				}
+		}
+
+	return value_s;
+}
+
+
+uint32 GetPopulationAlphabet (const bson_t *population_p, const char *alphabet_ss [GP_ALPHABET_SIZE])
+{
+	uint32 alphabet_size = 0;
+	bson_iter_t iter;
+
+	if (bson_iter_init_find (&iter, population_p, GP_ALPHABET_S) && BSON_ITER_HOLDS_ARRAY (&iter))
+		{
+			bson_iter_t alphabet_iter;
+
+			if (bson_iter_recurse (&iter, &alphabet_iter))
+				{
+					while ((alphabet_size < GP_ALPHABET_SIZE) && (bson_iter_next (&alphabet_iter)))
+						{
+							alphabet_ss [alphabet_size] = BSON_ITER_HOLDS_UTF8 (&alphabet_iter) ? bson_iter_utf8 (&alphabet_iter, NULL) : NULL;
+							++ alphabet_size;
+						}
+				}
+		}
+
+	return alphabet_size;
+}
+
+
+const uint8 *GetPopulationPackedCalls (const bson_t *population_p, const char *marker_key_s, uint32 *size_p)
+{
+	bson_iter_t marker_iter;
+
+	if (FindPopulationMarker (population_p, marker_key_s, &marker_iter))
+		{
+			if (bson_iter_find (&marker_iter, GP_CALLS_S) && BSON_ITER_HOLDS_BINARY (&marker_iter))
+				{
+					const uint8 *packed_p = NULL;
+
+					bson_iter_binary (&marker_iter, NULL, size_p, &packed_p);
+
+					return packed_p;
+				}
+		}
+
+	return NULL;
+}
+
+
+bool DecodePopulationCalls (const uint8 *packed_p, const uint32 packed_size, uint8 *codes_p, const uint32 num_calls)
+{
+	const uint32 num_whole_bytes = num_calls / GP_CALLS_PER_BYTE;
+	const uint32 num_remaining_calls = num_calls % GP_CALLS_PER_BYTE;
+	uint32 i;
+
+	if (GP_PACKED_CALLS_SIZE (num_calls) > packed_size)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, UINT32_FMT " bytes is too few for " UINT32_FMT " calls", packed_size, num_calls);
+			return false;
+		}
+
+	/*
+	 * Each byte is unpacked into its GP_CALLS_PER_BYTE codes at once
+	 * rather than shifting out each code in turn
+	 */
+	for (i = 0; i < num_whole_bytes; ++ i)
+		{
+			memcpy (codes_p, S_UNPACKED_CODES [packed_p [i]], GP_CALLS_PER_BYTE);
+			codes_p += GP_CALLS_PER_BYTE;
+		}
+
+	if (num_remaining_calls > 0)
+		{
+			memcpy (codes_p, S_UNPACKED_CODES [packed_p [i]], num_remaining_calls);
+		}
+
+	return true;
+}
+
+
+/*
+ * Static definitions
+ */
+
+static int CompareMarkerNames (const void *v0_p, const void *v1_p)
+{
+	const PopulationMarker *marker_0_p = * ((const PopulationMarker * const *) v0_p);
+	const PopulationMarker *marker_1_p = * ((const PopulationMarker * const *) v1_p);
+
+	return strcmp (marker_0_p -> pm_name_s, marker_1_p -> pm_name_s);
+}
+
+
+static int CompareMarkerName (const void *key_p, const void *marker_pp)
+{
+	const PopulationMarker *marker_p = * ((const PopulationMarker * const *) marker_pp);
+
+	return strcmp ((const char *) key_p, marker_p -> pm_name_s);
+}
+
+
+/*
+ * The number of bytes that a marker takes up in its parent document:
+ * its type, its key and its sub-document.
+ */
+static size_t GetMarkerSize (const PopulationMarker *marker_p)
+{
+	size_t size = 1 + strlen (marker_p -> pm_key_s) + 1 + marker_p -> pm_doc_p -> len;
+
+	if (marker_p -> pm_calls_p)
+		{
+			size += 1 + strlen (GP_CALLS_S) + 1 + marker_p -> pm_calls_p -> len;
+		}
+	else if (marker_p -> pm_packed_calls_p)
+		{
+			/* The binary's length and subtype and then the data */
+			size += 1 + strlen (GP_CALLS_S) + 1 + 4 + 1 + GP_PACKED_CALLS_SIZE (marker_p -> pm_num_calls);
+		}
+
+	return size;
+}
+
+
+static bool SaveWholePopulation (MongoTool *tool_p, const char *collection_s, PopulationBuilder *builder_p, const size_t size)
+{
+	bool success_flag = false;
+
+	/*
+	 * Allocate the whole document up front so that it
+	 * doesn't need to grow as the markers are added
+	 */
+	bson_t *doc_p = bson_sized_new (size);
+
+	if (doc_p)
+		{
+			if (BSON_APPEND_OID (doc_p, MONGO_ID_S, & (builder_p -> pb_id)) &&
+					bson_concat (doc_p, builder_p -> pb_header_p) &&
+					AppendPopulationMarkerRange (doc_p, builder_p, 0, builder_p -> pb_num_markers))
+				{
+					if (SaveMongoDataFromBSON (tool_p, doc_p, collection_s, NULL))
+						{
+							success_flag = true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to save population to \"%s\"", collection_s);
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to build population document of " SIZET_FMT " bytes", size);
+				}
+
+			bson_destroy (doc_p);
+		}
+
+	return success_flag;
+}
+
+
+static bool SaveSplitPopulation (MongoTool *tool_p, const char *collection_s, PopulationBuilder *builder_p)
+{
+	bool success_flag = false;
+	uint32 *chunk_ends_p = (uint32 *) AllocMemoryArray (builder_p -> pb_num_markers, sizeof (uint32));
+
+	if (chunk_ends_p)
+		{
+			const uint32 num_chunks = GetPopulationChunkEnds (builder_p, chunk_ends_p);
+
+			if (num_chunks > 0)
+				{
+					PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Splitting population of " UINT32_FMT " markers into " UINT32_FMT " documents", builder_p -> pb_num_markers, num_chunks);
+
+					EnsurePopulationChunksIndex (tool_p, collection_s);
+
+					if (InsertPopulationChunks (tool_p, builder_p, chunk_ends_p, num_chunks))
+						{
+							success_flag = true;
+						}
+					else
+						{
+							/*
+							 * Don't leave part of the population behind
+							 */
+							RemovePopulationChunks (tool_p, & (builder_p -> pb_id));
+						}
+				}
+
+			FreeMemory (chunk_ends_p);
+		}		/* if (chunk_ends_p) */
+
+	return success_flag;
+}
+
+
+/*
+ * Work out where each chunk ends by filling each one with as many
+ * markers as will fit. Returns the number of chunks or 0 upon error.
+ */
+static uint32 GetPopulationChunkEnds (const PopulationBuilder *builder_p, uint32 *chunk_ends_p)
+{
+	uint32 num_chunks = 0;
+	const size_t header_size = builder_p -> pb_header_p -> len;
+
+	if (header_size + S_CHUNK_METADATA_SIZE < GP_MAX_DOCUMENT_SIZE)
+		{
+			const size_t max_size = GP_MAX_DOCUMENT_SIZE - header_size - S_CHUNK_METADATA_SIZE;
+			size_t chunk_size = 0;
+			uint32 i;
+
+			for (i = 0; i < builder_p -> pb_num_markers; ++ i)
+				{
+					const PopulationMarker *marker_p = (builder_p -> pb_markers_p) + i;
+					const size_t marker_size = GetMarkerSize (marker_p);
+
+					if (marker_size > max_size)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Marker \"%s\" is too big to store at " SIZET_FMT " bytes", marker_p -> pm_name_s, marker_size);
+							return 0;
+						}
+
+					if (chunk_size + marker_size > max_size)
+						{
+							chunk_ends_p [num_chunks] = i;
+							++ num_chunks;
+							chunk_size = 0;
+						}
+
+					chunk_size += marker_size;
+				}
+
+			if (chunk_size > 0)
+				{
+					chunk_ends_p [num_chunks] = builder_p -> pb_num_markers;
+					++ num_chunks;
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Population header of " SIZET_FMT " bytes is too big to split", header_size);
+		}
+
+	return num_chunks;
+}
+
+
+static bool InsertPopulationChunks (MongoTool *tool_p, PopulationBuilder *builder_p, const uint32 *chunk_ends_p, const uint32 num_chunks)
+{
+	bool success_flag = true;
+	uint32 first_marker = 0;
+	uint32 i;
+
+	for (i = 0; (i < num_chunks) && success_flag; ++ i)
+		{
+			/*
+			 * Allocate the whole chunk up front so that it doesn't need
+			 * to grow, but no bigger than it needs to be
+			 */
+			bson_t *chunk_p = bson_sized_new (GetPopulationChunkSize (builder_p, first_marker, chunk_ends_p [i]));
+
+			success_flag = false;
+
+			if (chunk_p)
+				{
+					bson_oid_t chunk_id;
+
+					/*
+					 * The first chunk keeps the population's id so that
+					 * anything referring to the population still finds it
+					 */
+					if (i == 0)
+						{
+							bson_oid_copy (& (builder_p -> pb_id), &chunk_id);
+						}
+					else
+						{
+							bson_oid_init (&chunk_id, NULL);
+						}
+
+					if (BSON_APPEND_OID (chunk_p, MONGO_ID_S, &chunk_id) &&
+							BSON_APPEND_OID (chunk_p, GP_POPULATION_ID_S, & (builder_p -> pb_id)) &&
+							BSON_APPEND_INT32 (chunk_p, GP_CHUNK_S, (int32) i) &&
+							BSON_APPEND_INT32 (chunk_p, GP_NUM_CHUNKS_S, (int32) num_chunks) &&
+							BSON_APPEND_INT32 (chunk_p, GP_FIRST_MARKER_S, (int32) first_marker) &&
+							BSON_APPEND_INT32 (chunk_p, GP_END_MARKER_S, (int32) (chunk_ends_p [i])) &&
+							bson_concat (chunk_p, builder_p -> pb_header_p) &&
+							AppendPopulationMarkerRange (chunk_p, builder_p, first_marker, chunk_ends_p [i]))
+						{
+							bson_error_t error;
+
+							if (mongoc_collection_insert_one (tool_p -> mt_collection_p, chunk_p, NULL, NULL, &error))
+								{
+									success_flag = true;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to save chunk " UINT32_FMT " of " UINT32_FMT " of population: %s", i + 1, num_chunks, error.message);
+								}
+						}
+
+					first_marker = chunk_ends_p [i];
+					bson_destroy (chunk_p);
+				}		/* if (chunk_p) */
+
+		}		/* for (i = 0; (i < num_chunks) && success_flag; ++ i) */
+
+	return success_flag;
+}
+
+
+/*
+ * Get the most that a chunk holding the given range of markers
+ * could need, including its metadata and the population's header.
+ */
+static size_t GetPopulationChunkSize (const PopulationBuilder *builder_p, const uint32 first_marker, const uint32 end_marker)
+{
+	size_t size = S_CHUNK_METADATA_SIZE + (builder_p -> pb_header_p -> len);
+	uint32 i;
+
+	for (i = first_marker; i < end_marker; ++ i)
+		{
+			size += GetMarkerSize ((builder_p -> pb_markers_p) + i);
+		}
+
+	return size;
+}
+
+
+/*
+ * Copy a range of markers into a document, freeing each marker's
+ * own buffer once it has been copied.
+ */
+static bool AppendPopulationMarkerRange (bson_t *doc_p, PopulationBuilder *builder_p, const uint32 first_marker, const uint32 end_marker)
+{
+	uint32 i;
+
+	for (i = first_marker; i < end_marker; ++ i)
+		{
+			PopulationMarker *marker_p = (builder_p -> pb_markers_p) + i;
+			bool success_flag = false;
+
+			if ((marker_p -> pm_calls_p) || (marker_p -> pm_packed_calls_p))
+				{
+					bson_t child;
+
+					if (BSON_APPEND_DOCUMENT_BEGIN (doc_p, marker_p -> pm_key_s, &child))
+						{
+							if (bson_concat (&child, marker_p -> pm_doc_p))
+								{
+									if (marker_p -> pm_calls_p)
+										{
+											success_flag = BSON_APPEND_ARRAY (&child, GP_CALLS_S, marker_p -> pm_calls_p);
+										}
+									else
+										{
+											success_flag = BSON_APPEND_BINARY (&child, GP_CALLS_S, BSON_SUBTYPE_BINARY, marker_p -> pm_packed_calls_p, (uint32) GP_PACKED_CALLS_SIZE (marker_p -> pm_num_calls));
+										}
+								}
+
+							if (!bson_append_document_end (doc_p, &child))
+								{
+									success_flag = false;
+								}
+						}
+
+					if (marker_p -> pm_calls_p)
+						{
+							bson_destroy (marker_p -> pm_calls_p);
+							marker_p -> pm_calls_p = NULL;
+						}
+					else
+						{
+							FreeMemory (marker_p -> pm_packed_calls_p);
+							marker_p -> pm_packed_calls_p = NULL;
+						}
+				}
+			else
+				{
+					success_flag = BSON_APPEND_DOCUMENT (doc_p, marker_p -> pm_key_s, marker_p -> pm_doc_p);
+				}
+
+			if (!success_flag)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add marker \"%s\"", marker_p -> pm_name_s);
+					return false;
+				}
+
+			bson_destroy (marker_p -> pm_doc_p);
+			marker_p -> pm_doc_p = NULL;
+		}
+
+	return true;
+}
+
+
+/*
+ * Pad each marker's calls out to the full number of accessions and
+ * add the accessions to the values that every chunk has.
+ */
+static bool AddPopulationColumns (PopulationBuilder *builder_p)
+{
+	bool success_flag = true;
+	uint32 i;
+
+	for (i = 0; (i < builder_p -> pb_num_markers) && success_flag; ++ i)
+		{
+			PopulationMarker *marker_p = (builder_p -> pb_markers_p) + i;
+
+			if (builder_p -> pb_layout == PL_PACKED)
+				{
+					/*
+					 * Unset codes are already GP_MISSING_CALL_S so this
+					 * just needs to make sure that there is room for them
+					 */
+					if (ReservePackedCalls (marker_p, builder_p -> pb_num_accessions))
+						{
+							marker_p -> pm_num_calls = builder_p -> pb_num_accessions;
+						}
+					else
+						{
+							success_flag = false;
+						}
+				}
+			else
+				{
+					const char *missing_s = GetMissingPopulationCall (builder_p);
+
+					while (success_flag && (marker_p -> pm_num_calls < builder_p -> pb_num_accessions))
+						{
+							success_flag = AppendPopulationCall (marker_p -> pm_calls_p, marker_p -> pm_num_calls, missing_s);
+							++ (marker_p -> pm_num_calls);
+						}
+				}
+		}
+
+	if (success_flag)
+		{
+			const char *layout_s = (builder_p -> pb_layout == PL_PACKED) ? GP_LAYOUT_PACKED_S : GP_LAYOUT_COLUMNS_S;
+
+			if (BSON_APPEND_UTF8 (builder_p -> pb_header_p, GP_LAYOUT_S, layout_s) &&
+					BSON_APPEND_ARRAY (builder_p -> pb_header_p, GP_ACCESSIONS_S, builder_p -> pb_accessions_p))
+				{
+					/* This is in the header now so isn't needed any more */
+					bson_destroy (builder_p -> pb_accessions_p);
+					builder_p -> pb_accessions_p = NULL;
+
+					if (builder_p -> pb_layout == PL_PACKED)
+						{
+							bson_t alphabet;
+
+							success_flag = false;
+
+							if (BSON_APPEND_ARRAY_BEGIN (builder_p -> pb_header_p, GP_ALPHABET_S, &alphabet))
+								{
+									success_flag = true;
+
+									for (i = 0; (i < builder_p -> pb_alphabet_size) && success_flag; ++ i)
+										{
+											success_flag = AppendPopulationCall (&alphabet, i, builder_p -> pb_alphabet_ss [i]);
+										}
+
+									if (!bson_append_array_end (builder_p -> pb_header_p, &alphabet))
+										{
+											success_flag = false;
+										}
+								}
+						}
+				}
+			else
+				{
+					success_flag = false;
+				}
+		}
+
+	if (!success_flag)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add columns for " UINT32_FMT " accessions", builder_p -> pb_num_accessions);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Append a value to a BSON array, with a null for a
+ * missing value.
+ */
+static bool AppendPopulationCall (bson_t *calls_p, const uint32 index, const char *value_s)
+{
+	char buffer_s [16];
+	const char *key_s = NULL;
+	const int key_length = (int) bson_uint32_to_string (index, &key_s, buffer_s, sizeof (buffer_s));
+
+	return value_s ? bson_append_utf8 (calls_p, key_s, key_length, value_s, -1) : bson_append_null (calls_p, key_s, key_length);
+}
+
+
+static bool SetColumnPopulationCall (const PopulationBuilder *builder_p, PopulationMarker *marker_p, const uint32 index, const char *value_s)
+{
+	bool success_flag = true;
+	const char *missing_s = GetMissingPopulationCall (builder_p);
+
+	/*
+	 * Any accessions without a call for this marker get a missing
+	 * call so that the calls stay at the same positions as their
+	 * accessions
+	 */
+	while (success_flag && (marker_p -> pm_num_calls < index))
+		{
+			success_flag = AppendPopulationCall (marker_p -> pm_calls_p, marker_p -> pm_num_calls, missing_s);
+			++ (marker_p -> pm_num_calls);
+		}
+
+	if (success_flag)
+		{
+			success_flag = AppendPopulationCall (marker_p -> pm_calls_p, index, value_s);
+			++ (marker_p -> pm_num_calls);
+		}
+
+	return success_flag;
+}
+
+
+static bool SetPackedPopulationCall (PopulationBuilder *builder_p, PopulationMarker *marker_p, const uint32 index, const char *value_s)
+{
+	bool success_flag = false;
+	uint8 code;
+
+	if (GetPackedCallCode (builder_p, value_s, &code))
+		{
+			if (ReservePackedCalls (marker_p, index + 1))
+				{
+					/*
+					 * The buffer starts zeroed and each call is only set once
+					 * so the code can just be or'ed in
+					 */
+					marker_p -> pm_packed_calls_p [index / GP_CALLS_PER_BYTE] |= (uint8) (code << ((index % GP_CALLS_PER_BYTE) * GP_PACKED_CALL_BITS));
+					marker_p -> pm_num_calls = index + 1;
+					success_flag = true;
+				}
+		}
+	else if (builder_p -> pb_alphabet_size >= GP_ALPHABET_SIZE)
+		{
+			/*
+			 * There are too many different calls to pack so rather than
+			 * fail the whole population, store it as columns instead
+			 */
+			if (UnpackPopulationCalls (builder_p, value_s))
+				{
+					success_flag = SetColumnPopulationCall (builder_p, marker_p, index, value_s);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * The call for an accession without one for a marker. A population
+ * that was unpacked already has GP_MISSING_CALL_S for the calls that
+ * were missing before then, so it keeps using that.
+ */
+static const char *GetMissingPopulationCall (const PopulationBuilder *builder_p)
+{
+	return (builder_p -> pb_unpacked_flag) ? GP_MISSING_CALL_S : NULL;
+}
+
+
+/*
+ * Turn a PL_PACKED population into a PL_COLUMNS one. The codes are
+ * unpacked through the alphabet so each call reads back the same as
+ * it would have from the packed population, including the missing
+ * ones, and any calls that are missing from now on are the same.
+ */
+static bool UnpackPopulationCalls (PopulationBuilder *builder_p, const char *value_s)
+{
+	bool success_flag = true;
+	uint32 i;
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Call \"%s\" doesn't fit in the packed alphabet of %d calls, storing the population as columns instead", value_s, GP_ALPHABET_SIZE);
+
+	for (i = 0; (i < builder_p -> pb_num_markers) && success_flag; ++ i)
+		{
+			PopulationMarker *marker_p = (builder_p -> pb_markers_p) + i;
+
+			if ((marker_p -> pm_calls_p = bson_new ()) != NULL)
+				{
+					uint32 j;
+
+					for (j = 0; (j < marker_p -> pm_num_calls) && success_flag; ++ j)
+						{
+							const uint8 code = S_UNPACKED_CODES [marker_p -> pm_packed_calls_p [j / GP_CALLS_PER_BYTE]] [j % GP_CALLS_PER_BYTE];
+
+							success_flag = AppendPopulationCall (marker_p -> pm_calls_p, j, builder_p -> pb_alphabet_ss [code]);
+						}
+
+					if (marker_p -> pm_packed_calls_p)
+						{
+							FreeMemory (marker_p -> pm_packed_calls_p);
+							marker_p -> pm_packed_calls_p = NULL;
+							marker_p -> pm_packed_calls_size = 0;
+						}
+				}
+			else
+				{
+					success_flag = false;
+				}
+		}
+
+	if (success_flag)
+		{
+			builder_p -> pb_layout = PL_COLUMNS;
+			builder_p -> pb_unpacked_flag = true;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to store population of " UINT32_FMT " markers as columns", builder_p -> pb_num_markers);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Get the code for a call, adding it to the alphabet if it is new.
+ * This fails if the alphabet is already full.
+ */
+static bool GetPackedCallCode (PopulationBuilder *builder_p, const char *value_s, uint8 *code_p)
+{
+	uint32 i;
+
+	for (i = 0; i < builder_p -> pb_alphabet_size; ++ i)
+		{
+			if (strcmp (builder_p -> pb_alphabet_ss [i], value_s) == 0)
+				{
+					*code_p = (uint8) i;
+					return true;
+				}
+		}
+
+	if (builder_p -> pb_alphabet_size < GP_ALPHABET_SIZE)
+		{
+			const char *copied_value_s = CopyToUsersArena (builder_p -> pb_arena_p, value_s);
+
+			if (copied_value_s)
+				{
+					builder_p -> pb_alphabet_ss [builder_p -> pb_alphabet_size] = copied_value_s;
+					*code_p = (uint8) (builder_p -> pb_alphabet_size);
+					++ (builder_p -> pb_alphabet_size);
+
+					return true;
+				}
+		}
+
+	return false;
+}
+
+
+/*
+ * Make sure that a marker has room for a number of packed calls,
+ * with any new space zeroed so that its codes are all missing.
+ */
+static bool ReservePackedCalls (PopulationMarker *marker_p, const uint32 num_calls)
+{
+	const size_t needed_size = GP_PACKED_CALLS_SIZE (num_calls);
+
+	if (needed_size > marker_p -> pm_packed_calls_size)
+		{
+			/* Grow geometrically so adding calls one at a time stays cheap */
+			size_t new_size = (marker_p -> pm_packed_calls_size > 0) ? (marker_p -> pm_packed_calls_size) << 1 : 64;
+			uint8 *packed_calls_p = NULL;
+
+			if (new_size < needed_size)
+				{
+					new_size = needed_size;
+				}
+
+			if ((packed_calls_p = (uint8 *) AllocMemory (new_size)) != NULL)
+				{
+					if (marker_p -> pm_packed_calls_p)
+						{
+							memcpy (packed_calls_p, marker_p -> pm_packed_calls_p, marker_p -> pm_packed_calls_size);
+							FreeMemory (marker_p -> pm_packed_calls_p);
+						}
+
+					memset (packed_calls_p + (marker_p -> pm_packed_calls_size), 0, new_size - (marker_p -> pm_packed_calls_size));
+
+					marker_p -> pm_packed_calls_p = packed_calls_p;
+					marker_p -> pm_packed_calls_size = new_size;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " bytes of calls for \"%s\"", new_size, marker_p -> pm_name_s);
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+static bool FindPopulationMarker (const bson_t *population_p, const char *marker_key_s, bson_iter_t *marker_iter_p)
+{
+	bson_iter_t iter;
+
+	if (bson_iter_init_find (&iter, population_p, marker_key_s) && BSON_ITER_HOLDS_DOCUMENT (&iter))
+		{
+			return bson_iter_recurse (&iter, marker_iter_p);
+		}
+
+	return false;
+}
+
+
+static void RemovePopulationChunks (MongoTool *tool_p, const bson_oid_t *id_p)
+{
+	bson_t *selector_p = BCON_NEW (GP_POPULATION_ID_S, BCON_OID (id_p));
+
+	if (selector_p)
+		{
+			bson_error_t error;
+
+			if (!mongoc_collection_delete_many (tool_p -> mt_collection_p, selector_p, NULL, NULL, &error))
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to remove partially saved population: %s", error.message);
+				}
+
+			bson_destroy (selector_p);
+		}
+}
+
+
+static bool EnsurePopulationChunksIndex (MongoTool *tool_p, const char *collection_s)
+{
+	bool success_flag = false;
+	bson_t *command_p = BCON_NEW ("createIndexes", BCON_UTF8 (collection_s),
+		"indexes", "[",
+			"{", "key", "{", GP_POPULATION_ID_S, BCON_INT32 (1), GP_CHUNK_S, BCON_INT32 (1), "}", "name", BCON_UTF8 (S_CHUNKS_INDEX_S), "sparse", BCON_BOOL (true), "}",
+		"]");
+
+	if (command_p)
+		{
+			bson_t reply;
+			bson_error_t error;
+
+			/*
+			 * createIndexes does nothing if an identical index already exists
+			 */
+			if (mongoc_collection_write_command_with_opts (tool_p -> mt_collection_p, command_p, NULL, &reply, &error))
+				{
+					success_flag = true;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to build index \"%s\" on \"%s\": %s", S_CHUNKS_INDEX_S, collection_s, error.message);
+				}
+
+			bson_destroy (&reply);
+			bson_destroy (command_p);
+		}
+
+	return success_flag;
+}
+
+
+static bool AppendPopulationMarkers (bson_t *population_p, const bson_t *chunk_p)
+{
+	bool success_flag = false;
+	bson_iter_t iter;
+
+	if (bson_iter_init (&iter, chunk_p))
+		{
+			success_flag = true;
+
+			while (success_flag && (bson_iter_next (&iter)))
+				{
+					if (BSON_ITER_HOLDS_DOCUMENT (&iter))
+						{
+							success_flag = bson_append_iter (population_p, NULL, 0, &iter);
+						}
+				}
+		}
+
+	return success_flag;
+}
@@ -31,6 +31,8 @@
 
 #include "submission_service.h"
 #include "users_service.h"
+#include "users_service_data.h"
+#include "groups_population.h"
 
 #include "audit.h"
 #include "streams.h"
@@ -49,6 +51,27 @@ static const char * const S_ID_S = "id";
 static NamedParameterType S_SET_DATA = { "Data", PT_JSON_TABLE };
 
 
+/**
+ * A job for a worker to run when the service is running
+ * asynchronously.
+ */
+typedef struct GroupsSubmissionTask
+{
+	/**
+	 * The shared UsersServiceData for the service. The Service's own
+	 * UsersServiceData may have been freed before the task runs.
+	 */
+	UsersServiceData *gst_data_p;
+
+	/** The worker's own copy of the ServiceJob to update. */
+	ServiceJob *gst_job_p;
+
+	/** The table to save. */
+	json_t *gst_data_json_p;
+
+} GroupsSubmissionTask;
+
+
 static const char *GetGroupsSubmissionServiceName (const Service *service_p);
 
 static const char *GetGroupsSubmissionServiceDescription (const Service *service_p);
@@ -72,13 +95,13 @@ static ServiceMetadata *GetGroupsSubmissionServiceMetadata (Service *service_p);
 static bool GetGroupsSubmissionServiceParameterTypesForNamedParameters (const Service *service_p, const char *param_name_s, ParameterType *pt_p);
 
 
-static bool AddChromosomes (json_t *doc_p, json_t *chromosomes_p);
+static bool AddChromosomes (PopulationBuilder *builder_p, json_t *chromosomes_p);
 
-static bool AddGeneticMappingPositions (json_t *doc_p, json_t *mappings_p);
+static bool AddGeneticMappingPositions (PopulationBuilder *builder_p, json_t *mappings_p);
 
-static const char *AddParentRow (json_t *doc_p, json_t *genotypes_p, const char *key_s);
+static const char *AddParentRow (PopulationBuilder *builder_p, json_t *genotypes_p, const char *key_s);
 
-static bool AddGenotypesRow (json_t *doc_p, json_t *genotypes_p, UsersServiceData *data_p);
+static bool AddGenotypesRow (PopulationBuilder *builder_p, json_t *genotypes_p, UsersServiceData *data_p);
 
 static bson_oid_t *SaveMarkers (const char **parent_a_ss, const char **parent_b_ss, const json_t *data_json_p, UsersServiceData *data_p);
 
@@ -88,6 +111,16 @@ static bool SaveVariety (const char *parent_s, const bson_oid_t *id_p, MongoTool
 
 static char *GetAccession (const json_t *genotypes_p, UsersServiceData *data_p);
 
+static OperationStatus SaveGroups (const json_t *data_json_p, UsersServiceData *data_p);
+
+static OperationStatus RunGroupsSubmissionLater (UsersServiceData *data_p, ServiceJob *job_p, json_t *data_json_p);
+
+static void RunGroupsSubmissionTask (void *data_p);
+
+static void FreeGroupsSubmissionTask (void *data_p);
+
+static void FreeQueuedGroupsSubmissionTask (void *data_p);
+
 
 /*
  * API definitions
@@ -126,6 +159,11 @@ Service *GetGroupsSubmissionService (GrassrootsServer *grassroots_p)
 
 							if (ConfigureUsersService (data_p, grassroots_p))
 								{
+									if (data_p -> usd_workers_p)
+										{
+											service_p -> se_synchronous = SY_ASYNCHRONOUS_DETACHED;
+										}
+
 									return service_p;
 								}
 						}		/* if (InitialiseService (.... */
@@ -260,19 +298,23 @@ static ServiceJobSet *RunGroupsSubmissionService (Service *service_p, ParameterS
 
 							if (data_json_p)
 								{
-									const char *parent_a_s = NULL;
-									const char *parent_b_s = NULL;
-									bson_oid_t *id_p = SaveMarkers (&parent_a_s, &parent_b_s, data_json_p, data_p);
-
-									if (id_p)
+									if (data_p -> usd_workers_p)
 										{
-											if (SaveVarieties (parent_a_s, parent_b_s, id_p, data_p))
+											/*
+											 * The ParameterSet will be freed before the worker
+											 * runs so it needs its own copy of the table
+											 */
+											json_t *copied_data_json_p = json_deep_copy (data_json_p);
+
+											if (copied_data_json_p)
 												{
-													status = OS_SUCCEEDED;
+													status = RunGroupsSubmissionLater (data_p, job_p, copied_data_json_p);
 												}
-
-											FreeBSONOid (id_p);
-										}		/* if (id_p) */
+										}
+									else
+										{
+											status = SaveGroups (data_json_p, data_p);
+										}
 
 								}		/* if (data_json_p) */
 
@@ -282,14 +324,135 @@ static ServiceJobSet *RunGroupsSubmissionService (Service *service_p, ParameterS
 
 				}		/* if (param_set_p) */
 
-			SetServiceJobStatus (job_p, status);
-			LogServiceJob (job_p);
+			/*
+			 * A queued job's status is updated by its worker
+			 */
+			if (status != OS_PENDING)
+				{
+					SetServiceJobStatus (job_p, status);
+					LogServiceJob (job_p);
+				}
 		}		/* if (service_p -> se_jobs_p) */
 
 	return service_p -> se_jobs_p;
 }
 
 
+static OperationStatus SaveGroups (const json_t *data_json_p, UsersServiceData *data_p)
+{
+	OperationStatus status = OS_FAILED;
+	const char *parent_a_s = NULL;
+	const char *parent_b_s = NULL;
+	bson_oid_t *id_p = SaveMarkers (&parent_a_s, &parent_b_s, data_json_p, data_p);
+
+	if (id_p)
+		{
+			if (SaveVarieties (parent_a_s, parent_b_s, id_p, data_p))
+				{
+					status = OS_SUCCEEDED;
+				}
+
+			FreeBSONOid (id_p);
+		}		/* if (id_p) */
+
+	return status;
+}
+
+
+/*
+ * Run a job on one of the workers. This takes ownership of data_json_p.
+ * If the job can't be queued, it is run straight away instead.
+ */
+static OperationStatus RunGroupsSubmissionLater (UsersServiceData *data_p, ServiceJob *job_p, json_t *data_json_p)
+{
+	OperationStatus status = OS_FAILED_TO_START;
+	UsersServiceData *shared_p = data_p -> usd_shared_p;
+	GroupsSubmissionTask *task_p = (GroupsSubmissionTask *) AllocMemory (sizeof (GroupsSubmissionTask));
+
+	if (task_p)
+		{
+			task_p -> gst_data_p = shared_p;
+			task_p -> gst_job_p = NULL;
+			task_p -> gst_data_json_p = data_json_p;
+
+			/*
+			 * The job must be pending before the worker can start it
+			 */
+			UpdateUsersServiceJob (shared_p, job_p, OS_PENDING);
+
+			/*
+			 * job_p is sent back to the client and freed once we return,
+			 * so the worker updates its own copy instead
+			 */
+			if ((task_p -> gst_job_p = CopyUsersServiceJob (shared_p, job_p)) != NULL)
+				{
+					/*
+					 * The shared data must be kept until the task has been freed
+					 */
+					AcquireSharedUsersServiceData (shared_p);
+
+					if (SubmitUsersTask (shared_p -> usd_workers_p, RunGroupsSubmissionTask, FreeQueuedGroupsSubmissionTask, task_p))
+						{
+							return OS_PENDING;
+						}
+
+					ReleaseSharedUsersServiceData (shared_p, true);
+				}
+
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to queue job, running it now");
+
+			status = SaveGroups (data_json_p, shared_p);
+			FreeGroupsSubmissionTask (task_p);
+		}
+	else
+		{
+			json_decref (data_json_p);
+		}
+
+	return status;
+}
+
+
+static void RunGroupsSubmissionTask (void *data_p)
+{
+	GroupsSubmissionTask *task_p = (GroupsSubmissionTask *) data_p;
+	OperationStatus status;
+
+	UpdateUsersServiceJob (task_p -> gst_data_p, task_p -> gst_job_p, OS_STARTED);
+
+	status = SaveGroups (task_p -> gst_data_json_p, task_p -> gst_data_p);
+
+	UpdateUsersServiceJob (task_p -> gst_data_p, task_p -> gst_job_p, status);
+	LogServiceJob (task_p -> gst_job_p);
+}
+
+
+static void FreeGroupsSubmissionTask (void *data_p)
+{
+	GroupsSubmissionTask *task_p = (GroupsSubmissionTask *) data_p;
+
+	if (task_p -> gst_job_p)
+		{
+			FreeServiceJob (task_p -> gst_job_p);
+		}
+
+	json_decref (task_p -> gst_data_json_p);
+	FreeMemory (task_p);
+}
+
+
+/*
+ * Called on a worker once a queued task has finished.
+ */
+static void FreeQueuedGroupsSubmissionTask (void *data_p)
+{
+	UsersServiceData *shared_p = ((GroupsSubmissionTask *) data_p) -> gst_data_p;
+
+	FreeGroupsSubmissionTask (data_p);
+	ReleaseSharedUsersServiceData (shared_p, false);
+}
+
+
 static ServiceMetadata *GetGroupsSubmissionServiceMetadata (Service *service_p)
 {
 	const char *term_url_s = CONTEXT_PREFIX_EDAM_ONTOLOGY_S "topic_0625";
@@ -380,7 +543,7 @@ static ServiceMetadata *GetGroupsSubmissionServiceMetadata (Service *service_p)
 }
 
 
-static bool AddChromosomes (json_t *doc_p, json_t *chromosomes_p)
+static bool AddChromosomes (PopulationBuilder *builder_p, json_t *chromosomes_p)
 {
 	bool success_flag = true;
 	void *iter_p = json_object_iter (chromosomes_p);
@@ -393,54 +556,43 @@ static bool AddChromosomes (json_t *doc_p, json_t *chromosomes_p)
 				{
 					const char *value_s = GetJSONString (chromosomes_p, key_s);
 
+					success_flag = false;
+
 					if (value_s)
 						{
-							bool added_flag = false;
-							json_t *marker_p = json_object ();
+							/*
+							 * The marker name may contain full stops and although MongoDB 3.6+
+							 * allows these, the current version of the mongo-c driver (1.13)
+							 * does not, so we need to do the escaping ourselves. Each marker
+							 * keeps its escaped key so this is only done once per marker
+							 * rather than for every row.
+							 */
+							char *escaped_marker_s = NULL;
 
-							if (marker_p)
+							/*
+							 * Most names don't have any full stops so don't need
+							 * SearchAndReplaceInString () at all
+							 */
+							if ((!DoesPopulationKeyNeedEscaping (key_s)) || (SearchAndReplaceInString (key_s, &escaped_marker_s, ".", PGS_ESCAPED_DOT_S)))
 								{
-									/*
-									 * The marker name may contain full stops and although MongoDB 3.6+
-									 * allows these, the current version of the mongo-c driver (1.13)
-									 * does not, so we need to do the escaping ourselves
-									 */
-									char *escaped_marker_s = NULL;
+									PopulationMarker *marker_p = AddPopulationMarker (builder_p, key_s, escaped_marker_s);
 
-									if (SearchAndReplaceInString (key_s, &escaped_marker_s, ".", PGS_ESCAPED_DOT_S))
+									if (marker_p)
 										{
-											if (json_object_set_new (doc_p, escaped_marker_s ? escaped_marker_s : key_s, marker_p)  == 0)
-												{
-													if (SetJSONString (marker_p, PGS_CHROMOSOME_S, value_s))
-														{
-															added_flag = true;
-														}
-												}
-
-											if (escaped_marker_s)
+											if (SetPopulationMarkerString (marker_p, PGS_CHROMOSOME_S, value_s))
 												{
-													FreeCopiedString (escaped_marker_s);
+													success_flag = true;
 												}
+										}
 
-										}		/* if (SearchAndReplaceInString (key_s, &escaped_marker_s, ".", PGS_DOT_S)) */
-
-									if (!added_flag)
+									if (escaped_marker_s)
 										{
-											success_flag = false;
-											json_decref (marker_p);
+											FreeCopiedString (escaped_marker_s);
 										}
 
-								}		/* if (marker_p) */
-							else
-								{
-									success_flag = false;
-								}
+								}		/* if ((!DoesPopulationKeyNeedEscaping (key_s)) || (SearchAndReplaceInString (key_s, &escaped_marker_s, ".", PGS_ESCAPED_DOT_S))) */
 
 						}		/* if (value_s) */
-					else
-						{
-							success_flag = false;
-						}
 
 				}		/* if (strcmp (key_s, S_ID_S) != 0) */
 
@@ -454,10 +606,11 @@ static bool AddChromosomes (json_t *doc_p, json_t *chromosomes_p)
 
 
 
-static bool AddGeneticMappingPositions (json_t *doc_p, json_t *mappings_p)
+static bool AddGeneticMappingPositions (PopulationBuilder *builder_p, json_t *mappings_p)
 {
 	bool success_flag = true;
 	void *iter_p = json_object_iter (mappings_p);
+	uint32 column = 0;
 
 	while (iter_p && success_flag)
 		{
@@ -469,40 +622,21 @@ static bool AddGeneticMappingPositions (json_t *doc_p, json_t *mappings_p)
 
 					if (value_s)
 						{
-							/*
-							 * The marker name may contain full stops and although MongoDB 3.6+
-							 * allows these, the current version of the mongo-c driver (1.13)
-							 * does not, so we need to do the escaping ourselves
-							 */
-							char *escaped_key_s = NULL;
+							PopulationMarker *marker_p = GetPopulationMarkerAt (builder_p, column, key_s);
 
-							if (SearchAndReplaceInString (key_s, &escaped_key_s, ".", PGS_ESCAPED_DOT_S))
+							if (marker_p)
 								{
-									/* use key and value ... */
-									json_t *marker_p = json_object_get (doc_p, escaped_key_s ? escaped_key_s : key_s);
-
-									if (marker_p)
-										{
-											if (!SetJSONString (marker_p, PGS_MAPPING_POSITION_S, value_s))
-												{
-													PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, marker_p, "Failed to set \"%s\": \"%s\"", PGS_MAPPING_POSITION_S, value_s);
-													success_flag = false;
-												}
-										}		/* if (marker_p) */
-									else
+									if (!SetPopulationMarkerString (marker_p, PGS_MAPPING_POSITION_S, value_s))
 										{
-											PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, doc_p, "Failed to get \"%s\"", key_s);
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set \"%s\": \"%s\" for \"%s\"", PGS_MAPPING_POSITION_S, value_s, key_s);
 											success_flag = false;
 										}
-
-									if (escaped_key_s)
-										{
-											FreeCopiedString (escaped_key_s);
-										}
-
-								}		/* if (SearchAndReplaceInString (key_s, &escaped_marker_s, ".", PGS_DOT_S)) */
-
-
+								}		/* if (marker_p) */
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get marker \"%s\"", key_s);
+									success_flag = false;
+								}
 
 						}		/* if (value_s) */
 					else
@@ -511,6 +645,7 @@ static bool AddGeneticMappingPositions (json_t *doc_p, json_t *mappings_p)
 							success_flag = false;
 						}
 
+					++ column;
 				}		/* if (strcmp (key_s, S_ID_S) != 0) */
 
 			iter_p = json_object_iter_next (mappings_p, iter_p);
@@ -520,13 +655,13 @@ static bool AddGeneticMappingPositions (json_t *doc_p, json_t *mappings_p)
 }
 
 
-static const char *AddParentRow (json_t *doc_p, json_t *genotypes_p, const char *key_s)
+static const char *AddParentRow (PopulationBuilder *builder_p, json_t *genotypes_p, const char *key_s)
 {
 	const char *parent_s = GetJSONString (genotypes_p, S_ID_S);
 
 	if (parent_s)
 		{
-			if (SetJSONString (doc_p, key_s, parent_s))
+			if (SetPopulationString (builder_p, key_s, parent_s))
 				{
 					return parent_s;
 				}
@@ -609,14 +744,24 @@ static char *GetAccession (const json_t *genotypes_p, UsersServiceData *data_p)
 }
 
 
-static bool AddGenotypesRow (json_t *doc_p, json_t *genotypes_p, UsersServiceData *data_p)
+static bool AddGenotypesRow (PopulationBuilder *builder_p, json_t *genotypes_p, UsersServiceData *data_p)
 {
 	bool success_flag = true;
 	char *accession_s = GetAccession (genotypes_p, data_p);
 
 	if (accession_s)
 		{
-			void *iter_p = json_object_iter (genotypes_p);
+			void *iter_p = NULL;
+			uint32 column = 0;
+
+			if (AddPopulationAccession (builder_p, accession_s))
+				{
+					iter_p = json_object_iter (genotypes_p);
+				}
+			else
+				{
+					success_flag = false;
+				}
 
 			while (iter_p && success_flag)
 				{
@@ -629,40 +774,25 @@ static bool AddGenotypesRow (json_t *doc_p, json_t *genotypes_p, UsersServiceDat
 							if (value_s)
 								{
 									/*
-									 * The marker name may contain full stops and although MongoDB 3.6+
-									 * allows these, the current version of the mongo-c driver (1.13)
-									 * does not, so we need to do the escaping ourselves
+									 * The columns are normally in the same order as the header
+									 * row, so this doesn't need to search for the marker
 									 */
-									char *escaped_key_s = NULL;
+									PopulationMarker *marker_p = GetPopulationMarkerAt (builder_p, column, key_s);
 
-									if (SearchAndReplaceInString (key_s, &escaped_key_s, ".", PGS_ESCAPED_DOT_S))
+									if (marker_p)
 										{
-											/*
-											 * use key and value ...
-											 */
-											json_t *marker_p = json_object_get (doc_p, escaped_key_s ? escaped_key_s : key_s);
-
-											if (marker_p)
+											if (!SetPopulationMarkerCall (builder_p, marker_p, value_s))
 												{
-													if (!SetJSONString (marker_p, accession_s, value_s))
-														{
-															PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, marker_p, "Failed to set \"%s\": \"%s\"", accession_s, value_s);
-															success_flag = false;
-														}
-
-												}		/* if (marker_p) */
-											else
-												{
-													PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, doc_p, "Failed to get marker for %s", key_s);
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set \"%s\": \"%s\" for \"%s\"", accession_s, value_s, key_s);
 													success_flag = false;
 												}
 
-											if (escaped_key_s)
-												{
-													FreeCopiedString (escaped_key_s);
-												}
-
-										}		/* if (SearchAndReplaceInString (key_s, &escaped_marker_s, ".", PGS_DOT_S)) */
+										}		/* if (marker_p) */
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get marker for %s", key_s);
+											success_flag = false;
+										}
 
 								}		/* if (value_s) */
 							else
@@ -671,6 +801,7 @@ static bool AddGenotypesRow (json_t *doc_p, json_t *genotypes_p, UsersServiceDat
 									success_flag = false;
 								}
 
+							++ column;
 						}		/* if (strcmp (key_s, S_ID_S) == 0) else ... */
 
 					iter_p = json_object_iter_next (genotypes_p, iter_p);
@@ -691,174 +822,149 @@ static bool AddGenotypesRow (json_t *doc_p, json_t *genotypes_p, UsersServiceDat
 
 static bson_oid_t *SaveMarkers (const char **parent_a_ss, const char **parent_b_ss, const json_t *data_json_p, UsersServiceData *data_p)
 {
-	bson_oid_t *id_p = NULL;
 	bool success_flag = false;
-	json_t *doc_p = json_object ();
+	bson_oid_t *id_p = GetNewBSONOid ();
 
-	if (doc_p)
+	if (id_p)
 		{
-			id_p = GetNewBSONOid ();
-
-			if (id_p)
+			/*
+				The organisation is:
+				1 row = marker name
+				2 row = chromosome / linkage group name
+				3 row = genetic mapping position
+				4 row = Parent A (always Paragon for this set)
+				5 row = Parent B (always a Watkins landrace accession in format "Watkins 1190[0-9][0-9][0-9]"
+				6 to last row = individuals of that population, progenies from the cross of Parent A with Parent B
+
+				We abbreviate the population names from correctly: "Paragon x Watkins 1190[0-9][0-9][0-9]" to "ParW[0-9][0-9][0-9]".
+				The code 1190xxx was the original number these lines were stored in the germplasm resource unit.
+			 */
+			if (json_is_array (data_json_p))
 				{
-					if (AddCompoundIdToJSON (doc_p, id_p))
+					const size_t num_rows = json_array_size (data_json_p);
+
+					/*
+					 * There are 2 header rows, so the actual genotype data doesn't
+					 * start until row 3
+					 */
+					if (num_rows >= 3)
 						{
 							/*
-								The organisation is:
-								1 row = marker name
-								2 row = chromosome / linkage group name
-								3 row = genetic mapping position
-								4 row = Parent A (always Paragon for this set)
-								5 row = Parent B (always a Watkins landrace accession in format "Watkins 1190[0-9][0-9][0-9]"
-								6 to last row = individuals of that population, progenies from the cross of Parent A with Parent B
-
-								We abbreviate the population names from correctly: "Paragon x Watkins 1190[0-9][0-9][0-9]" to "ParW[0-9][0-9][0-9]".
-								The code 1190xxx was the original number these lines were stored in the germplasm resource unit.
+							 * Since the first row, the marker names, is used as the headers, the first entry should be
+							 * the chromosome / linkage group name
 							 */
-							if (json_is_array (data_json_p))
+							size_t row_index = 0;
+							json_t *row_p = json_array_get (data_json_p, row_index);
+
+							PopulationLayout layout = PL_DOCUMENTS;
+							PopulationBuilder *builder_p = NULL;
+
+							if (data_p -> usd_packed_populations_flag)
+								{
+									layout = PL_PACKED;
+								}
+							else if (data_p -> usd_columnar_populations_flag)
 								{
-									const size_t num_rows = json_array_size (data_json_p);
+									layout = PL_COLUMNS;
+								}
 
-									/*
-									 * There are 2 header rows, so the actual genotype data doesn't
-									 * start until row 3
-									 */
-									if (num_rows >= 3)
+							/*
+							 * Each marker's values are appended to its own BSON buffer as
+							 * the rows are read, so the population is never held as JSON
+							 */
+							builder_p = AllocatePopulationBuilder (id_p, (uint32) json_object_size (row_p), layout);
+
+							if (builder_p)
+								{
+									if (AddChromosomes (builder_p, row_p))
 										{
 											/*
-											 * Since the first row, the marker names, is used as the headers, the first entry should be
-											 * the chromosome / linkage group name
+											 * genetic mapping position
 											 */
-											size_t row_index = 0;
-											json_t *row_p = json_array_get (data_json_p, row_index);
+											row_p = json_array_get (data_json_p, ++ row_index);
 
-											if (AddChromosomes (doc_p, row_p))
+											if (AddGeneticMappingPositions (builder_p, row_p))
 												{
-													/*
-													 * genetic mapping position
-													 */
 													row_p = json_array_get (data_json_p, ++ row_index);
+													const char *parent_a_s = AddParentRow (builder_p, row_p, PGS_PARENT_A_S);
 
-													if (AddGeneticMappingPositions (doc_p, row_p))
+													if (parent_a_s)
 														{
 															row_p = json_array_get (data_json_p, ++ row_index);
-															const char *parent_a_s = AddParentRow (doc_p, row_p, PGS_PARENT_A_S);
+															const char *parent_b_s = AddParentRow (builder_p, row_p, PGS_PARENT_B_S);
 
-															if (parent_a_s)
+															if (parent_b_s)
 																{
-																	row_p = json_array_get (data_json_p, ++ row_index);
-																	const char *parent_b_s = AddParentRow (doc_p, row_p, PGS_PARENT_B_S);
+																	char *name_s = ConcatenateVarargsStrings (parent_a_s, " x ", parent_b_s, NULL);
 
-																	if (parent_b_s)
+																	if (name_s)
 																		{
-																			char *name_s = ConcatenateVarargsStrings (parent_a_s, " x ", parent_b_s, NULL);
-
-																			if (name_s)
+																			if (SetPopulationString (builder_p, PGS_POPULATION_NAME_S, name_s))
 																				{
-																					if (SetJSONString (doc_p, PGS_POPULATION_NAME_S, name_s))
-																						{
-																							success_flag = true;
+																					success_flag = true;
 
-																							++ row_index;
+																					++ row_index;
 
-																							while ((row_index < num_rows) && success_flag)
-																								{
-																									row_p = json_array_get (data_json_p, row_index);
-
-																									if (AddGenotypesRow (doc_p, row_p, data_p))
-																										{
-																											++ row_index;
-																										}
-																									else
-																										{
-																											success_flag = false;
-																										}
-
-																								}		/* while ((row_index < num_rows) && success_flag) */
+																					while ((row_index < num_rows) && success_flag)
+																						{
+																							row_p = json_array_get (data_json_p, row_index);
 
-																							if (success_flag)
+																							if (AddGenotypesRow (builder_p, row_p, data_p))
 																								{
-																									/*
-																									 * Save the document
-																									 */
-																									bson_t *bson_doc_p = ConvertJSONToBSON (doc_p);
-
-																									if (bson_doc_p)
-																										{
-																											/*
-																											 * Is the doc ok to save in one go?
-																											 */
-																											if (bson_doc_p -> len < BSON_MAX_SIZE)
-																												{
-																													if (SaveMongoDataFromBSON (data_p -> pgsd_mongo_p, bson_doc_p, data_p -> pgsd_populations_collection_s, NULL))
-																														{
-																															*parent_a_ss = parent_a_s;
-																															*parent_b_ss = parent_b_s;
-																														}
-																													else
-																														{
-																															success_flag = false;
-																															PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, doc_p, "Failed to save to \"%s\" -> \"%s\"", data_p -> pgsd_database_s, data_p -> pgsd_populations_collection_s);
-																														}
-
-																													bson_destroy (bson_doc_p);
-																												}
-																											else
-																												{
-																													/*
-																													 * We need to break the doc up into more
-																													 * manageable chunks so make a guess at how
-																													 * many docs we need
-																													 */
-																													size_t num_docs = (size_t) ((double) (bson_doc_p -> len) / (double) BSON_MAX_SIZE) + 1;
-
-
-																													/*
-																													 * Free the memory of the large doc
-																													 */
-																													bson_destroy (bson_doc_p);
-
-																												}
-
-
-																										}		/* if (bson_doc_p) */
-
-
+																									++ row_index;
+																								}
+																							else
+																								{
+																									success_flag = false;
 																								}
 
-																						}		/* if (SetJSONString (doc_p, PGS_POPULATION_NAME_S, name_s)) */
-
-																					FreeCopiedString (name_s);
-																				}		/* if (name_s) */
+																						}		/* while ((row_index < num_rows) && success_flag) */
 
+																					if (success_flag)
+																						{
+																							/*
+																							 * If the population is too big for a single
+																							 * document, this splits it into chunks
+																							 */
+																							if (SavePopulation (data_p -> pgsd_mongo_p, data_p -> pgsd_populations_collection_s, builder_p))
+																								{
+																									*parent_a_ss = parent_a_s;
+																									*parent_b_ss = parent_b_s;
+																								}
+																							else
+																								{
+																									success_flag = false;
+																									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to save population \"%s\" to \"%s\" -> \"%s\"", name_s, data_p -> pgsd_database_s, data_p -> pgsd_populations_collection_s);
+																								}
+																						}
 
-																		}		/* if (parent_b_s) */
+																				}		/* if (SetPopulationString (builder_p, PGS_POPULATION_NAME_S, name_s)) */
 
-																}		/* if (parent_a_s) */
+																			FreeCopiedString (name_s);
+																		}		/* if (name_s) */
 
-														}		/* if (AddGeneticMappingPositions (doc_p, row_p)) */
 
-												}		/* if (AddChromosomes (doc_p, chromosomes_p)) */
+																}		/* if (parent_b_s) */
 
-										}		/* if (num_rows >= 3) */
+														}		/* if (parent_a_s) */
 
-								}		/* if (json_is_array (data_json_p)) */
+												}		/* if (AddGeneticMappingPositions (builder_p, row_p)) */
 
-						}		/* if (AddCompoundIdToJSON (doc_p, id_p)) */
+										}		/* if (AddChromosomes (builder_p, row_p)) */
 
-				}		/* if (id_p) */
+									FreePopulationBuilder (builder_p);
+								}		/* if (builder_p) */
 
+						}		/* if (num_rows >= 3) */
 
-			json_decref (doc_p);
-		}		/* if (doc_p) */
+				}		/* if (json_is_array (data_json_p)) */
 
-	if (!success_flag)
-		{
-			if (id_p)
+			if (!success_flag)
 				{
 					FreeBSONOid (id_p);
 				}
-		}
+
+		}		/* if (id_p) */
 
 
 	return success_flag ? id_p : NULL;
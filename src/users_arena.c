@@ -0,0 +1,139 @@
+/*
+ * users_arena.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <string.h>
+
+#include "users_arena.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+/*
+ * Static declarations
+ */
+
+/** The alignment of the memory returned by AllocUsersArenaMemory (). */
+static const size_t S_ALIGNMENT = sizeof (void *) > sizeof (uint64) ? sizeof (void *) : sizeof (uint64);
+
+
+static void *GetUsersArenaMemory (UsersArena *arena_p, const size_t size, const size_t alignment);
+
+static UsersArenaBlock *AddUsersArenaBlock (UsersArena *arena_p, const size_t min_size);
+
+
+/*
+ * API definitions
+ */
+
+UsersArena *AllocateUsersArena (const size_t block_size)
+{
+	UsersArena *arena_p = (UsersArena *) AllocMemory (sizeof (UsersArena));
+
+	if (arena_p)
+		{
+			arena_p -> ua_current_p = NULL;
+			arena_p -> ua_block_size = (block_size > 0) ? block_size : UA_DEFAULT_BLOCK_SIZE;
+			arena_p -> ua_num_bytes = 0;
+		}
+
+	return arena_p;
+}
+
+
+void FreeUsersArena (UsersArena *arena_p)
+{
+	UsersArenaBlock *block_p = arena_p -> ua_current_p;
+
+	while (block_p)
+		{
+			UsersArenaBlock *next_p = block_p -> uab_next_p;
+
+			FreeMemory (block_p);
+			block_p = next_p;
+		}
+
+	FreeMemory (arena_p);
+}
+
+
+void *AllocUsersArenaMemory (UsersArena *arena_p, const size_t size)
+{
+	return GetUsersArenaMemory (arena_p, size, S_ALIGNMENT);
+}
+
+
+char *CopyToUsersArena (UsersArena *arena_p, const char *value_s)
+{
+	const size_t size = strlen (value_s) + 1;
+	char *copy_s = (char *) GetUsersArenaMemory (arena_p, size, 1);
+
+	if (copy_s)
+		{
+			memcpy (copy_s, value_s, size);
+		}
+
+	return copy_s;
+}
+
+
+/*
+ * Static definitions
+ */
+
+static void *GetUsersArenaMemory (UsersArena *arena_p, const size_t size, const size_t alignment)
+{
+	UsersArenaBlock *block_p = arena_p -> ua_current_p;
+	size_t offset = 0;
+
+	if (block_p)
+		{
+			offset = ((block_p -> uab_used) + alignment - 1) & ~ (alignment - 1);
+		}
+
+	if ((!block_p) || (offset + size > block_p -> uab_size))
+		{
+			/*
+			 * The start of each block's data is aligned so the new
+			 * piece can go straight at the front of it
+			 */
+			block_p = AddUsersArenaBlock (arena_p, size);
+			offset = 0;
+		}
+
+	if (block_p)
+		{
+			block_p -> uab_used = offset + size;
+			arena_p -> ua_num_bytes += size;
+
+			return (block_p -> uab_data) + offset;
+		}
+
+	return NULL;
+}
+
+
+static UsersArenaBlock *AddUsersArenaBlock (UsersArena *arena_p, const size_t min_size)
+{
+	const size_t size = (min_size > arena_p -> ua_block_size) ? min_size : arena_p -> ua_block_size;
+	UsersArenaBlock *block_p = (UsersArenaBlock *) AllocMemory (sizeof (UsersArenaBlock) + size);
+
+	if (block_p)
+		{
+			block_p -> uab_next_p = arena_p -> ua_current_p;
+			block_p -> uab_size = size;
+			block_p -> uab_used = 0;
+
+			arena_p -> ua_current_p = block_p;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate arena block of " SIZET_FMT " bytes", size);
+		}
+
+	return block_p;
+}
@@ -0,0 +1,285 @@
+/*
+ * users_cache.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <string.h>
+
+#include "users_cache.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "mongodb_util.h"
+
+
+/*
+ * Static declarations
+ */
+
+static User *CopyUser (const User *user_p);
+
+static UsersCacheEntry *FindUsersCacheEntry (UsersCache *cache_p, const char *id_s);
+
+static void ClearUsersCacheEntry (UsersCacheEntry *entry_p);
+
+
+/*
+ * API definitions
+ */
+
+UsersCache *AllocateUsersCache (const uint32 capacity, const uint32 ttl)
+{
+	UsersCacheEntry *entries_p = (UsersCacheEntry *) AllocMemoryArray (capacity, sizeof (UsersCacheEntry));
+
+	if (entries_p)
+		{
+			UsersCache *cache_p = (UsersCache *) AllocMemory (sizeof (UsersCache));
+
+			if (cache_p)
+				{
+					if (pthread_mutex_init (& (cache_p -> uc_lock), NULL) == 0)
+						{
+							uint32 i;
+
+							for (i = 0; i < capacity; ++ i)
+								{
+									* ((entries_p + i) -> uce_id_s) = '\0';
+									(entries_p + i) -> uce_user_p = NULL;
+									(entries_p + i) -> uce_load_time = 0;
+									(entries_p + i) -> uce_last_used = 0;
+								}
+
+							cache_p -> uc_entries_p = entries_p;
+							cache_p -> uc_capacity = capacity;
+							cache_p -> uc_ttl = ttl;
+							cache_p -> uc_clock = 0;
+							cache_p -> uc_generation = 0;
+
+							return cache_p;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise UsersCache lock");
+						}
+
+					FreeMemory (cache_p);
+				}
+
+			FreeMemory (entries_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeUsersCache (UsersCache *cache_p)
+{
+	uint32 i;
+
+	for (i = 0; i < cache_p -> uc_capacity; ++ i)
+		{
+			ClearUsersCacheEntry ((cache_p -> uc_entries_p) + i);
+		}
+
+	pthread_mutex_destroy (& (cache_p -> uc_lock));
+
+	FreeMemory (cache_p -> uc_entries_p);
+	FreeMemory (cache_p);
+}
+
+
+User *GetUserFromUsersCache (UsersCache *cache_p, const char *id_s, GrassrootsServer *grassroots_p)
+{
+	User *user_p = NULL;
+	UsersCacheEntry *entry_p;
+	uint64 generation;
+	const time_t now = time (NULL);
+
+	if (strlen (id_s) >= MONGO_OID_STRING_BUFFER_SIZE)
+		{
+			return GetUserByIdString (grassroots_p, id_s);
+		}
+
+	pthread_mutex_lock (& (cache_p -> uc_lock));
+
+	entry_p = FindUsersCacheEntry (cache_p, id_s);
+
+	if (entry_p)
+		{
+			if ((cache_p -> uc_ttl == 0) || (now < (entry_p -> uce_load_time) + (time_t) (cache_p -> uc_ttl)))
+				{
+					entry_p -> uce_last_used = ++ (cache_p -> uc_clock);
+					user_p = CopyUser (entry_p -> uce_user_p);
+				}
+			else
+				{
+					ClearUsersCacheEntry (entry_p);
+				}
+		}
+
+	generation = cache_p -> uc_generation;
+
+	pthread_mutex_unlock (& (cache_p -> uc_lock));
+
+	if (user_p)
+		{
+			return user_p;
+		}
+
+	/*
+	 * Load the User without holding the lock
+	 */
+	user_p = GetUserByIdString (grassroots_p, id_s);
+
+	if (user_p)
+		{
+			User *copied_user_p = CopyUser (user_p);
+
+			if (copied_user_p)
+				{
+					pthread_mutex_lock (& (cache_p -> uc_lock));
+
+					/*
+					 * Only add the User if nothing has been removed while
+					 * we were loading it and another request hasn't already
+					 * added it.
+					 */
+					if ((generation == cache_p -> uc_generation) && (!FindUsersCacheEntry (cache_p, id_s)))
+						{
+							UsersCacheEntry *oldest_entry_p = cache_p -> uc_entries_p;
+							uint32 i;
+
+							for (i = 1; i < cache_p -> uc_capacity; ++ i)
+								{
+									UsersCacheEntry *current_entry_p = (cache_p -> uc_entries_p) + i;
+
+									if (current_entry_p -> uce_last_used < oldest_entry_p -> uce_last_used)
+										{
+											oldest_entry_p = current_entry_p;
+										}
+								}
+
+							ClearUsersCacheEntry (oldest_entry_p);
+
+							strcpy (oldest_entry_p -> uce_id_s, id_s);
+							oldest_entry_p -> uce_user_p = copied_user_p;
+							oldest_entry_p -> uce_load_time = now;
+							oldest_entry_p -> uce_last_used = ++ (cache_p -> uc_clock);
+
+							copied_user_p = NULL;
+						}
+
+					pthread_mutex_unlock (& (cache_p -> uc_lock));
+
+					if (copied_user_p)
+						{
+							FreeUser (copied_user_p);
+						}
+				}
+
+		}		/* if (user_p) */
+
+	return user_p;
+}
+
+
+void RemoveUserFromUsersCache (UsersCache *cache_p, const bson_oid_t *id_p)
+{
+	char id_s [MONGO_OID_STRING_BUFFER_SIZE];
+	UsersCacheEntry *entry_p;
+
+	bson_oid_to_string (id_p, id_s);
+
+	pthread_mutex_lock (& (cache_p -> uc_lock));
+
+	entry_p = FindUsersCacheEntry (cache_p, id_s);
+
+	if (entry_p)
+		{
+			ClearUsersCacheEntry (entry_p);
+		}
+
+	++ (cache_p -> uc_generation);
+
+	pthread_mutex_unlock (& (cache_p -> uc_lock));
+}
+
+
+void ClearUsersCache (UsersCache *cache_p)
+{
+	uint32 i;
+
+	pthread_mutex_lock (& (cache_p -> uc_lock));
+
+	for (i = 0; i < cache_p -> uc_capacity; ++ i)
+		{
+			ClearUsersCacheEntry ((cache_p -> uc_entries_p) + i);
+		}
+
+	++ (cache_p -> uc_generation);
+
+	pthread_mutex_unlock (& (cache_p -> uc_lock));
+}
+
+
+/*
+ * Static definitions
+ */
+
+static User *CopyUser (const User *user_p)
+{
+	bson_oid_t *id_p = GetNewUnitialisedBSONOid ();
+
+	if (id_p)
+		{
+			User *copied_user_p;
+
+			bson_oid_copy (user_p -> us_id_p, id_p);
+
+			copied_user_p = AllocateUser (id_p, user_p -> us_email_s, user_p -> us_forename_s, user_p -> us_surname_s, user_p -> us_org_s, user_p -> us_orcid_s);
+
+			if (copied_user_p)
+				{
+					return copied_user_p;
+				}
+
+			FreeBSONOid (id_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to copy User \"%s\"", user_p -> us_email_s);
+
+	return NULL;
+}
+
+
+static UsersCacheEntry *FindUsersCacheEntry (UsersCache *cache_p, const char *id_s)
+{
+	UsersCacheEntry *entry_p = cache_p -> uc_entries_p;
+	uint32 i;
+
+	for (i = 0; i < cache_p -> uc_capacity; ++ i, ++ entry_p)
+		{
+			if ((entry_p -> uce_user_p) && (strcmp (entry_p -> uce_id_s, id_s) == 0))
+				{
+					return entry_p;
+				}
+		}
+
+	return NULL;
+}
+
+
+static void ClearUsersCacheEntry (UsersCacheEntry *entry_p)
+{
+	if (entry_p -> uce_user_p)
+		{
+			FreeUser (entry_p -> uce_user_p);
+			entry_p -> uce_user_p = NULL;
+		}
+
+	* (entry_p -> uce_id_s) = '\0';
+	entry_p -> uce_load_time = 0;
+	entry_p -> uce_last_used = 0;
+}
@@ -0,0 +1,310 @@
+/*
+ * users_cursor.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <string.h>
+
+#include "users_cursor.h"
+
+#include "streams.h"
+#include "string_utils.h"
+#include "mongodb_util.h"
+#include "user.h"
+
+#include "users_service_data.h"
+
+
+#ifdef _DEBUG
+#define USERS_CURSOR_DEBUG	(STM_LEVEL_FINE)
+#else
+#define USERS_CURSOR_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * Static declarations
+ */
+
+static bool DecodeUsersCursorRow (UsersCursorRow *row_p, const bson_t *doc_p);
+
+
+/*
+ * API definitions
+ */
+
+bool OpenUsersCursor (UsersCursor *cursor_p, MongoTool *tool_p, const char *collection_s, const bson_t *query_p, const char * const *fields_ss)
+{
+	bool success_flag = false;
+
+	cursor_p -> uc_cursor_p = NULL;
+	cursor_p -> uc_failed_flag = false;
+	cursor_p -> uc_num_rows = 0;
+	cursor_p -> uc_num_bytes = 0;
+	clock_gettime (CLOCK_MONOTONIC, & (cursor_p -> uc_start));
+	memset (& (cursor_p -> uc_row), 0, sizeof (UsersCursorRow));
+
+	if (SetMongoToolCollection (tool_p, collection_s))
+		{
+			bson_t *opts_p = GetUsersQueryOptions (fields_ss);
+
+			if (opts_p)
+				{
+					bson_t *empty_query_p = NULL;
+
+					if (!query_p)
+						{
+							empty_query_p = bson_new ();
+							query_p = empty_query_p;
+						}
+
+					if (query_p)
+						{
+							cursor_p -> uc_cursor_p = mongoc_collection_find_with_opts (tool_p -> mt_collection_p, query_p, opts_p, NULL);
+
+							if (cursor_p -> uc_cursor_p)
+								{
+									success_flag = true;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open cursor for \"%s\"", collection_s);
+								}
+						}
+
+					if (empty_query_p)
+						{
+							bson_destroy (empty_query_p);
+						}
+
+					bson_destroy (opts_p);
+				}		/* if (opts_p) */
+
+		}		/* if (SetMongoToolCollection (tool_p, collection_s)) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set collection to \"%s\"", collection_s);
+		}
+
+	return success_flag;
+}
+
+
+const UsersCursorRow *GetNextUsersCursorRow (UsersCursor *cursor_p)
+{
+	const bson_t *doc_p = NULL;
+
+	if ((! (cursor_p -> uc_failed_flag)) && (mongoc_cursor_next (cursor_p -> uc_cursor_p, &doc_p)))
+		{
+			++ (cursor_p -> uc_num_rows);
+			cursor_p -> uc_num_bytes += doc_p -> len;
+
+			if (DecodeUsersCursorRow (& (cursor_p -> uc_row), doc_p))
+				{
+					return & (cursor_p -> uc_row);
+				}
+			else
+				{
+					cursor_p -> uc_failed_flag = true;
+				}
+		}
+	else
+		{
+			bson_error_t error;
+
+			if (mongoc_cursor_error (cursor_p -> uc_cursor_p, &error))
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get next User: %s", error.message);
+					cursor_p -> uc_failed_flag = true;
+				}
+		}
+
+	return NULL;
+}
+
+
+bool HasUsersCursorFailed (const UsersCursor *cursor_p)
+{
+	return cursor_p -> uc_failed_flag;
+}
+
+
+void CloseUsersCursor (UsersCursor *cursor_p)
+{
+	if (cursor_p -> uc_cursor_p)
+		{
+			#if USERS_CURSOR_DEBUG >= STM_LEVEL_FINE
+				{
+					struct timespec end;
+					double elapsed;
+
+					/*
+					 * clock () would give the CPU time used by the whole
+					 * process rather than how long this cursor took
+					 */
+					clock_gettime (CLOCK_MONOTONIC, &end);
+					elapsed = ((double) (end.tv_sec - cursor_p -> uc_start.tv_sec)) + ((double) (end.tv_nsec - cursor_p -> uc_start.tv_nsec)) / 1000000000.0;
+
+					PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Read " SIZET_FMT " users, " SIZET_FMT " bytes in %lf seconds", cursor_p -> uc_num_rows, cursor_p -> uc_num_bytes, elapsed);
+				}
+			#endif
+
+			mongoc_cursor_destroy (cursor_p -> uc_cursor_p);
+			cursor_p -> uc_cursor_p = NULL;
+		}
+}
+
+
+bson_t *GetUsersQueryOptions (const char * const *fields_ss)
+{
+	/*
+	 * The sort key is indexed so this is an index-ordered scan
+	 */
+	bson_t *opts_p = BCON_NEW ("sort", "{", US_SORT_KEY_S, BCON_INT32 (1), "}");
+
+	if (opts_p)
+		{
+			if (fields_ss)
+				{
+					bson_t projection;
+
+					if (BSON_APPEND_DOCUMENT_BEGIN (opts_p, "projection", &projection))
+						{
+							bool success_flag = BSON_APPEND_INT32 (&projection, US_SORT_KEY_S, 1) && BSON_APPEND_INT32 (&projection, US_DISPLAY_NAME_S, 1);
+
+							while (*fields_ss && success_flag)
+								{
+									if (BSON_APPEND_INT32 (&projection, *fields_ss, 1))
+										{
+											++ fields_ss;
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add \"%s\" to projection", *fields_ss);
+											success_flag = false;
+										}
+								}
+
+							if (bson_append_document_end (opts_p, &projection) && success_flag)
+								{
+									return opts_p;
+								}
+
+						}		/* if (BSON_APPEND_DOCUMENT_BEGIN (opts_p, "projection", &projection)) */
+
+					bson_destroy (opts_p);
+					opts_p = NULL;
+				}		/* if (fields_ss) */
+
+		}		/* if (opts_p) */
+
+	return opts_p;
+}
+
+
+char *GetUsersCursorRowName (const UsersCursorRow *row_p)
+{
+	char *name_s = NULL;
+
+	/*
+	 * Use the same "<forename> <surname>" form as GetFullUsername ()
+	 * straight from the row's strings
+	 */
+	if (row_p -> ucr_forename_s && row_p -> ucr_surname_s)
+		{
+			name_s = ConcatenateVarargsStrings (row_p -> ucr_forename_s, " ", row_p -> ucr_surname_s, NULL);
+		}
+	else if (row_p -> ucr_surname_s)
+		{
+			name_s = EasyCopyToNewString (row_p -> ucr_surname_s);
+		}
+	else if (row_p -> ucr_forename_s)
+		{
+			name_s = EasyCopyToNewString (row_p -> ucr_forename_s);
+		}
+	else if (row_p -> ucr_email_s)
+		{
+			name_s = EasyCopyToNewString (row_p -> ucr_email_s);
+		}
+
+	return name_s;
+}
+
+
+void FreeUsersCursorRowName (char *name_s)
+{
+	FreeCopiedString (name_s);
+}
+
+
+/*
+ * Static definitions
+ */
+
+/*
+ * Read the fields that we need straight from the BSON document
+ * rather than converting it to JSON and then to a User first.
+ */
+static bool DecodeUsersCursorRow (UsersCursorRow *row_p, const bson_t *doc_p)
+{
+	bool id_flag = false;
+	bson_iter_t iter;
+
+	row_p -> ucr_surname_s = NULL;
+	row_p -> ucr_forename_s = NULL;
+	row_p -> ucr_email_s = NULL;
+	row_p -> ucr_timestamp = 0;
+	row_p -> ucr_sort_key_s = NULL;
+	row_p -> ucr_display_name_s = NULL;
+	row_p -> ucr_doc_p = doc_p;
+
+	if (bson_iter_init (&iter, doc_p))
+		{
+			while (bson_iter_next (&iter))
+				{
+					const char *key_s = bson_iter_key (&iter);
+
+					if (BSON_ITER_HOLDS_UTF8 (&iter))
+						{
+							if (strcmp (key_s, US_SURNAME_S) == 0)
+								{
+									row_p -> ucr_surname_s = bson_iter_utf8 (&iter, NULL);
+								}
+							else if (strcmp (key_s, US_FORENAME_S) == 0)
+								{
+									row_p -> ucr_forename_s = bson_iter_utf8 (&iter, NULL);
+								}
+							else if (strcmp (key_s, US_EMAIL_S) == 0)
+								{
+									row_p -> ucr_email_s = bson_iter_utf8 (&iter, NULL);
+								}
+							else if (strcmp (key_s, US_SORT_KEY_S) == 0)
+								{
+									row_p -> ucr_sort_key_s = bson_iter_utf8 (&iter, NULL);
+								}
+							else if (strcmp (key_s, US_DISPLAY_NAME_S) == 0)
+								{
+									row_p -> ucr_display_name_s = bson_iter_utf8 (&iter, NULL);
+								}
+						}
+					else if (BSON_ITER_HOLDS_OID (&iter) && (strcmp (key_s, MONGO_ID_S) == 0))
+						{
+							bson_oid_to_string (bson_iter_oid (&iter), row_p -> ucr_id_s);
+							id_flag = true;
+						}
+					else if (BSON_ITER_HOLDS_DATE_TIME (&iter) && (strcmp (key_s, MONGO_TIMESTAMP_S) == 0))
+						{
+							row_p -> ucr_timestamp = bson_iter_date_time (&iter);
+						}
+				}
+		}
+
+	if (!id_flag)
+		{
+			PrintBSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, doc_p, "Failed to get \"%s\"", MONGO_ID_S);
+		}
+
+	return id_flag;
+}
@@ -0,0 +1,1104 @@
+/*
+ * users_directory.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "users_directory.h"
+#include "users_cursor.h"
+#include "users_sort_key.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+#include "mongodb_util.h"
+#include "user.h"
+
+
+/*
+ * Static declarations
+ */
+
+/** The number of entries to allocate if we can't estimate the number of Users. */
+static const size_t S_DEFAULT_CAPACITY = 64;
+
+/** The fields needed to display and search for each User. */
+static const char * const S_DIRECTORY_FIELDS_SS [] = { US_SURNAME_S, US_FORENAME_S, US_EMAIL_S, MONGO_TIMESTAMP_S, NULL };
+
+/** Marks an entry that has been replaced or deleted when merging. */
+static const size_t S_DROPPED_ENTRY = (size_t) -1;
+
+
+static UsersDirectorySnapshot *LoadUsersDirectorySnapshot (MongoTool *tool_p, const char *collection_s, const bson_t *query_p, const size_t capacity);
+
+static UsersDirectorySnapshot *SyncUsersDirectorySnapshot (const UsersDirectorySnapshot *previous_p, MongoTool *tool_p, const char *collection_s, const UsersDirectoryTombstone *tombstones_p, const size_t num_tombstones, const uint32 overlap_ms, const bool count_flag);
+
+static int64 CountUsers (MongoTool *tool_p, const char *collection_s);
+
+static UsersDirectorySnapshot *MergeUsersDirectorySnapshots (const UsersDirectorySnapshot *previous_p, const UsersDirectorySnapshot *changes_p, const UsersDirectoryTombstone *tombstones_p, const size_t num_tombstones);
+
+static bool MarkDroppedUsersDirectoryEntries (const UsersDirectorySnapshot *previous_p, const UsersDirectorySnapshot *changes_p, const UsersDirectoryTombstone *tombstones_p, const size_t num_tombstones, size_t *indexes_p);
+
+static UsersDirectorySnapshot *AllocateUsersDirectorySnapshot (const size_t capacity);
+
+static bool ReserveUsersDirectorySnapshot (UsersDirectorySnapshot *snapshot_p, const size_t capacity);
+
+static bool AddUsersDirectoryRow (UsersDirectorySnapshot *snapshot_p, const UsersCursorRow *row_p);
+
+static UsersDirectoryEntry *AddUsersDirectoryEntry (UsersDirectorySnapshot *snapshot_p, const char *id_s, const char *name_s, const char *sort_key_s);
+
+static bool CopyUsersDirectoryKey (UsersDirectorySnapshot *snapshot_p, const char *key_s, const size_t entry_index);
+
+static void FreeUsersDirectorySnapshot (UsersDirectorySnapshot *snapshot_p);
+
+static void DecrementUsersDirectorySnapshotReferences (UsersDirectorySnapshot *snapshot_p);
+
+static bool IsUsersDirectorySnapshotCurrent (const UsersDirectory *directory_p, const time_t now);
+
+static void ReloadUsersDirectory (UsersDirectory *directory_p, UsersMongoPool *pool_p, const char *collection_s, const time_t now);
+
+static char *GetNormalisedUsersDirectoryKey (const char *value_s, UsersArena *arena_p);
+
+static bool AddUsersDirectoryKey (UsersDirectorySnapshot *snapshot_p, const char *value_s, const size_t entry_index);
+
+static int CompareUsersDirectoryKeys (const void *v0_p, const void *v1_p);
+
+static int CompareUsersDirectoryEntryAddresses (const void *v0_p, const void *v1_p);
+
+static int CompareUsersDirectoryEntryNames (const UsersDirectoryEntry *entry0_p, const UsersDirectoryEntry *entry1_p);
+
+static int CompareIdStrings (const void *v0_p, const void *v1_p);
+
+
+/*
+ * API definitions
+ */
+
+UsersDirectory *AllocateUsersDirectory (const uint32 ttl, const uint32 sync_overlap_ms, const uint32 full_reload_interval)
+{
+	UsersDirectory *directory_p = (UsersDirectory *) AllocMemory (sizeof (UsersDirectory));
+
+	if (directory_p)
+		{
+			if (pthread_mutex_init (& (directory_p -> ud_lock), NULL) == 0)
+				{
+					if (pthread_cond_init (& (directory_p -> ud_loaded), NULL) == 0)
+						{
+							directory_p -> ud_snapshot_p = NULL;
+							directory_p -> ud_load_time = 0;
+							directory_p -> ud_full_load_time = 0;
+							directory_p -> ud_full_reload_interval = full_reload_interval;
+							directory_p -> ud_ttl = ttl;
+							directory_p -> ud_sync_overlap_ms = sync_overlap_ms;
+							directory_p -> ud_num_invalidations = 0;
+							directory_p -> ud_stale_flag = true;
+							directory_p -> ud_loading_flag = false;
+							directory_p -> ud_num_loads = 0;
+							directory_p -> ud_revision = 0;
+							directory_p -> ud_tombstones_p = NULL;
+							directory_p -> ud_num_tombstones = 0;
+							directory_p -> ud_tombstones_capacity = 0;
+							directory_p -> ud_full_reload_flag = false;
+							directory_p -> ud_tracking_deletions_flag = false;
+							directory_p -> ud_count_next_sync_flag = false;
+
+							return directory_p;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise UsersDirectory condition");
+						}
+
+					pthread_mutex_destroy (& (directory_p -> ud_lock));
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise UsersDirectory lock");
+				}
+
+			FreeMemory (directory_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeUsersDirectory (UsersDirectory *directory_p)
+{
+	if (directory_p -> ud_snapshot_p)
+		{
+			DecrementUsersDirectorySnapshotReferences (directory_p -> ud_snapshot_p);
+		}
+
+	if (directory_p -> ud_tombstones_p)
+		{
+			FreeMemory (directory_p -> ud_tombstones_p);
+		}
+
+	pthread_cond_destroy (& (directory_p -> ud_loaded));
+	pthread_mutex_destroy (& (directory_p -> ud_lock));
+
+	FreeMemory (directory_p);
+}
+
+
+void InvalidateUsersDirectory (UsersDirectory *directory_p)
+{
+	pthread_mutex_lock (& (directory_p -> ud_lock));
+
+	directory_p -> ud_stale_flag = true;
+	++ (directory_p -> ud_num_invalidations);
+
+	pthread_mutex_unlock (& (directory_p -> ud_lock));
+}
+
+
+void SetUsersDirectoryDeletionTracking (UsersDirectory *directory_p, const bool tracking_flag)
+{
+	pthread_mutex_lock (& (directory_p -> ud_lock));
+
+	if (tracking_flag && (! (directory_p -> ud_tracking_deletions_flag)))
+		{
+			/* Anything deleted before now won't have a tombstone */
+			directory_p -> ud_count_next_sync_flag = true;
+		}
+
+	directory_p -> ud_tracking_deletions_flag = tracking_flag;
+
+	pthread_mutex_unlock (& (directory_p -> ud_lock));
+}
+
+
+bool RemoveUserFromUsersDirectory (UsersDirectory *directory_p, const bson_oid_t *id_p)
+{
+	bool success_flag = true;
+
+	pthread_mutex_lock (& (directory_p -> ud_lock));
+
+	if (directory_p -> ud_num_tombstones == directory_p -> ud_tombstones_capacity)
+		{
+			const size_t capacity = (directory_p -> ud_tombstones_capacity > 0) ? (directory_p -> ud_tombstones_capacity) << 1 : S_DEFAULT_CAPACITY;
+			UsersDirectoryTombstone *tombstones_p = (UsersDirectoryTombstone *) AllocMemoryArray (capacity, sizeof (UsersDirectoryTombstone));
+
+			if (tombstones_p)
+				{
+					if (directory_p -> ud_tombstones_p)
+						{
+							memcpy (tombstones_p, directory_p -> ud_tombstones_p, (directory_p -> ud_num_tombstones) * sizeof (UsersDirectoryTombstone));
+							FreeMemory (directory_p -> ud_tombstones_p);
+						}
+
+					directory_p -> ud_tombstones_p = tombstones_p;
+					directory_p -> ud_tombstones_capacity = capacity;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " users directory tombstones", capacity);
+					success_flag = false;
+				}
+		}
+
+	if (success_flag)
+		{
+			bson_oid_to_string (id_p, directory_p -> ud_tombstones_p [directory_p -> ud_num_tombstones].udt_id_s);
+			++ (directory_p -> ud_num_tombstones);
+		}
+	else
+		{
+			/* Without the tombstone, the only way to drop the User is to reload everything */
+			directory_p -> ud_full_reload_flag = true;
+		}
+
+	directory_p -> ud_stale_flag = true;
+	++ (directory_p -> ud_num_invalidations);
+
+	pthread_mutex_unlock (& (directory_p -> ud_lock));
+
+	return success_flag;
+}
+
+
+const UsersDirectorySnapshot *AcquireUsersDirectorySnapshot (UsersDirectory *directory_p, UsersMongoPool *pool_p, const char *collection_s)
+{
+	UsersDirectorySnapshot *snapshot_p = NULL;
+	time_t now = time (NULL);
+
+	pthread_mutex_lock (& (directory_p -> ud_lock));
+
+	if (!IsUsersDirectorySnapshotCurrent (directory_p, now))
+		{
+			if (directory_p -> ud_loading_flag)
+				{
+					/*
+					 * Another request is already running the query. If there
+					 * is a snapshot, serve that rather than holding this
+					 * request up. Otherwise wait for the load and use its
+					 * result rather than running the same query again.
+					 */
+					if (! (directory_p -> ud_snapshot_p))
+						{
+							const uint32 num_loads = directory_p -> ud_num_loads;
+
+							while ((directory_p -> ud_loading_flag) && (directory_p -> ud_num_loads == num_loads))
+								{
+									pthread_cond_wait (& (directory_p -> ud_loaded), & (directory_p -> ud_lock));
+								}
+						}
+				}
+			else
+				{
+					ReloadUsersDirectory (directory_p, pool_p, collection_s, now);
+				}
+		}
+
+	/*
+	 * If the reload failed, an out of date list is better than no list
+	 */
+	snapshot_p = directory_p -> ud_snapshot_p;
+
+	if (snapshot_p)
+		{
+			++ (snapshot_p -> uds_num_refs);
+		}
+
+	pthread_mutex_unlock (& (directory_p -> ud_lock));
+
+	return snapshot_p;
+}
+
+
+void ReleaseUsersDirectorySnapshot (UsersDirectory *directory_p, const UsersDirectorySnapshot *snapshot_p)
+{
+	pthread_mutex_lock (& (directory_p -> ud_lock));
+
+	DecrementUsersDirectorySnapshotReferences ((UsersDirectorySnapshot *) snapshot_p);
+
+	pthread_mutex_unlock (& (directory_p -> ud_lock));
+}
+
+
+size_t SearchUsersDirectorySnapshot (const UsersDirectorySnapshot *snapshot_p, const char *prefix_s, const UsersDirectoryEntry **matches_pp, const size_t max_num_matches)
+{
+	size_t num_matches = 0;
+	char *normalised_prefix_s = GetNormalisedUsersDirectoryKey (prefix_s, NULL);
+
+	if (normalised_prefix_s)
+		{
+			const size_t prefix_length = strlen (normalised_prefix_s);
+
+			if (prefix_length > 0)
+				{
+					const UsersDirectoryKey *keys_p = snapshot_p -> uds_keys_p;
+					size_t lower = 0;
+					size_t upper = snapshot_p -> uds_num_keys;
+
+					/*
+					 * Find the first key that is not less than the prefix
+					 */
+					while (lower < upper)
+						{
+							const size_t mid = lower + ((upper - lower) >> 1);
+
+							if (strcmp (keys_p [mid].udk_key_s, normalised_prefix_s) < 0)
+								{
+									lower = mid + 1;
+								}
+							else
+								{
+									upper = mid;
+								}
+						}
+
+					/*
+					 * All of the keys starting with the prefix are now
+					 * contiguous from here
+					 */
+					while ((lower < snapshot_p -> uds_num_keys) && (num_matches < max_num_matches) && (strncmp (keys_p [lower].udk_key_s, normalised_prefix_s, prefix_length) == 0))
+						{
+							const UsersDirectoryEntry *entry_p = (snapshot_p -> uds_entries_p) + (keys_p [lower].udk_entry_index);
+							size_t i;
+
+							/*
+							 * A User can match on more than one of their keys
+							 */
+							for (i = 0; (i < num_matches) && (matches_pp [i] != entry_p); ++ i)
+								{
+								}
+
+							if (i == num_matches)
+								{
+									matches_pp [num_matches] = entry_p;
+									++ num_matches;
+								}
+
+							++ lower;
+						}
+
+					if (num_matches > 1)
+						{
+							qsort (matches_pp, num_matches, sizeof (const UsersDirectoryEntry *), CompareUsersDirectoryEntryAddresses);
+						}
+
+				}		/* if (prefix_length > 0) */
+
+			FreeCopiedString (normalised_prefix_s);
+		}		/* if (normalised_prefix_s) */
+
+	return num_matches;
+}
+
+
+/*
+ * Static definitions
+ */
+
+static bool IsUsersDirectorySnapshotCurrent (const UsersDirectory *directory_p, const time_t now)
+{
+	bool current_flag = false;
+
+	if ((directory_p -> ud_snapshot_p) && (! (directory_p -> ud_stale_flag)))
+		{
+			if ((directory_p -> ud_ttl == 0) || (now - (directory_p -> ud_load_time) < (time_t) (directory_p -> ud_ttl)))
+				{
+					current_flag = true;
+				}
+		}
+
+	return current_flag;
+}
+
+
+/*
+ * This is called with the directory's lock held and returns with it
+ * held, but releases it while the database is being read.
+ */
+static void ReloadUsersDirectory (UsersDirectory *directory_p, UsersMongoPool *pool_p, const char *collection_s, const time_t now)
+{
+	UsersDirectorySnapshot *loaded_snapshot_p = NULL;
+	UsersDirectorySnapshot *previous_snapshot_p = NULL;
+	UsersDirectoryTombstone *tombstones_p = directory_p -> ud_tombstones_p;
+	const size_t num_tombstones = directory_p -> ud_num_tombstones;
+	MongoTool *tool_p;
+	const uint32 num_invalidations = directory_p -> ud_num_invalidations;
+	const bool count_flag = (! (directory_p -> ud_tracking_deletions_flag)) || (directory_p -> ud_count_next_sync_flag);
+	bool full_flag = true;
+
+	/*
+	 * Keep hold of the current snapshot so that the changes can be
+	 * merged into it, unless we need to start again from scratch,
+	 * either because a sync can't be trusted or as a periodic
+	 * backstop for any deletions that were missed
+	 */
+	if (! ((directory_p -> ud_full_reload_flag) || ((directory_p -> ud_full_reload_interval > 0) && (now - (directory_p -> ud_full_load_time) >= (time_t) (directory_p -> ud_full_reload_interval)))))
+		{
+			previous_snapshot_p = directory_p -> ud_snapshot_p;
+
+			if (previous_snapshot_p)
+				{
+					++ (previous_snapshot_p -> uds_num_refs);
+				}
+		}
+
+	directory_p -> ud_tombstones_p = NULL;
+	directory_p -> ud_num_tombstones = 0;
+	directory_p -> ud_tombstones_capacity = 0;
+	directory_p -> ud_full_reload_flag = false;
+	directory_p -> ud_count_next_sync_flag = false;
+	directory_p -> ud_loading_flag = true;
+
+	pthread_mutex_unlock (& (directory_p -> ud_lock));
+
+	/*
+	 * Do the database work without holding the lock so that
+	 * other requests can carry on using the current snapshot
+	 */
+	tool_p = CheckOutMongoTool (pool_p);
+
+	if (previous_snapshot_p && (previous_snapshot_p -> uds_watermark > 0))
+		{
+			loaded_snapshot_p = SyncUsersDirectorySnapshot (previous_snapshot_p, tool_p, collection_s, tombstones_p, num_tombstones, directory_p -> ud_sync_overlap_ms, count_flag);
+
+			if (loaded_snapshot_p)
+				{
+					full_flag = false;
+				}
+		}
+
+	if (!loaded_snapshot_p)
+		{
+			loaded_snapshot_p = LoadUsersDirectorySnapshot (tool_p, collection_s, NULL, 0);
+		}
+
+	CheckInMongoTool (pool_p, tool_p);
+
+	if (tombstones_p)
+		{
+			FreeMemory (tombstones_p);
+		}
+
+	pthread_mutex_lock (& (directory_p -> ud_lock));
+
+	if (previous_snapshot_p)
+		{
+			DecrementUsersDirectorySnapshotReferences (previous_snapshot_p);
+		}
+
+	if (loaded_snapshot_p)
+		{
+			if (directory_p -> ud_snapshot_p)
+				{
+					DecrementUsersDirectorySnapshotReferences (directory_p -> ud_snapshot_p);
+				}
+
+			/* The directory holds its own reference to its current snapshot */
+			loaded_snapshot_p -> uds_num_refs = 1;
+			loaded_snapshot_p -> uds_revision = ++ (directory_p -> ud_revision);
+			directory_p -> ud_snapshot_p = loaded_snapshot_p;
+			directory_p -> ud_load_time = now;
+
+			if (full_flag)
+				{
+					directory_p -> ud_full_load_time = now;
+				}
+
+			/*
+			 * If a User was saved while we were loading, we might have
+			 * missed it so leave the directory marked as stale
+			 */
+			if (directory_p -> ud_num_invalidations == num_invalidations)
+				{
+					directory_p -> ud_stale_flag = false;
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to reload users directory from \"%s\", using previous snapshot", collection_s);
+
+			/*
+			 * The tombstones have gone so make sure that the next
+			 * reload doesn't miss any deletions
+			 */
+			if (num_tombstones > 0)
+				{
+					directory_p -> ud_full_reload_flag = true;
+				}
+
+			if (count_flag)
+				{
+					directory_p -> ud_count_next_sync_flag = true;
+				}
+		}
+
+	directory_p -> ud_loading_flag = false;
+	++ (directory_p -> ud_num_loads);
+
+	pthread_cond_broadcast (& (directory_p -> ud_loaded));
+}
+
+
+static void DecrementUsersDirectorySnapshotReferences (UsersDirectorySnapshot *snapshot_p)
+{
+	-- (snapshot_p -> uds_num_refs);
+
+	if (snapshot_p -> uds_num_refs == 0)
+		{
+			FreeUsersDirectorySnapshot (snapshot_p);
+		}
+}
+
+
+/*
+ * If capacity is 0, the snapshot is sized from the number of
+ * documents in the collection.
+ */
+static UsersDirectorySnapshot *LoadUsersDirectorySnapshot (MongoTool *tool_p, const char *collection_s, const bson_t *query_p, const size_t capacity)
+{
+	UsersDirectorySnapshot *snapshot_p = NULL;
+	UsersCursor cursor;
+
+	if (OpenUsersCursor (&cursor, tool_p, collection_s, query_p, S_DIRECTORY_FIELDS_SS))
+		{
+			size_t initial_capacity = capacity;
+
+			if (initial_capacity == 0)
+				{
+					int64 num_docs = mongoc_collection_estimated_document_count (tool_p -> mt_collection_p, NULL, NULL, NULL, NULL);
+
+					/*
+					 * Size the snapshot up front so that it rarely needs to grow
+					 */
+					initial_capacity = (num_docs > 0) ? (size_t) num_docs : S_DEFAULT_CAPACITY;
+				}
+
+			snapshot_p = AllocateUsersDirectorySnapshot (initial_capacity);
+
+			if (snapshot_p)
+				{
+					bool success_flag = true;
+					const UsersCursorRow *row_p = NULL;
+
+					while (success_flag && ((row_p = GetNextUsersCursorRow (&cursor)) != NULL))
+						{
+							success_flag = AddUsersDirectoryRow (snapshot_p, row_p);
+						}
+
+					if (HasUsersCursorFailed (&cursor))
+						{
+							success_flag = false;
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get users from \"%s\"", collection_s);
+						}
+
+					if (success_flag)
+						{
+							qsort (snapshot_p -> uds_keys_p, snapshot_p -> uds_num_keys, sizeof (UsersDirectoryKey), CompareUsersDirectoryKeys);
+
+							PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Loaded " SIZET_FMT " users with " SIZET_FMT " bytes of names and keys", snapshot_p -> uds_num_entries, snapshot_p -> uds_arena_p -> ua_num_bytes);
+						}
+					else
+						{
+							FreeUsersDirectorySnapshot (snapshot_p);
+							snapshot_p = NULL;
+						}
+
+				}		/* if (snapshot_p) */
+
+			CloseUsersCursor (&cursor);
+		}		/* if (OpenUsersCursor (&cursor, tool_p, collection_s, query_p, S_DIRECTORY_FIELDS_SS)) */
+
+	return snapshot_p;
+}
+
+
+/*
+ * Fetch the Users saved since the previous snapshot was loaded and
+ * merge them into a copy of it. If count_flag is true, any deletions
+ * might not have tombstones so the Users in the collection are counted
+ * and, if the result doesn't have the same number, NULL is returned and
+ * the caller should do a full reload.
+ */
+static UsersDirectorySnapshot *SyncUsersDirectorySnapshot (const UsersDirectorySnapshot *previous_p, MongoTool *tool_p, const char *collection_s, const UsersDirectoryTombstone *tombstones_p, const size_t num_tombstones, const uint32 overlap_ms, const bool count_flag)
+{
+	UsersDirectorySnapshot *snapshot_p = NULL;
+	bson_t *query_p = BCON_NEW (MONGO_TIMESTAMP_S, "{", "$gte", BCON_DATE_TIME (previous_p -> uds_watermark - (int64) overlap_ms), "}");
+
+	if (query_p)
+		{
+			UsersDirectorySnapshot *changes_p = LoadUsersDirectorySnapshot (tool_p, collection_s, query_p, S_DEFAULT_CAPACITY);
+
+			if (changes_p)
+				{
+					snapshot_p = MergeUsersDirectorySnapshots (previous_p, changes_p, tombstones_p, num_tombstones);
+
+					if (snapshot_p && count_flag)
+						{
+							const int64 num_docs = CountUsers (tool_p, collection_s);
+
+							if (num_docs != (int64) (snapshot_p -> uds_num_entries))
+								{
+									PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Users directory has " SIZET_FMT " users but \"%s\" has " INT64_FMT ", reloading all users", snapshot_p -> uds_num_entries, collection_s, num_docs);
+
+									FreeUsersDirectorySnapshot (snapshot_p);
+									snapshot_p = NULL;
+								}
+						}
+
+					if (snapshot_p)
+						{
+							PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Synced " SIZET_FMT " changed and " SIZET_FMT " deleted users into users directory", changes_p -> uds_num_entries, num_tombstones);
+						}
+
+					FreeUsersDirectorySnapshot (changes_p);
+				}		/* if (changes_p) */
+
+			bson_destroy (query_p);
+		}		/* if (query_p) */
+
+	return snapshot_p;
+}
+
+
+/*
+ * Count the Users in the collection, returning -1 upon error.
+ *
+ * The estimated count comes from the collection's metadata, which can be
+ * wrong after an unclean shutdown or on a sharded cluster, so the documents
+ * are counted instead. The range on _id lets the server count the keys in
+ * the _id index rather than fetching every document.
+ */
+static int64 CountUsers (MongoTool *tool_p, const char *collection_s)
+{
+	int64 num_docs = -1;
+	bson_t *filter_p = BCON_NEW (MONGO_ID_S, "{", "$gt", BCON_MINKEY, "}");
+
+	if (filter_p)
+		{
+			bson_t *opts_p = BCON_NEW ("hint", "{", MONGO_ID_S, BCON_INT32 (1), "}");
+
+			if (opts_p)
+				{
+					bson_error_t error;
+
+					num_docs = mongoc_collection_count_documents (tool_p -> mt_collection_p, filter_p, opts_p, NULL, NULL, &error);
+
+					if (num_docs < 0)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to count users in \"%s\": %s", collection_s, error.message);
+						}
+
+					bson_destroy (opts_p);
+				}
+
+			bson_destroy (filter_p);
+		}
+
+	return num_docs;
+}
+
+
+/*
+ * Both snapshots have their entries sorted by name and their keys
+ * sorted by key, so a single pass over each keeps everything in order
+ * without having to sort again.
+ */
+static UsersDirectorySnapshot *MergeUsersDirectorySnapshots (const UsersDirectorySnapshot *previous_p, const UsersDirectorySnapshot *changes_p, const UsersDirectoryTombstone *tombstones_p, const size_t num_tombstones)
+{
+	UsersDirectorySnapshot *snapshot_p = NULL;
+
+	/*
+	 * Where each of the previous and changed entries ends up in the
+	 * merged snapshot. The +1 stops either array being empty.
+	 */
+	size_t *previous_indexes_p = (size_t *) AllocMemoryArray ((previous_p -> uds_num_entries) + 1, sizeof (size_t));
+	size_t *changes_indexes_p = (size_t *) AllocMemoryArray ((changes_p -> uds_num_entries) + 1, sizeof (size_t));
+
+	if (previous_indexes_p && changes_indexes_p)
+		{
+			if (MarkDroppedUsersDirectoryEntries (previous_p, changes_p, tombstones_p, num_tombstones, previous_indexes_p))
+				{
+					snapshot_p = AllocateUsersDirectorySnapshot ((previous_p -> uds_num_entries) + (changes_p -> uds_num_entries));
+
+					if (snapshot_p)
+						{
+							const UsersDirectoryEntry *previous_entries_p = previous_p -> uds_entries_p;
+							const UsersDirectoryEntry *changes_entries_p = changes_p -> uds_entries_p;
+							bool success_flag = true;
+							size_t i = 0;
+							size_t j = 0;
+
+							while (success_flag && ((i < previous_p -> uds_num_entries) || (j < changes_p -> uds_num_entries)))
+								{
+									if ((i < previous_p -> uds_num_entries) && (previous_indexes_p [i] == S_DROPPED_ENTRY))
+										{
+											++ i;
+										}
+									else if ((j >= changes_p -> uds_num_entries) || ((i < previous_p -> uds_num_entries) && (CompareUsersDirectoryEntryNames (previous_entries_p + i, changes_entries_p + j) <= 0)))
+										{
+											const UsersDirectoryEntry *entry_p = previous_entries_p + i;
+
+											previous_indexes_p [i] = snapshot_p -> uds_num_entries;
+											success_flag = (AddUsersDirectoryEntry (snapshot_p, entry_p -> ude_id_s, entry_p -> ude_name_s, entry_p -> ude_sort_key_s) != NULL);
+											++ i;
+										}
+									else
+										{
+											const UsersDirectoryEntry *entry_p = changes_entries_p + j;
+
+											changes_indexes_p [j] = snapshot_p -> uds_num_entries;
+											success_flag = (AddUsersDirectoryEntry (snapshot_p, entry_p -> ude_id_s, entry_p -> ude_name_s, entry_p -> ude_sort_key_s) != NULL);
+											++ j;
+										}
+								}
+
+							i = 0;
+							j = 0;
+
+							while (success_flag && ((i < previous_p -> uds_num_keys) || (j < changes_p -> uds_num_keys)))
+								{
+									const UsersDirectoryKey *previous_key_p = (i < previous_p -> uds_num_keys) ? (previous_p -> uds_keys_p) + i : NULL;
+									const UsersDirectoryKey *changes_key_p = (j < changes_p -> uds_num_keys) ? (changes_p -> uds_keys_p) + j : NULL;
+
+									if (previous_key_p && (previous_indexes_p [previous_key_p -> udk_entry_index] == S_DROPPED_ENTRY))
+										{
+											++ i;
+										}
+									else if ((!changes_key_p) || (previous_key_p && (strcmp (previous_key_p -> udk_key_s, changes_key_p -> udk_key_s) <= 0)))
+										{
+											success_flag = CopyUsersDirectoryKey (snapshot_p, previous_key_p -> udk_key_s, previous_indexes_p [previous_key_p -> udk_entry_index]);
+											++ i;
+										}
+									else
+										{
+											success_flag = CopyUsersDirectoryKey (snapshot_p, changes_key_p -> udk_key_s, changes_indexes_p [changes_key_p -> udk_entry_index]);
+											++ j;
+										}
+								}
+
+							if (success_flag)
+								{
+									snapshot_p -> uds_watermark = (previous_p -> uds_watermark > changes_p -> uds_watermark) ? previous_p -> uds_watermark : changes_p -> uds_watermark;
+								}
+							else
+								{
+									FreeUsersDirectorySnapshot (snapshot_p);
+									snapshot_p = NULL;
+								}
+
+						}		/* if (snapshot_p) */
+
+				}		/* if (MarkDroppedUsersDirectoryEntries (previous_p, changes_p, tombstones_p, num_tombstones, previous_indexes_p)) */
+
+		}		/* if (previous_indexes_p && changes_indexes_p) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate indexes to merge " SIZET_FMT " changed users", changes_p -> uds_num_entries);
+		}
+
+	if (changes_indexes_p)
+		{
+			FreeMemory (changes_indexes_p);
+		}
+
+	if (previous_indexes_p)
+		{
+			FreeMemory (previous_indexes_p);
+		}
+
+	return snapshot_p;
+}
+
+
+/*
+ * Set the index of each previous entry that has been changed or
+ * deleted to S_DROPPED_ENTRY and all of the others to 0.
+ */
+static bool MarkDroppedUsersDirectoryEntries (const UsersDirectorySnapshot *previous_p, const UsersDirectorySnapshot *changes_p, const UsersDirectoryTombstone *tombstones_p, const size_t num_tombstones, size_t *indexes_p)
+{
+	const size_t num_ids = (changes_p -> uds_num_entries) + num_tombstones;
+	const char **ids_ss = (const char **) AllocMemoryArray (num_ids + 1, sizeof (const char *));
+
+	if (ids_ss)
+		{
+			size_t i;
+
+			for (i = 0; i < changes_p -> uds_num_entries; ++ i)
+				{
+					ids_ss [i] = changes_p -> uds_entries_p [i].ude_id_s;
+				}
+
+			for (i = 0; i < num_tombstones; ++ i)
+				{
+					ids_ss [changes_p -> uds_num_entries + i] = tombstones_p [i].udt_id_s;
+				}
+
+			qsort (ids_ss, num_ids, sizeof (const char *), CompareIdStrings);
+
+			for (i = 0; i < previous_p -> uds_num_entries; ++ i)
+				{
+					const char *id_s = previous_p -> uds_entries_p [i].ude_id_s;
+
+					indexes_p [i] = (bsearch (&id_s, ids_ss, num_ids, sizeof (const char *), CompareIdStrings) != NULL) ? S_DROPPED_ENTRY : 0;
+				}
+
+			FreeMemory (ids_ss);
+
+			return true;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " ids to merge", num_ids);
+		}
+
+	return false;
+}
+
+
+static UsersDirectorySnapshot *AllocateUsersDirectorySnapshot (const size_t capacity)
+{
+	UsersDirectorySnapshot *snapshot_p = (UsersDirectorySnapshot *) AllocMemory (sizeof (UsersDirectorySnapshot));
+
+	if (snapshot_p)
+		{
+			snapshot_p -> uds_entries_p = NULL;
+			snapshot_p -> uds_num_entries = 0;
+			snapshot_p -> uds_keys_p = NULL;
+			snapshot_p -> uds_num_keys = 0;
+			snapshot_p -> uds_capacity = 0;
+			snapshot_p -> uds_num_refs = 0;
+			snapshot_p -> uds_watermark = 0;
+			snapshot_p -> uds_revision = 0;
+
+			if ((snapshot_p -> uds_arena_p = AllocateUsersArena (0)) != NULL)
+				{
+					if (ReserveUsersDirectorySnapshot (snapshot_p, capacity))
+						{
+							return snapshot_p;
+						}
+
+					FreeUsersArena (snapshot_p -> uds_arena_p);
+				}
+
+			FreeMemory (snapshot_p);
+		}
+
+	return NULL;
+}
+
+
+static bool ReserveUsersDirectorySnapshot (UsersDirectorySnapshot *snapshot_p, const size_t capacity)
+{
+	UsersDirectoryEntry *entries_p = (UsersDirectoryEntry *) AllocMemoryArray (capacity, sizeof (UsersDirectoryEntry));
+
+	if (entries_p)
+		{
+			/*
+			 * Each User has up to 3 keys: surname, forename and email
+			 */
+			UsersDirectoryKey *keys_p = (UsersDirectoryKey *) AllocMemoryArray (capacity * 3, sizeof (UsersDirectoryKey));
+
+			if (keys_p)
+				{
+					if (snapshot_p -> uds_entries_p)
+						{
+							memcpy (entries_p, snapshot_p -> uds_entries_p, (snapshot_p -> uds_num_entries) * sizeof (UsersDirectoryEntry));
+							FreeMemory (snapshot_p -> uds_entries_p);
+						}
+
+					if (snapshot_p -> uds_keys_p)
+						{
+							memcpy (keys_p, snapshot_p -> uds_keys_p, (snapshot_p -> uds_num_keys) * sizeof (UsersDirectoryKey));
+							FreeMemory (snapshot_p -> uds_keys_p);
+						}
+
+					snapshot_p -> uds_entries_p = entries_p;
+					snapshot_p -> uds_keys_p = keys_p;
+					snapshot_p -> uds_capacity = capacity;
+
+					return true;
+				}
+
+			FreeMemory (entries_p);
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " users directory entries", capacity);
+
+	return false;
+}
+
+
+static bool AddUsersDirectoryRow (UsersDirectorySnapshot *snapshot_p, const UsersCursorRow *row_p)
+{
+	bool success_flag = false;
+	char *built_name_s = NULL;
+	const char *name_s = row_p -> ucr_display_name_s;
+
+	/*
+	 * Only Users saved before display names were stored need
+	 * their names building
+	 */
+	if (!name_s)
+		{
+			name_s = built_name_s = GetUsersCursorRowName (row_p);
+		}
+
+	if (name_s)
+		{
+			const size_t entry_index = snapshot_p -> uds_num_entries;
+
+			if (AddUsersDirectoryEntry (snapshot_p, row_p -> ucr_id_s, name_s, row_p -> ucr_sort_key_s))
+				{
+					if (AddUsersDirectoryKey (snapshot_p, row_p -> ucr_surname_s, entry_index) &&
+							AddUsersDirectoryKey (snapshot_p, row_p -> ucr_forename_s, entry_index) &&
+							AddUsersDirectoryKey (snapshot_p, row_p -> ucr_email_s, entry_index))
+						{
+							if (row_p -> ucr_timestamp > snapshot_p -> uds_watermark)
+								{
+									snapshot_p -> uds_watermark = row_p -> ucr_timestamp;
+								}
+
+							success_flag = true;
+						}
+				}
+
+			if (built_name_s)
+				{
+					FreeUsersCursorRowName (built_name_s);
+				}
+		}
+	else
+		{
+			PrintBSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, row_p -> ucr_doc_p, "Failed to get full username");
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Copy the strings for a new entry into the snapshot's arena.
+ */
+static UsersDirectoryEntry *AddUsersDirectoryEntry (UsersDirectorySnapshot *snapshot_p, const char *id_s, const char *name_s, const char *sort_key_s)
+{
+	if ((snapshot_p -> uds_num_entries < snapshot_p -> uds_capacity) || (ReserveUsersDirectorySnapshot (snapshot_p, (snapshot_p -> uds_capacity) << 1)))
+		{
+			UsersDirectoryEntry *entry_p = (snapshot_p -> uds_entries_p) + (snapshot_p -> uds_num_entries);
+
+			strcpy (entry_p -> ude_id_s, id_s);
+			entry_p -> ude_name_s = CopyToUsersArena (snapshot_p -> uds_arena_p, name_s);
+			entry_p -> ude_sort_key_s = sort_key_s ? CopyToUsersArena (snapshot_p -> uds_arena_p, sort_key_s) : NULL;
+
+			if ((entry_p -> ude_name_s) && ((!sort_key_s) || (entry_p -> ude_sort_key_s)))
+				{
+					++ (snapshot_p -> uds_num_entries);
+					return entry_p;
+				}
+		}
+
+	return NULL;
+}
+
+
+static void FreeUsersDirectorySnapshot (UsersDirectorySnapshot *snapshot_p)
+{
+	if (snapshot_p -> uds_entries_p)
+		{
+			FreeMemory (snapshot_p -> uds_entries_p);
+		}
+
+	if (snapshot_p -> uds_keys_p)
+		{
+			FreeMemory (snapshot_p -> uds_keys_p);
+		}
+
+	/* All of the names and keys go in one go */
+	FreeUsersArena (snapshot_p -> uds_arena_p);
+
+	FreeMemory (snapshot_p);
+}
+
+
+static bool AddUsersDirectoryKey (UsersDirectorySnapshot *snapshot_p, const char *value_s, const size_t entry_index)
+{
+	bool success_flag = true;
+
+	if (!IsStringEmpty (value_s))
+		{
+			char *key_s = GetNormalisedUsersDirectoryKey (value_s, snapshot_p -> uds_arena_p);
+
+			if (key_s)
+				{
+					UsersDirectoryKey *key_p = (snapshot_p -> uds_keys_p) + (snapshot_p -> uds_num_keys);
+
+					key_p -> udk_key_s = key_s;
+					key_p -> udk_entry_index = entry_index;
+
+					++ (snapshot_p -> uds_num_keys);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create search key for \"%s\"", value_s);
+					success_flag = false;
+				}
+		}
+
+	return success_flag;
+}
+
+
+static bool CopyUsersDirectoryKey (UsersDirectorySnapshot *snapshot_p, const char *key_s, const size_t entry_index)
+{
+	UsersDirectoryKey *key_p = (snapshot_p -> uds_keys_p) + (snapshot_p -> uds_num_keys);
+
+	if ((key_p -> udk_key_s = CopyToUsersArena (snapshot_p -> uds_arena_p, key_s)) != NULL)
+		{
+			key_p -> udk_entry_index = entry_index;
+			++ (snapshot_p -> uds_num_keys);
+
+			return true;
+		}
+
+	return false;
+}
+
+
+/*
+ * Keys are compared ignoring case and accents and without
+ * any leading whitespace. If arena_p is NULL, the key should
+ * be freed with FreeCopiedString ().
+ */
+static char *GetNormalisedUsersDirectoryKey (const char *value_s, UsersArena *arena_p)
+{
+	char *key_s = NULL;
+
+	while (isspace ((unsigned char) *value_s))
+		{
+			++ value_s;
+		}
+
+	key_s = arena_p ? CopyToUsersArena (arena_p, value_s) : EasyCopyToNewString (value_s);
+
+	if (key_s)
+		{
+			FoldUsersString (key_s);
+		}
+
+	return key_s;
+}
+
+
+static int CompareUsersDirectoryKeys (const void *v0_p, const void *v1_p)
+{
+	const UsersDirectoryKey *key0_p = (const UsersDirectoryKey *) v0_p;
+	const UsersDirectoryKey *key1_p = (const UsersDirectoryKey *) v1_p;
+
+	return strcmp (key0_p -> udk_key_s, key1_p -> udk_key_s);
+}
+
+
+static int CompareUsersDirectoryEntryAddresses (const void *v0_p, const void *v1_p)
+{
+	const UsersDirectoryEntry *entry0_p = * ((const UsersDirectoryEntry **) v0_p);
+	const UsersDirectoryEntry *entry1_p = * ((const UsersDirectoryEntry **) v1_p);
+
+	if (entry0_p < entry1_p)
+		{
+			return -1;
+		}
+	else if (entry0_p > entry1_p)
+		{
+			return 1;
+		}
+
+	return 0;
+}
+
+
+/*
+ * Match the order that the database sorts Users in, where a
+ * missing sort key comes before any other.
+ */
+static int CompareUsersDirectoryEntryNames (const UsersDirectoryEntry *entry0_p, const UsersDirectoryEntry *entry1_p)
+{
+	const char *key0_s = entry0_p -> ude_sort_key_s;
+	const char *key1_s = entry1_p -> ude_sort_key_s;
+
+	if (key0_s)
+		{
+			return key1_s ? strcmp (key0_s, key1_s) : 1;
+		}
+
+	return key1_s ? -1 : 0;
+}
+
+
+static int CompareIdStrings (const void *v0_p, const void *v1_p)
+{
+	const char *id0_s = * ((const char **) v0_p);
+	const char *id1_s = * ((const char **) v1_p);
+
+	return strcmp (id0_s, id1_s);
+}
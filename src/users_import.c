@@ -0,0 +1,627 @@
+/*
+ * users_import.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "users_import.h"
+#include "users_sort_key.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+#include "mongodb_util.h"
+#include "user.h"
+
+
+/*
+ * The column headings for the table of Users
+ */
+static const char * const S_EMAIL_COLUMN_S = "Email";
+static const char * const S_SURNAME_COLUMN_S = "Last name";
+static const char * const S_FORENAME_COLUMN_S = "First name";
+static const char * const S_AFFILIATION_COLUMN_S = "Affiliation";
+static const char * const S_ORCID_COLUMN_S = "ORCID";
+
+
+/*
+ * The values for the status of each row in the results
+ */
+static const char * const S_ROW_SUCCEEDED_S = "succeeded";
+static const char * const S_ROW_FAILED_S = "failed";
+static const char * const S_ROW_INVALID_S = "invalid";
+
+
+/**
+ * A row and its email address used to find duplicate
+ * email addresses in a table.
+ */
+typedef struct ImportEmail
+{
+	const char *ie_email_s;
+	size_t ie_row;
+} ImportEmail;
+
+
+/*
+ * Static declarations
+ */
+
+static bool CheckImportRow (const json_t *row_p, const size_t row, json_t *result_p, ServiceJob *job_p, const char *param_name_s);
+
+static bool CheckRequiredImportValue (const json_t *row_p, const char *column_s, const size_t row, json_t *result_p, ServiceJob *job_p, const char *param_name_s);
+
+static size_t RemoveDuplicateImportEmails (const json_t *rows_p, size_t *valid_rows_p, const size_t num_valid_rows, json_t *results_p, ServiceJob *job_p, const char *param_name_s);
+
+static size_t WriteImportBatch (UsersServiceData *data_p, MongoTool *tool_p, const json_t *rows_p, const size_t *batch_rows_p, const size_t batch_size, json_t *results_p);
+
+static void ReportImportProgress (UsersServiceData *data_p, ServiceJob *job_p, const size_t num_imported, const size_t num_rows);
+
+static char *GetImportEmail (const json_t *row_p);
+
+static bson_t *GetImportUpdate (const json_t *row_p, const char *email_s);
+
+static void SetImportRowResult (json_t *result_p, const char *status_s, const char *error_s);
+
+static int CompareImportEmails (const void *v0_p, const void *v1_p);
+
+
+/*
+ * API definitions
+ */
+
+OperationStatus ImportUsers (UsersServiceData *data_p, const json_t *rows_p, ServiceJob *job_p, const char *param_name_s)
+{
+	OperationStatus status = OS_FAILED;
+	const size_t num_rows = json_array_size (rows_p);
+	UsersTimingSpan span;
+
+	StartUsersTimingSpan (data_p -> usd_timings_p, &span);
+
+	if (num_rows > 0)
+		{
+			json_t *results_p = json_array ();
+
+			if (results_p)
+				{
+					size_t *valid_rows_p = (size_t *) AllocMemoryArray (num_rows, sizeof (size_t));
+
+					if (valid_rows_p)
+						{
+							size_t num_valid_rows = 0;
+							size_t num_imported = 0;
+							size_t i;
+							bool success_flag = true;
+
+							/*
+							 * Check every row before writing anything
+							 */
+							for (i = 0; (i < num_rows) && success_flag; ++ i)
+								{
+									json_t *result_p = json_pack ("{s:I}", "row", (json_int_t) (i + 1));
+
+									if (result_p)
+										{
+											if (json_array_append_new (results_p, result_p) == 0)
+												{
+													if (CheckImportRow (json_array_get (rows_p, i), i + 1, result_p, job_p, param_name_s))
+														{
+															valid_rows_p [num_valid_rows] = i;
+															++ num_valid_rows;
+														}
+												}
+											else
+												{
+													json_decref (result_p);
+													success_flag = false;
+												}
+										}
+									else
+										{
+											success_flag = false;
+										}
+								}
+
+							if (success_flag)
+								{
+									json_t *resource_p = NULL;
+
+									num_valid_rows = RemoveDuplicateImportEmails (rows_p, valid_rows_p, num_valid_rows, results_p, job_p, param_name_s);
+
+									if (num_valid_rows > 0)
+										{
+											MongoTool *tool_p = CheckOutMongoTool (data_p -> usd_mongo_pool_p);
+
+											if (SetMongoToolCollection (tool_p, data_p -> usd_users_collection_s))
+												{
+													const size_t batch_size = data_p -> usd_import_batch_size;
+
+													for (i = 0; i < num_valid_rows; i += batch_size)
+														{
+															const size_t num_batch_rows = (num_valid_rows - i < batch_size) ? num_valid_rows - i : batch_size;
+
+															num_imported += WriteImportBatch (data_p, tool_p, rows_p, valid_rows_p + i, num_batch_rows, results_p);
+
+															ReportImportProgress (data_p, job_p, num_imported, num_valid_rows);
+														}
+
+													if (num_imported > 0)
+														{
+															if (data_p -> usd_directory_p)
+																{
+																	InvalidateUsersDirectory (data_p -> usd_directory_p);
+																}
+
+															if (data_p -> usd_users_cache_p)
+																{
+																	ClearUsersCache (data_p -> usd_users_cache_p);
+																}
+														}
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set collection to \"%s\"", data_p -> usd_users_collection_s);
+												}
+
+											CheckInMongoTool (data_p -> usd_mongo_pool_p, tool_p);
+
+										}		/* if (num_valid_rows > 0) */
+
+									if (num_imported == num_rows)
+										{
+											status = OS_SUCCEEDED;
+										}
+									else if (num_imported > 0)
+										{
+											status = OS_PARTIALLY_SUCCEEDED;
+										}
+
+									PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Imported " SIZET_FMT " of " SIZET_FMT " users", num_imported, num_rows);
+
+									resource_p = GetResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, "Imported Users", results_p);
+
+									if (resource_p)
+										{
+											if (!AddResultToServiceJob (job_p, resource_p))
+												{
+													PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, resource_p, "Failed to add import results to ServiceJob");
+													json_decref (resource_p);
+												}
+										}
+
+								}		/* if (success_flag) */
+
+							FreeMemory (valid_rows_p);
+						}		/* if (valid_rows_p) */
+
+					json_decref (results_p);
+				}		/* if (results_p) */
+
+		}		/* if (num_rows > 0) */
+
+	EndUsersTimingSpan (data_p -> usd_timings_p, &span, UTP_IMPORT);
+
+	return status;
+}
+
+
+/*
+ * Static definitions
+ */
+
+/*
+ * row is the 1-based row number that is shown in any errors, matching
+ * the "row" value in the results.
+ */
+static bool CheckImportRow (const json_t *row_p, const size_t row, json_t *result_p, ServiceJob *job_p, const char *param_name_s)
+{
+	bool valid_flag = false;
+
+	if (json_is_object (row_p))
+		{
+			const char *email_s = GetJSONString (row_p, S_EMAIL_COLUMN_S);
+
+			if (email_s)
+				{
+					SetJSONString (result_p, "email", email_s);
+				}
+
+			/*
+			 * Check all of the columns so that every problem
+			 * with the row gets reported
+			 */
+			valid_flag = CheckRequiredImportValue (row_p, S_EMAIL_COLUMN_S, row, result_p, job_p, param_name_s);
+			valid_flag = CheckRequiredImportValue (row_p, S_SURNAME_COLUMN_S, row, result_p, job_p, param_name_s) && valid_flag;
+			valid_flag = CheckRequiredImportValue (row_p, S_FORENAME_COLUMN_S, row, result_p, job_p, param_name_s) && valid_flag;
+		}
+	else
+		{
+			SetImportRowResult (result_p, S_ROW_INVALID_S, "Row is not an object");
+		}
+
+	return valid_flag;
+}
+
+
+static bool CheckRequiredImportValue (const json_t *row_p, const char *column_s, const size_t row, json_t *result_p, ServiceJob *job_p, const char *param_name_s)
+{
+	const char *value_s = GetJSONString (row_p, column_s);
+
+	if (IsStringEmpty (value_s))
+		{
+			const char * const error_s = "Value required";
+
+			AddTabularParameterErrorMessageToServiceJob (job_p, param_name_s, PT_JSON_TABLE, error_s, (uint32) row, column_s);
+			SetImportRowResult (result_p, S_ROW_INVALID_S, error_s);
+
+			return false;
+		}
+
+	return true;
+}
+
+
+/*
+ * Unordered writes of the same email address would race each other,
+ * so only keep the first row for each email address. Email addresses
+ * are compared ignoring case, since ones that only differ by case belong
+ * to the same person.
+ */
+static size_t RemoveDuplicateImportEmails (const json_t *rows_p, size_t *valid_rows_p, const size_t num_valid_rows, json_t *results_p, ServiceJob *job_p, const char *param_name_s)
+{
+	size_t num_unique_rows = num_valid_rows;
+
+	if (num_valid_rows > 1)
+		{
+			ImportEmail *emails_p = (ImportEmail *) AllocMemoryArray (num_valid_rows, sizeof (ImportEmail));
+
+			if (emails_p)
+				{
+					size_t i;
+
+					for (i = 0; i < num_valid_rows; ++ i)
+						{
+							emails_p [i].ie_email_s = GetJSONString (json_array_get (rows_p, valid_rows_p [i]), S_EMAIL_COLUMN_S);
+							emails_p [i].ie_row = valid_rows_p [i];
+						}
+
+					/*
+					 * Sorting by email and then row keeps the first of any duplicates
+					 */
+					qsort (emails_p, num_valid_rows, sizeof (ImportEmail), CompareImportEmails);
+
+					valid_rows_p [0] = emails_p [0].ie_row;
+					num_unique_rows = 1;
+
+					for (i = 1; i < num_valid_rows; ++ i)
+						{
+							if (Stricmp (emails_p [i].ie_email_s, emails_p [i - 1].ie_email_s) != 0)
+								{
+									valid_rows_p [num_unique_rows] = emails_p [i].ie_row;
+									++ num_unique_rows;
+								}
+							else
+								{
+									const char * const error_s = "Duplicate email address";
+
+									AddTabularParameterErrorMessageToServiceJob (job_p, param_name_s, PT_JSON_TABLE, error_s, (uint32) (emails_p [i].ie_row + 1), S_EMAIL_COLUMN_S);
+									SetImportRowResult (json_array_get (results_p, emails_p [i].ie_row), S_ROW_INVALID_S, error_s);
+								}
+						}
+
+					FreeMemory (emails_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate memory to check for duplicate emails");
+				}
+		}
+
+	return num_unique_rows;
+}
+
+
+static size_t WriteImportBatch (UsersServiceData *data_p, MongoTool *tool_p, const json_t *rows_p, const size_t *batch_rows_p, const size_t batch_size, json_t *results_p)
+{
+	size_t num_written = 0;
+	bson_t *bulk_opts_p = BCON_NEW ("ordered", BCON_BOOL (false));
+	bson_t *upsert_opts_p = BCON_NEW ("upsert", BCON_BOOL (true));
+	size_t *op_rows_p = (size_t *) AllocMemoryArray (batch_size, sizeof (size_t));
+
+	if (bulk_opts_p && upsert_opts_p && op_rows_p)
+		{
+			mongoc_bulk_operation_t *bulk_p = mongoc_collection_create_bulk_operation_with_opts (tool_p -> mt_collection_p, bulk_opts_p);
+
+			if (bulk_p)
+				{
+					size_t num_ops = 0;
+					size_t i;
+
+					for (i = 0; i < batch_size; ++ i)
+						{
+							const size_t row = batch_rows_p [i];
+							const json_t *row_p = json_array_get (rows_p, row);
+							char *email_s = GetImportEmail (row_p);
+							bson_t *update_p = email_s ? GetImportUpdate (row_p, email_s) : NULL;
+
+							if (update_p)
+								{
+									bson_t *selector_p = BCON_NEW (US_EMAIL_S, BCON_UTF8 (email_s));
+
+									if (selector_p)
+										{
+											bson_error_t error;
+
+											if (mongoc_bulk_operation_update_one_with_opts (bulk_p, selector_p, update_p, upsert_opts_p, &error))
+												{
+													op_rows_p [num_ops] = row;
+													++ num_ops;
+												}
+											else
+												{
+													SetImportRowResult (json_array_get (results_p, row), S_ROW_FAILED_S, error.message);
+												}
+
+											bson_destroy (selector_p);
+										}
+									else
+										{
+											SetImportRowResult (json_array_get (results_p, row), S_ROW_FAILED_S, "Failed to create selector");
+										}
+
+									bson_destroy (update_p);
+								}
+							else
+								{
+									SetImportRowResult (json_array_get (results_p, row), S_ROW_FAILED_S, "Failed to create update");
+								}
+
+							if (email_s)
+								{
+									FreeCopiedString (email_s);
+								}
+						}
+
+					if (num_ops > 0)
+						{
+							bson_t reply;
+							bson_error_t error;
+							bool executed_flag = (mongoc_bulk_operation_execute (bulk_p, &reply, &error) != 0);
+							bool write_errors_flag = false;
+							bson_iter_t iter;
+
+							/*
+							 * Mark any rows that failed. The indexes in writeErrors are the
+							 * positions of the operations within this batch.
+							 */
+							if (bson_iter_init_find (&iter, &reply, "writeErrors") && BSON_ITER_HOLDS_ARRAY (&iter))
+								{
+									bson_iter_t errors_iter;
+
+									if (bson_iter_recurse (&iter, &errors_iter))
+										{
+											while (bson_iter_next (&errors_iter))
+												{
+													bson_iter_t index_iter;
+													bson_iter_t message_iter;
+
+													if (bson_iter_recurse (&errors_iter, &index_iter) && bson_iter_find (&index_iter, "index") && BSON_ITER_HOLDS_INT32 (&index_iter))
+														{
+															const int32 op_index = bson_iter_int32 (&index_iter);
+
+															if ((op_index >= 0) && ((size_t) op_index < num_ops))
+																{
+																	const char *message_s = "Write failed";
+
+																	if (bson_iter_recurse (&errors_iter, &message_iter) && bson_iter_find (&message_iter, "errmsg") && BSON_ITER_HOLDS_UTF8 (&message_iter))
+																		{
+																			message_s = bson_iter_utf8 (&message_iter, NULL);
+																		}
+
+																	SetImportRowResult (json_array_get (results_p, op_rows_p [op_index]), S_ROW_FAILED_S, message_s);
+																	write_errors_flag = true;
+																}
+														}
+												}
+										}
+								}
+
+							for (i = 0; i < num_ops; ++ i)
+								{
+									json_t *result_p = json_array_get (results_p, op_rows_p [i]);
+
+									if (!json_object_get (result_p, "status"))
+										{
+											/*
+											 * If the whole batch failed, e.g. the connection was lost,
+											 * there won't be any individual write errors
+											 */
+											if (executed_flag || write_errors_flag)
+												{
+													SetImportRowResult (result_p, S_ROW_SUCCEEDED_S, NULL);
+													++ num_written;
+												}
+											else
+												{
+													SetImportRowResult (result_p, S_ROW_FAILED_S, error.message);
+												}
+										}
+								}
+
+							if (!executed_flag)
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Bulk import into \"%s\" had errors: %s", data_p -> usd_users_collection_s, error.message);
+								}
+
+							bson_destroy (&reply);
+						}		/* if (num_ops > 0) */
+
+					mongoc_bulk_operation_destroy (bulk_p);
+				}		/* if (bulk_p) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create bulk operation for \"%s\"", data_p -> usd_users_collection_s);
+				}
+
+		}		/* if (bulk_opts_p && upsert_opts_p && op_rows_p) */
+
+	if (op_rows_p)
+		{
+			FreeMemory (op_rows_p);
+		}
+
+	if (upsert_opts_p)
+		{
+			bson_destroy (upsert_opts_p);
+		}
+
+	if (bulk_opts_p)
+		{
+			bson_destroy (bulk_opts_p);
+		}
+
+	return num_written;
+}
+
+
+/*
+ * Get a row's email address in lower case. Duplicates in the table are
+ * found ignoring case, so the stored value and the upsert's selector
+ * need to ignore it too or "A@b.org" and "a@B.org" in different imports
+ * would become two Users.
+ */
+static char *GetImportEmail (const json_t *row_p)
+{
+	char *email_s = EasyCopyToNewString (GetJSONString (row_p, S_EMAIL_COLUMN_S));
+
+	if (email_s)
+		{
+			char *c_p;
+
+			for (c_p = email_s; *c_p; ++ c_p)
+				{
+					if ((*c_p >= 'A') && (*c_p <= 'Z'))
+						{
+							*c_p += 'a' - 'A';
+						}
+				}
+		}
+
+	return email_s;
+}
+
+
+/*
+ * Get the upsert for a row using the same document layout as
+ * GetUserAsJSON () so imported Users are identical to ones
+ * saved through the form.
+ */
+static bson_t *GetImportUpdate (const json_t *row_p, const char *email_s)
+{
+	bson_t *update_p = NULL;
+	User *user_p = AllocateUser (NULL, email_s, GetJSONString (row_p, S_FORENAME_COLUMN_S), GetJSONString (row_p, S_SURNAME_COLUMN_S), GetJSONString (row_p, S_AFFILIATION_COLUMN_S), GetJSONString (row_p, S_ORCID_COLUMN_S));
+
+	if (user_p)
+		{
+			json_t *user_json_p = GetUserAsJSON (user_p, true);
+
+			if (user_json_p && (!AddUsersSortFields (user_json_p, user_p)))
+				{
+					json_decref (user_json_p);
+					user_json_p = NULL;
+				}
+
+			if (user_json_p)
+				{
+					bson_t *set_p = NULL;
+
+					/*
+					 * Existing Users keep their ids
+					 */
+					json_object_del (user_json_p, MONGO_ID_S);
+
+					set_p = ConvertJSONToBSON (user_json_p);
+
+					if (set_p)
+						{
+							update_p = BCON_NEW ("$currentDate", "{", MONGO_TIMESTAMP_S, BCON_BOOL (true), "}");
+
+							if (update_p)
+								{
+									if (!BSON_APPEND_DOCUMENT (update_p, "$set", set_p))
+										{
+											bson_destroy (update_p);
+											update_p = NULL;
+										}
+								}
+
+							bson_destroy (set_p);
+						}
+
+					json_decref (user_json_p);
+				}
+
+			FreeUser (user_p);
+		}
+
+	return update_p;
+}
+
+
+static void SetImportRowResult (json_t *result_p, const char *status_s, const char *error_s)
+{
+	if (result_p)
+		{
+			SetJSONString (result_p, "status", status_s);
+
+			if (error_s)
+				{
+					SetJSONString (result_p, "error", error_s);
+				}
+		}
+}
+
+
+static int CompareImportEmails (const void *v0_p, const void *v1_p)
+{
+	const ImportEmail *email0_p = (const ImportEmail *) v0_p;
+	const ImportEmail *email1_p = (const ImportEmail *) v1_p;
+	int res = Stricmp (email0_p -> ie_email_s, email1_p -> ie_email_s);
+
+	if (res == 0)
+		{
+			if (email0_p -> ie_row < email1_p -> ie_row)
+				{
+					res = -1;
+				}
+			else if (email0_p -> ie_row > email1_p -> ie_row)
+				{
+					res = 1;
+				}
+		}
+
+	return res;
+}
+
+
+/*
+ * When running in the background, let a client that is polling the
+ * job see how far the import has got.
+ */
+static void ReportImportProgress (UsersServiceData *data_p, ServiceJob *job_p, const size_t num_imported, const size_t num_rows)
+{
+	if (data_p -> usd_publish_jobs_flag)
+		{
+			char progress_s [64];
+
+			snprintf (progress_s, sizeof (progress_s), "Imported " SIZET_FMT " of " SIZET_FMT " users", num_imported, num_rows);
+
+			SetServiceJobDescription (job_p, progress_s);
+			UpdateUsersServiceJob (data_p, job_p, OS_STARTED);
+		}
+}
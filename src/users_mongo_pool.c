@@ -0,0 +1,174 @@
+/*
+ * users_mongo_pool.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include "users_mongo_pool.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+/*
+ * API definitions
+ */
+
+UsersMongoPool *AllocateUsersMongoPool (const uint32 size, MongoClientManager *manager_p, const char *database_s)
+{
+	UsersMongoPool *pool_p = (UsersMongoPool *) AllocMemory (sizeof (UsersMongoPool));
+
+	if (pool_p)
+		{
+			pool_p -> ump_tools_pp = (MongoTool **) AllocMemoryArray (size, sizeof (MongoTool *));
+
+			if (pool_p -> ump_tools_pp)
+				{
+					pool_p -> ump_free_tools_pp = (MongoTool **) AllocMemoryArray (size, sizeof (MongoTool *));
+
+					if (pool_p -> ump_free_tools_pp)
+						{
+							if (pthread_mutex_init (& (pool_p -> ump_lock), NULL) == 0)
+								{
+									if (pthread_cond_init (& (pool_p -> ump_returned), NULL) == 0)
+										{
+											bool success_flag = true;
+
+											pool_p -> ump_size = 0;
+											pool_p -> ump_num_free = 0;
+											pool_p -> ump_num_checkouts = 0;
+											pool_p -> ump_num_waits = 0;
+											pool_p -> ump_max_in_use = 0;
+
+											while ((pool_p -> ump_size < size) && success_flag)
+												{
+													MongoTool *tool_p = AllocateMongoTool (NULL, manager_p);
+
+													if (tool_p)
+														{
+															* ((pool_p -> ump_tools_pp) + (pool_p -> ump_size)) = tool_p;
+															++ (pool_p -> ump_size);
+
+															* ((pool_p -> ump_free_tools_pp) + (pool_p -> ump_num_free)) = tool_p;
+															++ (pool_p -> ump_num_free);
+
+															if (!SetMongoToolDatabase (tool_p, database_s))
+																{
+																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set MongoTool database to \"%s\"", database_s);
+																	success_flag = false;
+																}
+														}
+													else
+														{
+															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate MongoTool " UINT32_FMT " of " UINT32_FMT, pool_p -> ump_size, size);
+															success_flag = false;
+														}
+												}
+
+											if (success_flag)
+												{
+													return pool_p;
+												}
+
+											FreeUsersMongoPool (pool_p);
+											return NULL;
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise UsersMongoPool condition");
+										}
+
+									pthread_mutex_destroy (& (pool_p -> ump_lock));
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise UsersMongoPool lock");
+								}
+
+							FreeMemory (pool_p -> ump_free_tools_pp);
+						}
+
+					FreeMemory (pool_p -> ump_tools_pp);
+				}
+
+			FreeMemory (pool_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeUsersMongoPool (UsersMongoPool *pool_p)
+{
+	uint32 i;
+
+	PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "UsersMongoPool of size " UINT32_FMT ": " UINT64_FMT " checkouts, " UINT64_FMT " had to wait, at most " UINT32_FMT " in use",
+						pool_p -> ump_size, pool_p -> ump_num_checkouts, pool_p -> ump_num_waits, pool_p -> ump_max_in_use);
+
+	if (pool_p -> ump_num_free != pool_p -> ump_size)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, UINT32_FMT " MongoTools are still checked out", pool_p -> ump_size - pool_p -> ump_num_free);
+		}
+
+	for (i = 0; i < pool_p -> ump_size; ++ i)
+		{
+			FreeMongoTool (* ((pool_p -> ump_tools_pp) + i));
+		}
+
+	pthread_cond_destroy (& (pool_p -> ump_returned));
+	pthread_mutex_destroy (& (pool_p -> ump_lock));
+
+	FreeMemory (pool_p -> ump_free_tools_pp);
+	FreeMemory (pool_p -> ump_tools_pp);
+	FreeMemory (pool_p);
+}
+
+
+MongoTool *CheckOutMongoTool (UsersMongoPool *pool_p)
+{
+	MongoTool *tool_p;
+	uint32 num_in_use;
+
+	pthread_mutex_lock (& (pool_p -> ump_lock));
+
+	++ (pool_p -> ump_num_checkouts);
+
+	if (pool_p -> ump_num_free == 0)
+		{
+			++ (pool_p -> ump_num_waits);
+
+			do
+				{
+					pthread_cond_wait (& (pool_p -> ump_returned), & (pool_p -> ump_lock));
+				}
+			while (pool_p -> ump_num_free == 0);
+		}
+
+	-- (pool_p -> ump_num_free);
+	tool_p = * ((pool_p -> ump_free_tools_pp) + (pool_p -> ump_num_free));
+
+	num_in_use = pool_p -> ump_size - pool_p -> ump_num_free;
+
+	if (num_in_use > pool_p -> ump_max_in_use)
+		{
+			pool_p -> ump_max_in_use = num_in_use;
+		}
+
+	pthread_mutex_unlock (& (pool_p -> ump_lock));
+
+	return tool_p;
+}
+
+
+void CheckInMongoTool (UsersMongoPool *pool_p, MongoTool *tool_p)
+{
+	pthread_mutex_lock (& (pool_p -> ump_lock));
+
+	* ((pool_p -> ump_free_tools_pp) + (pool_p -> ump_num_free)) = tool_p;
+	++ (pool_p -> ump_num_free);
+
+	pthread_cond_signal (& (pool_p -> ump_returned));
+
+	pthread_mutex_unlock (& (pool_p -> ump_lock));
+}
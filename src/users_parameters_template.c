@@ -0,0 +1,100 @@
+/*
+ * users_parameters_template.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include "users_parameters_template.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+/*
+ * API definitions
+ */
+
+UsersParametersTemplate *AllocateUsersParametersTemplate (void)
+{
+	UsersParametersTemplate *template_p = (UsersParametersTemplate *) AllocMemory (sizeof (UsersParametersTemplate));
+
+	if (template_p)
+		{
+			if (pthread_mutex_init (& (template_p -> upt_lock), NULL) == 0)
+				{
+					template_p -> upt_template_p = NULL;
+					template_p -> upt_revision = 0;
+
+					return template_p;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise parameters template lock");
+				}
+
+			FreeMemory (template_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeUsersParametersTemplate (UsersParametersTemplate *template_p)
+{
+	if (template_p -> upt_template_p)
+		{
+			json_decref (template_p -> upt_template_p);
+		}
+
+	pthread_mutex_destroy (& (template_p -> upt_lock));
+	FreeMemory (template_p);
+}
+
+
+json_t *AcquireUsersParametersTemplate (UsersParametersTemplate *template_p, const uint32 revision)
+{
+	json_t *template_json_p = NULL;
+
+	pthread_mutex_lock (& (template_p -> upt_lock));
+
+	if ((template_p -> upt_template_p) && (template_p -> upt_revision == revision))
+		{
+			template_json_p = json_incref (template_p -> upt_template_p);
+		}
+
+	pthread_mutex_unlock (& (template_p -> upt_lock));
+
+	return template_json_p;
+}
+
+
+void ReleaseUsersParametersTemplate (UsersParametersTemplate *template_p, json_t *template_json_p)
+{
+	/*
+	 * jansson's reference counts are only atomic in some builds
+	 * so they are always changed with the lock held
+	 */
+	pthread_mutex_lock (& (template_p -> upt_lock));
+	json_decref (template_json_p);
+	pthread_mutex_unlock (& (template_p -> upt_lock));
+}
+
+
+void SetUsersParametersTemplate (UsersParametersTemplate *template_p, const uint32 revision, json_t *template_json_p)
+{
+	pthread_mutex_lock (& (template_p -> upt_lock));
+
+	if ((! (template_p -> upt_template_p)) || (revision > template_p -> upt_revision))
+		{
+			if (template_p -> upt_template_p)
+				{
+					json_decref (template_p -> upt_template_p);
+				}
+
+			template_p -> upt_template_p = json_incref (template_json_p);
+			template_p -> upt_revision = revision;
+		}
+
+	pthread_mutex_unlock (& (template_p -> upt_lock));
+}
@@ -5,12 +5,48 @@
  *      Author: billy
  */
 
+#include <string.h>
+#include <pthread.h>
+
 #include "users_service_data.h"
 
 
 
 #include "streams.h"
 #include "string_utils.h"
+#include "user.h"
+#include "users_import.h"
+#include "users_sort_key.h"
+
+#include "jobs_manager.h"
+
+
+static void EnsureUsersIndexes (UsersServiceData *data_p, MongoTool *tool_p, const json_t *service_config_p);
+
+static bool EnsureUsersIndex (UsersServiceData *data_p, MongoTool *tool_p, const json_t *index_p);
+
+static void StartUsersWriteBehindFromConfig (UsersServiceData *data_p, const json_t *write_behind_config_p);
+
+static void FinishUsersWriteBehindJob (void *data_p, ServiceJob *job_p, const OperationStatus status);
+
+static UsersServiceData *GetSharedUsersServiceData (const json_t *service_config_p, GrassrootsServer *grassroots_p);
+
+static bool ConfigureSharedUsersServiceData (UsersServiceData *data_p, GrassrootsServer *grassroots_p);
+
+static void FreeSharedUsersServiceDataEntry (UsersServiceData *shared_p);
+
+static UsersServiceData *RemoveIdleSharedUsersServiceData (const time_t now);
+
+static void FreeSharedUsersServiceDataEntries (UsersServiceData *shared_p);
+
+
+/*
+ * The UsersServiceData that own the resources shared by every
+ * instance of the service in this process.
+ */
+static UsersServiceData *s_shared_data_p = NULL;
+
+static pthread_mutex_t s_shared_data_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
 UsersServiceData *AllocateUsersServiceData  (void)
@@ -19,10 +55,28 @@ UsersServiceData *AllocateUsersServiceData  (void)
 
 	if (data_p)
 		{
-			data_p -> usd_mongo_p = NULL;
+			data_p -> usd_mongo_pool_p = NULL;
 			data_p -> usd_database_s = NULL;
 			data_p -> usd_users_collection_s = NULL;
 			data_p -> usd_groups_collection_s = NULL;
+			data_p -> usd_directory_p = NULL;
+			data_p -> usd_search_limit = 0;
+			data_p -> usd_users_cache_p = NULL;
+			data_p -> usd_parameters_template_p = NULL;
+			data_p -> usd_import_batch_size = UI_DEFAULT_BATCH_SIZE;
+			data_p -> usd_workers_p = NULL;
+			data_p -> usd_publish_jobs_flag = false;
+			data_p -> usd_timings_p = NULL;
+			data_p -> usd_watcher_p = NULL;
+			data_p -> usd_write_behind_p = NULL;
+			data_p -> usd_columnar_populations_flag = false;
+			data_p -> usd_packed_populations_flag = false;
+			data_p -> usd_shared_p = NULL;
+			data_p -> usd_next_shared_p = NULL;
+			data_p -> usd_ref_count = 0;
+			data_p -> usd_idle_time = 0;
+			data_p -> usd_idle_timeout = USD_DEFAULT_IDLE_TIMEOUT;
+			data_p -> usd_grassroots_p = NULL;
 
 			return data_p;
 		}
@@ -33,9 +87,78 @@ UsersServiceData *AllocateUsersServiceData  (void)
 
 void FreeUsersServiceData (UsersServiceData *data_p)
 {
-	if (data_p -> usd_mongo_p)
+	/*
+	 * Everything is only borrowed from the shared UsersServiceData
+	 */
+	if (data_p -> usd_shared_p)
 		{
-			FreeMongoTool (data_p -> usd_mongo_p);
+			/*
+			 * The Service is closed by the server so it is
+			 * safe to free any shared data that is no longer used
+			 */
+			ReleaseSharedUsersServiceData (data_p, true);
+		}
+	else
+		{
+			/*
+			 * Since nothing holds a reference any more, there are no
+			 * jobs left to publish. Anything that does get this far
+			 * mustn't touch a JobsManager that may be going away.
+			 */
+			data_p -> usd_publish_jobs_flag = false;
+
+			/*
+			 * Let any queued jobs finish before freeing what they use
+			 */
+			if (data_p -> usd_workers_p)
+				{
+					FreeUsersWorkerPool (data_p -> usd_workers_p);
+					data_p -> usd_workers_p = NULL;
+				}
+
+			/*
+			 * The workers may have queued Users so this must be stopped
+			 * after them. It still needs the directory, cache and MongoTools.
+			 */
+			if (data_p -> usd_write_behind_p)
+				{
+					StopUsersWriteBehind (data_p -> usd_write_behind_p);
+					data_p -> usd_write_behind_p = NULL;
+				}
+
+			if (data_p -> usd_watcher_p)
+				{
+					StopUsersChangeWatcher (data_p -> usd_watcher_p);
+					data_p -> usd_watcher_p = NULL;
+				}
+
+			if (data_p -> usd_users_cache_p)
+				{
+					FreeUsersCache (data_p -> usd_users_cache_p);
+				}
+
+			if (data_p -> usd_parameters_template_p)
+				{
+					FreeUsersParametersTemplate (data_p -> usd_parameters_template_p);
+				}
+
+			if (data_p -> usd_directory_p)
+				{
+					FreeUsersDirectory (data_p -> usd_directory_p);
+				}
+
+			if (data_p -> usd_mongo_pool_p)
+				{
+					FreeUsersMongoPool (data_p -> usd_mongo_pool_p);
+				}
+
+			/*
+			 * The workers and write-behind thread record their times here
+			 */
+			if (data_p -> usd_timings_p)
+				{
+					FreeUsersTimings (data_p -> usd_timings_p);
+				}
 		}
 
 	FreeMemory (data_p);
@@ -43,43 +166,823 @@ void FreeUsersServiceData (UsersServiceData *data_p)
 
 
 bool ConfigureUsersService (UsersServiceData *data_p, GrassrootsServer *grassroots_p)
+{
+	bool success_flag = false;
+	UsersServiceData *shared_p = GetSharedUsersServiceData (data_p -> usd_base_data.sd_config_p, grassroots_p);
+
+	if (shared_p)
+		{
+			data_p -> usd_shared_p = shared_p;
+
+			data_p -> usd_mongo_pool_p = shared_p -> usd_mongo_pool_p;
+			data_p -> usd_database_s = shared_p -> usd_database_s;
+			data_p -> usd_users_collection_s = shared_p -> usd_users_collection_s;
+			data_p -> usd_groups_collection_s = shared_p -> usd_groups_collection_s;
+			data_p -> usd_directory_p = shared_p -> usd_directory_p;
+			data_p -> usd_search_limit = shared_p -> usd_search_limit;
+			data_p -> usd_users_cache_p = shared_p -> usd_users_cache_p;
+			data_p -> usd_parameters_template_p = shared_p -> usd_parameters_template_p;
+			data_p -> usd_import_batch_size = shared_p -> usd_import_batch_size;
+			data_p -> usd_columnar_populations_flag = shared_p -> usd_columnar_populations_flag;
+			data_p -> usd_packed_populations_flag = shared_p -> usd_packed_populations_flag;
+			data_p -> usd_workers_p = shared_p -> usd_workers_p;
+			data_p -> usd_publish_jobs_flag = shared_p -> usd_publish_jobs_flag;
+			data_p -> usd_write_behind_p = shared_p -> usd_write_behind_p;
+			data_p -> usd_grassroots_p = shared_p -> usd_grassroots_p;
+
+			data_p -> usd_timings_p = shared_p -> usd_timings_p;
+
+			success_flag = true;
+		}		/* if (shared_p) */
+
+	return success_flag;
+}
+
+
+/*
+ * Get the UsersServiceData holding the resources for the database and
+ * users collection in service_config_p, creating it if this is the first
+ * time that they have been used in this process. Since a new Service is
+ * made for each request, anything held by a single instance would be
+ * thrown away as soon as the request had finished. The caller gets a
+ * reference which is given up when its UsersServiceData is freed.
+ */
+static UsersServiceData *GetSharedUsersServiceData (const json_t *service_config_p, GrassrootsServer *grassroots_p)
+{
+	UsersServiceData *shared_p = NULL;
+	UsersServiceData *idle_p = NULL;
+	const char *database_s = GetJSONString (service_config_p, "database");
+	const char *users_collection_s = GetJSONString (service_config_p, "users_collection");
+
+	if (database_s && users_collection_s)
+		{
+			pthread_mutex_lock (&s_shared_data_lock);
+
+			shared_p = s_shared_data_p;
+
+			while (shared_p && ((strcmp (shared_p -> usd_database_s, database_s) != 0) || (strcmp (shared_p -> usd_users_collection_s, users_collection_s) != 0)))
+				{
+					shared_p = shared_p -> usd_next_shared_p;
+				}
+
+			if (!shared_p)
+				{
+					if ((shared_p = AllocateUsersServiceData ()) != NULL)
+						{
+							bool success_flag = false;
+
+							/*
+							 * This outlives the Service whose configuration it was
+							 * made from, so it needs its own copies
+							 */
+							shared_p -> usd_base_data.sd_service_p = NULL;
+							shared_p -> usd_grassroots_p = grassroots_p;
+							shared_p -> usd_base_data.sd_config_p = json_deep_copy (service_config_p);
+							shared_p -> usd_database_s = EasyCopyToNewString (database_s);
+							shared_p -> usd_users_collection_s = EasyCopyToNewString (users_collection_s);
+
+							if ((shared_p -> usd_base_data.sd_config_p) && (shared_p -> usd_database_s) && (shared_p -> usd_users_collection_s))
+								{
+									success_flag = ConfigureSharedUsersServiceData (shared_p, grassroots_p);
+								}
+
+							if (success_flag)
+								{
+									shared_p -> usd_next_shared_p = s_shared_data_p;
+									s_shared_data_p = shared_p;
+								}
+							else
+								{
+									FreeSharedUsersServiceDataEntry (shared_p);
+									shared_p = NULL;
+								}
+						}
+				}
+
+			if (shared_p)
+				{
+					++ (shared_p -> usd_ref_count);
+				}
+
+			/*
+			 * Since we're on one of the server's threads, this
+			 * is a good time to get rid of anything unused
+			 */
+			idle_p = RemoveIdleSharedUsersServiceData (time (NULL));
+
+			pthread_mutex_unlock (&s_shared_data_lock);
+
+			if (idle_p)
+				{
+					FreeSharedUsersServiceDataEntries (idle_p);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Both database and users_collection must be set");
+		}
+
+	return shared_p;
+}
+
+
+static bool ConfigureSharedUsersServiceData (UsersServiceData *data_p, GrassrootsServer *grassroots_p)
 {
 	bool success_flag = false;
 	const json_t *service_config_p = data_p -> usd_base_data.sd_config_p;
+	const char *groups_collection_s = GetJSONString (service_config_p, "groups_collection");
+
+	if (groups_collection_s && ((data_p -> usd_groups_collection_s = EasyCopyToNewString (groups_collection_s)) != NULL))
+		{
+			int pool_size = UMP_DEFAULT_SIZE;
+
+			/*
+			 * How many database calls can be made at the same time?
+			 */
+			GetJSONInteger (service_config_p, "mongo_pool_size", &pool_size);
+
+			if (pool_size <= 0)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid mongo_pool_size %d, using %d", pool_size, UMP_DEFAULT_SIZE);
+					pool_size = UMP_DEFAULT_SIZE;
+				}
+
+			if ((data_p -> usd_mongo_pool_p = AllocateUsersMongoPool ((uint32) pool_size, grassroots_p -> gs_mongo_manager_p, data_p -> usd_database_s)) != NULL)
+				{
+					MongoTool *tool_p = CheckOutMongoTool (data_p -> usd_mongo_pool_p);
+					int ttl = UD_DEFAULT_TTL;
+					int search_limit = 0;
+					int batch_size = UI_DEFAULT_BATCH_SIZE;
+					int cache_size = UC_DEFAULT_CAPACITY;
+					const json_t *write_behind_config_p = json_object_get (service_config_p, "write_behind");
+					const json_t *timings_config_p = json_object_get (service_config_p, "timings");
+					int num_workers = 0;
+					int idle_timeout = USD_DEFAULT_IDLE_TIMEOUT;
+					bool cache_flag = true;
+					bool watch_flag = false;
 
-	data_p -> usd_database_s = GetJSONString (service_config_p, "database");
+					/*
+					 * This is only run once for each collection in the process
+					 * rather than every time that the service is created
+					 */
+					EnsureUsersIndexes (data_p, tool_p, service_config_p);
+
+					/*
+					 * Users are listed in sort key order so any without one would be out of place
+					 */
+					if (!BackfillUsersSortFields (tool_p, data_p -> usd_users_collection_s, UI_DEFAULT_BATCH_SIZE))
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add sort keys to all users in \"%s\"", data_p -> usd_users_collection_s);
+						}
+
+					CheckInMongoTool (data_p -> usd_mongo_pool_p, tool_p);
+
+					/*
+					 * How long, in seconds, can the list of users be cached for?
+					 */
+					GetJSONInteger (service_config_p, "users_directory_ttl", &ttl);
+
+					if (ttl < 0)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid users_directory_ttl %d, using %d", ttl, UD_DEFAULT_TTL);
+							ttl = UD_DEFAULT_TTL;
+						}
+
+					/*
+					 * Should the users list be replaced by a search?
+					 */
+					if (GetJSONInteger (service_config_p, "users_search_limit", &search_limit))
+						{
+							if (search_limit > 0)
+								{
+									data_p -> usd_search_limit = (uint32) search_limit;
+								}
+						}
+
+					/*
+					 * How many users should be written at a time when importing?
+					 */
+					GetJSONInteger (service_config_p, "import_batch_size", &batch_size);
+
+					if (batch_size > 0)
+						{
+							data_p -> usd_import_batch_size = (uint32) batch_size;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid import_batch_size %d, using %d", batch_size, UI_DEFAULT_BATCH_SIZE);
+						}
+
+					/*
+					 * How many Users should be kept for editing?
+					 */
+					GetJSONInteger (service_config_p, "users_cache_size", &cache_size);
+
+					if (cache_size > 0)
+						{
+							if ((data_p -> usd_users_cache_p = AllocateUsersCache ((uint32) cache_size, (uint32) ttl)) == NULL)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate users cache of size %d", cache_size);
+								}
+						}
+
+					/*
+					 * Should the list of users be cached or streamed
+					 * from the database for each request?
+					 */
+					GetJSONBoolean (service_config_p, "users_directory_cache", &cache_flag);
+
+					if (cache_flag)
+						{
+							int sync_overlap = UD_DEFAULT_SYNC_OVERLAP_MS;
+							int full_reload_interval = UD_DEFAULT_FULL_RELOAD_INTERVAL;
+							bool template_flag = true;
+
+							/*
+							 * How far back, in milliseconds, should a refresh look for
+							 * changes that were acknowledged out of order?
+							 */
+							GetJSONInteger (service_config_p, "users_directory_sync_overlap_ms", &sync_overlap);
+
+							if (sync_overlap < 0)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid users_directory_sync_overlap_ms %d, using %d", sync_overlap, UD_DEFAULT_SYNC_OVERLAP_MS);
+									sync_overlap = UD_DEFAULT_SYNC_OVERLAP_MS;
+								}
+
+							/*
+							 * How often, in seconds, should every User be loaded to
+							 * catch any deletions that a sync missed? 0 means never.
+							 */
+							GetJSONInteger (service_config_p, "users_directory_full_reload_interval", &full_reload_interval);
+
+							if (full_reload_interval < 0)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid users_directory_full_reload_interval %d, using %d", full_reload_interval, UD_DEFAULT_FULL_RELOAD_INTERVAL);
+									full_reload_interval = UD_DEFAULT_FULL_RELOAD_INTERVAL;
+								}
+
+							if ((data_p -> usd_directory_p = AllocateUsersDirectory ((uint32) ttl, (uint32) sync_overlap, (uint32) full_reload_interval)) != NULL)
+								{
+									success_flag = true;
+
+									/*
+									 * Should the ParameterSet be built once for each
+									 * revision of the directory? A search changes the
+									 * list for each request so there's nothing to reuse.
+									 */
+									GetJSONBoolean (service_config_p, "parameters_template", &template_flag);
+
+									if (template_flag && (data_p -> usd_search_limit == 0))
+										{
+											if ((data_p -> usd_parameters_template_p = AllocateUsersParametersTemplate ()) == NULL)
+												{
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate parameters template, building parameters for each request");
+												}
+										}
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate users directory");
+								}
+						}
+					else
+						{
+							/*
+							 * Searching needs the index held in the directory
+							 */
+							if (data_p -> usd_search_limit > 0)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "users_search_limit needs users_directory_cache to be enabled, listing all users instead");
+									data_p -> usd_search_limit = 0;
+								}
+
+							success_flag = true;
+						}
+
+					/*
+					 * Should changes made by other tools be picked up straight away?
+					 */
+					GetJSONBoolean (service_config_p, "watch_changes", &watch_flag);
+
+					if (success_flag && watch_flag && ((data_p -> usd_directory_p) || (data_p -> usd_users_cache_p)))
+						{
+							int poll_interval = UCW_DEFAULT_POLL_INTERVAL;
+
+							GetJSONInteger (service_config_p, "watch_poll_interval", &poll_interval);
+
+							if (poll_interval <= 0)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid watch_poll_interval %d, using %d", poll_interval, UCW_DEFAULT_POLL_INTERVAL);
+									poll_interval = UCW_DEFAULT_POLL_INTERVAL;
+								}
+
+							data_p -> usd_watcher_p = StartUsersChangeWatcher (data_p -> usd_directory_p, data_p -> usd_users_cache_p, data_p -> usd_mongo_pool_p, grassroots_p -> gs_mongo_manager_p,
+																																	data_p -> usd_database_s, data_p -> usd_users_collection_s, (uint32) poll_interval);
+
+							if (! (data_p -> usd_watcher_p))
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to start watching \"%s\" for changes", data_p -> usd_users_collection_s);
+								}
+						}
+
+					/*
+					 * Should the time taken by each phase be recorded? This is done
+					 * before starting the workers and write-behind thread
+					 * as they record their times too.
+					 */
+					if (timings_config_p)
+						{
+							bool enabled_flag = false;
+
+							if (GetJSONBoolean (timings_config_p, "enabled", &enabled_flag) && enabled_flag)
+								{
+									int dump_interval = 0;
+
+									GetJSONInteger (timings_config_p, "dump_interval", &dump_interval);
+
+									if (dump_interval < 0)
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid timings dump_interval %d, only writing timings at close", dump_interval);
+											dump_interval = 0;
+										}
+
+									if ((data_p -> usd_timings_p = AllocateUsersTimings ((uint32) dump_interval, GetJSONString (timings_config_p, "dump_trigger"))) == NULL)
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate timings");
+										}
+								}
+						}
+
+					/*
+					 * Should jobs be run in the background?
+					 */
+					if (success_flag && GetJSONInteger (service_config_p, "async_workers", &num_workers) && (num_workers > 0))
+						{
+							int queue_size = UWP_DEFAULT_QUEUE_SIZE;
+
+							GetJSONInteger (service_config_p, "async_queue_size", &queue_size);
+
+							if (queue_size <= 0)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid async_queue_size %d, using %d", queue_size, UWP_DEFAULT_QUEUE_SIZE);
+									queue_size = UWP_DEFAULT_QUEUE_SIZE;
+								}
+
+							if ((data_p -> usd_workers_p = AllocateUsersWorkerPool ((uint32) num_workers, (uint32) queue_size)) != NULL)
+								{
+									data_p -> usd_publish_jobs_flag = true;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to start %d workers, running jobs synchronously", num_workers);
+								}
+						}
+
+					/*
+					 * Should new Users be written in batches?
+					 */
+					if (success_flag && write_behind_config_p)
+						{
+							StartUsersWriteBehindFromConfig (data_p, write_behind_config_p);
+						}
+
+					/*
+					 * How long, in seconds, should all of this be kept
+					 * for the next request once nothing is using it?
+					 */
+					GetJSONInteger (service_config_p, "shared_data_idle_timeout", &idle_timeout);
+
+					if (idle_timeout >= 0)
+						{
+							data_p -> usd_idle_timeout = (uint32) idle_timeout;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid shared_data_idle_timeout %d, using %d", idle_timeout, USD_DEFAULT_IDLE_TIMEOUT);
+						}
+
+					/*
+					 * How should submitted populations store their calls?
+					 */
+					GetJSONBoolean (service_config_p, "columnar_populations", & (data_p -> usd_columnar_populations_flag));
+					GetJSONBoolean (service_config_p, "packed_populations", & (data_p -> usd_packed_populations_flag));
+				}		/* if ((data_p -> usd_mongo_pool_p = AllocateUsersMongoPool ((uint32) pool_size, grassroots_p -> gs_mongo_manager_p, data_p -> usd_database_s)) != NULL) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate MongoTool pool of size %d", pool_size);
+				}
 
-	if (data_p -> usd_database_s)
+		}		/* if (groups_collection_s && ((data_p -> usd_groups_collection_s = EasyCopyToNewString (groups_collection_s)) != NULL)) */
+	else
 		{
-			if ((data_p -> usd_users_collection_s = GetJSONString (service_config_p, "users_collection")) != NULL)
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "No groups_collection set");
+		}
+
+	return success_flag;
+}
+
+
+static void FreeSharedUsersServiceDataEntry (UsersServiceData *shared_p)
+{
+	json_t *config_p = shared_p -> usd_base_data.sd_config_p;
+	char *database_s = (char *) (shared_p -> usd_database_s);
+	char *users_collection_s = (char *) (shared_p -> usd_users_collection_s);
+	char *groups_collection_s = (char *) (shared_p -> usd_groups_collection_s);
+
+	/*
+	 * Anything still running needs the names so they are freed last
+	 */
+	FreeUsersServiceData (shared_p);
+
+	if (groups_collection_s)
+		{
+			FreeCopiedString (groups_collection_s);
+		}
+
+	if (users_collection_s)
+		{
+			FreeCopiedString (users_collection_s);
+		}
+
+	if (database_s)
+		{
+			FreeCopiedString (database_s);
+		}
+
+	if (config_p)
+		{
+			json_decref (config_p);
+		}
+}
+
+
+void AcquireSharedUsersServiceData (UsersServiceData *data_p)
+{
+	UsersServiceData *shared_p = (data_p -> usd_shared_p) ? (data_p -> usd_shared_p) : data_p;
+
+	pthread_mutex_lock (&s_shared_data_lock);
+	++ (shared_p -> usd_ref_count);
+	pthread_mutex_unlock (&s_shared_data_lock);
+}
+
+
+void ReleaseSharedUsersServiceData (UsersServiceData *data_p, const bool server_thread_flag)
+{
+	UsersServiceData *shared_p = (data_p -> usd_shared_p) ? (data_p -> usd_shared_p) : data_p;
+	UsersServiceData *idle_p = NULL;
+	const time_t now = time (NULL);
+
+	pthread_mutex_lock (&s_shared_data_lock);
+
+	if (shared_p -> usd_ref_count > 0)
+		{
+			if (-- (shared_p -> usd_ref_count) == 0)
+				{
+					shared_p -> usd_idle_time = now;
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Shared data for \"%s\" released more times than it was acquired", shared_p -> usd_users_collection_s);
+		}
+
+	/*
+	 * Freeing the shared data stops the workers and write-behind
+	 * thread so it can't be done from one of them. Anything left
+	 * unused by them is picked up by the next server thread instead.
+	 */
+	if (server_thread_flag)
+		{
+			idle_p = RemoveIdleSharedUsersServiceData (now);
+		}
+
+	pthread_mutex_unlock (&s_shared_data_lock);
+
+	if (idle_p)
+		{
+			FreeSharedUsersServiceDataEntries (idle_p);
+		}
+}
+
+
+/*
+ * Unlink every shared UsersServiceData that has been unused for longer
+ * than its idle timeout. This must be called with s_shared_data_lock held.
+ */
+static UsersServiceData *RemoveIdleSharedUsersServiceData (const time_t now)
+{
+	UsersServiceData *idle_p = NULL;
+	UsersServiceData **shared_pp = &s_shared_data_p;
+
+	while (*shared_pp)
+		{
+			UsersServiceData *shared_p = *shared_pp;
+
+			if ((shared_p -> usd_ref_count == 0) && (difftime (now, shared_p -> usd_idle_time) >= (double) (shared_p -> usd_idle_timeout)))
+				{
+					*shared_pp = shared_p -> usd_next_shared_p;
+
+					shared_p -> usd_next_shared_p = idle_p;
+					idle_p = shared_p;
+				}
+			else
+				{
+					shared_pp = & (shared_p -> usd_next_shared_p);
+				}
+		}
+
+	return idle_p;
+}
+
+
+/*
+ * These have already been unlinked so the lock isn't held while
+ * waiting for their threads to stop.
+ */
+static void FreeSharedUsersServiceDataEntries (UsersServiceData *shared_p)
+{
+	while (shared_p)
+		{
+			UsersServiceData *next_p = shared_p -> usd_next_shared_p;
+
+			PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Freeing unused shared data for \"%s\"", shared_p -> usd_users_collection_s);
+
+			FreeSharedUsersServiceDataEntry (shared_p);
+			shared_p = next_p;
+		}
+}
+
+
+void UpdateUsersServiceJob (UsersServiceData *data_p, ServiceJob *job_p, const OperationStatus status)
+{
+	SetServiceJobStatus (job_p, status);
+
+	if (data_p -> usd_publish_jobs_flag)
+		{
+			JobsManager *jobs_manager_p = GetJobsManager (data_p -> usd_grassroots_p);
+
+			if (!AddServiceJobToJobsManager (jobs_manager_p, job_p -> sj_id, job_p))
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to store job with status %d", status);
+				}
+		}
+}
+
+
+ServiceJob *CopyUsersServiceJob (UsersServiceData *data_p, ServiceJob *job_p)
+{
+	ServiceJob *copied_job_p = NULL;
+	json_t *job_json_p = GetServiceJobAsJSON (job_p, false);
+
+	if (job_json_p)
+		{
+			copied_job_p = CreateServiceJobFromJSON (job_json_p, data_p -> usd_grassroots_p);
+
+			if (!copied_job_p)
+				{
+					PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, job_json_p, "Failed to copy ServiceJob");
+				}
+
+			json_decref (job_json_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get ServiceJob as JSON to copy it");
+		}
+
+	return copied_job_p;
+}
+
+
+/*
+ * Make sure that the indexes used to sort and look up Users exist.
+ * Any failures are logged but don't stop the service from running.
+ */
+static void EnsureUsersIndexes (UsersServiceData *data_p, MongoTool *tool_p, const json_t *service_config_p)
+{
+	const json_t *indexes_p = json_object_get (service_config_p, "users_indexes");
+	json_t *default_indexes_p = NULL;
+
+	if (!indexes_p)
+		{
+			default_indexes_p = json_pack ("[{s:s,s:[s,s]},{s:s,s:[s],s:b},{s:s,s:[s],s:b},{s:s,s:[s]},{s:s,s:[s]}]",
+																		 "name", "surname_forename", "keys", US_SURNAME_S, US_FORENAME_S,
+																		 "name", "email", "keys", US_EMAIL_S, "unique", 1,
+																		 "name", "orcid", "keys", US_ORCID_S, "sparse", 1,
+																		 "name", "timestamp", "keys", MONGO_TIMESTAMP_S,
+																		 "name", "sort_key", "keys", US_SORT_KEY_S);
+
+			indexes_p = default_indexes_p;
+		}
+
+	if (json_is_array (indexes_p))
+		{
+			if (SetMongoToolCollection (tool_p, data_p -> usd_users_collection_s))
+				{
+					const size_t num_indexes = json_array_size (indexes_p);
+					size_t i;
+
+					for (i = 0; i < num_indexes; ++ i)
+						{
+							const json_t *index_p = json_array_get (indexes_p, i);
+
+							if (!EnsureUsersIndex (data_p, tool_p, index_p))
+								{
+									PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, index_p, "Failed to create index on \"%s\"", data_p -> usd_users_collection_s);
+								}
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set collection to \"%s\" to create indexes", data_p -> usd_users_collection_s);
+				}
+		}
+	else if (indexes_p)
+		{
+			PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, indexes_p, "users_indexes is not an array");
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create default users indexes");
+		}
+
+	if (default_indexes_p)
+		{
+			json_decref (default_indexes_p);
+		}
+}
+
+
+/*
+ * Each index is of the form
+ *
+ * { "name": <string>, "keys": [ <string>, ... ], "unique": <boolean>, "sparse": <boolean> }
+ *
+ * where unique and sparse are optional.
+ */
+static bool EnsureUsersIndex (UsersServiceData *data_p, MongoTool *tool_p, const json_t *index_p)
+{
+	bool success_flag = false;
+	const char *name_s = GetJSONString (index_p, "name");
+	const json_t *keys_p = json_object_get (index_p, "keys");
+
+	if (name_s && json_is_array (keys_p) && (json_array_size (keys_p) > 0))
+		{
+			bson_t *command_p = BCON_NEW ("createIndexes", BCON_UTF8 (data_p -> usd_users_collection_s));
+
+			if (command_p)
 				{
-					if ((data_p -> usd_groups_collection_s = GetJSONString (service_config_p, "groups_collection")) != NULL)
+					bson_t indexes;
+
+					if (BSON_APPEND_ARRAY_BEGIN (command_p, "indexes", &indexes))
 						{
-							if ((data_p -> usd_mongo_p = AllocateMongoTool (NULL, grassroots_p -> gs_mongo_manager_p)) != NULL)
+							bson_t index;
+
+							if (BSON_APPEND_DOCUMENT_BEGIN (&indexes, "0", &index))
 								{
-									if (SetMongoToolDatabase (data_p -> usd_mongo_p, data_p -> usd_database_s))
+									bson_t keys;
+
+									if (BSON_APPEND_DOCUMENT_BEGIN (&index, "key", &keys))
 										{
+											const size_t num_keys = json_array_size (keys_p);
+											size_t i;
+
 											success_flag = true;
+
+											for (i = 0; (i < num_keys) && success_flag; ++ i)
+												{
+													const json_t *key_p = json_array_get (keys_p, i);
+
+													if (! (json_is_string (key_p) && BSON_APPEND_INT32 (&keys, json_string_value (key_p), 1)))
+														{
+															success_flag = false;
+														}
+												}
+
+											success_flag = bson_append_document_end (&index, &keys) && success_flag;
 										}
-									else
+
+									if (success_flag)
 										{
-											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set MongoTool database to \"%s\"", data_p -> usd_database_s);
+											bool unique_flag = false;
+											bool sparse_flag = false;
+
+											GetJSONBoolean (index_p, "unique", &unique_flag);
+											GetJSONBoolean (index_p, "sparse", &sparse_flag);
+
+											success_flag = BSON_APPEND_UTF8 (&index, "name", name_s) &&
+												BSON_APPEND_BOOL (&index, "unique", unique_flag) &&
+												BSON_APPEND_BOOL (&index, "sparse", sparse_flag);
 										}
 
+									success_flag = bson_append_document_end (&indexes, &index) && success_flag;
+								}
+
+							success_flag = bson_append_array_end (command_p, &indexes) && success_flag;
+						}
+
+					if (success_flag)
+						{
+							bson_t reply;
+							bson_error_t error;
+
+							/*
+							 * createIndexes does nothing if an identical index already exists
+							 */
+							if (mongoc_collection_write_command_with_opts (tool_p -> mt_collection_p, command_p, NULL, &reply, &error))
+								{
+									bson_iter_t iter;
 
-								}		/* if ((data_p -> usd_mongo_p = AllocateMongoTool (NULL, grassroots_p -> gs_mongo_manager_p)) != NULL) */
+									if (bson_iter_init_find (&iter, &reply, "note"))
+										{
+											PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Index \"%s\" on \"%s\" already exists", name_s, data_p -> usd_users_collection_s);
+										}
+									else
+										{
+											PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Built index \"%s\" on \"%s\"", name_s, data_p -> usd_users_collection_s);
+										}
+								}
 							else
 								{
-									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate MongoTool");
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to build index \"%s\" on \"%s\": %s", name_s, data_p -> usd_users_collection_s, error.message);
+									success_flag = false;
 								}
 
-						}		/* if ((data_p -> usd_groups_collection_s = GetJSONString (service_config_p, "groups_collection")) != NULL) */
+							bson_destroy (&reply);
+						}
 
-				}		/* if ((data_p -> usd_users_collection_s = GetJSONString (service_config_p, "users_collection")) != NULL) */
+					bson_destroy (command_p);
+				}		/* if (command_p) */
 
-		}		/* if (data_p -> psd_database_s) */
+		}		/* if (name_s && json_is_array (keys_p) && (json_array_size (keys_p) > 0)) */
 
 	return success_flag;
 }
 
 
+static void StartUsersWriteBehindFromConfig (UsersServiceData *data_p, const json_t *write_behind_config_p)
+{
+	bool enabled_flag = false;
+
+	if (GetJSONBoolean (write_behind_config_p, "enabled", &enabled_flag) && enabled_flag)
+		{
+			/*
+			 * A queued User's job only finishes after the service has
+			 * returned so the service needs to be running asynchronously
+			 */
+			if (data_p -> usd_workers_p)
+				{
+					int batch_size = UWB_DEFAULT_BATCH_SIZE;
+					int flush_interval = UWB_DEFAULT_FLUSH_INTERVAL_MS;
+
+					GetJSONInteger (write_behind_config_p, "batch_size", &batch_size);
+
+					if (batch_size <= 0)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid write_behind batch_size %d, using %d", batch_size, UWB_DEFAULT_BATCH_SIZE);
+							batch_size = UWB_DEFAULT_BATCH_SIZE;
+						}
+
+					GetJSONInteger (write_behind_config_p, "flush_interval_ms", &flush_interval);
+
+					if (flush_interval < 0)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Invalid write_behind flush_interval_ms %d, using %d", flush_interval, UWB_DEFAULT_FLUSH_INTERVAL_MS);
+							flush_interval = UWB_DEFAULT_FLUSH_INTERVAL_MS;
+						}
+
+					data_p -> usd_write_behind_p = StartUsersWriteBehind (data_p -> usd_mongo_pool_p, data_p -> usd_users_collection_s, data_p -> usd_directory_p, data_p -> usd_users_cache_p,
+																																(uint32) batch_size, (uint32) flush_interval, FinishUsersWriteBehindJob, data_p);
+
+					if (! (data_p -> usd_write_behind_p))
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to start write-behind queue, saving users one at a time");
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "write_behind needs async_workers to be set, saving users one at a time");
+				}
+		}
+}
+
+
+/*
+ * Called on the write-behind thread once a queued User has been written.
+ */
+static void FinishUsersWriteBehindJob (void *data_p, ServiceJob *job_p, const OperationStatus status)
+{
+	/*
+	 * This is the worker's own copy of the job, which is handed
+	 * over to us when the User is queued
+	 */
+	UpdateUsersServiceJob ((UsersServiceData *) data_p, job_p, status);
+	LogServiceJob (job_p);
+	FreeServiceJob (job_p);
+
+	/*
+	 * Give up the reference that was taken when the User was queued
+	 */
+	ReleaseSharedUsersServiceData ((UsersServiceData *) data_p, false);
+}
@@ -0,0 +1,392 @@
+/*
+ * users_sort_key.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <string.h>
+
+#include "users_sort_key.h"
+#include "users_service_data.h"
+#include "users_cursor.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "mongodb_util.h"
+
+
+/*
+ * Static declarations
+ */
+
+/**
+ * Goes between the surname and forename in a sort key. It is lower
+ * than any printable character so "Smith, John" sorts before
+ * "Smithson, Anne".
+ */
+static const char S_SORT_KEY_SEPARATOR = '\x1f';
+
+/** The first code point in S_LATIN_FOLDS_SS. */
+static const unsigned int S_FIRST_LATIN_FOLD = 0xC0;
+
+/**
+ * The folded forms of U+00C0 to U+017F, the Latin-1 Supplement and
+ * Latin Extended-A letters. NULL entries are left as they are.
+ * Each fold is no longer than the 2 bytes used to encode its
+ * character in UTF-8, so strings can be folded in place.
+ *
+ * Only ASCII and these two blocks are folded. Names in any other
+ * script, such as Greek, Cyrillic or Latin Extended-B (e.g. "Ș"),
+ * keep their case and accents, so they sort by their code points
+ * after every folded name and only match searches for exactly the
+ * same characters. Covering them would need full Unicode case
+ * folding and decomposition, e.g. a MongoDB collation with strength 1,
+ * rather than extending this table.
+ */
+static const char * const S_LATIN_FOLDS_SS [] =
+{
+	/* U+00C0 */ "a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+	/* U+00D0 */ "d", "n", "o", "o", "o", "o", "o", NULL, "o", "u", "u", "u", "u", "y", "th", "ss",
+	/* U+00E0 */ "a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+	/* U+00F0 */ "d", "n", "o", "o", "o", "o", "o", NULL, "o", "u", "u", "u", "u", "y", "th", "y",
+	/* U+0100 */ "a", "a", "a", "a", "a", "a", "c", "c", "c", "c", "c", "c", "c", "c", "d", "d",
+	/* U+0110 */ "d", "d", "e", "e", "e", "e", "e", "e", "e", "e", "e", "e", "g", "g", "g", "g",
+	/* U+0120 */ "g", "g", "g", "g", "h", "h", "h", "h", "i", "i", "i", "i", "i", "i", "i", "i",
+	/* U+0130 */ "i", "i", "ij", "ij", "j", "j", "k", "k", "k", "l", "l", "l", "l", "l", "l", "l",
+	/* U+0140 */ "l", "l", "l", "n", "n", "n", "n", "n", "n", "n", "n", "n", "o", "o", "o", "o",
+	/* U+0150 */ "o", "o", "oe", "oe", "r", "r", "r", "r", "r", "r", "s", "s", "s", "s", "s", "s",
+	/* U+0160 */ "s", "s", "t", "t", "t", "t", "t", "t", "u", "u", "u", "u", "u", "u", "u", "u",
+	/* U+0170 */ "u", "u", "u", "u", "w", "w", "y", "y", "y", "z", "z", "z", "z", "z", "z", "s"
+};
+
+
+/** The fields needed to work out a User's sort key and display name. */
+static const char * const S_BACKFILL_FIELDS_SS [] = { US_SURNAME_S, US_FORENAME_S, US_EMAIL_S, NULL };
+
+
+static bool AddUsersSortFieldsUpdate (mongoc_bulk_operation_t *bulk_p, const UsersCursorRow *row_p);
+
+static bool ExecuteUsersSortFieldsUpdates (mongoc_bulk_operation_t *bulk_p, const char *collection_s);
+
+
+/*
+ * API definitions
+ */
+
+void FoldUsersString (char *value_s)
+{
+	const unsigned char *src_p = (const unsigned char *) value_s;
+	char *dest_p = value_s;
+	const unsigned int num_folds = sizeof (S_LATIN_FOLDS_SS) / sizeof (S_LATIN_FOLDS_SS [0]);
+
+	while (*src_p)
+		{
+			if (*src_p < 0x80)
+				{
+					*dest_p = (char) (((*src_p >= 'A') && (*src_p <= 'Z')) ? (*src_p + ('a' - 'A')) : *src_p);
+					++ dest_p;
+					++ src_p;
+				}
+			else if (((*src_p & 0xE0) == 0xC0) && ((src_p [1] & 0xC0) == 0x80))
+				{
+					/* A 2-byte sequence, which covers all of the Latin letters that we fold */
+					const unsigned int code_point = ((unsigned int) (*src_p & 0x1F) << 6) | (unsigned int) (src_p [1] & 0x3F);
+					const char *fold_s = NULL;
+
+					if ((code_point >= S_FIRST_LATIN_FOLD) && (code_point < S_FIRST_LATIN_FOLD + num_folds))
+						{
+							fold_s = S_LATIN_FOLDS_SS [code_point - S_FIRST_LATIN_FOLD];
+						}
+
+					if (fold_s)
+						{
+							while (*fold_s)
+								{
+									*dest_p = *fold_s;
+									++ dest_p;
+									++ fold_s;
+								}
+						}
+					else
+						{
+							dest_p [0] = (char) src_p [0];
+							dest_p [1] = (char) src_p [1];
+							dest_p += 2;
+						}
+
+					src_p += 2;
+				}
+			else
+				{
+					*dest_p = (char) *src_p;
+					++ dest_p;
+					++ src_p;
+				}
+		}
+
+	*dest_p = '\0';
+}
+
+
+char *GetUsersSortKey (const char *surname_s, const char *forename_s)
+{
+	const size_t surname_length = surname_s ? strlen (surname_s) : 0;
+	const size_t forename_length = forename_s ? strlen (forename_s) : 0;
+	char *key_s = (char *) AllocMemory (surname_length + forename_length + 2);
+
+	if (key_s)
+		{
+			char *c_p = key_s;
+
+			if (surname_length > 0)
+				{
+					memcpy (c_p, surname_s, surname_length);
+					c_p += surname_length;
+				}
+
+			*c_p = S_SORT_KEY_SEPARATOR;
+			++ c_p;
+
+			if (forename_length > 0)
+				{
+					memcpy (c_p, forename_s, forename_length);
+					c_p += forename_length;
+				}
+
+			*c_p = '\0';
+
+			FoldUsersString (key_s);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate sort key for \"%s\" \"%s\"", surname_s ? surname_s : "", forename_s ? forename_s : "");
+		}
+
+	return key_s;
+}
+
+
+void FreeUsersSortKey (char *key_s)
+{
+	FreeMemory (key_s);
+}
+
+
+bool AddUsersSortFields (json_t *user_json_p, const User *user_p)
+{
+	bool success_flag = false;
+	char *key_s = GetUsersSortKey (user_p -> us_surname_s, user_p -> us_forename_s);
+
+	if (key_s)
+		{
+			if (SetJSONString (user_json_p, US_SORT_KEY_S, key_s))
+				{
+					char *name_s = GetFullUsername (user_p);
+
+					if (name_s)
+						{
+							if (SetJSONString (user_json_p, US_DISPLAY_NAME_S, name_s))
+								{
+									success_flag = true;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set \"%s\" to \"%s\"", US_DISPLAY_NAME_S, name_s);
+								}
+
+							FreeFullUsername (name_s);
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get full username for \"%s\"", user_p -> us_email_s);
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set \"%s\" to \"%s\"", US_SORT_KEY_S, key_s);
+				}
+
+			FreeUsersSortKey (key_s);
+		}
+
+	return success_flag;
+}
+
+
+bool BackfillUsersSortFields (MongoTool *tool_p, const char *collection_s, const uint32 batch_size)
+{
+	bool success_flag = false;
+	bson_t *query_p = BCON_NEW (US_SORT_KEY_S, "{", "$exists", BCON_BOOL (false), "}");
+
+	/*
+	 * Each update only touches its own User so they can be applied in any
+	 * order and one failing doesn't need to stop the rest
+	 */
+	bson_t *bulk_opts_p = BCON_NEW ("ordered", BCON_BOOL (false));
+
+	if (query_p && bulk_opts_p)
+		{
+			UsersCursor cursor;
+
+			if (OpenUsersCursor (&cursor, tool_p, collection_s, query_p, S_BACKFILL_FIELDS_SS))
+				{
+					mongoc_bulk_operation_t *bulk_p = NULL;
+					const UsersCursorRow *row_p = NULL;
+					uint32 num_queued = 0;
+					size_t num_updated = 0;
+
+					success_flag = true;
+
+					while (success_flag && ((row_p = GetNextUsersCursorRow (&cursor)) != NULL))
+						{
+							if (!bulk_p)
+								{
+									if ((bulk_p = mongoc_collection_create_bulk_operation_with_opts (tool_p -> mt_collection_p, bulk_opts_p)) == NULL)
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create bulk operation for \"%s\"", collection_s);
+											success_flag = false;
+										}
+								}
+
+							if (bulk_p)
+								{
+									if (AddUsersSortFieldsUpdate (bulk_p, row_p))
+										{
+											++ num_queued;
+
+											if (num_queued == batch_size)
+												{
+													success_flag = ExecuteUsersSortFieldsUpdates (bulk_p, collection_s);
+													mongoc_bulk_operation_destroy (bulk_p);
+													bulk_p = NULL;
+
+													num_updated += num_queued;
+													num_queued = 0;
+												}
+										}
+									else
+										{
+											success_flag = false;
+										}
+								}
+
+						}		/* while (success_flag && ((row_p = GetNextUsersCursorRow (&cursor)) != NULL)) */
+
+					if (bulk_p)
+						{
+							if (success_flag && (num_queued > 0))
+								{
+									success_flag = ExecuteUsersSortFieldsUpdates (bulk_p, collection_s);
+									num_updated += num_queued;
+								}
+
+							mongoc_bulk_operation_destroy (bulk_p);
+						}
+
+					if (HasUsersCursorFailed (&cursor))
+						{
+							success_flag = false;
+						}
+
+					CloseUsersCursor (&cursor);
+
+					if (num_updated > 0)
+						{
+							PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Added sort keys and display names to " SIZET_FMT " users in \"%s\"", num_updated, collection_s);
+						}
+
+				}		/* if (OpenUsersCursor (&cursor, tool_p, collection_s, query_p, S_BACKFILL_FIELDS_SS)) */
+
+		}		/* if (query_p && bulk_opts_p) */
+
+	if (bulk_opts_p)
+		{
+			bson_destroy (bulk_opts_p);
+		}
+
+	if (query_p)
+		{
+			bson_destroy (query_p);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Static definitions
+ */
+
+static bool AddUsersSortFieldsUpdate (mongoc_bulk_operation_t *bulk_p, const UsersCursorRow *row_p)
+{
+	bool success_flag = false;
+	char *key_s = GetUsersSortKey (row_p -> ucr_surname_s, row_p -> ucr_forename_s);
+
+	if (key_s)
+		{
+			char *name_s = GetUsersCursorRowName (row_p);
+
+			if (name_s)
+				{
+					bson_oid_t id;
+					bson_t *selector_p = NULL;
+
+					bson_oid_init_from_string (&id, row_p -> ucr_id_s);
+
+					if ((selector_p = BCON_NEW (MONGO_ID_S, BCON_OID (&id))) != NULL)
+						{
+							bson_t *update_p = BCON_NEW ("$set", "{", US_SORT_KEY_S, BCON_UTF8 (key_s), US_DISPLAY_NAME_S, BCON_UTF8 (name_s), "}");
+
+							if (update_p)
+								{
+									bson_error_t error;
+
+									if (mongoc_bulk_operation_update_one_with_opts (bulk_p, selector_p, update_p, NULL, &error))
+										{
+											success_flag = true;
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add sort key update for \"%s\": %s", row_p -> ucr_id_s, error.message);
+										}
+
+									bson_destroy (update_p);
+								}
+
+							bson_destroy (selector_p);
+						}
+
+					FreeUsersCursorRowName (name_s);
+				}
+			else
+				{
+					PrintBSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, row_p -> ucr_doc_p, "Failed to get full username");
+				}
+
+			FreeUsersSortKey (key_s);
+		}
+
+	return success_flag;
+}
+
+
+static bool ExecuteUsersSortFieldsUpdates (mongoc_bulk_operation_t *bulk_p, const char *collection_s)
+{
+	bool success_flag = false;
+	bson_t reply;
+	bson_error_t error;
+
+	if (mongoc_bulk_operation_execute (bulk_p, &reply, &error) != 0)
+		{
+			success_flag = true;
+		}
+	else
+		{
+			PrintBSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, &reply, "Failed to add sort keys to users in \"%s\": %s", collection_s, error.message);
+		}
+
+	bson_destroy (&reply);
+
+	return success_flag;
+}
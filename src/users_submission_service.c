@@ -25,6 +25,9 @@
 #include "users_submission_service.h"
 #include "users_service.h"
 #include "users_service_data.h"
+#include "users_cursor.h"
+#include "users_import.h"
+#include "users_sort_key.h"
 
 
 #include "audit.h"
@@ -35,12 +38,15 @@
 #include "mongodb_util.h"
 
 #include "string_parameter.h"
+#include "parameter_set.h"
+#include "grassroots_server.h"
 
 /*
  * Static declarations
  */
 
 static NamedParameterType S_USER_ID = { "US Id", PT_STRING };
+static NamedParameterType S_USER_SEARCH = { "US Search", PT_STRING };
 
 
 static NamedParameterType S_EMAIL = { "US Email", PT_STRING };
@@ -49,8 +55,44 @@ static NamedParameterType S_FORENAME = { "US Forename", PT_STRING };
 static NamedParameterType S_AFFILIATION = { "US Affiliation", PT_STRING };
 static NamedParameterType S_ORCID = { "US ORCID", PT_STRING };
 
+static NamedParameterType S_IMPORT = { "US Import", PT_JSON_TABLE };
+
 static const char * const S_EMPTY_LIST_OPTION_S = "<empty>";
 
+/**
+ * A job for a worker to run when the service is running
+ * asynchronously.
+ */
+typedef struct UsersSubmissionTask
+{
+	/**
+	 * The shared UsersServiceData for the service. The Service's own
+	 * UsersServiceData may have been freed before the task runs.
+	 */
+	UsersServiceData *ust_data_p;
+
+	/**
+	 * The worker's own copy of the ServiceJob to update. Once the User
+	 * has been queued to be written, this belongs to the write-behind
+	 * queue and is set to <code>NULL</code>.
+	 */
+	ServiceJob *ust_job_p;
+
+	/** The User to save or <code>NULL</code> if importing. */
+	User *ust_user_p;
+
+	/** The table of Users to import or <code>NULL</code> if saving a single User. */
+	json_t *ust_rows_p;
+
+} UsersSubmissionTask;
+
+
+/** The fields needed to list each User. */
+static const char * const S_LIST_FIELDS_SS [] = { US_SURNAME_S, US_FORENAME_S, NULL };
+
+/** The User's fields that GetUserAsJSON () can write, other than its id and timestamp. */
+static const char * const S_USER_KEYS_SS [] = { US_EMAIL_S, US_FORENAME_S, US_SURNAME_S, US_ORGANISATION_S, US_ORCID_S, NULL };
+
 
 
 static const char *GetUsersSubmissionServiceName (const Service *service_p);
@@ -76,13 +118,38 @@ static ServiceMetadata *GetUsersSubmissionServiceMetadata (Service *service_p);
 static bool GetUsersSubmissionServiceParameterTypesForNamedParameters (const Service *service_p, const char *param_name_s, ParameterType *pt_p);
 
 
-static bool SetUpUsersListParameter (const UsersServiceData *data_p, Parameter *param_p, const User *active_user_p, const bool empty_option_flag);
+static bool SetUpUsersListParameter (const UsersServiceData *data_p, Parameter *param_p, const User *active_user_p, const char *search_s, const bool empty_option_flag);
+
+static bool AddUsersListOptionsFromDirectory (const UsersServiceData *data_p, Parameter *param_p, const char *search_s, const char *param_value_s, bool *value_set_flag_p);
+
+static bool AddUsersListOptionsFromDatabase (const UsersServiceData *data_p, Parameter *param_p, const char *param_value_s, bool *value_set_flag_p);
+
+static bool AddUsersListOption (Parameter *param_p, const char *id_s, const char *name_s, const char *param_value_s, bool *value_set_flag_p);
 
+static bool AddUsersImportParameter (ServiceData *data_p, ParameterSet *param_set_p);
 
-static json_t *GetAllUsersAsJSON (const UsersServiceData *data_p, const bool full_data_flag);
+static User *GetUserFromParameters (ParameterSet *param_set_p);
 
+static bool CheckRequiredUserParameters (ParameterSet *param_set_p, ServiceJob *job_p);
 
-static OperationStatus SaveUser (User *user_p, ServiceJob *job_p, UsersServiceData *data_p);
+static OperationStatus RunUsersSubmissionLater (UsersServiceData *data_p, ServiceJob *job_p, User *user_p, json_t *rows_p);
+
+static void RunUsersSubmissionTask (void *data_p);
+
+static OperationStatus RunUsersSubmissionTaskNow (UsersSubmissionTask *task_p, ServiceJob *job_p, const bool queue_flag);
+
+static void FreeUsersSubmissionTask (void *data_p);
+
+static void FreeQueuedUsersSubmissionTask (void *data_p);
+
+
+static OperationStatus SaveUser (User *user_p, ServiceJob *job_p, UsersServiceData *data_p, const bool queue_flag);
+
+static bool QueueUsersWriteWithReference (UsersServiceData *data_p, User *user_p, const json_t *user_json_p, ServiceJob *job_p);
+
+static OperationStatus UpdateUser (User *user_p, const json_t *user_json_p, MongoTool *tool_p, UsersServiceData *data_p, bool *found_flag_p);
+
+static bool GetUserChanges (const json_t *user_json_p, const json_t *stored_user_p, json_t *set_p, json_t *unset_p);
 
 //static User *GetUserByIdString (const char *user_id_s, const UsersServiceData *data_p);
 
@@ -90,8 +157,16 @@ static OperationStatus SaveUser (User *user_p, ServiceJob *job_p, UsersServiceDa
 
 static User *GetUserFromResource (DataResource *resource_p, const NamedParameterType program_param_type, UsersServiceData *dfw_data_p);
 
+static const json_t *GetParametersJSONFromResource (DataResource *resource_p);
+
 static bool SetUpDefaultsFromExistingUser (const User *user_p, char **id_ss);
 
+static ParameterSet *BuildUsersSubmissionServiceParameters (Service *service_p, UsersServiceData *us_data_p, DataResource *resource_p, const User *active_user_p);
+
+static ParameterSet *GetUsersSubmissionServiceParametersFromTemplate (Service *service_p, UsersServiceData *data_p, const User *active_user_p);
+
+static bool SetUpActiveUserParameters (ParameterSet *param_set_p, const User *active_user_p);
+
 
 /*
  * API definitions
@@ -130,6 +205,11 @@ Service *GetUsersSubmissionService (GrassrootsServer *grassroots_p)
 
 							if (ConfigureUsersService (data_p, grassroots_p))
 								{
+									if (data_p -> usd_workers_p)
+										{
+											service_p -> se_synchronous = SY_ASYNCHRONOUS_DETACHED;
+										}
+
 									return service_p;
 								}
 						}		/* if (InitialiseService (.... */
@@ -173,19 +253,153 @@ static const char *GetUsersSubmissionServiceInformationUri (const Service * UNUS
 
 
 static ParameterSet *GetUsersSubmissionServiceParameters (Service *service_p, DataResource *resource_p, User * UNUSED_PARAM (user_p))
+{
+	ParameterSet *param_set_p = NULL;
+	UsersServiceData *data_p = (UsersServiceData *) (service_p -> se_data_p);
+	User *active_user_p = NULL;
+	UsersTimingSpan span;
+	UsersTimingSpan active_user_span;
+
+	StartUsersTimingSpan (data_p -> usd_timings_p, &span);
+
+	StartUsersTimingSpan (data_p -> usd_timings_p, &active_user_span);
+	active_user_p = GetUserFromResource (resource_p, S_USER_ID, data_p);
+	EndUsersTimingSpan (data_p -> usd_timings_p, &active_user_span, UTP_ACTIVE_USER);
+
+	/*
+	 * A search changes the list of Users for each request
+	 * so there's no template to use
+	 */
+	if ((data_p -> usd_parameters_template_p) && (data_p -> usd_search_limit == 0))
+		{
+			param_set_p = GetUsersSubmissionServiceParametersFromTemplate (service_p, data_p, active_user_p);
+		}
+
+	if (!param_set_p)
+		{
+			param_set_p = BuildUsersSubmissionServiceParameters (service_p, data_p, resource_p, active_user_p);
+		}
+
+	if (active_user_p)
+		{
+			FreeUser (active_user_p);
+		}
+
+	EndUsersTimingSpan (data_p -> usd_timings_p, &span, UTP_PARAMETERS);
+
+	return param_set_p;
+}
+
+
+/*
+ * Make the ParameterSet from the template for the current revision of the
+ * UsersDirectory. If there isn't one, this request builds it for the others.
+ */
+static ParameterSet *GetUsersSubmissionServiceParametersFromTemplate (Service *service_p, UsersServiceData *data_p, const User *active_user_p)
+{
+	ParameterSet *param_set_p = NULL;
+	const UsersDirectorySnapshot *snapshot_p = AcquireUsersDirectorySnapshot (data_p -> usd_directory_p, data_p -> usd_mongo_pool_p, data_p -> usd_users_collection_s);
+
+	if (snapshot_p)
+		{
+			UsersParametersTemplate *template_p = data_p -> usd_parameters_template_p;
+			const uint32 revision = snapshot_p -> uds_revision;
+			json_t *template_json_p = NULL;
+
+			/*
+			 * If the directory is reloaded while the template is being built,
+			 * the template is newer than this revision and so is just built
+			 * again by the next request
+			 */
+			ReleaseUsersDirectorySnapshot (data_p -> usd_directory_p, snapshot_p);
+
+			if ((template_json_p = AcquireUsersParametersTemplate (template_p, revision)) != NULL)
+				{
+					if ((param_set_p = CreateParameterSetFromJSON (template_json_p, service_p, false)) == NULL)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create parameters from template for revision " UINT32_FMT, revision);
+						}
+
+					ReleaseUsersParametersTemplate (template_p, template_json_p);
+				}
+			else if ((param_set_p = BuildUsersSubmissionServiceParameters (service_p, data_p, NULL, NULL)) != NULL)
+				{
+					if ((template_json_p = GetParameterSetAsJSON (param_set_p, GetSchemaVersion (data_p -> usd_grassroots_p), true)) != NULL)
+						{
+							SetUsersParametersTemplate (template_p, revision, template_json_p);
+							ReleaseUsersParametersTemplate (template_p, template_json_p);
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to get parameters as JSON for template revision " UINT32_FMT, revision);
+						}
+				}
+
+			if (param_set_p && active_user_p)
+				{
+					if (!SetUpActiveUserParameters (param_set_p, active_user_p))
+						{
+							FreeParameterSet (param_set_p);
+							param_set_p = NULL;
+						}
+				}
+
+		}		/* if (snapshot_p) */
+
+	return param_set_p;
+}
+
+
+/*
+ * Fill in the active User's values in a ParameterSet that was made with no
+ * active User. The User is already on the list since the list came from the
+ * current revision of the UsersDirectory.
+ */
+static bool SetUpActiveUserParameters (ParameterSet *param_set_p, const User *active_user_p)
+{
+	char id_s [MONGO_OID_STRING_BUFFER_SIZE];
+	const NamedParameterType *params_p [] = { &S_USER_ID, &S_EMAIL, &S_SURNAME, &S_FORENAME, &S_AFFILIATION, &S_ORCID };
+	const char *values_ss [] = { id_s, active_user_p -> us_email_s, active_user_p -> us_surname_s, active_user_p -> us_forename_s, active_user_p -> us_org_s, active_user_p -> us_orcid_s };
+	const size_t num_params = sizeof (params_p) / sizeof (params_p [0]);
+	size_t i;
+
+	bson_oid_to_string (active_user_p -> us_id_p, id_s);
+
+	for (i = 0; i < num_params; ++ i)
+		{
+			if (values_ss [i])
+				{
+					Parameter *param_p = GetParameterFromParameterSetByName (param_set_p, params_p [i] -> npt_name_s);
+
+					if (! (param_p && SetStringParameterDefaultValue (param_p, values_ss [i]) && SetStringParameterCurrentValue (param_p, values_ss [i])))
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set %s to \"%s\"", params_p [i] -> npt_name_s, values_ss [i]);
+							return false;
+						}
+				}
+		}
+
+	return true;
+}
+
+
+/*
+ * Build the ParameterSet from scratch. resource_p and active_user_p can be NULL.
+ */
+static ParameterSet *BuildUsersSubmissionServiceParameters (Service *service_p, UsersServiceData *us_data_p, DataResource *resource_p, const User *active_user_p)
 {
 	ParameterSet *param_set_p = AllocateParameterSet ("User submission service parameters", "The parameters used for the User submission service");
 
 	if (param_set_p)
 		{
-			ServiceData *data_p = service_p -> se_data_p;
-			UsersServiceData *us_data_p = (UsersServiceData *) data_p;
+			ServiceData *data_p = & (us_data_p -> usd_base_data);
 			Parameter *param_p = NULL;
 			ParameterGroup *group_p = CreateAndAddParameterGroupToParameterSet ("User details", false, data_p, param_set_p);
 			char *id_s = NULL;
-			User *active_user_p = GetUserFromResource (resource_p, S_USER_ID, us_data_p);
+			const char *search_s = NULL;
 			bool defaults_flag = false;
-
+			bool search_flag = true;
+			bool success_flag = false;
 
 			if (active_user_p)
 				{
@@ -200,9 +414,35 @@ static ParameterSet *GetUsersSubmissionServiceParameters (Service *service_p, Da
 					defaults_flag = true;
 				}
 
-			if ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, S_USER_ID.npt_type, S_USER_ID.npt_name_s, "Load User", "Edit an existing User", id_s, PL_ALL)) != NULL)
+			/*
+			 * Are we only listing the Users that match a search?
+			 */
+			if (us_data_p -> usd_search_limit > 0)
+				{
+					const json_t *params_json_p = GetParametersJSONFromResource (resource_p);
+
+					if (params_json_p)
+						{
+							search_s = GetNamedParameterDefaultValueFromJSON (S_USER_SEARCH.npt_name_s, params_json_p);
+						}
+
+					if ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, S_USER_SEARCH.npt_type, S_USER_SEARCH.npt_name_s, "Find User", "Find the Users whose last name, first name or email address begins with this", search_s, PL_ALL)) != NULL)
+						{
+							/*
+							 * Update the list of Users as the search changes
+							 */
+							param_p -> pa_refresh_service_flag = true;
+						}
+					else
+						{
+							search_flag = false;
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add %s parameter", S_USER_SEARCH.npt_name_s);
+						}
+				}
+
+			if (search_flag && ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, S_USER_ID.npt_type, S_USER_ID.npt_name_s, "Load User", "Edit an existing User", id_s, PL_ALL)) != NULL))
 				{
-					if (SetUpUsersListParameter (us_data_p, param_p, active_user_p, true))
+					if (SetUpUsersListParameter (us_data_p, param_p, active_user_p, search_s, true))
 						{
 							/*
 							 * We want to update all of the values in the form
@@ -213,32 +453,28 @@ static ParameterSet *GetUsersSubmissionServiceParameters (Service *service_p, Da
 							 */
 							param_p -> pa_refresh_service_flag = true;
 
-
-
+							/*
+							 * The email and names aren't marked as required since they are left
+							 * empty when importing a table of Users, so CheckRequiredUserParameters()
+							 * checks them when the job is run instead.
+							 */
 							if ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, S_EMAIL.npt_type, S_EMAIL.npt_name_s, "Email", "The user's email address", active_user_p ? active_user_p -> us_email_s : NULL, PL_ALL)) != NULL)
 								{
-									param_p -> pa_required_flag = true;
-
 									if ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, S_SURNAME.npt_type, S_SURNAME.npt_name_s, "Last name", "The User's last name", active_user_p ? active_user_p -> us_surname_s : NULL, PL_ALL)) != NULL)
 										{
-											param_p -> pa_required_flag = true;
-
 											if ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, S_FORENAME.npt_type, S_FORENAME.npt_name_s, "First name", "The User's first name", active_user_p ? active_user_p -> us_forename_s : NULL, PL_ALL)) != NULL)
 												{
-													param_p -> pa_required_flag = true;
-
 													if ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, S_AFFILIATION.npt_type, S_AFFILIATION.npt_name_s, "Affiliation", "The orgranisation that the user belongs to", active_user_p ? active_user_p -> us_org_s : NULL, PL_ALL)) != NULL)
 														{
 															if ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, S_ORCID.npt_type, S_ORCID.npt_name_s, "ORCID", "The user's ORCID", active_user_p ? active_user_p -> us_orcid_s : NULL, PL_ALL)) != NULL)
 																{
-																	return param_set_p;
+																	success_flag = AddUsersImportParameter (data_p, param_set_p);
 																}
 															else
 																{
 																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add %s parameter", S_ORCID.npt_name_s);
 																}
 
-
 														}
 													else
 														{
@@ -262,9 +498,19 @@ static ParameterSet *GetUsersSubmissionServiceParameters (Service *service_p, Da
 									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add %s parameter", S_EMAIL.npt_name_s);
 								}
 
-						}		/* if (SetUpUsersListParameter ((UsersServiceData *) data_p, (StringParameter *) param_p, active_user_p, true)) */
+						}		/* if (SetUpUsersListParameter ((UsersServiceData *) data_p, (StringParameter *) param_p, active_user_p, search_s, true)) */
+
+				}		/* if (search_flag && ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, S_USER_ID.npt_type, S_USER_ID.npt_name_s, "Load User", "Edit an existing User", id_s, PL_ALL)) != NULL)) */
+
+			if (active_user_p && id_s)
+				{
+					FreeBSONOidString (id_s);
+				}
 
-				}		/* if ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, S_USER_ID.npt_type, S_USER_ID.npt_name_s, "Load User", "Edit an existing User", id_s, PL_ALL)) != NULL) */
+			if (success_flag)
+				{
+					return param_set_p;
+				}
 
 			FreeParameterSet (param_set_p);
 		}
@@ -289,6 +535,8 @@ static bool GetUsersSubmissionServiceParameterTypesForNamedParameters (const Ser
 			S_AFFILIATION,
 			S_ORCID,
 			S_USER_ID,
+			S_USER_SEARCH,
+			S_IMPORT,
 			NULL
 		};
 
@@ -318,6 +566,9 @@ static bool CloseUsersSubmissionService (Service *service_p)
 static ServiceJobSet *RunUsersSubmissionService (Service *service_p, ParameterSet *param_set_p, User * UNUSED_PARAM (logged_in_user_p), ProvidersStateTable * UNUSED_PARAM (providers_p))
 {
 	UsersServiceData *data_p = (UsersServiceData *) (service_p -> se_data_p);
+	UsersTimingSpan span;
+
+	StartUsersTimingSpan (data_p -> usd_timings_p, &span);
 
 	service_p -> se_jobs_p = AllocateSimpleServiceJobSet (service_p, NULL, "Users");
 
@@ -330,347 +581,758 @@ static ServiceJobSet *RunUsersSubmissionService (Service *service_p, ParameterSe
 
 			if (param_set_p)
 				{
-					const char *email_s = NULL;
+					const json_t *import_p = NULL;
 
-					if (GetCurrentStringParameterValueFromParameterSet (param_set_p, S_EMAIL.npt_name_s, &email_s))
+					/*
+					 * If there is a table of Users, import them rather
+					 * than saving the single User from the form
+					 */
+					if (GetCurrentJSONParameterValueFromParameterSet (param_set_p, S_IMPORT.npt_name_s, &import_p) && (json_array_size (import_p) > 0))
 						{
-							if (!IsStringEmpty (email_s))
+							if (data_p -> usd_workers_p)
 								{
-									const char *surname_s = NULL;
+									/*
+									 * The ParameterSet will be freed before the worker
+									 * runs so it needs its own copy of the table
+									 */
+									json_t *rows_p = json_deep_copy (import_p);
 
-									if (GetCurrentStringParameterValueFromParameterSet (param_set_p, S_SURNAME.npt_name_s, &surname_s))
+									if (rows_p)
 										{
-											if (!IsStringEmpty (surname_s))
-												{
-													const char *forename_s = NULL;
-
-													if (GetCurrentStringParameterValueFromParameterSet (param_set_p, S_FORENAME.npt_name_s, &forename_s))
-														{
-															if (!IsStringEmpty (forename_s))
-																{
-																	User *user_p = NULL;
-																	const char *orcid_s = NULL;
-																	const char *affiliation_s = NULL;
-
-																	GetCurrentStringParameterValueFromParameterSet (param_set_p, S_ORCID.npt_name_s, &orcid_s);
-																	GetCurrentStringParameterValueFromParameterSet (param_set_p, S_AFFILIATION.npt_name_s, &affiliation_s);
-
-																	user_p = AllocateUser (NULL, email_s, forename_s, surname_s, affiliation_s, orcid_s);
-
-																	if (user_p)
-																		{
-																			status = SaveUser (user_p, job_p, data_p);
-
-																			FreeUser (user_p);
-																		}
+											status = RunUsersSubmissionLater (data_p, job_p, NULL, rows_p);
+										}
+								}
+							else
+								{
+									status = ImportUsers (data_p, import_p, job_p, S_IMPORT.npt_name_s);
+								}
+						}
+					else if (CheckRequiredUserParameters (param_set_p, job_p))
+						{
+							User *user_p = GetUserFromParameters (param_set_p);
 
-																}
-														}
-												}
+							if (user_p)
+								{
+									if (data_p -> usd_workers_p)
+										{
+											status = RunUsersSubmissionLater (data_p, job_p, user_p, NULL);
+										}
+									else
+										{
+											status = SaveUser (user_p, job_p, data_p, false);
+											FreeUser (user_p);
 										}
 								}
 						}
 				}		/* if (param_set_p) */
 
-			SetServiceJobStatus (job_p, status);
-			LogServiceJob (job_p);
+			/*
+			 * A queued job's status is updated by its worker
+			 */
+			if (status != OS_PENDING)
+				{
+					SetServiceJobStatus (job_p, status);
+					LogServiceJob (job_p);
+				}
 		}		/* if (service_p -> se_jobs_p) */
 
+	EndUsersTimingSpan (data_p -> usd_timings_p, &span, UTP_RUN);
+
 	return service_p -> se_jobs_p;
 }
 
 
-static ServiceMetadata *GetUsersSubmissionServiceMetadata (Service *service_p)
+/*
+ * The detail parameters aren't marked as required so that a table can be
+ * imported without them, which means that a single User needs them to be
+ * checked here instead.
+ */
+static bool CheckRequiredUserParameters (ParameterSet *param_set_p, ServiceJob *job_p)
 {
-	const char *term_url_s = CONTEXT_PREFIX_EDAM_ONTOLOGY_S "topic_0625";
-	SchemaTerm *category_p = AllocateSchemaTerm (term_url_s, "Genotype and phenotype",
-																							 "The study of genetic constitution of a living entity, such as an individual, and organism, a cell and so on, "
-																							 "typically with respect to a particular observable phenotypic traits, or resources concerning such traits, which "
-																							 "might be an aspect of biochemistry, physiology, morphology, anatomy, development and so on.");
+	const NamedParameterType * const required_params_pp [] = { &S_EMAIL, &S_SURNAME, &S_FORENAME, NULL };
+	const NamedParameterType * const *param_pp = required_params_pp;
+	bool valid_flag = true;
 
-	if (category_p)
+	/*
+	 * Check them all so that every missing value gets reported
+	 */
+	while (*param_pp)
 		{
-			SchemaTerm *subcategory_p;
+			const char *value_s = NULL;
 
-			term_url_s = CONTEXT_PREFIX_EDAM_ONTOLOGY_S "operation_0304";
-			subcategory_p = AllocateSchemaTerm (term_url_s, "Query and retrieval", "Search or query a data resource and retrieve entries and / or annotation.");
+			GetCurrentStringParameterValueFromParameterSet (param_set_p, (*param_pp) -> npt_name_s, &value_s);
 
-			if (subcategory_p)
+			if (IsStringEmpty (value_s))
 				{
-					ServiceMetadata *metadata_p = AllocateServiceMetadata (category_p, subcategory_p);
+					AddParameterErrorMessageToServiceJob (job_p, (*param_pp) -> npt_name_s, (*param_pp) -> npt_type, "Value required");
+					valid_flag = false;
+				}
 
-					if (metadata_p)
-						{
-							SchemaTerm *input_p;
+			++ param_pp;
+		}
 
-							term_url_s = CONTEXT_PREFIX_EDAM_ONTOLOGY_S "data_0968";
-							input_p = AllocateSchemaTerm (term_url_s, "Keyword",
-																						"Boolean operators (AND, OR and NOT) and wildcard characters may be allowed. Keyword(s) or phrase(s) used (typically) for text-searching purposes.");
+	return valid_flag;
+}
 
-							if (input_p)
+
+static User *GetUserFromParameters (ParameterSet *param_set_p)
+{
+	User *user_p = NULL;
+	const char *email_s = NULL;
+
+	if (GetCurrentStringParameterValueFromParameterSet (param_set_p, S_EMAIL.npt_name_s, &email_s))
+		{
+			if (!IsStringEmpty (email_s))
+				{
+					const char *surname_s = NULL;
+
+					if (GetCurrentStringParameterValueFromParameterSet (param_set_p, S_SURNAME.npt_name_s, &surname_s))
+						{
+							if (!IsStringEmpty (surname_s))
 								{
-									if (AddSchemaTermToServiceMetadataInput (metadata_p, input_p))
-										{
-											SchemaTerm *output_p;
-											/* Genotype */
-											term_url_s = CONTEXT_PREFIX_EXPERIMENTAL_FACTOR_ONTOLOGY_S "EFO_0000513";
-											output_p = AllocateSchemaTerm (term_url_s, "genotype", "Information, making the distinction between the actual physical material "
-																										 "(e.g. a cell) and the information about the genetic content (genotype).");
+									const char *forename_s = NULL;
 
-											if (output_p)
+									if (GetCurrentStringParameterValueFromParameterSet (param_set_p, S_FORENAME.npt_name_s, &forename_s))
+										{
+											if (!IsStringEmpty (forename_s))
 												{
-													if (AddSchemaTermToServiceMetadataOutput (metadata_p, output_p))
+													const char *orcid_s = NULL;
+													const char *affiliation_s = NULL;
+													const char *id_s = NULL;
+													bson_oid_t *id_p = NULL;
+
+													GetCurrentStringParameterValueFromParameterSet (param_set_p, S_ORCID.npt_name_s, &orcid_s);
+													GetCurrentStringParameterValueFromParameterSet (param_set_p, S_AFFILIATION.npt_name_s, &affiliation_s);
+
+													/*
+													 * Are we editing an existing User?
+													 */
+													if (GetCurrentStringParameterValueFromParameterSet (param_set_p, S_USER_ID.npt_name_s, &id_s))
 														{
-															return metadata_p;
-														}		/* if (AddSchemaTermToServiceMetadataOutput (metadata_p, output_p)) */
-													else
+															if ((!IsStringEmpty (id_s)) && (strcmp (id_s, S_EMPTY_LIST_OPTION_S) != 0) && (bson_oid_is_valid (id_s, strlen (id_s))))
+																{
+																	id_p = GetBSONOidFromString (id_s);
+																}
+														}
+
+													user_p = AllocateUser (id_p, email_s, forename_s, surname_s, affiliation_s, orcid_s);
+
+													if ((!user_p) && id_p)
 														{
-															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add output term %s to service metadata", term_url_s);
-															FreeSchemaTerm (output_p);
+															FreeBSONOid (id_p);
 														}
 
-												}		/* if (output_p) */
-											else
-												{
-													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate output term %s for service metadata", term_url_s);
 												}
-
-										}		/* if (AddSchemaTermToServiceMetadataInput (metadata_p, input_p)) */
-									else
-										{
-											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add input term %s to service metadata", term_url_s);
-											FreeSchemaTerm (input_p);
 										}
-
-								}		/* if (input_p) */
-							else
-								{
-									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate input term %s for service metadata", term_url_s);
 								}
-
-						}		/* if (metadata_p) */
-					else
-						{
-							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate service metadata");
 						}
-
-				}		/* if (subcategory_p) */
-			else
-				{
-					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate sub-category term %s for service metadata", term_url_s);
 				}
-
-		}		/* if (category_p) */
-	else
-		{
-			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate category term %s for service metadata", term_url_s);
 		}
 
-	return NULL;
+	return user_p;
 }
 
 
-
-static ParameterSet *IsResourceForUsersSubmissionService (Service * UNUSED_PARAM (service_p), DataResource * UNUSED_PARAM (resource_p), Handler * UNUSED_PARAM (handler_p))
+/*
+ * Run a job on one of the workers. This takes ownership of user_p and
+ * rows_p. If the job can't be queued, it is run straight away instead.
+ */
+static OperationStatus RunUsersSubmissionLater (UsersServiceData *data_p, ServiceJob *job_p, User *user_p, json_t *rows_p)
 {
-	return NULL;
-}
-
+	OperationStatus status = OS_FAILED_TO_START;
+	UsersServiceData *shared_p = data_p -> usd_shared_p;
+	UsersSubmissionTask *task_p = (UsersSubmissionTask *) AllocMemory (sizeof (UsersSubmissionTask));
 
+	if (task_p)
+		{
+			task_p -> ust_data_p = shared_p;
+			task_p -> ust_job_p = NULL;
+			task_p -> ust_user_p = user_p;
+			task_p -> ust_rows_p = rows_p;
+
+			/*
+			 * The job must be pending before the worker can start it
+			 */
+			UpdateUsersServiceJob (shared_p, job_p, OS_PENDING);
+
+			/*
+			 * job_p is sent back to the client and freed once we return,
+			 * so the worker updates its own copy instead
+			 */
+			if ((task_p -> ust_job_p = CopyUsersServiceJob (shared_p, job_p)) != NULL)
+				{
+					/*
+					 * The shared data must be kept until the task has been freed
+					 */
+					AcquireSharedUsersServiceData (shared_p);
+
+					if (SubmitUsersTask (shared_p -> usd_workers_p, RunUsersSubmissionTask, FreeQueuedUsersSubmissionTask, task_p))
+						{
+							return OS_PENDING;
+						}
+
+					ReleaseSharedUsersServiceData (shared_p, true);
+
+					FreeServiceJob (task_p -> ust_job_p);
+					task_p -> ust_job_p = NULL;
+				}
+
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to queue job, running it now");
+
+			status = RunUsersSubmissionTaskNow (task_p, job_p, false);
+			FreeUsersSubmissionTask (task_p);
+		}
+	else
+		{
+			if (user_p)
+				{
+					FreeUser (user_p);
+				}
+
+			if (rows_p)
+				{
+					json_decref (rows_p);
+				}
+		}
+
+	return status;
+}
 
-static json_t *GetAllUsersAsJSON (const UsersServiceData *data_p, const bool full_data_flag)
+
+static void RunUsersSubmissionTask (void *data_p)
 {
-	json_t *results_p = NULL;
+	UsersSubmissionTask *task_p = (UsersSubmissionTask *) data_p;
+	ServiceJob *job_p = task_p -> ust_job_p;
+	OperationStatus status;
+	UsersTimingSpan span;
+
+	StartUsersTimingSpan (task_p -> ust_data_p -> usd_timings_p, &span);
+
+	UpdateUsersServiceJob (task_p -> ust_data_p, job_p, OS_STARTED);
+
+	status = RunUsersSubmissionTaskNow (task_p, job_p, true);
 
-	if (SetMongoToolCollection (data_p -> usd_mongo_p, data_p -> usd_users_collection_s))
+	EndUsersTimingSpan (task_p -> ust_data_p -> usd_timings_p, &span, UTP_WORKER);
+
+	/*
+	 * If the User has been queued to be written, its job
+	 * is finished and freed by the write-behind thread instead
+	 */
+	if (status != OS_PENDING)
 		{
-			bson_t *query_p = NULL;
-			bson_t *opts_p = NULL;
+			UpdateUsersServiceJob (task_p -> ust_data_p, job_p, status);
+			LogServiceJob (job_p);
+		}
+	else
+		{
+			task_p -> ust_job_p = NULL;
+		}
+}
+
+
+/*
+ * If queue_flag is true, job_p belongs to the task and a new User can be
+ * left for the write-behind queue to save.
+ */
+static OperationStatus RunUsersSubmissionTaskNow (UsersSubmissionTask *task_p, ServiceJob *job_p, const bool queue_flag)
+{
+	OperationStatus status = OS_FAILED_TO_START;
+
+	if (task_p -> ust_rows_p)
+		{
+			status = ImportUsers (task_p -> ust_data_p, task_p -> ust_rows_p, job_p, S_IMPORT.npt_name_s);
+		}
+	else if (task_p -> ust_user_p)
+		{
+			status = SaveUser (task_p -> ust_user_p, job_p, task_p -> ust_data_p, queue_flag);
+		}
 
-			if (full_data_flag)
+	return status;
+}
+
+
+static void FreeUsersSubmissionTask (void *data_p)
+{
+	UsersSubmissionTask *task_p = (UsersSubmissionTask *) data_p;
+
+	if (task_p -> ust_user_p)
+		{
+			FreeUser (task_p -> ust_user_p);
+		}
+
+	if (task_p -> ust_rows_p)
+		{
+			json_decref (task_p -> ust_rows_p);
+		}
+
+	if (task_p -> ust_job_p)
+		{
+			FreeServiceJob (task_p -> ust_job_p);
+		}
+
+	FreeMemory (task_p);
+}
+
+
+/*
+ * Called on a worker once a queued task has finished.
+ */
+static void FreeQueuedUsersSubmissionTask (void *data_p)
+{
+	UsersServiceData *shared_p = ((UsersSubmissionTask *) data_p) -> ust_data_p;
+
+	FreeUsersSubmissionTask (data_p);
+	ReleaseSharedUsersServiceData (shared_p, false);
+}
+
+
+static ServiceMetadata *GetUsersSubmissionServiceMetadata (Service *service_p)
+{
+	const char *term_url_s = CONTEXT_PREFIX_EDAM_ONTOLOGY_S "topic_0625";
+	SchemaTerm *category_p = AllocateSchemaTerm (term_url_s, "Genotype and phenotype",
+																							 "The study of genetic constitution of a living entity, such as an individual, and organism, a cell and so on, "
+																							 "typically with respect to a particular observable phenotypic traits, or resources concerning such traits, which "
+																							 "might be an aspect of biochemistry, physiology, morphology, anatomy, development and so on.");
+
+	if (category_p)
+		{
+			SchemaTerm *subcategory_p;
+
+			term_url_s = CONTEXT_PREFIX_EDAM_ONTOLOGY_S "operation_0304";
+			subcategory_p = AllocateSchemaTerm (term_url_s, "Query and retrieval", "Search or query a data resource and retrieve entries and / or annotation.");
+
+			if (subcategory_p)
 				{
-					opts_p =  BCON_NEW ( "sort", "{", US_SURNAME_S, BCON_INT32 (1), US_FORENAME_S, BCON_INT32 (1), "}");
+					ServiceMetadata *metadata_p = AllocateServiceMetadata (category_p, subcategory_p);
+
+					if (metadata_p)
+						{
+							SchemaTerm *input_p;
+
+							term_url_s = CONTEXT_PREFIX_EDAM_ONTOLOGY_S "data_0968";
+							input_p = AllocateSchemaTerm (term_url_s, "Keyword",
+																						"Boolean operators (AND, OR and NOT) and wildcard characters may be allowed. Keyword(s) or phrase(s) used (typically) for text-searching purposes.");
+
+							if (input_p)
+								{
+									if (AddSchemaTermToServiceMetadataInput (metadata_p, input_p))
+										{
+											SchemaTerm *output_p;
+											/* Genotype */
+											term_url_s = CONTEXT_PREFIX_EXPERIMENTAL_FACTOR_ONTOLOGY_S "EFO_0000513";
+											output_p = AllocateSchemaTerm (term_url_s, "genotype", "Information, making the distinction between the actual physical material "
+																										 "(e.g. a cell) and the information about the genetic content (genotype).");
+
+											if (output_p)
+												{
+													if (AddSchemaTermToServiceMetadataOutput (metadata_p, output_p))
+														{
+															return metadata_p;
+														}		/* if (AddSchemaTermToServiceMetadataOutput (metadata_p, output_p)) */
+													else
+														{
+															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add output term %s to service metadata", term_url_s);
+															FreeSchemaTerm (output_p);
+														}
+
+												}		/* if (output_p) */
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate output term %s for service metadata", term_url_s);
+												}
+
+										}		/* if (AddSchemaTermToServiceMetadataInput (metadata_p, input_p)) */
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add input term %s to service metadata", term_url_s);
+											FreeSchemaTerm (input_p);
+										}
+
+								}		/* if (input_p) */
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate input term %s for service metadata", term_url_s);
+								}
+
+						}		/* if (metadata_p) */
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate service metadata");
+						}
+
+				}		/* if (subcategory_p) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate sub-category term %s for service metadata", term_url_s);
+				}
+
+		}		/* if (category_p) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate category term %s for service metadata", term_url_s);
+		}
+
+	return NULL;
+}
+
+
+
+static ParameterSet *IsResourceForUsersSubmissionService (Service * UNUSED_PARAM (service_p), DataResource * UNUSED_PARAM (resource_p), Handler * UNUSED_PARAM (handler_p))
+{
+	return NULL;
+}
+
+
+
+static bool SetUpUsersListParameter (const UsersServiceData *data_p, Parameter *param_p, const User *active_user_p, const char *search_s, const bool empty_option_flag)
+{
+	bool success_flag = true;
+	bool value_set_flag = false;
+	char active_id_s [MONGO_OID_STRING_BUFFER_SIZE];
+	UsersTimingSpan span;
+
+	StartUsersTimingSpan (data_p -> usd_timings_p, &span);
+
+	/*
+	 * The id string is only needed while building the list so
+	 * there's no need to allocate it
+	 */
+	if (active_user_p)
+		{
+			bson_oid_to_string (active_user_p -> us_id_p, active_id_s);
+		}
+
+	/*
+	 * If there's an empty option, add it
+	 */
+	if (empty_option_flag)
+		{
+			success_flag = CreateAndAddStringParameterOption (param_p, S_EMPTY_LIST_OPTION_S, S_EMPTY_LIST_OPTION_S);
+		}
+
+	if (success_flag)
+		{
+			const char *param_value_s = GetStringParameterCurrentValue (param_p);
+
+			if (data_p -> usd_directory_p)
+				{
+					success_flag = AddUsersListOptionsFromDirectory (data_p, param_p, search_s, param_value_s, &value_set_flag);
 				}
 			else
 				{
-					opts_p =  BCON_NEW ("projection", "{", US_SURNAME_S, BCON_BOOL (true), US_FORENAME_S, BCON_BOOL (true), "}",
-															"sort", "{", US_SURNAME_S, BCON_INT32 (1), US_FORENAME_S, BCON_INT32 (1), "}");
+					success_flag = AddUsersListOptionsFromDatabase (data_p, param_p, param_value_s, &value_set_flag);
 				}
 
+			/*
+			 * When searching, the active User might not match the search
+			 * but it still needs to be on the list
+			 */
+			if (success_flag && active_user_p && (data_p -> usd_search_limit > 0))
+				{
+					if (! (param_value_s && value_set_flag && (strcmp (param_value_s, active_id_s) == 0)))
+						{
+							char *name_s = GetFullUsername (active_user_p);
 
-			results_p = GetAllMongoResultsAsJSON (data_p -> usd_mongo_p, query_p, opts_p);
+							if (name_s)
+								{
+									success_flag = AddUsersListOption (param_p, active_id_s, name_s, param_value_s, &value_set_flag);
+									FreeFullUsername (name_s);
+								}
+							else
+								{
+									success_flag = false;
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get full username for \"%s\"", active_user_p -> us_email_s);
+								}
+						}
+				}
 
-			if (opts_p)
+			/*
+			 * If the parameter's value isn't on the list, reset it
+			 */
+			if ((param_value_s != NULL) && (strcmp (param_value_s, S_EMPTY_LIST_OPTION_S) != 0) && (value_set_flag == false))
 				{
-					bson_destroy (opts_p);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "param value \"%s\" not on list of existing programmes", param_value_s);
 				}
 
-		}		/* if (SetMongoToolCollection (data_p -> dftsd_mongo_p, data_p -> dftsd_collection_ss [DFTD_PROGRAMME])) */
+		}		/* if (success_flag) */
+
+	if (success_flag && active_user_p)
+		{
+			success_flag = SetStringParameterDefaultValue (param_p, active_id_s);
+		}
 
-	return results_p;
+	EndUsersTimingSpan (data_p -> usd_timings_p, &span, UTP_USERS_LIST);
+
+	return success_flag;
 }
 
 
-static bool SetUpUsersListParameter (const UsersServiceData *data_p, Parameter *param_p, const User *active_user_p, const bool empty_option_flag)
+static bool AddUsersListOptionsFromDirectory (const UsersServiceData *data_p, Parameter *param_p, const char *search_s, const char *param_value_s, bool *value_set_flag_p)
 {
 	bool success_flag = false;
-	json_t *results_p = GetAllUsersAsJSON (data_p, true);
-	bool value_set_flag = false;
+	const UsersDirectorySnapshot *snapshot_p = NULL;
+	UsersTimingSpan span;
 
-	if (results_p)
-		{
-			if (json_is_array (results_p))
-				{
-					const size_t num_results = json_array_size (results_p);
+	StartUsersTimingSpan (data_p -> usd_timings_p, &span);
+	snapshot_p = AcquireUsersDirectorySnapshot (data_p -> usd_directory_p, data_p -> usd_mongo_pool_p, data_p -> usd_users_collection_s);
+	EndUsersTimingSpan (data_p -> usd_timings_p, &span, UTP_DIRECTORY);
 
-					success_flag = true;
+	if (snapshot_p)
+		{
+			success_flag = true;
 
+			if (data_p -> usd_search_limit > 0)
+				{
 					/*
-					 * If there's an empty option, add it
+					 * Only list the Users matching the search, if there is one
 					 */
-					if (empty_option_flag)
+					if (!IsStringEmpty (search_s))
 						{
-							success_flag = CreateAndAddStringParameterOption (param_p, S_EMPTY_LIST_OPTION_S, S_EMPTY_LIST_OPTION_S);
-						}
+							const UsersDirectoryEntry **matches_pp = (const UsersDirectoryEntry **) AllocMemoryArray (data_p -> usd_search_limit, sizeof (const UsersDirectoryEntry *));
 
-					if (success_flag)
-						{
-							if (num_results > 0)
+							if (matches_pp)
 								{
+									const size_t num_matches = SearchUsersDirectorySnapshot (snapshot_p, search_s, matches_pp, data_p -> usd_search_limit);
 									size_t i = 0;
-									const char *param_value_s = GetStringParameterCurrentValue (param_p);
-
-									bson_oid_t *id_p = GetNewUnitialisedBSONOid ();
 
-									if (id_p)
+									while ((i < num_matches) && success_flag)
 										{
-											while ((i < num_results) && success_flag)
+											const UsersDirectoryEntry *entry_p = matches_pp [i];
+
+											if (AddUsersListOption (param_p, entry_p -> ude_id_s, entry_p -> ude_name_s, param_value_s, value_set_flag_p))
+												{
+													++ i;
+												}
+											else
 												{
-													json_t *entry_p = json_array_get (results_p, i);
+													success_flag = false;
+												}
+										}
 
-													if (GetMongoIdFromJSON (entry_p, id_p))
-														{
-															char *id_s = GetBSONOidAsString (id_p);
+									FreeMemory (matches_pp);
+								}
+							else
+								{
+									success_flag = false;
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " UINT32_FMT " search matches", data_p -> usd_search_limit);
+								}
 
-															if (id_s)
-																{
-																	User *user_p = GetUserFromJSON (entry_p);
+						}		/* if (!IsStringEmpty (search_s)) */
 
-																	if (user_p)
-																		{
-																			char *name_s = GetFullUsername (user_p);
+				}		/* if (data_p -> usd_search_limit > 0) */
+			else
+				{
+					size_t i = 0;
+					const UsersDirectoryEntry *entry_p = snapshot_p -> uds_entries_p;
 
-																			if (name_s)
-																				{
-																					if (param_value_s && (strcmp (param_value_s, id_s) == 0))
-																						{
-																							value_set_flag = true;
-																						}
+					while ((i < snapshot_p -> uds_num_entries) && success_flag)
+						{
+							if (AddUsersListOption (param_p, entry_p -> ude_id_s, entry_p -> ude_name_s, param_value_s, value_set_flag_p))
+								{
+									++ i;
+									++ entry_p;
+								}
+							else
+								{
+									success_flag = false;
+								}
 
-																					if (!CreateAndAddStringParameterOption (param_p, id_s, name_s))
-																						{
-																							success_flag = false;
-																							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add param option \"%s\": \"%s\"", id_s, name_s);
-																						}
+						}		/* while ((i < snapshot_p -> uds_num_entries) && success_flag) */
+				}
 
+			ReleaseUsersDirectorySnapshot (data_p -> usd_directory_p, snapshot_p);
+		}		/* if (snapshot_p) */
 
-																					FreeFullUsername (name_s);
-																				}
+	return success_flag;
+}
 
-																		}		/* if (name_s) */
-																	else
-																		{
-																			success_flag = false;
-																			PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, entry_p, "Failed to get full username");
-																		}
 
-																	FreeBSONOidString (id_s);
-																}
-															else
-																{
-																	success_flag = false;
-																	PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, entry_p, "Failed to get Programme BSON oid");
-																}
+/*
+ * Without a UsersDirectory, add each User as it comes off the
+ * cursor so only one document is held in memory at a time.
+ */
+static bool AddUsersListOptionsFromDatabase (const UsersServiceData *data_p, Parameter *param_p, const char *param_value_s, bool *value_set_flag_p)
+{
+	bool success_flag = false;
+	UsersCursor cursor;
+	MongoTool *tool_p = NULL;
+	UsersTimingSpan span;
 
-														}		/* if (GetMongoIdFromJSON (entry_p, id_p)) */
-													else
-														{
-															success_flag = false;
-															PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, entry_p, "GetMongoIdFromJSON () failed");
-														}
+	StartUsersTimingSpan (data_p -> usd_timings_p, &span);
 
-													if (success_flag)
-														{
-															++ i;
-														}
+	tool_p = CheckOutMongoTool (data_p -> usd_mongo_pool_p);
 
-												}		/* while ((i < num_results) && success_flag) */
+	if (OpenUsersCursor (&cursor, tool_p, data_p -> usd_users_collection_s, NULL, S_LIST_FIELDS_SS))
+		{
+			const UsersCursorRow *row_p = NULL;
 
-											FreeBSONOid (id_p);
-										}		/* if (id_p) */
+			success_flag = true;
 
-									/*
-									 * If the parameter's value isn't on the list, reset it
-									 */
-									if ((param_value_s != NULL) && (strcmp (param_value_s, S_EMPTY_LIST_OPTION_S) != 0) && (value_set_flag == false))
-										{
-											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "param value \"%s\" not on list of existing programmes", param_value_s);
-										}
+			while (success_flag && ((row_p = GetNextUsersCursorRow (&cursor)) != NULL))
+				{
+					if (row_p -> ucr_display_name_s)
+						{
+							success_flag = AddUsersListOption (param_p, row_p -> ucr_id_s, row_p -> ucr_display_name_s, param_value_s, value_set_flag_p);
+						}
+					else
+						{
+							/*
+							 * Users saved before display names were stored
+							 * need their names building
+							 */
+							char *name_s = GetUsersCursorRowName (row_p);
 
-								}		/* if (num_results > 0) */
+							if (name_s)
+								{
+									success_flag = AddUsersListOption (param_p, row_p -> ucr_id_s, name_s, param_value_s, value_set_flag_p);
+									FreeUsersCursorRowName (name_s);
+								}
 							else
 								{
-									/* nothing to add */
-									success_flag = true;
+									success_flag = false;
+									PrintBSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, row_p -> ucr_doc_p, "Failed to get full username");
 								}
+						}
+				}
 
-						}		/* if (success_flag) */
+			if (HasUsersCursorFailed (&cursor))
+				{
+					success_flag = false;
+				}
 
+			CloseUsersCursor (&cursor);
+		}		/* if (OpenUsersCursor (&cursor, tool_p, data_p -> usd_users_collection_s, NULL, S_LIST_FIELDS_SS)) */
 
-				}		/* if (json_is_array (results_p)) */
+	CheckInMongoTool (data_p -> usd_mongo_pool_p, tool_p);
 
-			json_decref (results_p);
-		}		/* if (results_p) */
+	EndUsersTimingSpan (data_p -> usd_timings_p, &span, UTP_DATABASE_LIST);
 
-	if (success_flag)
+	return success_flag;
+}
+
+
+static bool AddUsersListOption (Parameter *param_p, const char *id_s, const char *name_s, const char *param_value_s, bool *value_set_flag_p)
+{
+	if (param_value_s && (strcmp (param_value_s, id_s) == 0))
 		{
-			if (active_user_p)
-				{
-					char *id_s = GetBSONOidAsString (active_user_p -> us_id_p);
+			*value_set_flag_p = true;
+		}
 
-					if (id_s)
-						{
-							success_flag = SetStringParameterDefaultValue (param_p, id_s);
-							FreeBSONOidString (id_s);
-						}
-					else
-						{
-							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get id string for active program \"%s\"", active_user_p -> us_email_s);
-							success_flag = false;
-						}
+	if (CreateAndAddStringParameterOption (param_p, id_s, name_s))
+		{
+			return true;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add param option \"%s\": \"%s\"", id_s, name_s);
+		}
+
+	return false;
+}
+
+
+static bool AddUsersImportParameter (ServiceData *data_p, ParameterSet *param_set_p)
+{
+	ParameterGroup *group_p = CreateAndAddParameterGroupToParameterSet ("Import Users", false, data_p, param_set_p);
+	Parameter *param_p = EasyCreateAndAddJSONParameterToParameterSet (data_p, param_set_p, group_p, S_IMPORT.npt_type, S_IMPORT.npt_name_s, "Users",
+																																		"A table of Users to add or update. The columns are \"Email\", \"Last name\", \"First name\", \"Affiliation\" and \"ORCID\". "
+																																		"Any existing Users with the same email addresses will be updated.", NULL, PL_ADVANCED);
+
+	if (param_p)
+		{
+			if (AddParameterKeyStringValuePair (param_p, PA_TABLE_COLUMN_HEADERS_PLACEMENT_S, PA_TABLE_COLUMN_HEADERS_PLACEMENT_FIRST_ROW_S))
+				{
+					return true;
 				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add table headers placement for %s parameter", S_IMPORT.npt_name_s);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add %s parameter", S_IMPORT.npt_name_s);
 		}
 
-	return success_flag;
+	return false;
 }
 
 
 
 
-static OperationStatus SaveUser (User *user_p, ServiceJob *job_p, UsersServiceData *data_p)
+/*
+ * If queue_flag is true, a new User can be left for the write-behind queue
+ * to save. job_p is then handed over to the queue, which finishes and
+ * frees it, so this must only be set for a worker's own copy of the job.
+ */
+static OperationStatus SaveUser (User *user_p, ServiceJob *job_p, UsersServiceData *data_p, const bool queue_flag)
 {
 	OperationStatus status = OS_FAILED;
+	json_t *user_json_p = NULL;
 	bson_t *selector_p = NULL;
-	bool success_flag = PrepareSaveData (& (user_p -> us_id_p), &selector_p);
+	const bool new_user_flag = (user_p -> us_id_p == NULL);
+	UsersTimingSpan span;
 
-	if (success_flag)
+	StartUsersTimingSpan (data_p -> usd_timings_p, &span);
+
+	/*
+	 * A new User gets its id here, before it is converted to JSON,
+	 * so that the document is saved with the same id that the
+	 * client, the cache and the job refer to
+	 */
+	if (PrepareSaveData (& (user_p -> us_id_p), &selector_p))
+		{
+			user_json_p = GetUserAsJSON (user_p, true);
+		}
+
+	/*
+	 * Store the sort key and display name so that listing
+	 * Users doesn't need to work them out for every row
+	 */
+	if (user_json_p && (!AddUsersSortFields (user_json_p, user_p)))
+		{
+			json_decref (user_json_p);
+			user_json_p = NULL;
+		}
+
+	if (user_json_p)
 		{
-			json_t *user_json_p = GetUserAsJSON (user_p, true);
+			MongoTool *tool_p = CheckOutMongoTool (data_p -> usd_mongo_pool_p);
+			bool found_flag = false;
+
+			/*
+			 * For an existing User, only send the fields that have changed
+			 */
+			if (!new_user_flag)
+				{
+					status = UpdateUser (user_p, user_json_p, tool_p, data_p, &found_flag);
+				}
 
-			if (user_json_p)
+			if (!found_flag)
 				{
-					if (SaveMongoDataWithTimestamp (data_p -> usd_mongo_p, user_json_p, data_p -> usd_users_collection_s, selector_p, MONGO_TIMESTAMP_S))
+					/*
+					 * A new User can't clash with an existing one so it
+					 * can be written along with others in a single batch
+					 */
+					if (new_user_flag && queue_flag && (data_p -> usd_write_behind_p) && QueueUsersWriteWithReference (data_p, user_p, user_json_p, job_p))
+						{
+							status = OS_PENDING;
+						}
+					else if (SaveMongoDataWithTimestamp (tool_p, user_json_p, data_p -> usd_users_collection_s, selector_p, MONGO_TIMESTAMP_S))
 						{
+							/*
+							 * The cached list of Users no longer matches the database
+							 */
+							if (data_p -> usd_directory_p)
+								{
+									InvalidateUsersDirectory (data_p -> usd_directory_p);
+								}
+
+							if (data_p -> usd_users_cache_p)
+								{
+									RemoveUserFromUsersCache (data_p -> usd_users_cache_p, user_p -> us_id_p);
+								}
+
 							status = OS_SUCCEEDED;
 						}
 					else
@@ -678,55 +1340,287 @@ static OperationStatus SaveUser (User *user_p, ServiceJob *job_p, UsersServiceDa
 							status = OS_FAILED;
 						}
 
+				}		/* if (!found_flag) */
 
-					json_decref (user_json_p);
-				}
+			CheckInMongoTool (data_p -> usd_mongo_pool_p, tool_p);
+			json_decref (user_json_p);
+		}		/* if (user_json_p) */
 
+	if (selector_p)
+		{
+			bson_destroy (selector_p);
+		}
 
-		}		/* if (success_flag) */
+	/*
+	 * A queued User's job is updated once it has been written
+	 */
+	if (status != OS_PENDING)
+		{
+			SetServiceJobStatus (job_p, status);
+		}
 
-	SetServiceJobStatus (job_p, status);
+	EndUsersTimingSpan (data_p -> usd_timings_p, &span, UTP_SAVE_USER);
 
 	return status;
 }
 
 
-static User *GetUserFromResource (DataResource *resource_p, const NamedParameterType program_param_type, UsersServiceData *us_data_p)
+/*
+ * The shared data must be kept until the write-behind thread has
+ * finished job_p, which is when FinishUsersWriteBehindJob() gives
+ * up the reference that is taken here.
+ */
+static bool QueueUsersWriteWithReference (UsersServiceData *data_p, User *user_p, const json_t *user_json_p, ServiceJob *job_p)
 {
-	User *user_p = NULL;
+	bool success_flag;
 
-	/*
-	 * Have we been set some parameter values to refresh from?
-	 */
-	if (resource_p && (resource_p -> re_data_p))
+	AcquireSharedUsersServiceData (data_p);
+
+	success_flag = QueueUsersWrite (data_p -> usd_write_behind_p, user_p -> us_id_p, user_json_p, job_p);
+
+	if (!success_flag)
 		{
-			const json_t *param_set_json_p = json_object_get (resource_p -> re_data_p, PARAM_SET_KEY_S);
+			ReleaseSharedUsersServiceData (data_p, false);
+		}
 
-			if (param_set_json_p)
+	return success_flag;
+}
+
+
+/*
+ * Compare a User against its stored version and send a $set of the
+ * fields that have changed and an $unset of any that have been cleared.
+ * If nothing has changed, the database isn't written to at all.
+ */
+static OperationStatus UpdateUser (User *user_p, const json_t *user_json_p, MongoTool *tool_p, UsersServiceData *data_p, bool *found_flag_p)
+{
+	OperationStatus status = OS_FAILED;
+	json_t *stored_user_p = NULL;
+	bson_t *selector_p = BCON_NEW (MONGO_ID_S, BCON_OID (user_p -> us_id_p));
+
+	*found_flag_p = false;
+
+	if (selector_p)
+		{
+			UsersCursor cursor;
+			UsersTimingSpan span;
+
+			StartUsersTimingSpan (data_p -> usd_timings_p, &span);
+
+			if (OpenUsersCursor (&cursor, tool_p, data_p -> usd_users_collection_s, selector_p, NULL))
 				{
-					json_t *params_json_p = json_object_get (param_set_json_p, PARAM_SET_PARAMS_S);
+					const UsersCursorRow *row_p = GetNextUsersCursorRow (&cursor);
 
-					if (params_json_p)
+					if (row_p)
 						{
-							const char *user_id_s = GetNamedParameterDefaultValueFromJSON (program_param_type.npt_name_s, params_json_p);
+							*found_flag_p = true;
 
-							/*
-							 * Do we have an existing user id?
-							 */
-							if (user_id_s)
+							if ((stored_user_p = ConvertBSONToJSON (row_p -> ucr_doc_p)) == NULL)
 								{
-									GrassrootsServer *grassroots_p = us_data_p -> usd_base_data.sd_service_p -> se_grassroots_p;
-									user_p = GetUserByIdString (grassroots_p, user_id_s);
+									PrintBSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, row_p -> ucr_doc_p, "Failed to convert stored User to JSON");
+								}
+						}
+
+					CloseUsersCursor (&cursor);
+				}
 
-									if (!user_p)
+			EndUsersTimingSpan (data_p -> usd_timings_p, &span, UTP_LOAD_STORED_USER);
+
+			if (stored_user_p)
+				{
+					json_t *set_p = json_object ();
+					json_t *unset_p = json_object ();
+
+					if (set_p && unset_p)
+						{
+							if (GetUserChanges (user_json_p, stored_user_p, set_p, unset_p))
+								{
+									if ((json_object_size (set_p) == 0) && (json_object_size (unset_p) == 0))
+										{
+											PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "User \"%s\" is unchanged", user_p -> us_email_s);
+											status = OS_SUCCEEDED;
+										}
+									else
 										{
-											PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, params_json_p, "Failed to load User with id \"%s\"", user_id_s);
+											json_t *update_json_p = json_pack ("{s:{s:b}}", "$currentDate", MONGO_TIMESTAMP_S, true);
+
+											if (update_json_p)
+												{
+													bool success_flag = true;
+
+													if (json_object_size (set_p) > 0)
+														{
+															success_flag = (json_object_set (update_json_p, "$set", set_p) == 0);
+														}
+
+													if (success_flag && (json_object_size (unset_p) > 0))
+														{
+															success_flag = (json_object_set (update_json_p, "$unset", unset_p) == 0);
+														}
+
+													if (success_flag)
+														{
+															bson_t *update_p = ConvertJSONToBSON (update_json_p);
+
+															if (update_p)
+																{
+																	bson_error_t error;
+
+																	if (mongoc_collection_update_one (tool_p -> mt_collection_p, selector_p, update_p, NULL, NULL, &error))
+																		{
+																			if (data_p -> usd_directory_p)
+																				{
+																					InvalidateUsersDirectory (data_p -> usd_directory_p);
+																				}
+
+																			if (data_p -> usd_users_cache_p)
+																				{
+																					RemoveUserFromUsersCache (data_p -> usd_users_cache_p, user_p -> us_id_p);
+																				}
+
+																			status = OS_SUCCEEDED;
+																		}
+																	else
+																		{
+																			PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, update_json_p, "Failed to update User: %s", error.message);
+																		}
+
+																	bson_destroy (update_p);
+																}
+														}
+
+													json_decref (update_json_p);
+												}		/* if (update_json_p) */
+
 										}
 
-								}		/* if (user_id_s) */
+								}		/* if (GetUserChanges (user_json_p, stored_user_p, set_p, unset_p)) */
+
+						}		/* if (set_p && unset_p) */
+
+					if (unset_p)
+						{
+							json_decref (unset_p);
+						}
+
+					if (set_p)
+						{
+							json_decref (set_p);
+						}
+
+					json_decref (stored_user_p);
+				}		/* if (stored_user_p) */
+
+			bson_destroy (selector_p);
+		}		/* if (selector_p) */
+
+	return status;
+}
+
+
+static bool GetUserChanges (const json_t *user_json_p, const json_t *stored_user_p, json_t *set_p, json_t *unset_p)
+{
+	bool success_flag = true;
+	const char * const *key_ss = S_USER_KEYS_SS;
+	const char *key_s;
+	json_t *value_p;
+
+	/*
+	 * The id never changes and the timestamp is set by the update itself
+	 */
+	json_object_foreach ((json_t *) user_json_p, key_s, value_p)
+		{
+			if ((strcmp (key_s, MONGO_ID_S) != 0) && (strcmp (key_s, MONGO_TIMESTAMP_S) != 0))
+				{
+					if (!json_equal (value_p, json_object_get (stored_user_p, key_s)))
+						{
+							if (json_object_set (set_p, key_s, value_p) != 0)
+								{
+									success_flag = false;
+								}
+						}
+				}
+		}
+
+	/*
+	 * Only remove the fields that we write, so that anything
+	 * else stored with the User is left alone
+	 */
+	while (*key_ss)
+		{
+			if ((!json_object_get (user_json_p, *key_ss)) && (json_object_get (stored_user_p, *key_ss)))
+				{
+					if (json_object_set_new (unset_p, *key_ss, json_string ("")) != 0)
+						{
+							success_flag = false;
+						}
+				}
+
+			++ key_ss;
+		}
+
+	return success_flag;
+}
+
+
+static User *GetUserFromResource (DataResource *resource_p, const NamedParameterType program_param_type, UsersServiceData *us_data_p)
+{
+	User *user_p = NULL;
+	const json_t *params_json_p = GetParametersJSONFromResource (resource_p);
+
+	if (params_json_p)
+		{
+			const char *user_id_s = GetNamedParameterDefaultValueFromJSON (program_param_type.npt_name_s, params_json_p);
+
+			/*
+			 * Do we have an existing user id?
+			 */
+			if (user_id_s)
+				{
+					GrassrootsServer *grassroots_p = us_data_p -> usd_base_data.sd_service_p -> se_grassroots_p;
 
+					/*
+					 * Refreshing the form after selecting a User is the most
+					 * common request so use the cached copy if we have one
+					 */
+					if (us_data_p -> usd_users_cache_p)
+						{
+							user_p = GetUserFromUsersCache (us_data_p -> usd_users_cache_p, user_id_s, grassroots_p);
 						}
 					else
+						{
+							user_p = GetUserByIdString (grassroots_p, user_id_s);
+						}
+
+					if (!user_p)
+						{
+							PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, params_json_p, "Failed to load User with id \"%s\"", user_id_s);
+						}
+
+				}		/* if (user_id_s) */
+
+		}		/* if (params_json_p) */
+
+	return user_p;
+}
+
+
+static const json_t *GetParametersJSONFromResource (DataResource *resource_p)
+{
+	const json_t *params_json_p = NULL;
+
+	/*
+	 * Have we been set some parameter values to refresh from?
+	 */
+	if (resource_p && (resource_p -> re_data_p))
+		{
+			const json_t *param_set_json_p = json_object_get (resource_p -> re_data_p, PARAM_SET_KEY_S);
+
+			if (param_set_json_p)
+				{
+					params_json_p = json_object_get (param_set_json_p, PARAM_SET_PARAMS_S);
+
+					if (!params_json_p)
 						{
 							PrintJSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, param_set_json_p, "Failed to get params with key \"%s\"", PARAM_SET_PARAMS_S);
 						}
@@ -738,7 +1632,7 @@ static User *GetUserFromResource (DataResource *resource_p, const NamedParameter
 
 		}		/* if (resource_p && (resource_p -> re_data_p)) */
 
-	return user_p;
+	return params_json_p;
 }
 
 
@@ -0,0 +1,278 @@
+/*
+ * users_timings.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "users_timings.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "string_utils.h"
+
+
+/*
+ * The names of each UsersTimingPhase used when writing to the log
+ */
+static const char * const S_PHASE_NAMES_SS [UTP_NUM_PHASES] =
+{
+	"parameters",
+	"active_user",
+	"users_list",
+	"directory",
+	"database_list",
+	"run",
+	"worker",
+	"save_user",
+	"load_stored_user",
+	"import"
+};
+
+
+/*
+ * Static declarations
+ */
+
+static uint32 GetUsersTimingBucket (const uint64 duration_us);
+
+static uint64 GetUsersTimingPercentile (const uint64 *buckets_p, const uint64 count, const uint32 percentile);
+
+static bool ShouldDumpUsersTimings (UsersTimings *timings_p, const time_t now);
+
+
+/*
+ * API definitions
+ */
+
+UsersTimings *AllocateUsersTimings (const uint32 dump_interval, const char *dump_trigger_s)
+{
+	UsersTimings *timings_p = (UsersTimings *) AllocMemory (sizeof (UsersTimings));
+
+	if (timings_p)
+		{
+			char *copied_trigger_s = NULL;
+
+			if ((!dump_trigger_s) || ((copied_trigger_s = EasyCopyToNewString (dump_trigger_s)) != NULL))
+				{
+					if (pthread_mutex_init (& (timings_p -> ut_dump_lock), NULL) == 0)
+						{
+							memset (timings_p -> ut_histograms, 0, sizeof (timings_p -> ut_histograms));
+							timings_p -> ut_dump_interval = dump_interval;
+							timings_p -> ut_last_dump_time = time (NULL);
+							timings_p -> ut_dump_trigger_s = copied_trigger_s;
+							timings_p -> ut_last_trigger_check_time = timings_p -> ut_last_dump_time;
+
+							return timings_p;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise UsersTimings lock");
+						}
+
+					if (copied_trigger_s)
+						{
+							FreeCopiedString (copied_trigger_s);
+						}
+				}
+
+			FreeMemory (timings_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeUsersTimings (UsersTimings *timings_p)
+{
+	DumpUsersTimings (timings_p);
+
+	if (timings_p -> ut_dump_trigger_s)
+		{
+			FreeCopiedString (timings_p -> ut_dump_trigger_s);
+		}
+
+	pthread_mutex_destroy (& (timings_p -> ut_dump_lock));
+	FreeMemory (timings_p);
+}
+
+
+void StartUsersTimingSpan (const UsersTimings *timings_p, UsersTimingSpan *span_p)
+{
+	if (timings_p)
+		{
+			clock_gettime (CLOCK_MONOTONIC, & (span_p -> uts_start));
+		}
+}
+
+
+void EndUsersTimingSpan (UsersTimings *timings_p, const UsersTimingSpan *span_p, const UsersTimingPhase phase)
+{
+	if (timings_p)
+		{
+			UsersTimingHistogram *histogram_p = (timings_p -> ut_histograms) + phase;
+			struct timespec end;
+			int64 duration_us;
+			uint64 max_us;
+
+			clock_gettime (CLOCK_MONOTONIC, &end);
+
+			duration_us = ((int64) (end.tv_sec - span_p -> uts_start.tv_sec)) * 1000000 + (end.tv_nsec - span_p -> uts_start.tv_nsec) / 1000;
+
+			if (duration_us < 0)
+				{
+					duration_us = 0;
+				}
+
+			/*
+			 * Use atomic updates rather than a lock so that concurrent
+			 * requests don't wait for each other
+			 */
+			__sync_fetch_and_add ((histogram_p -> uth_buckets) + GetUsersTimingBucket ((uint64) duration_us), 1);
+			__sync_fetch_and_add (& (histogram_p -> uth_count), 1);
+			__sync_fetch_and_add (& (histogram_p -> uth_total_us), (uint64) duration_us);
+
+			max_us = histogram_p -> uth_max_us;
+
+			while (((uint64) duration_us > max_us) && (!__sync_bool_compare_and_swap (& (histogram_p -> uth_max_us), max_us, (uint64) duration_us)))
+				{
+					max_us = histogram_p -> uth_max_us;
+				}
+
+			if (ShouldDumpUsersTimings (timings_p, time (NULL)))
+				{
+					DumpUsersTimings (timings_p);
+				}
+
+		}		/* if (timings_p) */
+}
+
+
+void DumpUsersTimings (UsersTimings *timings_p)
+{
+	uint32 i;
+
+	for (i = 0; i < UTP_NUM_PHASES; ++ i)
+		{
+			const UsersTimingHistogram *histogram_p = (timings_p -> ut_histograms) + i;
+			uint64 buckets [UT_NUM_BUCKETS];
+			uint64 count = 0;
+			uint32 j;
+
+			/*
+			 * Take a copy as other requests can still be adding to the histogram
+			 */
+			for (j = 0; j < UT_NUM_BUCKETS; ++ j)
+				{
+					buckets [j] = histogram_p -> uth_buckets [j];
+					count += buckets [j];
+				}
+
+			if (count > 0)
+				{
+					PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "users timings %s: count " UINT64_FMT ", mean " UINT64_FMT " us, p50 <= " UINT64_FMT " us, p90 <= " UINT64_FMT " us, p99 <= " UINT64_FMT " us, max " UINT64_FMT " us",
+										S_PHASE_NAMES_SS [i], count, (histogram_p -> uth_total_us) / count,
+										GetUsersTimingPercentile (buckets, count, 50), GetUsersTimingPercentile (buckets, count, 90), GetUsersTimingPercentile (buckets, count, 99),
+										histogram_p -> uth_max_us);
+				}
+		}
+}
+
+
+/*
+ * Static definitions
+ */
+
+static uint32 GetUsersTimingBucket (const uint64 duration_us)
+{
+	uint32 bucket = 0;
+
+	if (duration_us > 0)
+		{
+			/* The number of bits needed to hold duration_us */
+			bucket = 64 - __builtin_clzll (duration_us);
+
+			if (bucket >= UT_NUM_BUCKETS)
+				{
+					bucket = UT_NUM_BUCKETS - 1;
+				}
+		}
+
+	return bucket;
+}
+
+
+/*
+ * Decide whether this request should write the histograms, either because
+ * the dump interval has passed or because the trigger file has been created.
+ * Only one request needs to write them, so any that can't get the lock
+ * straight away leave it to the one that has.
+ */
+static bool ShouldDumpUsersTimings (UsersTimings *timings_p, const time_t now)
+{
+	bool dump_flag = false;
+	const bool interval_flag = (timings_p -> ut_dump_interval > 0) && (now >= timings_p -> ut_last_dump_time + (time_t) (timings_p -> ut_dump_interval));
+	const bool trigger_flag = (timings_p -> ut_dump_trigger_s != NULL) && (now > timings_p -> ut_last_trigger_check_time);
+
+	if ((interval_flag || trigger_flag) && (pthread_mutex_trylock (& (timings_p -> ut_dump_lock)) == 0))
+		{
+			if ((timings_p -> ut_dump_interval > 0) && (now >= timings_p -> ut_last_dump_time + (time_t) (timings_p -> ut_dump_interval)))
+				{
+					dump_flag = true;
+				}
+
+			if ((timings_p -> ut_dump_trigger_s) && (now > timings_p -> ut_last_trigger_check_time))
+				{
+					timings_p -> ut_last_trigger_check_time = now;
+
+					/*
+					 * Delete the file so that each one only gives a single dump
+					 */
+					if (unlink (timings_p -> ut_dump_trigger_s) == 0)
+						{
+							dump_flag = true;
+						}
+				}
+
+			if (dump_flag)
+				{
+					timings_p -> ut_last_dump_time = now;
+				}
+
+			pthread_mutex_unlock (& (timings_p -> ut_dump_lock));
+		}
+
+	return dump_flag;
+}
+
+
+/*
+ * Get the upper bound, in microseconds, of the bucket that
+ * the given percentile falls in.
+ */
+static uint64 GetUsersTimingPercentile (const uint64 *buckets_p, const uint64 count, const uint32 percentile)
+{
+	const uint64 target = (count * percentile + 99) / 100;
+	uint64 total = 0;
+	uint32 i;
+
+	for (i = 0; i < UT_NUM_BUCKETS; ++ i)
+		{
+			total += buckets_p [i];
+
+			if (total >= target)
+				{
+					break;
+				}
+		}
+
+	if (i >= UT_NUM_BUCKETS)
+		{
+			i = UT_NUM_BUCKETS - 1;
+		}
+
+	return ((uint64) 1) << i;
+}
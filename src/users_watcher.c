@@ -0,0 +1,424 @@
+/*
+ * users_watcher.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "users_watcher.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "mongodb_util.h"
+
+
+/*
+ * Static declarations
+ */
+
+/**
+ * How long, in milliseconds, to wait for a change before checking
+ * whether the watcher has been told to stop.
+ */
+static const int64 S_MAX_AWAIT_MS = 1000;
+
+/**
+ * The longest time, in seconds, to wait between attempts to start a
+ * change stream. Each failed attempt doubles the wait up to this.
+ */
+static const uint32 S_MAX_RETRY_INTERVAL = 600;
+
+
+static void *RunUsersChangeWatcher (void *data_p);
+
+static bool WatchUsersChanges (UsersChangeWatcher *watcher_p);
+
+static bool ApplyUsersChange (UsersChangeWatcher *watcher_p, const bson_t *change_p);
+
+static void MarkAllUsersStale (UsersChangeWatcher *watcher_p);
+
+static void SyncUsersDirectory (UsersChangeWatcher *watcher_p);
+
+static bool IsUsersChangeWatcherStopping (UsersChangeWatcher *watcher_p);
+
+static void WaitForUsersChangeWatcher (UsersChangeWatcher *watcher_p, const uint32 seconds);
+
+
+/*
+ * API definitions
+ */
+
+UsersChangeWatcher *StartUsersChangeWatcher (UsersDirectory *directory_p, UsersCache *cache_p, UsersMongoPool *pool_p, MongoClientManager *manager_p,
+	const char *database_s, const char *collection_s, const uint32 poll_interval)
+{
+	UsersChangeWatcher *watcher_p = (UsersChangeWatcher *) AllocMemory (sizeof (UsersChangeWatcher));
+
+	if (watcher_p)
+		{
+			watcher_p -> ucw_tool_p = AllocateMongoTool (NULL, manager_p);
+
+			if (watcher_p -> ucw_tool_p)
+				{
+					if (SetMongoToolDatabase (watcher_p -> ucw_tool_p, database_s) && SetMongoToolCollection (watcher_p -> ucw_tool_p, collection_s))
+						{
+							if (pthread_mutex_init (& (watcher_p -> ucw_lock), NULL) == 0)
+								{
+									if (pthread_cond_init (& (watcher_p -> ucw_stop), NULL) == 0)
+										{
+											watcher_p -> ucw_directory_p = directory_p;
+											watcher_p -> ucw_cache_p = cache_p;
+											watcher_p -> ucw_pool_p = pool_p;
+											watcher_p -> ucw_collection_s = collection_s;
+											watcher_p -> ucw_poll_interval = (poll_interval > 0) ? poll_interval : UCW_DEFAULT_POLL_INTERVAL;
+											watcher_p -> ucw_stopping_flag = false;
+
+											if (pthread_create (& (watcher_p -> ucw_thread), NULL, RunUsersChangeWatcher, watcher_p) == 0)
+												{
+													return watcher_p;
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start watcher for \"%s\"", collection_s);
+												}
+
+											pthread_cond_destroy (& (watcher_p -> ucw_stop));
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise UsersChangeWatcher condition");
+										}
+
+									pthread_mutex_destroy (& (watcher_p -> ucw_lock));
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise UsersChangeWatcher lock");
+								}
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set watcher collection to \"%s\".\"%s\"", database_s, collection_s);
+						}
+
+					FreeMongoTool (watcher_p -> ucw_tool_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate MongoTool for watcher");
+				}
+
+			FreeMemory (watcher_p);
+		}
+
+	return NULL;
+}
+
+
+void StopUsersChangeWatcher (UsersChangeWatcher *watcher_p)
+{
+	pthread_mutex_lock (& (watcher_p -> ucw_lock));
+	watcher_p -> ucw_stopping_flag = true;
+	pthread_cond_broadcast (& (watcher_p -> ucw_stop));
+	pthread_mutex_unlock (& (watcher_p -> ucw_lock));
+
+	pthread_join (watcher_p -> ucw_thread, NULL);
+
+	pthread_cond_destroy (& (watcher_p -> ucw_stop));
+	pthread_mutex_destroy (& (watcher_p -> ucw_lock));
+
+	FreeMongoTool (watcher_p -> ucw_tool_p);
+	FreeMemory (watcher_p);
+}
+
+
+/*
+ * Static definitions
+ */
+
+static void *RunUsersChangeWatcher (void *data_p)
+{
+	UsersChangeWatcher *watcher_p = (UsersChangeWatcher *) data_p;
+	uint32 retry_interval = watcher_p -> ucw_poll_interval;
+	struct timespec next_watch;
+
+	/*
+	 * Try to start a change stream straight away
+	 */
+	next_watch.tv_sec = 0;
+	next_watch.tv_nsec = 0;
+
+	while (!IsUsersChangeWatcherStopping (watcher_p))
+		{
+			struct timespec now;
+
+			clock_gettime (CLOCK_MONOTONIC, &now);
+
+			if (now.tv_sec >= next_watch.tv_sec)
+				{
+					if (WatchUsersChanges (watcher_p))
+						{
+							/*
+							 * The stream ran until it failed or we were told to stop,
+							 * so start a new one after the usual interval
+							 */
+							retry_interval = watcher_p -> ucw_poll_interval;
+						}
+					else
+						{
+							/*
+							 * The database may just have been unavailable, e.g. while a
+							 * replica set elects a primary, so keep trying with a growing
+							 * gap between attempts and sync in the meantime
+							 */
+							PrintLog ((retry_interval == watcher_p -> ucw_poll_interval) ? STM_LEVEL_INFO : STM_LEVEL_FINE, __FILE__, __LINE__,
+												"Change streams are not available for \"%s\", syncing every " UINT32_FMT " seconds and trying again in " UINT32_FMT " seconds",
+												watcher_p -> ucw_collection_s, watcher_p -> ucw_poll_interval, retry_interval);
+
+							next_watch.tv_sec = now.tv_sec + (time_t) retry_interval;
+
+							if (retry_interval < S_MAX_RETRY_INTERVAL)
+								{
+									retry_interval = (retry_interval <= (S_MAX_RETRY_INTERVAL >> 1)) ? (retry_interval << 1) : S_MAX_RETRY_INTERVAL;
+								}
+
+							SyncUsersDirectory (watcher_p);
+						}
+				}
+			else
+				{
+					SyncUsersDirectory (watcher_p);
+				}
+
+			WaitForUsersChangeWatcher (watcher_p, watcher_p -> ucw_poll_interval);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Apply the changes from a change stream until the watcher is stopped
+ * or the stream fails. This returns false if the stream couldn't be
+ * started at all.
+ */
+static bool WatchUsersChanges (UsersChangeWatcher *watcher_p)
+{
+	bool available_flag = false;
+	bson_t *opts_p = BCON_NEW ("maxAwaitTimeMS", BCON_INT64 (S_MAX_AWAIT_MS));
+
+	if (opts_p)
+		{
+			mongoc_change_stream_t *stream_p = mongoc_collection_watch (watcher_p -> ucw_tool_p -> mt_collection_p, NULL, opts_p);
+
+			if (stream_p)
+				{
+					bson_error_t error;
+					const bson_t *error_doc_p = NULL;
+
+					if (!mongoc_change_stream_error_document (stream_p, &error, &error_doc_p))
+						{
+							bool watching_flag = true;
+
+							available_flag = true;
+
+							/*
+							 * Every deletion from now on gets a tombstone so
+							 * syncing doesn't need to count the Users
+							 */
+							if (watcher_p -> ucw_directory_p)
+								{
+									SetUsersDirectoryDeletionTracking (watcher_p -> ucw_directory_p, true);
+								}
+
+							/*
+							 * Anything changed before the stream started
+							 * won't be reported by it
+							 */
+							MarkAllUsersStale (watcher_p);
+
+							while (watching_flag && (!IsUsersChangeWatcherStopping (watcher_p)))
+								{
+									const bson_t *change_p = NULL;
+
+									if (mongoc_change_stream_next (stream_p, &change_p))
+										{
+											watching_flag = ApplyUsersChange (watcher_p, change_p);
+										}
+									else if (mongoc_change_stream_error_document (stream_p, &error, &error_doc_p))
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Change stream for \"%s\" failed: %s", watcher_p -> ucw_collection_s, error.message);
+
+											/* We may have missed some changes */
+											MarkAllUsersStale (watcher_p);
+											watching_flag = false;
+										}
+								}
+
+							if (watcher_p -> ucw_directory_p)
+								{
+									SetUsersDirectoryDeletionTracking (watcher_p -> ucw_directory_p, false);
+								}
+						}
+					else
+						{
+							PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Failed to watch \"%s\": %s", watcher_p -> ucw_collection_s, error.message);
+						}
+
+					mongoc_change_stream_destroy (stream_p);
+				}		/* if (stream_p) */
+
+			bson_destroy (opts_p);
+		}		/* if (opts_p) */
+
+	return available_flag;
+}
+
+
+/*
+ * Returns false if the change stream has ended and needs to be restarted.
+ */
+static bool ApplyUsersChange (UsersChangeWatcher *watcher_p, const bson_t *change_p)
+{
+	bool watching_flag = true;
+	bson_iter_t iter;
+
+	if (bson_iter_init_find (&iter, change_p, "operationType") && BSON_ITER_HOLDS_UTF8 (&iter))
+		{
+			const char *operation_s = bson_iter_utf8 (&iter, NULL);
+			const bson_oid_t *id_p = NULL;
+			bson_iter_t id_iter;
+
+			if (bson_iter_init (&iter, change_p) && bson_iter_find_descendant (&iter, "documentKey." MONGO_ID_S, &id_iter) && BSON_ITER_HOLDS_OID (&id_iter))
+				{
+					id_p = bson_iter_oid (&id_iter);
+				}
+
+			if ((strcmp (operation_s, "insert") == 0) || (strcmp (operation_s, "update") == 0) || (strcmp (operation_s, "replace") == 0))
+				{
+					/*
+					 * The directory fetches the changed User itself when it next syncs
+					 */
+					if (watcher_p -> ucw_directory_p)
+						{
+							InvalidateUsersDirectory (watcher_p -> ucw_directory_p);
+						}
+
+					if (watcher_p -> ucw_cache_p)
+						{
+							if (id_p)
+								{
+									RemoveUserFromUsersCache (watcher_p -> ucw_cache_p, id_p);
+								}
+							else
+								{
+									ClearUsersCache (watcher_p -> ucw_cache_p);
+								}
+						}
+				}
+			else if ((strcmp (operation_s, "delete") == 0) && id_p)
+				{
+					if (watcher_p -> ucw_directory_p)
+						{
+							RemoveUserFromUsersDirectory (watcher_p -> ucw_directory_p, id_p);
+						}
+
+					if (watcher_p -> ucw_cache_p)
+						{
+							RemoveUserFromUsersCache (watcher_p -> ucw_cache_p, id_p);
+						}
+				}
+			else
+				{
+					/*
+					 * The collection has been dropped, renamed, etc.
+					 */
+					MarkAllUsersStale (watcher_p);
+
+					if (strcmp (operation_s, "invalidate") == 0)
+						{
+							watching_flag = false;
+						}
+				}
+
+		}		/* if (bson_iter_init_find (&iter, change_p, "operationType") && BSON_ITER_HOLDS_UTF8 (&iter)) */
+	else
+		{
+			PrintBSONToErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, change_p, "Unknown change to \"%s\"", watcher_p -> ucw_collection_s);
+			MarkAllUsersStale (watcher_p);
+		}
+
+	return watching_flag;
+}
+
+
+static void MarkAllUsersStale (UsersChangeWatcher *watcher_p)
+{
+	if (watcher_p -> ucw_directory_p)
+		{
+			InvalidateUsersDirectory (watcher_p -> ucw_directory_p);
+		}
+
+	if (watcher_p -> ucw_cache_p)
+		{
+			ClearUsersCache (watcher_p -> ucw_cache_p);
+		}
+}
+
+
+/*
+ * Bring the directory up to date now so that requests don't
+ * have to wait for it.
+ */
+static void SyncUsersDirectory (UsersChangeWatcher *watcher_p)
+{
+	if (watcher_p -> ucw_directory_p)
+		{
+			const UsersDirectorySnapshot *snapshot_p;
+
+			InvalidateUsersDirectory (watcher_p -> ucw_directory_p);
+
+			snapshot_p = AcquireUsersDirectorySnapshot (watcher_p -> ucw_directory_p, watcher_p -> ucw_pool_p, watcher_p -> ucw_collection_s);
+
+			if (snapshot_p)
+				{
+					ReleaseUsersDirectorySnapshot (watcher_p -> ucw_directory_p, snapshot_p);
+				}
+		}
+}
+
+
+static bool IsUsersChangeWatcherStopping (UsersChangeWatcher *watcher_p)
+{
+	bool stopping_flag;
+
+	pthread_mutex_lock (& (watcher_p -> ucw_lock));
+	stopping_flag = watcher_p -> ucw_stopping_flag;
+	pthread_mutex_unlock (& (watcher_p -> ucw_lock));
+
+	return stopping_flag;
+}
+
+
+static void WaitForUsersChangeWatcher (UsersChangeWatcher *watcher_p, const uint32 seconds)
+{
+	struct timespec until;
+
+	clock_gettime (CLOCK_REALTIME, &until);
+	until.tv_sec += (time_t) seconds;
+
+	pthread_mutex_lock (& (watcher_p -> ucw_lock));
+
+	while (! (watcher_p -> ucw_stopping_flag))
+		{
+			if (pthread_cond_timedwait (& (watcher_p -> ucw_stop), & (watcher_p -> ucw_lock), &until) != 0)
+				{
+					/* Timed out */
+					break;
+				}
+		}
+
+	pthread_mutex_unlock (& (watcher_p -> ucw_lock));
+}
@@ -0,0 +1,221 @@
+/*
+ * users_worker_pool.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include "users_worker_pool.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+/*
+ * Static declarations
+ */
+
+static void *RunUsersWorker (void *data_p);
+
+static void StopUsersWorkers (UsersWorkerPool *pool_p, const uint32 num_threads);
+
+
+/*
+ * API definitions
+ */
+
+UsersWorkerPool *AllocateUsersWorkerPool (const uint32 num_threads, const uint32 max_queued)
+{
+	UsersWorkerPool *pool_p = (UsersWorkerPool *) AllocMemory (sizeof (UsersWorkerPool));
+
+	if (pool_p)
+		{
+			pool_p -> uwp_threads_p = (pthread_t *) AllocMemoryArray (num_threads, sizeof (pthread_t));
+
+			if (pool_p -> uwp_threads_p)
+				{
+					if (pthread_mutex_init (& (pool_p -> uwp_lock), NULL) == 0)
+						{
+							if (pthread_cond_init (& (pool_p -> uwp_task_added), NULL) == 0)
+								{
+									uint32 i = 0;
+
+									pool_p -> uwp_num_threads = num_threads;
+									pool_p -> uwp_head_p = NULL;
+									pool_p -> uwp_tail_p = NULL;
+									pool_p -> uwp_num_queued = 0;
+									pool_p -> uwp_max_queued = max_queued;
+									pool_p -> uwp_stopping_flag = false;
+
+									while (i < num_threads)
+										{
+											if (pthread_create ((pool_p -> uwp_threads_p) + i, NULL, RunUsersWorker, pool_p) == 0)
+												{
+													++ i;
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start worker " UINT32_FMT " of " UINT32_FMT, i, num_threads);
+													StopUsersWorkers (pool_p, i);
+													break;
+												}
+										}
+
+									if (i == num_threads)
+										{
+											return pool_p;
+										}
+
+									pthread_cond_destroy (& (pool_p -> uwp_task_added));
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise UsersWorkerPool condition");
+								}
+
+							pthread_mutex_destroy (& (pool_p -> uwp_lock));
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise UsersWorkerPool lock");
+						}
+
+					FreeMemory (pool_p -> uwp_threads_p);
+				}
+
+			FreeMemory (pool_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeUsersWorkerPool (UsersWorkerPool *pool_p)
+{
+	StopUsersWorkers (pool_p, pool_p -> uwp_num_threads);
+
+	pthread_cond_destroy (& (pool_p -> uwp_task_added));
+	pthread_mutex_destroy (& (pool_p -> uwp_lock));
+
+	FreeMemory (pool_p -> uwp_threads_p);
+	FreeMemory (pool_p);
+}
+
+
+bool SubmitUsersTask (UsersWorkerPool *pool_p, void (*run_fn) (void *data_p), void (*free_fn) (void *data_p), void *data_p)
+{
+	bool success_flag = false;
+	UsersTask *task_p = (UsersTask *) AllocMemory (sizeof (UsersTask));
+
+	if (task_p)
+		{
+			task_p -> ut_run_fn = run_fn;
+			task_p -> ut_free_fn = free_fn;
+			task_p -> ut_data_p = data_p;
+			task_p -> ut_next_p = NULL;
+
+			pthread_mutex_lock (& (pool_p -> uwp_lock));
+
+			if ((pool_p -> uwp_num_queued < pool_p -> uwp_max_queued) && (! (pool_p -> uwp_stopping_flag)))
+				{
+					if (pool_p -> uwp_tail_p)
+						{
+							pool_p -> uwp_tail_p -> ut_next_p = task_p;
+						}
+					else
+						{
+							pool_p -> uwp_head_p = task_p;
+						}
+
+					pool_p -> uwp_tail_p = task_p;
+					++ (pool_p -> uwp_num_queued);
+
+					pthread_cond_signal (& (pool_p -> uwp_task_added));
+
+					success_flag = true;
+				}
+
+			pthread_mutex_unlock (& (pool_p -> uwp_lock));
+
+			if (!success_flag)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Worker queue is full with " UINT32_FMT " tasks", pool_p -> uwp_max_queued);
+					FreeMemory (task_p);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Static definitions
+ */
+
+static void *RunUsersWorker (void *data_p)
+{
+	UsersWorkerPool *pool_p = (UsersWorkerPool *) data_p;
+
+	pthread_mutex_lock (& (pool_p -> uwp_lock));
+
+	for (;;)
+		{
+			UsersTask *task_p;
+
+			while ((! (pool_p -> uwp_head_p)) && (! (pool_p -> uwp_stopping_flag)))
+				{
+					pthread_cond_wait (& (pool_p -> uwp_task_added), & (pool_p -> uwp_lock));
+				}
+
+			/*
+			 * Finish any queued tasks before stopping
+			 */
+			if (! (pool_p -> uwp_head_p))
+				{
+					break;
+				}
+
+			task_p = pool_p -> uwp_head_p;
+			pool_p -> uwp_head_p = task_p -> ut_next_p;
+
+			if (! (pool_p -> uwp_head_p))
+				{
+					pool_p -> uwp_tail_p = NULL;
+				}
+
+			-- (pool_p -> uwp_num_queued);
+
+			pthread_mutex_unlock (& (pool_p -> uwp_lock));
+
+			task_p -> ut_run_fn (task_p -> ut_data_p);
+
+			if (task_p -> ut_free_fn)
+				{
+					task_p -> ut_free_fn (task_p -> ut_data_p);
+				}
+
+			FreeMemory (task_p);
+
+			pthread_mutex_lock (& (pool_p -> uwp_lock));
+		}
+
+	pthread_mutex_unlock (& (pool_p -> uwp_lock));
+
+	return NULL;
+}
+
+
+static void StopUsersWorkers (UsersWorkerPool *pool_p, const uint32 num_threads)
+{
+	uint32 i;
+
+	pthread_mutex_lock (& (pool_p -> uwp_lock));
+	pool_p -> uwp_stopping_flag = true;
+	pthread_cond_broadcast (& (pool_p -> uwp_task_added));
+	pthread_mutex_unlock (& (pool_p -> uwp_lock));
+
+	for (i = 0; i < num_threads; ++ i)
+		{
+			pthread_join ((pool_p -> uwp_threads_p) [i], NULL);
+		}
+}
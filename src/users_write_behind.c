@@ -0,0 +1,486 @@
+/*
+ * users_write_behind.c
+ *
+ *  Created on: 17 Oct 2026
+ *      Author: agent
+ */
+
+#include "users_write_behind.h"
+
+#include "memory_allocations.h"
+#include "streams.h"
+#include "mongodb_util.h"
+
+
+/*
+ * Static declarations
+ */
+
+/**
+ * How many full batches can be waiting before new Users are
+ * written by their callers instead.
+ */
+static const uint32 S_MAX_PENDING_BATCHES = 4;
+
+
+static void *RunUsersWriteBehind (void *data_p);
+
+static UsersPendingWrite *TakeUsersWriteBatch (UsersWriteBehind *write_behind_p, uint32 *num_writes_p);
+
+static void WriteUsersBatch (UsersWriteBehind *write_behind_p, UsersPendingWrite *batch_p, const uint32 num_writes);
+
+static void ExecuteUsersWriteBatch (UsersWriteBehind *write_behind_p, MongoTool *tool_p, UsersPendingWrite *batch_p, const uint32 num_writes);
+
+static void FreeUsersPendingWrite (UsersPendingWrite *write_p);
+
+
+/*
+ * API definitions
+ */
+
+UsersWriteBehind *StartUsersWriteBehind (UsersMongoPool *pool_p, const char *collection_s, UsersDirectory *directory_p, UsersCache *cache_p,
+	const uint32 batch_size, const uint32 flush_interval_ms, void (*done_fn) (void *data_p, ServiceJob *job_p, const OperationStatus status), void *done_data_p)
+{
+	UsersWriteBehind *write_behind_p = (UsersWriteBehind *) AllocMemory (sizeof (UsersWriteBehind));
+
+	if (write_behind_p)
+		{
+			if (pthread_mutex_init (& (write_behind_p -> uwb_lock), NULL) == 0)
+				{
+					if (pthread_cond_init (& (write_behind_p -> uwb_write_added), NULL) == 0)
+						{
+							write_behind_p -> uwb_pool_p = pool_p;
+							write_behind_p -> uwb_collection_s = collection_s;
+							write_behind_p -> uwb_directory_p = directory_p;
+							write_behind_p -> uwb_cache_p = cache_p;
+							write_behind_p -> uwb_done_fn = done_fn;
+							write_behind_p -> uwb_done_data_p = done_data_p;
+							write_behind_p -> uwb_batch_size = (batch_size > 0) ? batch_size : UWB_DEFAULT_BATCH_SIZE;
+							write_behind_p -> uwb_flush_interval_ms = flush_interval_ms;
+							write_behind_p -> uwb_head_p = NULL;
+							write_behind_p -> uwb_tail_p = NULL;
+							write_behind_p -> uwb_num_pending = 0;
+							write_behind_p -> uwb_max_pending = (write_behind_p -> uwb_batch_size) * S_MAX_PENDING_BATCHES;
+							write_behind_p -> uwb_stopping_flag = false;
+
+							if (pthread_create (& (write_behind_p -> uwb_thread), NULL, RunUsersWriteBehind, write_behind_p) == 0)
+								{
+									return write_behind_p;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to start write-behind thread for \"%s\"", collection_s);
+								}
+
+							pthread_cond_destroy (& (write_behind_p -> uwb_write_added));
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise UsersWriteBehind condition");
+						}
+
+					pthread_mutex_destroy (& (write_behind_p -> uwb_lock));
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to initialise UsersWriteBehind lock");
+				}
+
+			FreeMemory (write_behind_p);
+		}
+
+	return NULL;
+}
+
+
+void StopUsersWriteBehind (UsersWriteBehind *write_behind_p)
+{
+	pthread_mutex_lock (& (write_behind_p -> uwb_lock));
+	write_behind_p -> uwb_stopping_flag = true;
+	pthread_cond_broadcast (& (write_behind_p -> uwb_write_added));
+	pthread_mutex_unlock (& (write_behind_p -> uwb_lock));
+
+	pthread_join (write_behind_p -> uwb_thread, NULL);
+
+	pthread_cond_destroy (& (write_behind_p -> uwb_write_added));
+	pthread_mutex_destroy (& (write_behind_p -> uwb_lock));
+
+	FreeMemory (write_behind_p);
+}
+
+
+bool QueueUsersWrite (UsersWriteBehind *write_behind_p, const bson_oid_t *id_p, const json_t *user_json_p, ServiceJob *job_p)
+{
+	bool success_flag = false;
+	UsersPendingWrite *write_p = (UsersPendingWrite *) AllocMemory (sizeof (UsersPendingWrite));
+
+	if (write_p)
+		{
+			bson_t *doc_p = ConvertJSONToBSON (user_json_p);
+
+			write_p -> upw_update_p = NULL;
+
+			if (doc_p)
+				{
+					write_p -> upw_update_p = BCON_NEW ("$set", BCON_DOCUMENT (doc_p), "$currentDate", "{", MONGO_TIMESTAMP_S, BCON_BOOL (true), "}");
+					bson_destroy (doc_p);
+				}
+
+			if (write_p -> upw_update_p)
+				{
+					bson_oid_copy (id_p, & (write_p -> upw_id));
+					write_p -> upw_job_p = job_p;
+					write_p -> upw_status = OS_FAILED;
+					write_p -> upw_next_p = NULL;
+					clock_gettime (CLOCK_REALTIME, & (write_p -> upw_queued));
+
+					pthread_mutex_lock (& (write_behind_p -> uwb_lock));
+
+					if ((write_behind_p -> uwb_num_pending < write_behind_p -> uwb_max_pending) && (! (write_behind_p -> uwb_stopping_flag)))
+						{
+							if (write_behind_p -> uwb_tail_p)
+								{
+									write_behind_p -> uwb_tail_p -> upw_next_p = write_p;
+								}
+							else
+								{
+									write_behind_p -> uwb_head_p = write_p;
+								}
+
+							write_behind_p -> uwb_tail_p = write_p;
+							++ (write_behind_p -> uwb_num_pending);
+
+							pthread_cond_signal (& (write_behind_p -> uwb_write_added));
+
+							success_flag = true;
+						}
+
+					pthread_mutex_unlock (& (write_behind_p -> uwb_lock));
+
+					if (!success_flag)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Write-behind queue is full with " UINT32_FMT " users", write_behind_p -> uwb_max_pending);
+						}
+				}
+			else
+				{
+					PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, user_json_p, "Failed to create update for queued User");
+				}
+
+			if (!success_flag)
+				{
+					FreeUsersPendingWrite (write_p);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Static definitions
+ */
+
+static void *RunUsersWriteBehind (void *data_p)
+{
+	UsersWriteBehind *write_behind_p = (UsersWriteBehind *) data_p;
+
+	pthread_mutex_lock (& (write_behind_p -> uwb_lock));
+
+	for (;;)
+		{
+			UsersPendingWrite *batch_p;
+			uint32 num_writes = 0;
+
+			while ((! (write_behind_p -> uwb_head_p)) && (! (write_behind_p -> uwb_stopping_flag)))
+				{
+					pthread_cond_wait (& (write_behind_p -> uwb_write_added), & (write_behind_p -> uwb_lock));
+				}
+
+			/*
+			 * Write any queued Users before stopping
+			 */
+			if (! (write_behind_p -> uwb_head_p))
+				{
+					break;
+				}
+
+			/*
+			 * Wait for a full batch, but no longer than the flush
+			 * interval after the oldest User was queued
+			 */
+			if (write_behind_p -> uwb_flush_interval_ms > 0)
+				{
+					struct timespec until = write_behind_p -> uwb_head_p -> upw_queued;
+
+					until.tv_sec += (time_t) (write_behind_p -> uwb_flush_interval_ms / 1000);
+					until.tv_nsec += (long) ((write_behind_p -> uwb_flush_interval_ms % 1000) * 1000000);
+
+					if (until.tv_nsec >= 1000000000L)
+						{
+							++ until.tv_sec;
+							until.tv_nsec -= 1000000000L;
+						}
+
+					while ((write_behind_p -> uwb_num_pending < write_behind_p -> uwb_batch_size) && (! (write_behind_p -> uwb_stopping_flag)))
+						{
+							if (pthread_cond_timedwait (& (write_behind_p -> uwb_write_added), & (write_behind_p -> uwb_lock), &until) != 0)
+								{
+									/* Timed out */
+									break;
+								}
+						}
+				}
+
+			batch_p = TakeUsersWriteBatch (write_behind_p, &num_writes);
+
+			pthread_mutex_unlock (& (write_behind_p -> uwb_lock));
+
+			WriteUsersBatch (write_behind_p, batch_p, num_writes);
+
+			pthread_mutex_lock (& (write_behind_p -> uwb_lock));
+		}
+
+	pthread_mutex_unlock (& (write_behind_p -> uwb_lock));
+
+	return NULL;
+}
+
+
+/*
+ * Remove up to a batch of Users from the front of the queue.
+ * The lock must be held when calling this.
+ */
+static UsersPendingWrite *TakeUsersWriteBatch (UsersWriteBehind *write_behind_p, uint32 *num_writes_p)
+{
+	UsersPendingWrite *batch_p = write_behind_p -> uwb_head_p;
+	UsersPendingWrite *last_p = batch_p;
+	uint32 num_writes = 1;
+
+	while ((num_writes < write_behind_p -> uwb_batch_size) && (last_p -> upw_next_p))
+		{
+			last_p = last_p -> upw_next_p;
+			++ num_writes;
+		}
+
+	write_behind_p -> uwb_head_p = last_p -> upw_next_p;
+	last_p -> upw_next_p = NULL;
+
+	if (! (write_behind_p -> uwb_head_p))
+		{
+			write_behind_p -> uwb_tail_p = NULL;
+		}
+
+	write_behind_p -> uwb_num_pending -= num_writes;
+	*num_writes_p = num_writes;
+
+	return batch_p;
+}
+
+
+/*
+ * Write a batch of Users and then give each of their ServiceJobs
+ * its final status.
+ */
+static void WriteUsersBatch (UsersWriteBehind *write_behind_p, UsersPendingWrite *batch_p, const uint32 num_writes)
+{
+	MongoTool *tool_p = CheckOutMongoTool (write_behind_p -> uwb_pool_p);
+	UsersPendingWrite *write_p = batch_p;
+	uint32 num_written = 0;
+
+	if (SetMongoToolCollection (tool_p, write_behind_p -> uwb_collection_s))
+		{
+			ExecuteUsersWriteBatch (write_behind_p, tool_p, batch_p, num_writes);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set collection to \"%s\"", write_behind_p -> uwb_collection_s);
+		}
+
+	CheckInMongoTool (write_behind_p -> uwb_pool_p, tool_p);
+
+	/*
+	 * Make sure that nothing stale can be read before any of the
+	 * ServiceJobs say that their Users have been saved
+	 */
+	while (write_p)
+		{
+			if (write_p -> upw_status == OS_SUCCEEDED)
+				{
+					if (write_behind_p -> uwb_cache_p)
+						{
+							RemoveUserFromUsersCache (write_behind_p -> uwb_cache_p, & (write_p -> upw_id));
+						}
+
+					++ num_written;
+				}
+
+			write_p = write_p -> upw_next_p;
+		}
+
+	if ((num_written > 0) && (write_behind_p -> uwb_directory_p))
+		{
+			InvalidateUsersDirectory (write_behind_p -> uwb_directory_p);
+		}
+
+	PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Wrote " UINT32_FMT " of " UINT32_FMT " queued users to \"%s\"", num_written, num_writes, write_behind_p -> uwb_collection_s);
+
+	while (batch_p)
+		{
+			UsersPendingWrite *next_p = batch_p -> upw_next_p;
+
+			write_behind_p -> uwb_done_fn (write_behind_p -> uwb_done_data_p, batch_p -> upw_job_p, batch_p -> upw_status);
+			FreeUsersPendingWrite (batch_p);
+
+			batch_p = next_p;
+		}
+}
+
+
+static void ExecuteUsersWriteBatch (UsersWriteBehind *write_behind_p, MongoTool *tool_p, UsersPendingWrite *batch_p, const uint32 num_writes)
+{
+	bson_t *bulk_opts_p = BCON_NEW ("ordered", BCON_BOOL (false));
+	bson_t *upsert_opts_p = BCON_NEW ("upsert", BCON_BOOL (true));
+	UsersPendingWrite **ops_pp = (UsersPendingWrite **) AllocMemoryArray (num_writes, sizeof (UsersPendingWrite *));
+
+	if (bulk_opts_p && upsert_opts_p && ops_pp)
+		{
+			mongoc_bulk_operation_t *bulk_p = mongoc_collection_create_bulk_operation_with_opts (tool_p -> mt_collection_p, bulk_opts_p);
+
+			if (bulk_p)
+				{
+					UsersPendingWrite *write_p = batch_p;
+					uint32 num_ops = 0;
+
+					while (write_p)
+						{
+							bson_t *selector_p = BCON_NEW (MONGO_ID_S, BCON_OID (& (write_p -> upw_id)));
+
+							if (selector_p)
+								{
+									bson_error_t error;
+
+									if (mongoc_bulk_operation_update_one_with_opts (bulk_p, selector_p, write_p -> upw_update_p, upsert_opts_p, &error))
+										{
+											ops_pp [num_ops] = write_p;
+											++ num_ops;
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add queued User to bulk write: %s", error.message);
+										}
+
+									bson_destroy (selector_p);
+								}
+
+							write_p = write_p -> upw_next_p;
+						}
+
+					if (num_ops > 0)
+						{
+							bson_t reply;
+							bson_error_t error;
+							bool executed_flag = (mongoc_bulk_operation_execute (bulk_p, &reply, &error) != 0);
+							bool write_errors_flag = false;
+							bool concern_errors_flag = false;
+							bson_iter_t iter;
+							uint32 i;
+
+							for (i = 0; i < num_ops; ++ i)
+								{
+									ops_pp [i] -> upw_status = OS_SUCCEEDED;
+								}
+
+							/*
+							 * Mark any Users that failed. The indexes in writeErrors
+							 * are the positions of the operations within this batch.
+							 */
+							if (bson_iter_init_find (&iter, &reply, "writeErrors") && BSON_ITER_HOLDS_ARRAY (&iter))
+								{
+									bson_iter_t errors_iter;
+
+									if (bson_iter_recurse (&iter, &errors_iter))
+										{
+											while (bson_iter_next (&errors_iter))
+												{
+													bson_iter_t index_iter;
+
+													if (bson_iter_recurse (&errors_iter, &index_iter) && bson_iter_find (&index_iter, "index") && BSON_ITER_HOLDS_INT32 (&index_iter))
+														{
+															const int32 op_index = bson_iter_int32 (&index_iter);
+
+															if ((op_index >= 0) && ((uint32) op_index < num_ops))
+																{
+																	ops_pp [op_index] -> upw_status = OS_FAILED;
+																	write_errors_flag = true;
+																}
+														}
+												}
+										}
+								}
+
+							if (bson_iter_init_find (&iter, &reply, "writeConcernErrors") && BSON_ITER_HOLDS_ARRAY (&iter))
+								{
+									bson_iter_t errors_iter;
+
+									if (bson_iter_recurse (&iter, &errors_iter) && bson_iter_next (&errors_iter))
+										{
+											concern_errors_flag = true;
+										}
+								}
+
+							/*
+							 * If the whole batch failed, e.g. the connection was lost, or
+							 * the writes weren't acknowledged, none of the Users are saved
+							 */
+							if ((!executed_flag) && ((!write_errors_flag) || concern_errors_flag))
+								{
+									for (i = 0; i < num_ops; ++ i)
+										{
+											ops_pp [i] -> upw_status = OS_FAILED;
+										}
+								}
+
+							if (!executed_flag)
+								{
+									PrintBSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, &reply, "Bulk write of queued users to \"%s\" had errors: %s", write_behind_p -> uwb_collection_s, error.message);
+								}
+
+							bson_destroy (&reply);
+						}		/* if (num_ops > 0) */
+
+					mongoc_bulk_operation_destroy (bulk_p);
+				}		/* if (bulk_p) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create bulk operation for \"%s\"", write_behind_p -> uwb_collection_s);
+				}
+
+		}		/* if (bulk_opts_p && upsert_opts_p && ops_pp) */
+
+	if (ops_pp)
+		{
+			FreeMemory (ops_pp);
+		}
+
+	if (upsert_opts_p)
+		{
+			bson_destroy (upsert_opts_p);
+		}
+
+	if (bulk_opts_p)
+		{
+			bson_destroy (bulk_opts_p);
+		}
+}
+
+
+static void FreeUsersPendingWrite (UsersPendingWrite *write_p)
+{
+	if (write_p -> upw_update_p)
+		{
+			bson_destroy (write_p -> upw_update_p);
+		}
+
+	FreeMemory (write_p);
+}